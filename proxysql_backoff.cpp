@@ -0,0 +1,28 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "proxysql_backoff.h"
+
+Backoff::Backoff(unsigned int _min_ms, unsigned int _max_ms) :
+	min_ms(_min_ms), max_ms(_max_ms < _min_ms ? _min_ms : _max_ms), failures(0)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rnd = uint32_t(ts.tv_nsec) ^ (uint32_t(getpid()) << 16) ^ uint32_t(ts.tv_sec);
+	if (rnd == 0) {
+		rnd = 1;
+	}
+}
+
+unsigned int Backoff::next_ms() {
+	uint64_t delay = uint64_t(min_ms) << (failures < 16 ? failures : 16);
+	if (delay > max_ms) {
+		delay = max_ms;
+	}
+	failures++;
+	// xorshift32; the quality only has to break lockstep.
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return unsigned(delay / 2 + rnd % (delay / 2 + 1));
+}
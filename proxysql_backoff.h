@@ -0,0 +1,30 @@
+#ifndef PROXYSQL_BACKOFF
+#define PROXYSQL_BACKOFF
+
+// Jittered exponential backoff between retries.
+//
+// The first retry comes after min_ms, and each consecutive failure doubles
+// the delay up to max_ms. Every delay is drawn at random from the upper half
+// of that, so that processes which lost the same server together (a source
+// restart drops all its replicas at once) do not come back in step.
+
+#include <stdint.h>
+
+class Backoff {
+	private:
+	unsigned int min_ms;
+	unsigned int max_ms;
+	unsigned int failures;
+	uint32_t rnd;
+
+	public:
+	Backoff(unsigned int _min_ms, unsigned int _max_ms);
+
+	// Records a failure and returns the delay before the next attempt.
+	unsigned int next_ms();
+	// After a success: the next failure starts over from min_ms.
+	void reset() { failures = 0; }
+	unsigned int get_failures() const { return failures; }
+};
+
+#endif /* PROXYSQL_BACKOFF */
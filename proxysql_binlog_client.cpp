@@ -0,0 +1,996 @@
+#include "proxysql_binlog_client.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/sha.h>
+
+#include "proxysql_binlog_event.h"
+#include "proxysql_crc32.h"
+
+namespace {
+
+// Capability flags of the handshake.
+const uint32_t CLIENT_LONG_PASSWORD     = 0x00000001;
+const uint32_t CLIENT_LONG_FLAG         = 0x00000004;
+const uint32_t CLIENT_PROTOCOL_41       = 0x00000200;
+const uint32_t CLIENT_TRANSACTIONS      = 0x00002000;
+const uint32_t CLIENT_SECURE_CONNECTION = 0x00008000;
+const uint32_t CLIENT_PLUGIN_AUTH       = 0x00080000;
+
+const unsigned char COM_QUERY            = 0x03;
+const unsigned char COM_REGISTER_SLAVE   = 0x15;
+const unsigned char COM_BINLOG_DUMP_GTID = 0x1e;
+
+// COM_BINLOG_DUMP_GTID flag: the start position is the GTID set.
+const uint16_t BINLOG_THROUGH_GTID = 0x04;
+
+const unsigned char CHARSET_UTF8_GENERAL_CI = 33;
+const size_t MAX_PACKET_LENGTH = 0xffffff;
+const size_t SCRAMBLE_LENGTH = 20;
+
+// Run on every connection, in order.
+const char *const startup_queries[] = {
+	// Announce that checksums are understood, under both the old and the
+	// new variable name; the source sends them only then.
+	"SET @master_binlog_checksum = @@global.binlog_checksum, @source_binlog_checksum = @@global.binlog_checksum",
+	"SELECT @@global.gtid_mode, @@global.binlog_checksum, @@global.gtid_executed, @@global.gtid_purged",
+};
+const size_t STARTUP_QUERIES = sizeof(startup_queries) / sizeof(startup_queries[0]);
+// Where the startup queries begin when polling: checksums do not matter.
+const size_t POLL_FIRST_QUERY = 1;
+
+const char *const POLL_QUERY = "SELECT @@global.gtid_executed";
+
+inline void put_uint(std::string& s, uint64_t v, size_t bytes) {
+	for (size_t i = 0; i < bytes; i++) {
+		s.push_back(char(v >> (8 * i)));
+	}
+}
+
+// Length-encoded integer at 'p'; false if it runs past 'end'.
+bool get_lenenc(const unsigned char *&p, const unsigned char *end, uint64_t& v) {
+	if (p >= end) return false;
+	size_t n = 0;
+	switch (*p) {
+		case 0xfc: n = 2; break;
+		case 0xfd: n = 3; break;
+		case 0xfe: n = 8; break;
+		default: v = *p++; return true;
+	}
+	if (size_t(end - p) < 1 + n) return false;
+	v = 0;
+	for (size_t i = 0; i < n; i++) {
+		v |= uint64_t(p[1 + i]) << (8 * i);
+	}
+	p += 1 + n;
+	return true;
+}
+
+std::string digest(const EVP_MD *md, const std::string& a, const std::string& b = std::string()) {
+	unsigned char out[EVP_MAX_MD_SIZE];
+	unsigned int len = 0;
+	EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+	EVP_DigestInit_ex(ctx, md, NULL);
+	EVP_DigestUpdate(ctx, a.data(), a.size());
+	EVP_DigestUpdate(ctx, b.data(), b.size());
+	EVP_DigestFinal_ex(ctx, out, &len);
+	EVP_MD_CTX_destroy(ctx);
+	return std::string((const char *)out, len);
+}
+
+std::string xor_strings(std::string a, const std::string& b) {
+	for (size_t i = 0; i < a.size(); i++) {
+		a[i] ^= b[i % b.size()];
+	}
+	return a;
+}
+
+}  // namespace
+
+Binlog_Client::Binlog_Client() :
+	port(3306), server_id(0), verify_all_checksums(false), heartbeat_period_ms(0),
+	poll_interval_ms(0), start_cb(NULL), gtid_cb(NULL), burst_cb(NULL), log_cb(NULL), dump_error_cb(NULL), data(NULL),
+	loop(NULL), state(IDLE), fd(-1), started(false), stopped(true), last_read(0),
+	dump_start(0), poll_pending(false), poll_sent(0), retry(BINLOG_CLIENT_RETRY_MIN_MS, BINLOG_CLIENT_RETRY_MS),
+	in_pos(0), in_len(0), out_pos(0), seq(0), auth_step(0), query_idx(0), dump_sent(false),
+	rs_state(RS_HEADER), rs_columns(0), row_seen(false), checksums(false),
+	burst_gtids(false), skip_left(0), skip_more(false), in_skip(false),
+	skip_verify(false), skip_crc(0), skip_off(0), skip_event_len(0)
+{
+	ev_io_init(&rio, io_read_cb, -1, EV_READ);
+	ev_io_init(&wio, io_write_cb, -1, EV_WRITE);
+	ev_timer_init(&timer, timer_cb, 0, 0);
+	rio.data = this;
+	wio.data = this;
+	timer.data = this;
+}
+
+Binlog_Client::~Binlog_Client() {
+	stop();
+}
+
+void Binlog_Client::start(struct ev_loop *_loop) {
+	loop = _loop;
+	stopped = false;
+	connect_now();
+}
+
+void Binlog_Client::stop() {
+	stopped = true;
+	if (loop) {
+		disconnect();
+	}
+}
+
+void Binlog_Client::info(const std::string& msg) {
+	if (log_cb) log_cb(this, false, msg);
+}
+
+void Binlog_Client::fail(const std::string& msg) {
+	if (log_cb) log_cb(this, true, msg);
+	// A dump or poll that held longer than the longest delay was a success.
+	if ((state == DUMP || state == POLL) && ev_now(loop) - dump_start >= BINLOG_CLIENT_RETRY_MS / 1000.0) {
+		retry.reset();
+	}
+	disconnect();
+	if (!stopped) {
+		ev_timer_set(&timer, retry.next_ms() / 1000.0, 0);
+		ev_timer_start(loop, &timer);
+	}
+}
+
+void Binlog_Client::disconnect() {
+	ev_io_stop(loop, &rio);
+	ev_io_stop(loop, &wio);
+	ev_timer_stop(loop, &timer);
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+	state = IDLE;
+	in_pos = 0;
+	in_len = 0;
+	out.clear();
+	out_pos = 0;
+	in_skip = false;
+}
+
+void Binlog_Client::connect_now() {
+	disconnect();
+
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	const std::string service = std::to_string(port);
+	const int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &res);
+	if (rc != 0) {
+		fail("cannot resolve " + host + ": " + gai_strerror(rc));
+		return;
+	}
+	fd = socket(res->ai_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		freeaddrinfo(res);
+		fail(std::string("socket(): ") + strerror(errno));
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	int arg_on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &arg_on, sizeof(arg_on));
+	const int crc = connect(fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (crc != 0 && errno != EINPROGRESS) {
+		fail("cannot connect to " + host + ":" + service + ": " + strerror(errno));
+		return;
+	}
+
+	if (in.size() != BINLOG_CLIENT_BUFFER_SIZE) {
+		in.resize(BINLOG_CLIENT_BUFFER_SIZE);
+	}
+	state = CONNECTING;
+	ev_io_set(&rio, fd, EV_READ);
+	ev_io_set(&wio, fd, EV_WRITE);
+	ev_io_start(loop, &wio);
+	ev_timer_set(&timer, BINLOG_CLIENT_TIMEOUT_MS / 1000.0, 0);
+	ev_timer_start(loop, &timer);
+}
+
+void Binlog_Client::on_connected() {
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+		err = errno;
+	}
+	if (err) {
+		fail("cannot connect to " + host + ":" + std::to_string(port) + ": " + strerror(err));
+		return;
+	}
+	ev_io_stop(loop, &wio);
+	ev_io_start(loop, &rio);
+	state = GREETING;
+}
+
+void Binlog_Client::io_read_cb(struct ev_loop *loop, ev_io *w, int revents) {
+	((Binlog_Client *)w->data)->on_readable();
+}
+
+void Binlog_Client::io_write_cb(struct ev_loop *loop, ev_io *w, int revents) {
+	Binlog_Client *c = (Binlog_Client *)w->data;
+	if (c->state == CONNECTING) {
+		c->on_connected();
+	} else {
+		c->flush();
+	}
+}
+
+void Binlog_Client::timer_cb(struct ev_loop *loop, ev_timer *t, int revents) {
+	Binlog_Client *c = (Binlog_Client *)t->data;
+	if (c->state == IDLE) {
+		c->connect_now();
+	} else if (c->state == DUMP) {
+		c->check_stall();
+	} else if (c->state == POLL) {
+		if (c->poll_pending) {
+			c->fail("no reply to the poll from " + c->host + ":" + std::to_string(c->port) + " for " + std::to_string(BINLOG_CLIENT_TIMEOUT_MS) + " ms");
+		} else {
+			c->send_poll();
+		}
+	} else {
+		c->fail("timed out connecting to " + c->host + ":" + std::to_string(c->port));
+	}
+}
+
+// Reads only note the time; the timer re-arms itself for whatever is left
+// of the stall timeout since then.
+void Binlog_Client::check_stall() {
+	const unsigned int stall_ms = heartbeat_period_ms * BINLOG_CLIENT_STALL_PERIODS;
+	const ev_tstamp left = last_read + stall_ms / 1000.0 - ev_now(loop);
+	if (left > 0) {
+		ev_timer_set(&timer, left, 0);
+		ev_timer_start(loop, &timer);
+		return;
+	}
+	fail("no data or heartbeat from " + host + ":" + std::to_string(port) + " for " + std::to_string(stall_ms) + " ms");
+}
+
+void Binlog_Client::on_readable() {
+	burst_gtids = false;
+	for (;;) {
+		if (in_pos > 0) {
+			// Whatever is left is the start of a packet; move it to the front.
+			memmove(in.data(), in.data() + in_pos, in_len - in_pos);
+			in_len -= in_pos;
+			in_pos = 0;
+		}
+		const size_t room = in.size() - in_len;
+		const ssize_t n = recv(fd, in.data() + in_len, room, 0);
+		if (n == 0) {
+			fail("connection closed by " + host + ":" + std::to_string(port));
+			break;
+		}
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				fail(std::string("read error: ") + strerror(errno));
+			}
+			break;
+		}
+		in_len += n;
+		if (state == DUMP) {
+			last_read = ev_now(loop);
+		}
+		if (!process_input()) break;
+		// A short read drained the socket; the loop calls again when more
+		// arrives.
+		if (size_t(n) < room) break;
+	}
+	if (burst_gtids && burst_cb) {
+		burst_cb(this);
+	}
+}
+
+// Handles the complete packets in the buffer. False once the connection is
+// gone.
+bool Binlog_Client::process_input() {
+	while (state != DUMP && state != IDLE) {
+		if (in_len - in_pos < 4) break;
+		const unsigned char *h = in.data() + in_pos;
+		const size_t len = get_uint3(h);
+		if (4 + len > in.size()) {
+			// Only binlog events get this large.
+			fail("packet of " + std::to_string(len) + " bytes during the handshake");
+			return false;
+		}
+		if (in_len - in_pos < 4 + len) break;
+		seq = h[3] + 1;
+		in_pos += 4 + len;
+		handle_packet(h + 4, len);
+	}
+	if (state == DUMP) {
+		return parse_dump();
+	}
+	return state != IDLE;
+}
+
+void Binlog_Client::flush() {
+	while (out_pos < out.size()) {
+		const ssize_t n = send(fd, out.data() + out_pos, out.size() - out_pos, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ev_io_start(loop, &wio);
+				return;
+			}
+			fail(std::string("write error: ") + strerror(errno));
+			return;
+		}
+		out_pos += n;
+	}
+	out.clear();
+	out_pos = 0;
+	ev_io_stop(loop, &wio);
+}
+
+void Binlog_Client::send_packet(const std::string& payload) {
+	put_uint(out, payload.size(), 3);
+	out.push_back(char(seq++));
+	out += payload;
+	flush();
+}
+
+// A command starts a new sequence.
+void Binlog_Client::queue_command(unsigned char cmd, const std::string& args) {
+	put_uint(out, args.size() + 1, 3);
+	out.push_back('\0');
+	out.push_back(char(cmd));
+	out += args;
+	seq = 1;
+}
+
+void Binlog_Client::send_command(unsigned char cmd, const std::string& args) {
+	queue_command(cmd, args);
+	flush();
+}
+
+std::string Binlog_Client::server_error(const unsigned char *p, size_t len) {
+	// 0xff, code, '#' and SQL state, message.
+	if (len < 3) return "unknown error";
+	size_t off = 3;
+	if (len >= 9 && p[3] == '#') off = 9;
+	return std::string((const char *)p + off, len - off) + " (" + std::to_string(get_uint2(p + 1)) + ")";
+}
+
+void Binlog_Client::handle_packet(const unsigned char *p, size_t len) {
+	switch (state) {
+		case GREETING:
+			handle_greeting(p, len);
+			break;
+		case AUTH:
+			handle_auth(p, len);
+			break;
+		case QUERY:
+		case POLL:
+			handle_result(p, len);
+			break;
+		case REGISTER:
+			if (len > 0 && p[0] == 0x00) {
+				start_dump();
+			} else if (len > 0 && p[0] == 0xff) {
+				fail("COM_REGISTER_SLAVE failed: " + server_error(p, len));
+			} else {
+				fail("unexpected reply to COM_REGISTER_SLAVE");
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void Binlog_Client::handle_greeting(const unsigned char *p, size_t len) {
+	if (len > 0 && p[0] == 0xff) {
+		fail("connection refused: " + server_error(p, len));
+		return;
+	}
+	if (len < 1 || p[0] != 10) {
+		fail("unsupported protocol version");
+		return;
+	}
+	const unsigned char *end = p + len;
+	const unsigned char *q = p + 1;
+	const unsigned char *nul = (const unsigned char *)memchr(q, 0, end - q);
+	if (!nul || end - (nul + 1) < 4 + 8 + 1 + 2) {
+		fail("malformed handshake");
+		return;
+	}
+	const std::string version((const char *)q, nul - q);
+	q = nul + 1 + 4;
+	scramble.assign((const char *)q, 8);
+	q += 8 + 1;
+	uint32_t caps = get_uint2(q);
+	q += 2;
+	plugin.clear();
+	if (end - q >= 1 + 2 + 2 + 1 + 10) {
+		caps |= get_uint2(q + 3) << 16;
+		const size_t auth_len = q[5];
+		q += 1 + 2 + 2 + 1 + 10;
+		if (caps & CLIENT_SECURE_CONNECTION) {
+			size_t n = auth_len > 8 + 13 ? auth_len - 8 : 13;
+			if (n > size_t(end - q)) n = end - q;
+			scramble.append((const char *)q, n);
+			q += n;
+		}
+		if ((caps & CLIENT_PLUGIN_AUTH) && q < end) {
+			nul = (const unsigned char *)memchr(q, 0, end - q);
+			plugin.assign((const char *)q, (nul ? nul : end) - q);
+		}
+	}
+	if (scramble.size() > SCRAMBLE_LENGTH) {
+		scramble.resize(SCRAMBLE_LENGTH);
+	}
+	if (!(caps & CLIENT_PROTOCOL_41) || !(caps & CLIENT_SECURE_CONNECTION)) {
+		fail("MySQL " + version + " is too old");
+		return;
+	}
+	if (plugin.empty()) {
+		plugin = "mysql_native_password";
+	}
+	info("Connected to " + host + ":" + std::to_string(port) + ", MySQL " + version + ", authenticating with " + plugin);
+
+	// HandshakeResponse41.
+	std::string r;
+	put_uint(r, CLIENT_LONG_PASSWORD | CLIENT_LONG_FLAG | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_PLUGIN_AUTH, 4);
+	put_uint(r, MAX_PACKET_LENGTH + 1, 4);
+	r.push_back(char(CHARSET_UTF8_GENERAL_CI));
+	r.append(23, '\0');
+	r += user;
+	r.push_back('\0');
+	const std::string a = auth_response(plugin);
+	r.push_back(char(a.size()));
+	r += a;
+	r += plugin;
+	r.push_back('\0');
+	state = AUTH;
+	auth_step = 0;
+	send_packet(r);
+}
+
+std::string Binlog_Client::auth_response(const std::string& plugin_name) {
+	if (password.empty()) {
+		return std::string();
+	}
+	if (plugin_name == "mysql_native_password") {
+		const std::string h1 = digest(EVP_sha1(), password);
+		const std::string h2 = digest(EVP_sha1(), h1);
+		return xor_strings(h1, digest(EVP_sha1(), scramble, h2));
+	}
+	if (plugin_name == "caching_sha2_password") {
+		const std::string d1 = digest(EVP_sha256(), password);
+		const std::string d2 = digest(EVP_sha256(), d1);
+		return xor_strings(d1, digest(EVP_sha256(), d2, scramble));
+	}
+	if (plugin_name == "sha256_password") {
+		// Request the public key.
+		return std::string(1, '\x01');
+	}
+	return std::string();
+}
+
+bool Binlog_Client::rsa_encrypt_password(const std::string& pem, std::string& out_data) {
+	std::string buf = password;
+	buf.push_back('\0');
+	buf = xor_strings(buf, scramble);
+
+	BIO *bio = BIO_new_mem_buf((void *)pem.data(), int(pem.size()));
+	EVP_PKEY *pkey = bio ? PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL) : NULL;
+	if (bio) BIO_free(bio);
+	if (!pkey) return false;
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	size_t outlen = 0;
+	bool ok = ctx && EVP_PKEY_encrypt_init(ctx) == 1 &&
+		EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) == 1 &&
+		EVP_PKEY_encrypt(ctx, NULL, &outlen, (const unsigned char *)buf.data(), buf.size()) == 1;
+	if (ok) {
+		out_data.resize(outlen);
+		ok = EVP_PKEY_encrypt(ctx, (unsigned char *)&out_data[0], &outlen, (const unsigned char *)buf.data(), buf.size()) == 1;
+		out_data.resize(outlen);
+	}
+	if (ctx) EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+	return ok;
+}
+
+void Binlog_Client::handle_auth(const unsigned char *p, size_t len) {
+	if (len == 0) {
+		fail("malformed authentication reply");
+		return;
+	}
+	switch (p[0]) {
+		case 0x00:
+			send_startup();
+			return;
+		case 0xff:
+			fail("authentication failed: " + server_error(p, len));
+			return;
+		case 0xfe: {
+			// Auth switch: plugin name, then its scramble.
+			const unsigned char *end = p + len;
+			const unsigned char *nul = (const unsigned char *)memchr(p + 1, 0, len - 1);
+			plugin.assign((const char *)p + 1, (nul ? nul : end) - (p + 1));
+			if (nul) {
+				scramble.assign((const char *)nul + 1, end - (nul + 1));
+				if (scramble.size() > SCRAMBLE_LENGTH) scramble.resize(SCRAMBLE_LENGTH);
+			}
+			auth_step = 0;
+			if (plugin != "mysql_native_password" && plugin != "caching_sha2_password" && plugin != "sha256_password") {
+				fail("unsupported authentication plugin " + plugin);
+				return;
+			}
+			send_packet(auth_response(plugin));
+			return;
+		}
+		case 0x01:
+			break;
+		default:
+			fail("malformed authentication reply");
+			return;
+	}
+
+	// AuthMoreData.
+	if (plugin == "caching_sha2_password" && auth_step == 0 && len == 2) {
+		if (p[1] == 0x03) {
+			// Fast authentication succeeded; an OK follows.
+			return;
+		}
+		if (p[1] == 0x04) {
+			// Full authentication, over a plain connection: ask for the key.
+			auth_step = 1;
+			send_packet(std::string(1, '\x02'));
+			return;
+		}
+	}
+	if (plugin == "caching_sha2_password" || plugin == "sha256_password") {
+		std::string enc;
+		if (!rsa_encrypt_password(std::string((const char *)p + 1, len - 1), enc)) {
+			fail("cannot encrypt the password with the server's public key");
+			return;
+		}
+		send_packet(enc);
+		return;
+	}
+	fail("unexpected authentication data for " + plugin);
+}
+
+// The first query also asks for heartbeats, under both variable names.
+std::string Binlog_Client::startup_query(size_t idx) const {
+	std::string q = startup_queries[idx];
+	if (idx == 0 && heartbeat_period_ms) {
+		// In nanoseconds.
+		const std::string ns = std::to_string(uint64_t(heartbeat_period_ms) * 1000000);
+		q += ", @master_heartbeat_period = " + ns + ", @source_heartbeat_period = " + ns;
+	}
+	return q;
+}
+
+// The startup queries and COM_REGISTER_SLAVE go out in one write, without
+// waiting for each reply; on a reconnect, when the set to dump from is
+// already known, so does COM_BINLOG_DUMP_GTID. The replies come back in
+// the same order. Polling needs only the GTID state query.
+void Binlog_Client::send_startup() {
+	query_idx = poll_interval_ms ? POLL_FIRST_QUERY : 0;
+	state = QUERY;
+	start_result();
+	for (size_t i = query_idx; i < STARTUP_QUERIES; i++) {
+		queue_command(COM_QUERY, startup_query(i));
+	}
+	dump_sent = false;
+	if (!poll_interval_ms) {
+		queue_command(COM_REGISTER_SLAVE, register_args());
+		dump_sent = started;
+		if (dump_sent) {
+			queue_command(COM_BINLOG_DUMP_GTID, dump_args());
+		}
+	}
+	flush();
+}
+
+void Binlog_Client::start_result() {
+	rs_state = RS_HEADER;
+	rs_columns = 0;
+	row.clear();
+	row_null.clear();
+	row_seen = false;
+}
+
+void Binlog_Client::handle_result(const unsigned char *p, size_t len) {
+	if (len > 0 && p[0] == 0xff) {
+		const std::string q = state == POLL ? std::string(POLL_QUERY) : startup_query(query_idx);
+		fail("query '" + q + "' failed: " + server_error(p, len));
+		return;
+	}
+	const bool eof = len > 0 && len < 9 && p[0] == 0xfe;
+	switch (rs_state) {
+		case RS_HEADER: {
+			if (len > 0 && p[0] == 0x00) {
+				query_done();
+				return;
+			}
+			const unsigned char *q = p;
+			if (!get_lenenc(q, p + len, rs_columns)) {
+				fail("malformed result set");
+				return;
+			}
+			rs_state = RS_COLUMNS;
+			return;
+		}
+		case RS_COLUMNS:
+			// Column definitions are not needed.
+			if (eof) rs_state = RS_ROWS;
+			return;
+		case RS_ROWS: {
+			if (eof) {
+				query_done();
+				return;
+			}
+			if (row_seen) return;
+			const unsigned char *q = p;
+			const unsigned char *end = p + len;
+			for (uint64_t i = 0; i < rs_columns; i++) {
+				if (q < end && *q == 0xfb) {
+					row.push_back(std::string());
+					row_null.push_back(true);
+					q++;
+					continue;
+				}
+				uint64_t n = 0;
+				if (!get_lenenc(q, end, n) || n > uint64_t(end - q)) {
+					fail("malformed result set");
+					return;
+				}
+				row.push_back(std::string((const char *)q, size_t(n)));
+				row_null.push_back(false);
+				q += n;
+			}
+			row_seen = true;
+			return;
+		}
+	}
+}
+
+void Binlog_Client::query_done() {
+	if (state == POLL) {
+		poll_done();
+		return;
+	}
+	if (query_idx == 1) {
+		if (!row_seen || row.size() < 4 || row_null[0] || row_null[2]) {
+			fail("cannot read the GTID state of the source");
+			return;
+		}
+		if (row[0] != "ON") {
+			fail("gtid_mode is " + row[0] + ", it must be ON");
+			return;
+		}
+		checksums = row[1] == "CRC32";
+		if (!started) {
+			executed.clear();
+			executed.parseGtid(row[2]);
+			if (executed.gtid_executed.empty()) {
+				info("'gtid_executed' found empty, retrying...");
+				disconnect();
+				if (!stopped) {
+					ev_timer_set(&timer, BINLOG_CLIENT_RETRY_MS / 1000.0, 0);
+					ev_timer_start(loop, &timer);
+				}
+				return;
+			}
+			started = true;
+			if (start_cb) {
+				slave::Position purged;
+				if (!row_null[3]) {
+					purged.parseGtid(row[3]);
+				}
+				start_cb(this, executed, purged);
+			}
+			if (state == IDLE) return;
+		} else if (poll_interval_ms) {
+			// Whatever the source executed while disconnected.
+			slave::Position source;
+			source.parseGtid(row[2]);
+			add_new_gtids(source);
+		}
+	}
+	if (++query_idx < STARTUP_QUERIES) {
+		start_result();
+		return;
+	}
+	if (poll_interval_ms) {
+		start_poll();
+		return;
+	}
+	state = REGISTER;
+}
+
+std::string Binlog_Client::register_args() const {
+	char hostname[256];
+	if (gethostname(hostname, sizeof(hostname)) != 0) {
+		hostname[0] = '\0';
+	}
+	hostname[sizeof(hostname) - 1] = '\0';
+	std::string args;
+	put_uint(args, server_id, 4);
+	const size_t hlen = strnlen(hostname, 255);
+	args.push_back(char(hlen));
+	args.append(hostname, hlen);
+	args.push_back('\0');  // user
+	args.push_back('\0');  // password
+	put_uint(args, 0, 2);  // port
+	put_uint(args, 0, 4);  // replication rank
+	put_uint(args, 0, 4);  // master id
+	return args;
+}
+
+std::string Binlog_Client::dump_args() {
+	std::string set(executed.encodedGtidSize(), '\0');
+	executed.encodeGtid((unsigned char *)&set[0]);
+	std::string args;
+	put_uint(args, BINLOG_THROUGH_GTID, 2);
+	put_uint(args, server_id, 4);
+	put_uint(args, 0, 4);  // binlog name length
+	put_uint(args, 4, 8);  // binlog position
+	put_uint(args, set.size(), 4);
+	args += set;
+	return args;
+}
+
+// Once COM_REGISTER_SLAVE succeeded; the dump request went out already, or
+// goes now.
+void Binlog_Client::start_dump() {
+	in_skip = false;
+	state = DUMP;
+	dump_start = ev_now(loop);
+	ev_timer_stop(loop, &timer);
+	if (heartbeat_period_ms) {
+		last_read = ev_now(loop);
+		ev_timer_set(&timer, heartbeat_period_ms * BINLOG_CLIENT_STALL_PERIODS / 1000.0, 0);
+		ev_timer_start(loop, &timer);
+	}
+	if (!dump_sent) {
+		send_command(COM_BINLOG_DUMP_GTID, dump_args());
+	}
+	if (state == DUMP) {
+		info("Dumping binlog from " + executed.str());
+	}
+}
+
+// Once the startup queries are answered, instead of the dump. The first
+// poll comes one interval later: the startup query just read the set.
+void Binlog_Client::start_poll() {
+	state = POLL;
+	dump_start = ev_now(loop);
+	last_read = dump_start;
+	poll_pending = false;
+	poll_sent = dump_start;
+	ev_timer_stop(loop, &timer);
+	ev_timer_set(&timer, poll_interval_ms / 1000.0, 0);
+	ev_timer_start(loop, &timer);
+	info("Polling the executed GTID set every " + std::to_string(poll_interval_ms) + "ms from " + executed.str());
+}
+
+void Binlog_Client::send_poll() {
+	start_result();
+	poll_pending = true;
+	poll_sent = ev_now(loop);
+	ev_timer_set(&timer, BINLOG_CLIENT_TIMEOUT_MS / 1000.0, 0);
+	ev_timer_start(loop, &timer);
+	send_command(COM_QUERY, POLL_QUERY);
+}
+
+// Polls are paced from when each was sent, so a slow reply does not push
+// the next one back by a full interval.
+void Binlog_Client::poll_done() {
+	if (!row_seen || row.empty() || row_null[0]) {
+		fail("cannot read the GTID state of the source");
+		return;
+	}
+	slave::Position source;
+	source.parseGtid(row[0]);
+	add_new_gtids(source);
+	poll_pending = false;
+	last_read = ev_now(loop);
+	const ev_tstamp left = poll_sent + poll_interval_ms / 1000.0 - last_read;
+	ev_timer_stop(loop, &timer);
+	ev_timer_set(&timer, left > 0 ? left : 0, 0);
+	ev_timer_start(loop, &timer);
+}
+
+// Hands over the GTIDs of 'source' that 'executed' lacks, per UUID in
+// increasing order. Both sets hold sorted, merged intervals, as the source
+// prints them and addGtid() keeps them. GTIDs the source no longer has,
+// after a RESET MASTER or a failover, stay known.
+void Binlog_Client::add_new_gtids(const slave::Position& source) {
+	struct Range {
+		const std::string *sid;
+		int64_t start;
+		int64_t end;
+	};
+	std::vector<Range> ranges;
+	const std::list<slave::gtid_interval_t> none;
+	for (auto sit = source.gtid_executed.begin(); sit != source.gtid_executed.end(); ++sit) {
+		auto eit = executed.gtid_executed.find(sit->first);
+		const std::list<slave::gtid_interval_t>& known = eit == executed.gtid_executed.end() ? none : eit->second;
+		auto k = known.begin();
+		for (auto h = sit->second.begin(); h != sit->second.end(); ++h) {
+			int64_t next = h->first;
+			while (k != known.end() && k->second < next) {
+				++k;
+			}
+			for (auto kk = k; kk != known.end() && kk->first <= h->second; ++kk) {
+				if (kk->first > next) {
+					ranges.push_back(Range{&sit->first, next, kk->first - 1});
+				}
+				if (kk->second + 1 > next) {
+					next = kk->second + 1;
+				}
+			}
+			if (next <= h->second) {
+				ranges.push_back(Range{&sit->first, next, h->second});
+			}
+		}
+	}
+	// Added only now: the lists walked above are those being extended.
+	for (size_t i = 0; i < ranges.size(); i++) {
+		for (int64_t gno = ranges[i].start; gno <= ranges[i].end; gno++) {
+			executed.addGtid(slave::gtid_t(*ranges[i].sid, gno));
+			if (gtid_cb) {
+				gtid_cb(this, *ranges[i].sid, gno);
+			}
+		}
+		burst_gtids = true;
+	}
+}
+
+// Consumes the binlog packets in the buffer. Error and EOF packets, and the
+// events handle_event() decodes, are taken once complete; any other event is
+// consumed as it arrives, and only the checksum of it is kept.
+bool Binlog_Client::parse_dump() {
+	for (;;) {
+		const size_t avail = in_len - in_pos;
+		const unsigned char *h = in.data() + in_pos;
+		if (in_skip) {
+			if (skip_left > 0) {
+				const size_t n = skip_left < avail ? skip_left : avail;
+				if (n == 0) break;
+				skip_bytes(h, n);
+				in_pos += n;
+				skip_left -= n;
+				if (skip_left > 0) break;
+				continue;
+			}
+			if (skip_more) {
+				// The event continues in the next packet.
+				if (avail < 4) break;
+				skip_left = get_uint3(h);
+				skip_more = skip_left == MAX_PACKET_LENGTH;
+				in_pos += 4;
+				continue;
+			}
+			in_skip = false;
+			if (!skip_done()) return false;
+			continue;
+		}
+
+		if (avail < 4) break;
+		const size_t len = get_uint3(h);
+		const size_t head = len < 1 + EVENT_HEADER_LEN ? len : 1 + EVENT_HEADER_LEN;
+		if (avail < 4 + head) break;
+		const unsigned char *p = h + 4;
+		if (head < 1 + EVENT_HEADER_LEN || p[0] != 0x00 ||
+			p[1 + EVENT_TYPE_OFFSET] == FORMAT_DESCRIPTION_EVENT || p[1 + EVENT_TYPE_OFFSET] == GTID_LOG_EVENT) {
+			if (len >= MAX_PACKET_LENGTH || 4 + len > in.size()) {
+				fail("binlog packet of " + std::to_string(len) + " bytes is too large to decode");
+				return false;
+			}
+			if (avail < 4 + len) break;
+			in_pos += 4 + len;
+			if (len > 0 && p[0] == 0xff) {
+				const unsigned int code = len >= 3 ? get_uint2(p + 1) : 0;
+				fail("binlog dump failed: " + server_error(p, len));
+				if (dump_error_cb) {
+					dump_error_cb(this, code);
+				}
+				return false;
+			}
+			if (len > 0 && len < 9 && p[0] == 0xfe) {
+				fail("end of the binlog stream");
+				return false;
+			}
+			if (len < 1 + EVENT_HEADER_LEN || p[0] != 0x00) {
+				fail("malformed binlog packet");
+				return false;
+			}
+			if (!handle_event(p + 1, len - 1)) return false;
+			continue;
+		}
+
+		// Skipped on its type byte: the rest of the event is consumed as it
+		// arrives.
+		in_pos += 4 + 1;
+		in_skip = true;
+		skip_left = len - 1;
+		skip_more = len == MAX_PACKET_LENGTH;
+		skip_event_len = get_uint4(p + 1 + EVENT_LEN_OFFSET);
+		skip_verify = verify_all_checksums && checksums && skip_event_len >= EVENT_HEADER_LEN + CHECKSUM_LEN;
+		skip_crc = 0;
+		skip_off = 0;
+	}
+	return true;
+}
+
+void Binlog_Client::skip_bytes(const unsigned char *p, size_t n) {
+	if (skip_verify) {
+		const size_t crc_len = skip_event_len - CHECKSUM_LEN;
+		if (skip_off < crc_len) {
+			skip_crc = proxysql_crc32(skip_crc, p, n < crc_len - skip_off ? n : crc_len - skip_off);
+		}
+		const size_t from = skip_off > crc_len ? skip_off : crc_len;
+		const size_t to = skip_off + n < skip_event_len ? skip_off + n : skip_event_len;
+		if (from < to) {
+			memcpy(skip_trailer + (from - crc_len), p + (from - skip_off), to - from);
+		}
+	}
+	skip_off += n;
+}
+
+bool Binlog_Client::skip_done() {
+	if (skip_off != skip_event_len) {
+		fail("skipped event is " + std::to_string(skip_off) + " bytes, its header says " + std::to_string(skip_event_len));
+		return false;
+	}
+	if (skip_verify && get_uint4(skip_trailer) != skip_crc) {
+		fail("CRC32 check failed on a skipped event");
+		return false;
+	}
+	return true;
+}
+
+bool Binlog_Client::handle_event(const unsigned char *ev, size_t len) {
+	if (get_uint4(ev + EVENT_LEN_OFFSET) != len) {
+		fail("binlog event length does not match its packet");
+		return false;
+	}
+	const unsigned char type = ev[EVENT_TYPE_OFFSET];
+	if (type == FORMAT_DESCRIPTION_EVENT) {
+		// Its own checksum setting is in it; it is not verified.
+		fde_checksums(ev, len, checksums);
+		return true;
+	}
+	// GTID_LOG_EVENT.
+	if (len < GTID_MIN_LEN + (checksums ? CHECKSUM_LEN : 0)) {
+		fail("malformed GTID event");
+		return false;
+	}
+	if (checksums && proxysql_crc32(0, ev, len - CHECKSUM_LEN) != get_uint4(ev + len - CHECKSUM_LEN)) {
+		fail("CRC32 check failed on a GTID event");
+		return false;
+	}
+	const std::string sid = hex_sid(ev + GTID_SID_OFFSET);
+	const int64_t gno = int64_t(get_uint8(ev + GTID_GNO_OFFSET));
+	executed.addGtid(slave::gtid_t(sid, gno));
+	if (gtid_cb) {
+		gtid_cb(this, sid, gno);
+	}
+	burst_gtids = true;
+	return true;
+}
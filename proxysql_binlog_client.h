@@ -0,0 +1,207 @@
+#ifndef PROXYSQL_BINLOG_CLIENT
+#define PROXYSQL_BINLOG_CLIENT
+
+// Native replication client for the GTID-only reader (-E native).
+//
+// It speaks the MySQL client/server protocol itself, over a non-blocking
+// socket driven by the reader's libev loop:
+//
+//   - the handshake, with mysql_native_password, caching_sha2_password or
+//     sha256_password; the connection is not encrypted, so the latter two
+//     send the password encrypted with the server's RSA key;
+//   - the checksum handshake and a query for the GTID mode, the checksum
+//     algorithm, and the executed and purged sets;
+//   - COM_REGISTER_SLAVE and COM_BINLOG_DUMP_GTID.
+// Everything after the handshake is pipelined: the queries and the register
+// go out in one write, and on a reconnect the dump request with them, so the
+// dump starts one round trip after authentication.
+//
+// The binlog stream is then read into one large buffer, as many events per
+// recv() as the socket holds. Only FORMAT_DESCRIPTION and GTID events are
+// decoded; any other event is skipped on its type byte, across as many reads
+// as it takes, without being assembled in memory. GTIDs are handed to the
+// owner on the loop thread, with no thread hop and no copy of the packet.
+//
+// On any error the connection is closed and opened again, dumping from the
+// set the client has seen so far: BINLOG_CLIENT_RETRY_MIN_MS later the first
+// time, then with a jittered exponential backoff up to BINLOG_CLIENT_RETRY_MS
+// until a dump lasts longer than that.
+// With a heartbeat period, the source sends a heartbeat event whenever it
+// has been idle that long, and a stream silent for BINLOG_CLIENT_STALL_PERIODS
+// periods counts as such an error.
+//
+// With a poll interval (-E poll), there is no dump at all: after the same
+// handshake, the client queries @@global.gtid_executed on the connection
+// every interval, and hands the GTIDs the source has that it has not seen
+// to the owner, as the dump would. The source runs no dump thread and sends
+// no row images; a GTID is seen up to one interval late, and every poll
+// costs a round trip carrying the whole executed set. A reply missing for
+// BINLOG_CLIENT_TIMEOUT_MS counts as an error, as a stalled dump does.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <ev.h>
+#include "binlog_pos.h"
+#include "proxysql_backoff.h"
+
+#define BINLOG_CLIENT_BUFFER_SIZE  (1024 * 1024)
+#define BINLOG_CLIENT_TIMEOUT_MS   10000
+#define BINLOG_CLIENT_RETRY_MIN_MS 20
+#define BINLOG_CLIENT_RETRY_MS     1000
+#define BINLOG_CLIENT_STALL_PERIODS 3
+
+class Binlog_Client {
+	public:
+	// Connection settings; set before start().
+	std::string host;
+	unsigned int port;
+	std::string user;
+	std::string password;
+	uint32_t server_id;
+	// Verify the CRC32 of every event, not only of the ones decoded.
+	bool verify_all_checksums;
+	// Heartbeat period requested from the source, in milliseconds; 0 for
+	// none, and no stall detection.
+	unsigned int heartbeat_period_ms;
+	// Poll the executed set this often, in milliseconds, instead of dumping
+	// the binlog; 0 to dump.
+	unsigned int poll_interval_ms;
+
+	// Called on the loop thread. start_cb gets the source's executed set,
+	// and the part of it whose binlogs the source has purged, once, on the
+	// first connection; gtid_cb then gets every GTID that follows, and
+	// burst_cb runs after each read that delivered any. dump_error_cb gets
+	// the error code of a dump the source refused, before the reconnect.
+	void (*start_cb)(Binlog_Client *c, const slave::Position& executed, const slave::Position& purged);
+	void (*gtid_cb)(Binlog_Client *c, const std::string& sid, int64_t gno);
+	void (*burst_cb)(Binlog_Client *c);
+	void (*log_cb)(Binlog_Client *c, bool error, const std::string& msg);
+	void (*dump_error_cb)(Binlog_Client *c, unsigned int code);
+	void *data;
+
+	Binlog_Client();
+	~Binlog_Client();
+
+	// Connects, and keeps reconnecting, on '_loop'.
+	void start(struct ev_loop *_loop);
+	void stop();
+
+	// The set dumped from on the next connection, or polled against. start_cb
+	// may replace it before the first dump or poll.
+	const slave::Position& get_executed() const { return executed; }
+	void set_executed(const slave::Position& pos) { executed = pos; }
+	// The next connection reads the source's sets again and hands them to
+	// start_cb, instead of dumping from the set seen so far.
+	void reread_source() { started = false; }
+	// Wall clock of the last data received from the source, heartbeats and
+	// poll replies included, in milliseconds; 0 before the first dump.
+	int64_t last_event_ms() const { return int64_t(last_read * 1000); }
+
+	private:
+	enum State { IDLE, CONNECTING, GREETING, AUTH, QUERY, REGISTER, DUMP, POLL };
+	enum Result_State { RS_HEADER, RS_COLUMNS, RS_ROWS };
+
+	struct ev_loop *loop;
+	State state;
+	int fd;
+	bool started;
+	bool stopped;
+	ev_io rio;
+	ev_io wio;
+	// Connect/handshake deadline, the retry delay while IDLE, the stall
+	// check while dumping, or the next poll or its reply deadline.
+	ev_timer timer;
+	// ev_now() of the last read while dumping or polling, and of the dump
+	// request or first poll.
+	ev_tstamp last_read;
+	ev_tstamp dump_start;
+	// A poll query is out, sent at poll_sent.
+	bool poll_pending;
+	ev_tstamp poll_sent;
+	Backoff retry;
+
+	std::vector<unsigned char> in;
+	size_t in_pos;
+	size_t in_len;
+	std::string out;
+	size_t out_pos;
+	uint8_t seq;
+
+	std::string scramble;
+	std::string plugin;
+	int auth_step;
+
+	size_t query_idx;
+	// COM_BINLOG_DUMP_GTID went out with the startup commands.
+	bool dump_sent;
+	Result_State rs_state;
+	uint64_t rs_columns;
+	std::vector<std::string> row;
+	std::vector<bool> row_null;
+	bool row_seen;
+
+	bool checksums;
+	slave::Position executed;
+	bool burst_gtids;
+
+	// A skipped event in progress: payload bytes left in the current packet,
+	// and whether another packet of the same event follows.
+	size_t skip_left;
+	bool skip_more;
+	bool in_skip;
+	// Checksum of the skipped event, with verify_all_checksums.
+	bool skip_verify;
+	uint32_t skip_crc;
+	size_t skip_off;
+	size_t skip_event_len;
+	unsigned char skip_trailer[4];
+
+	static void io_read_cb(struct ev_loop *loop, ev_io *w, int revents);
+	static void io_write_cb(struct ev_loop *loop, ev_io *w, int revents);
+	static void timer_cb(struct ev_loop *loop, ev_timer *t, int revents);
+
+	void info(const std::string& msg);
+	void fail(const std::string& msg);
+	void disconnect();
+	void connect_now();
+	void on_connected();
+	void on_readable();
+	void check_stall();
+	bool process_input();
+	void flush();
+	void send_packet(const std::string& payload);
+	void queue_command(unsigned char cmd, const std::string& args);
+	void send_command(unsigned char cmd, const std::string& args);
+
+	// These may close the connection; callers check 'state' afterwards.
+	void handle_packet(const unsigned char *p, size_t len);
+	void handle_greeting(const unsigned char *p, size_t len);
+	void handle_auth(const unsigned char *p, size_t len);
+	void handle_result(const unsigned char *p, size_t len);
+	void query_done();
+	std::string startup_query(size_t idx) const;
+	void send_startup();
+	void start_result();
+	std::string register_args() const;
+	std::string dump_args();
+	void start_dump();
+	void start_poll();
+	void send_poll();
+	void poll_done();
+	void add_new_gtids(const slave::Position& source);
+
+	bool parse_dump();
+	bool handle_event(const unsigned char *ev, size_t len);
+	void skip_bytes(const unsigned char *p, size_t n);
+	bool skip_done();
+
+	std::string auth_response(const std::string& plugin_name);
+	bool rsa_encrypt_password(const std::string& pem, std::string& out_data);
+	std::string server_error(const unsigned char *p, size_t len);
+};
+
+#endif /* PROXYSQL_BINLOG_CLIENT */
@@ -0,0 +1,136 @@
+#ifndef PROXYSQL_BINLOG_EVENT
+#define PROXYSQL_BINLOG_EVENT
+
+// Layout of the binlog events the reader parses itself, shared by the
+// replication client (-E native, poll), the binlog file reader (-E file,
+// replay) and test/bench/mock_source, which writes them.
+//
+// Every event starts with a 19-byte header: timestamp (4), type (1), server
+// id (4), event length (4), position of the next event (4), flags (2).
+// Integers are little-endian. With binlog_checksum=CRC32, the last 4 bytes
+// of an event are the CRC32 of the rest of it; a FORMAT_DESCRIPTION event
+// says whether the events after it have one.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// Event header.
+const size_t EVENT_HEADER_LEN = 19;
+const size_t EVENT_TYPE_OFFSET = 4;
+const size_t EVENT_LEN_OFFSET = 9;
+const size_t LOG_POS_OFFSET = 13;
+const size_t CHECKSUM_LEN = 4;
+
+// Event types.
+const unsigned char QUERY_EVENT = 2;
+const unsigned char STOP_EVENT = 3;
+const unsigned char ROTATE_EVENT = 4;
+const unsigned char FORMAT_DESCRIPTION_EVENT = 15;
+const unsigned char XID_EVENT = 16;
+const unsigned char GTID_LOG_EVENT = 33;
+const unsigned char PREVIOUS_GTIDS_LOG_EVENT = 35;
+const unsigned char XA_PREPARE_LOG_EVENT = 38;
+
+const unsigned char BINLOG_CHECKSUM_ALG_CRC32 = 1;
+
+// Every binlog file starts with it.
+const unsigned char BINLOG_MAGIC[4] = { 0xfe, 'b', 'i', 'n' };
+const size_t BINLOG_MAGIC_LEN = sizeof(BINLOG_MAGIC);
+
+// FORMAT_DESCRIPTION body: binlog version, server version, timestamp, header
+// length, post-header lengths (at least up to GTID_LOG_EVENT), checksum
+// algorithm.
+const size_t FDE_MIN_LEN = EVENT_HEADER_LEN + 2 + 50 + 4 + 1 + GTID_LOG_EVENT + 1 + CHECKSUM_LEN;
+
+// GTID event body: flags, source UUID, transaction number, then, since
+// MySQL 5.7, the logical clock (a type byte, two 8-byte timestamps); MySQL
+// 8.0 follows it with the commit timestamps (7 bytes each, the second one
+// flagged in the first) and the transaction length as a packed integer.
+const size_t GTID_SID_OFFSET = EVENT_HEADER_LEN + 1;
+const size_t GTID_GNO_OFFSET = GTID_SID_OFFSET + 16;
+const size_t GTID_MIN_LEN = GTID_GNO_OFFSET + 8;
+const size_t GTID_CLOCK_OFFSET = GTID_MIN_LEN + 1;
+const size_t GTID_COMMIT_TS_OFFSET = GTID_CLOCK_OFFSET + 8 + 8;
+const size_t GTID_COMMIT_TS_LEN = 7;
+
+inline uint32_t get_uint2(const unsigned char *p) {
+	return uint32_t(p[0]) | uint32_t(p[1]) << 8;
+}
+
+inline uint32_t get_uint3(const unsigned char *p) {
+	return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16;
+}
+
+inline uint32_t get_uint4(const unsigned char *p) {
+	return get_uint3(p) | uint32_t(p[3]) << 24;
+}
+
+inline uint64_t get_uint8(const unsigned char *p) {
+	return uint64_t(get_uint4(p)) | uint64_t(get_uint4(p + 4)) << 32;
+}
+
+// A packed integer, as in the client/server protocol; false if it runs
+// past 'end'.
+inline bool get_packed(const unsigned char *p, const unsigned char *end, uint64_t& v) {
+	if (p >= end) return false;
+	const size_t n = *p < 251 ? 0 : *p == 252 ? 2 : *p == 253 ? 3 : *p == 254 ? 8 : size_t(-1);
+	if (n == size_t(-1) || size_t(end - p) < 1 + n) return false;
+	if (n == 0) {
+		v = *p;
+		return true;
+	}
+	v = 0;
+	for (size_t i = 0; i < n; i++) {
+		v |= uint64_t(p[1 + i]) << (8 * i);
+	}
+	return true;
+}
+
+// The 32 hex digits of a 16-byte UUID, without dashes.
+inline std::string hex_sid(const unsigned char *p) {
+	static const char digits[] = "0123456789abcdef";
+	std::string s(32, '0');
+	for (size_t i = 0; i < 16; i++) {
+		s[2 * i] = digits[p[i] >> 4];
+		s[2 * i + 1] = digits[p[i] & 0xf];
+	}
+	return s;
+}
+
+// Sets 'crc32' to whether the events after the FORMAT_DESCRIPTION event
+// 'ev' of 'len' bytes have a checksum. Before MySQL 5.6.1 the event has no
+// checksum algorithm; 'crc32' is left as it is.
+inline void fde_checksums(const unsigned char *ev, size_t len, bool& crc32) {
+	if (len >= FDE_MIN_LEN) {
+		crc32 = ev[len - CHECKSUM_LEN - 1] == BINLOG_CHECKSUM_ALG_CRC32;
+	}
+}
+
+// The original commit timestamp of the GTID event 'ev', in microseconds;
+// 0 before MySQL 8.0. 'body_end' is where its checksum, if any, begins.
+inline uint64_t gtid_commit_ts(const unsigned char *ev, size_t body_end) {
+	if (body_end < GTID_COMMIT_TS_OFFSET + GTID_COMMIT_TS_LEN) return 0;
+	uint64_t ts = 0;
+	for (size_t i = 0; i < GTID_COMMIT_TS_LEN; i++) {
+		ts |= uint64_t(ev[GTID_COMMIT_TS_OFFSET + i]) << (8 * i);
+	}
+	// The top bit flags a second timestamp.
+	return ts & ~(uint64_t(1) << (8 * GTID_COMMIT_TS_LEN - 1));
+}
+
+// The length of the transaction the GTID event 'ev' starts, itself
+// included; 0 before MySQL 8.0.
+inline uint64_t gtid_trx_len(const unsigned char *ev, size_t body_end) {
+	if (body_end < GTID_COMMIT_TS_OFFSET + GTID_COMMIT_TS_LEN) return 0;
+	size_t off = GTID_COMMIT_TS_OFFSET + GTID_COMMIT_TS_LEN;
+	if (ev[off - 1] & 0x80) {
+		off += GTID_COMMIT_TS_LEN;
+	}
+	uint64_t trx_len = 0;
+	if (off >= body_end || !get_packed(ev + off, ev + body_end, trx_len)) return 0;
+	return trx_len;
+}
+
+#endif /* PROXYSQL_BINLOG_EVENT */
@@ -10,12 +10,16 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/ioctl.h>
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 #include <libdaemon/dfork.h>
 #include <libdaemon/dsignal.h>
@@ -25,7 +29,17 @@
 
 #include "Slave.h"
 #include "DefaultExtState.h"
+#include "proxysql_backoff.h"
+#include "proxysql_binlog_client.h"
+#include "proxysql_binlog_tail.h"
+#include "proxysql_crc32.h"
+#include "proxysql_gtid_checkpoint.h"
 #include "proxysql_gtid.h"
+#include "proxysql_gtid_shm.h"
+#include "proxysql_gtid_wire.h"
+#include "proxysql_handoff.h"
+#include "proxysql_timer_wheel.h"
+#include "proxysql_tls.h"
 
 #define BINLOG_VERSION GITVERSION
 
@@ -67,13 +81,36 @@ void proxy_log_func(const char *fmt, ...) {
 #define DEFAULT_MAX_NETBUFLEN_STREAMING      (8 * NETBUFLEN)
 #define DEFAULT_MAX_NETBUFLEN_BATCHED        (8192 * NETBUFLEN)
 #define PROXYSQL_UPDATE_BATCHING_MIN_VERSION "3.0.8"
-#define UUID_SIZE_BYTES                      64
+#define TLS_HANDSHAKE_TIMEOUT_SEC            10
+#define HELLO_MAX_LEN                        (1024 * 1024)
+#define DEFAULT_DEFLATE_LEVEL                1
+#define DEFAULT_KEEPALIVE_SEC                10
+#define DEFAULT_WRITE_DEADLINE_MS            10000
+#define HEARTBEAT_MIN_MS                     100
+#define DEFAULT_POLL_INTERVAL_MS             100
+#define DEFAULT_SOURCE_HEARTBEAT_MS          1000
+#define SOURCE_RETRY_MIN_MS                  20
+#define SOURCE_RETRY_MAX_SEC                 1
+#define ANGEL_RESTART_MIN_MS                 20
+#define ANGEL_RESTART_MAX_MS                 1000
+#define ANGEL_STABLE_MS                      10000
+#define TIMER_WHEEL_TICK_MS                  50
+#define CHECKPOINT_INTERVAL_MS               1000
+#define FLUSH_FREQ_MAX_MS                    60000
+#define MAX_NETBUFLEN_LIMIT                  (1024 * 1024 * 1024)
+#define HANDOFF_FD_ENV                       "PROXYSQL_BINLOG_HANDOFF_FD"
+// The source no longer has the binlogs a dump asks for.
+#ifndef ER_MASTER_FATAL_ERROR_READING_BINLOG
+#define ER_MASTER_FATAL_ERROR_READING_BINLOG 1236
+#endif
 
 struct ev_async async;
-std::vector<struct ev_io *> Clients;
 
 pid_t pid;
-time_t laststart;
+// Monotonic start time of the current child, in milliseconds.
+uint64_t laststart;
+// Delays angel restarts while children keep dying within ANGEL_STABLE_MS.
+Backoff restart_backoff(ANGEL_RESTART_MIN_MS, ANGEL_RESTART_MAX_MS);
 pthread_mutex_t pos_mutex;
 
 std::vector<char *> server_uuids;
@@ -83,6 +120,10 @@ static struct ev_loop *loop;
 
 volatile sig_atomic_t stopflag = 0;
 slave::Slave* sl = NULL;
+// Set instead of 'sl' with -E native.
+Binlog_Client* native_client = NULL;
+// Set instead of 'sl' with -E file.
+Binlog_Tail* binlog_tail = NULL;
 slave::Position curpos;
 
 int pipefd[2];
@@ -90,13 +131,165 @@ int pipefd[2];
 char last_server_uuid[256];
 uint64_t last_trx_id = 0;
 
+// Replication client that reads the binlog (-E).
+enum Engine {
+	// libslave, on its own thread, over libmysqlclient.
+	ENGINE_LIBSLAVE,
+	// Binlog_Client, on the server loop.
+	ENGINE_NATIVE,
+	// Binlog_Client polling the executed set, with no binlog dump.
+	ENGINE_POLL,
+	// Binlog_Tail, reading the binlog files on the server loop.
+	ENGINE_FILE,
+	// Binlog_Tail replaying captured binlog files, then exiting.
+	ENGINE_REPLAY,
+};
+
 // Global arguments
 char *errorlog = NULL;
+Engine engine = ENGINE_LIBSLAVE;
+// -E poll:<ms>
+unsigned int poll_interval_ms = DEFAULT_POLL_INTERVAL_MS;
+// -E replay: clients to wait for, and pace (0: as fast as possible).
+unsigned int replay_clients = 0;
+double replay_speed = 0;
+bool replay_waiting = false;
 bool foreground = false;
-unsigned int listen_port = DEFAULT_LISTEN_PORT;
 size_t max_netbuflen = 0;
 uint64_t update_freq_ms = 0;
 bool update_batching = true;
+uint64_t hello_wait_ms = 0;
+// -c all: also verify the checksum of the events the reader skips.
+bool verify_all_checksums = false;
+unsigned int keepalive_sec = DEFAULT_KEEPALIVE_SEC;
+uint64_t write_deadline_ms = DEFAULT_WRITE_DEADLINE_MS;
+// -H: heartbeat period asked of the source, in milliseconds; 0 for none.
+unsigned int source_heartbeat_ms = DEFAULT_SOURCE_HEARTBEAT_MS;
+char *shm_path = NULL;
+// -C: GTID checkpoint file.
+char *checkpoint_path = NULL;
+// -D: binlog index file, with -E file.
+char *binlog_index = NULL;
+char *tls_cert = NULL;
+char *tls_key = NULL;
+char *tls_ca = NULL;
+
+GTID_Shm_Writer shm_writer;
+GTID_Checkpoint checkpoint;
+uint64_t next_checkpoint_ms = 0;
+// Set when clients were served a restored state, from the checkpoint or
+// handed over by the previous process, before the source was reached.
+bool state_restored = false;
+// True while the state served may lag behind the source: it was restored,
+// and the stream has not yet covered 'catchup_target', the
+// source's executed set when it was reached (under pos_mutex).
+std::atomic<bool> state_stale(false);
+GTID_Set catchup_target;
+bool catchup_pending = false;
+// Set when the source refused to dump from the restored state: the next
+// time the source is reached, the state is discarded (under pos_mutex).
+bool restored_state_refused = false;
+// Asks the server loop to close its streaming clients.
+std::atomic<bool> clients_reset_pending(false);
+// SIGUSR2 execs the binary at 'exe_path' with 'exec_argv', this process's
+// arguments before getopt() masked the password.
+char exe_path[PATH_MAX];
+std::vector<char *> exec_argv;
+// In a process exec'd by SIGUSR2: the socket the previous one hands over on.
+int handoff_fd = -1;
+// Set in the forked copy that hands the clients over: their queued data goes
+// to the new process instead of the sockets.
+bool handoff_donor = false;
+// Handoff records; each starts with its type.
+enum { HANDOFF_STATE = 1, HANDOFF_LISTENER, HANDOFF_CLIENT, HANDOFF_END };
+// A streaming client taken over, until the server loop adopts it.
+struct Handoff_Client {
+	int fd;
+	std::string ip;
+	uint64_t proto;
+	uint64_t freq_ms;
+	uint64_t batching;
+	uint64_t netbuf_limit;
+	uint64_t hb_ms;
+	uint64_t zlevel;
+	uint64_t hello_done;
+	std::string inbuf;
+	std::string pending;
+};
+std::vector<Handoff_Client> handoff_clients;
+TLS_Server_Context tls_ctx;
+// Per-client deadlines, driven by one ev_timer in the server loop.
+Timer_Wheel timers(TIMER_WHEEL_TICK_MS);
+
+// Totals over all "z=deflate" connections, logged on SIGUSR1 and at exit.
+struct Deflate_Stats {
+	uint64_t connections;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t ns;
+} deflate_stats;
+
+static uint64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t monotonic_ms() {
+	return monotonic_ns() / 1000000;
+}
+
+static int64_t realtime_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Time from the start of the process, or from the fork of a restarted child,
+// to the first client served its initial state, broken down by phase: the
+// window in which ProxySQL has no GTID information from this server. Logged
+// once, when that client is served.
+struct Startup_Profile {
+	uint64_t start_ns;
+	uint64_t last_ns;
+	std::string phases;
+	bool done;
+
+	void begin() {
+		start_ns = last_ns = monotonic_ns();
+		phases.clear();
+		done = false;
+	}
+	// Ends the phase 'name' now.
+	void mark(const char *name) {
+		if (done) return;
+		const uint64_t now = monotonic_ns();
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%s%s %.1fms", phases.empty() ? "" : ", ", name, (now - last_ns) / 1e6);
+		phases += buf;
+		last_ns = now;
+	}
+	void finish(const char *name);
+} startup;
+
+void Startup_Profile::finish(const char *name) {
+	if (done) return;
+	mark(name);
+	done = true;
+	proxy_info("Startup profile: %s; %.1fms in total", phases.c_str(), (last_ns - start_ns) / 1e6);
+}
+
+void log_deflate_stats() {
+	if (deflate_stats.connections == 0) {
+		return;
+	}
+	proxy_info(
+		"deflate: %lu connections, %lu bytes in, %lu bytes out (ratio %.2f), %.2f ns/byte",
+		deflate_stats.connections, deflate_stats.bytes_in, deflate_stats.bytes_out,
+		deflate_stats.bytes_out ? double(deflate_stats.bytes_in) / deflate_stats.bytes_out : 0.0,
+		deflate_stats.bytes_in ? double(deflate_stats.ns) / deflate_stats.bytes_in : 0.0
+	);
+}
 
 static const char * proxysql_binlog_pid_file() {
 	static char fn[512];
@@ -140,6 +333,8 @@ void daemonize_wait_daemon() {
 }
 
 
+unsigned int open_listeners();
+
 bool daemonize_phase2() {
 	int rc;
 	/* Close FDs */
@@ -163,6 +358,15 @@ bool daemonize_phase2() {
 		return false;
 	}
 
+	/* The angel owns the listening sockets: each child inherits them, and
+	 * connections queue in their backlog while a crashed child is replaced. */
+	unsigned int failed_port = open_listeners();
+	if (failed_port) {
+		daemon_log(LOG_ERR, "Could not listen on port %u: %s", failed_port, strerror(errno));
+		daemon_retval_send(3);
+		return false;
+	}
+
 	/* Send OK to parent process */
 	daemon_retval_send(0);
 	flush_error_log();
@@ -202,6 +406,14 @@ void parent_close_error_log() {
 }
 
 
+// The pid file names the angel: a SIGUSR2 sent to it is meant for the
+// reader it runs. In the reader, 'pid' is 0 until libev takes the signal.
+void angel_sigusr2_handler(int sig) {
+	if (pid > 0) {
+		kill(pid, SIGUSR2);
+	}
+}
+
 bool daemonize_phase3() {
 	int rc;
 	int status;
@@ -261,6 +473,23 @@ void daemonize_phase1(char *argv0) {
 	}
 }
 
+GTID_Set position_to_gtid_set(slave::Position &curpos) {
+	GTID_Set gtid_set;
+
+	for (auto it=curpos.gtid_executed.begin(); it!=curpos.gtid_executed.end(); ++it) {
+		auto uuid = it->first;
+		for (auto itr = it->second.begin(); itr != it->second.end(); ++itr) {
+			gtid_set.add(uuid, itr->first, itr->second);
+		}
+	}
+	return gtid_set;
+}
+
+// Yields the executed set in its compact form, one entry per UUID.
+std::string gtid_set_to_string(slave::Position &curpos) {
+	return position_to_gtid_set(curpos).to_string();
+}
+
 std::string position_to_string(slave::Position &curpos) {
 	GTID_Set gtid_set;
 
@@ -285,14 +514,69 @@ std::string position_to_string(slave::Position &curpos) {
 	}
 
 	// GTID string for ranged updates.
-	for (auto it=curpos.gtid_executed.begin(); it!=curpos.gtid_executed.end(); ++it) {
-		auto uuid = it->first;
-		for (auto itr = it->second.begin(); itr != it->second.end(); ++itr) {
-			gtid_set.add(uuid, itr->first, itr->second);
+	return gtid_set_to_string(curpos);
+}
+
+void write_stall_cb(Timer_Wheel_Entry *e);
+void group_timer_cb(struct ev_loop *loop, struct ev_timer *t, int revents);
+
+// Streaming clients that share a flush policy and a protocol. Each batch is
+// encoded once for all of them; only compression is per client.
+class Flush_Group {
+	public:
+	uint64_t freq_ms;
+	bool batching;
+	int proto;
+	std::vector<struct ev_io *> clients;
+	GTID_Wire_Encoder enc;
+	// Set when a client joined: the next batch must not rely on lines the
+	// newcomer did not get (I2/I4, binary UUID ids).
+	bool reset;
+	// Updates since the last flush.
+	std::vector<std::pair<std::string, uint64_t>> pending;
+	GTID_Set pending_set;
+	struct ev_timer timer;
+
+	Flush_Group(uint64_t _freq_ms, bool _batching, int _proto) : enc(_proto) {
+		freq_ms = _freq_ms;
+		batching = _batching;
+		proto = _proto;
+		reset = false;
+		ev_timer_init(&timer, group_timer_cb, freq_ms / 1000.0, freq_ms / 1000.0);
+		timer.data = this;
+		if (freq_ms) {
+			ev_timer_start(loop, &timer);
 		}
 	}
-	return gtid_set.to_string();
-}
+	~Flush_Group() {
+		ev_timer_stop(loop, &timer);
+	}
+	void add(const char *uuid, uint64_t trxid) {
+		if (batching) {
+			pending_set.add(uuid, trxid);
+		} else {
+			pending.push_back(std::make_pair(std::string(uuid), trxid));
+		}
+	}
+};
+
+std::vector<Flush_Group *> Groups;
+
+// One -l entry: a port, and the defaults of the clients accepted on it.
+class Listener {
+	public:
+	unsigned int port;
+	uint64_t freq_ms;
+	bool batching;
+	size_t max_netbuflen;
+	int sd;
+	struct ev_io ev_accept;
+};
+
+std::vector<Listener *> Listeners;
+
+class Client_Data;
+void leave_group(Client_Data *custom_data);
 
 class Client_Data {
 	public:
@@ -302,18 +586,59 @@ class Client_Data {
 	size_t size;
 	size_t pos;
 	struct ev_io *w;
-	char uuid_server[UUID_SIZE_BYTES];
 	char *ip = NULL;
+	// TLS session, NULL on a plaintext listener. Once 'ktls' is set the
+	// kernel encrypts and the socket is written to directly.
+	SSL *ssl;
+	bool tls_handshake;
+	bool ktls;
+	// Deadline of the TLS handshake, then of the wait for a HELLO (-w),
+	// then of a stalled write (-W).
+	Timer_Wheel_Entry deadline;
+	// Armed when the client negotiated hb=<ms>.
+	Timer_Wheel_Entry heartbeat;
+	uint64_t hb_ms;
+	uint64_t last_progress_ms;
+	uint64_t last_send_ms;
+	// Set once the initial state was sent; the client then joins a group.
+	bool streaming;
+	// Flush policy: -t/-b, or what the client asked for.
+	uint64_t freq_ms;
+	bool batching;
+	Flush_Group *group;
+	// Write queue limit of the listener the client came from.
+	size_t netbuf_limit;
+	bool hello_done;
+	std::string inbuf;
+	GTID_Wire_Encoder enc;
+	// Active once the client negotiated z=deflate, at level 'zlevel'.
+	GTID_Wire_Deflater z;
+	int zlevel;
+	std::string zout;
 
 	Client_Data(struct ev_io *_w) {
 		w = _w;
 		size = NETBUFLEN;
 		data = (char *)malloc(size);
-		uuid_server[0] = 0;
 		pos = 0;
 		len = 0;
 		max_len = 0;
 		ip = strdup("unknown");
+		ssl = NULL;
+		tls_handshake = false;
+		ktls = false;
+		deadline.data = w;
+		heartbeat.data = w;
+		hb_ms = 0;
+		last_progress_ms = 0;
+		last_send_ms = 0;
+		streaming = false;
+		freq_ms = update_freq_ms;
+		batching = update_batching;
+		group = NULL;
+		netbuf_limit = max_netbuflen;
+		hello_done = false;
+		zlevel = 0;
 	}
 	void resize(size_t _s) {
 		char *data_ = (char *)malloc(_s);
@@ -322,7 +647,7 @@ class Client_Data {
 		free(data);
 		data = data_;
 	}
-	void add_string(const char *_ptr, size_t _s) {
+	void append(const char *_ptr, size_t _s) {
 		if (size < len + _s) {
 			// Round up size to n-times NETBUFLEN
 			size_t new_s = len + _s;
@@ -333,10 +658,36 @@ class Client_Data {
 		len += _s;
 		if (len > max_len) max_len = len;
 	}
-	void add_string(std::string s) {
-		add_string(s.c_str(), s.size());
+	// Queues one batch, compressed if the client asked for it.
+	void add_string(const char *_ptr, size_t _s) {
+		if (hb_ms && _s) {
+			last_send_ms = monotonic_ms();
+		}
+		if (!z.is_active()) {
+			append(_ptr, _s);
+			return;
+		}
+		if (_s == 0) {
+			return;
+		}
+		uint64_t t0 = monotonic_ns();
+		zout.clear();
+		if (!z.write(zout, _ptr, _s)) {
+			proxy_error("failed to compress %zu bytes for client %s", _s, ip);
+		}
+		deflate_stats.ns += monotonic_ns() - t0;
+		deflate_stats.bytes_in += _s;
+		deflate_stats.bytes_out += zout.size();
+		append(zout.data(), zout.size());
+	}
+	void add_string(const std::string& s) {
+		add_string(s.data(), s.size());
 	}
 	~Client_Data() {
+		leave_group(this);
+		timers.remove(&deadline);
+		timers.remove(&heartbeat);
+		if (ssl) SSL_free(ssl);
 		if (ip) free(ip);
 		free(data);
 	}
@@ -346,14 +697,49 @@ class Client_Data {
 		sprintf(ip,"%s:%d",a,p);
 	}
 
+	// Reads pending input. Returns 1 once a full line is buffered, 0 when more
+	// is needed, -1 on EOF, error or an oversized line.
+	int read_line() {
+		char buf[4096];
+		while (true) {
+			ssize_t rc;
+			if (ssl) {
+				rc = tls_read(ssl, buf, sizeof(buf));
+			} else {
+				rc = read(w->fd, buf, sizeof(buf));
+			}
+			if (rc > 0) {
+				inbuf.append(buf, rc);
+				if (inbuf.find('\n') != std::string::npos) {
+					return 1;
+				}
+				if (inbuf.size() > HELLO_MAX_LEN) {
+					return -1;
+				}
+			} else if (rc == 0) {
+				return -1;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			} else if (errno != EINTR) {
+				return -1;
+			}
+		}
+	}
+
 	bool writeout() {
 		bool ret = true;
-		while (len) {
+		while (len && !handoff_donor) {
 			size_t chunk = len-pos;
 			if (chunk > WRITE_CHUNKLEN) { chunk = WRITE_CHUNKLEN; }
-			int rc = write(w->fd,data+pos,chunk);
+			int rc;
+			if (ssl && !ktls) {
+				rc = tls_write(ssl,data+pos,chunk);
+			} else {
+				rc = write(w->fd,data+pos,chunk);
+			}
 			if (rc > 0) {
 				pos += rc;
+				last_progress_ms = monotonic_ms();
 				if (pos >= len/2) {
 					memmove(data,data+pos,len-pos);
 					len -= pos;
@@ -361,9 +747,14 @@ class Client_Data {
 				}
 			} else {
 				int myerr = errno;
+				if (rc==-1 && (myerr == EAGAIN || myerr == EWOULDBLOCK)) {
+					// Socket full: the rest goes out from write_cb, instead
+					// of spinning here while every other client waits.
+					break;
+				}
 				if (
 					(rc==0) ||
-					(rc==-1 && myerr != EINTR && myerr != EAGAIN)
+					(rc==-1 && myerr != EINTR)
 				) {
 					proxy_error("failed to write %d/%d bytes to client FD %d, error %d", chunk, len-pos, w->fd, errno);
 					ret = false;
@@ -382,6 +773,10 @@ class Client_Data {
 				ev_io_set(w, w->fd, new_events);
 				ev_io_start(loop, w);
 			}
+			if (len && streaming && write_deadline_ms && !deadline.is_pending()) {
+				deadline.cb = write_stall_cb;
+				timers.add(&deadline, write_deadline_ms);
+			}
 		} else {
 			ev_io_stop(loop,w);
 			shutdown(w->fd,SHUT_RDWR);
@@ -391,27 +786,53 @@ class Client_Data {
 	}
 };
 
+// Adds a streaming client to the group of its flush policy and protocol.
+void join_group(struct ev_io *client) {
+	Client_Data *custom_data = (Client_Data *)client->data;
+	int proto = custom_data->enc.get_proto();
+	Flush_Group *g = NULL;
+	for (std::vector<Flush_Group *>::iterator it = Groups.begin(); it != Groups.end(); ++it) {
+		if ((*it)->freq_ms == custom_data->freq_ms && (*it)->batching == custom_data->batching && (*it)->proto == proto) {
+			g = *it;
+			break;
+		}
+	}
+	if (g == NULL) {
+		g = new Flush_Group(custom_data->freq_ms, custom_data->batching, proto);
+		Groups.push_back(g);
+	}
+	g->clients.push_back(client);
+	g->reset = true;
+	custom_data->group = g;
+}
+
+// Takes a client out of its group; the group goes away with its last member.
+void leave_group(Client_Data *custom_data) {
+	Flush_Group *g = custom_data->group;
+	if (g == NULL) {
+		return;
+	}
+	custom_data->group = NULL;
+	std::vector<struct ev_io *>::iterator it = std::find(g->clients.begin(), g->clients.end(), custom_data->w);
+	if (it != g->clients.end()) {
+		g->clients.erase(it);
+	}
+	if (g->clients.empty()) {
+		Groups.erase(std::find(Groups.begin(), Groups.end(), g));
+		delete g;
+	}
+}
+
 void write_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
 	Client_Data * custom_data = (Client_Data *)watcher->data;
 	bool rc = custom_data->writeout();
 	if (rc == false) {
-		std::vector<struct ev_io *>::iterator it;
-		it = std::find(Clients.begin(), Clients.end(), watcher);
-		if (it != Clients.end()) {
-			Clients.erase(it);
-		}
 		delete custom_data;
 		free(watcher);
 	}
 }
 
 void read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
-	std::vector<struct ev_io *>::iterator it;
-	it = std::find(Clients.begin(), Clients.end(), watcher);
-	if (it != Clients.end()) {
-		//proxy_info("Remove client with FD %d", watcher->fd);
-		Clients.erase(it);
-	}
 	if(EV_ERROR & revents) {
 		perror("got invalid event");
 		ev_io_stop(loop,watcher);
@@ -432,14 +853,353 @@ void read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
 	free(watcher);
 }
 
+// Encodes the initial state in the client's protocol. With the set the
+// client already 'known's, only the missing intervals are sent as updates,
+// unless they would not be smaller than the full state. Returns true when
+// the difference was used.
+bool encode_initial_state(Client_Data *custom_data, const GTID_Set *known, std::string& out) {
+	pthread_mutex_lock(&pos_mutex);
+	GTID_Set gtid_set = position_to_gtid_set(curpos);
+	pthread_mutex_unlock(&pos_mutex);
+
+	// Both candidates start from the same encoder state.
+	GTID_Wire_Encoder full_enc = custom_data->enc;
+	full_enc.snapshot(out, gtid_set, !custom_data->batching);
+
+	GTID_Set diff;
+	if (known == NULL || !gtid_wire_set_diff(gtid_set, *known, diff)) {
+		custom_data->enc = full_enc;
+		return false;
+	}
+	GTID_Wire_Encoder diff_enc = custom_data->enc;
+	std::string diff_out;
+	for (auto it = diff.map.begin(); it != diff.map.end(); ++it) {
+		for (auto itr = it->second.begin(); itr != it->second.end(); ++itr) {
+			diff_enc.update(diff_out, it->first, *itr);
+		}
+	}
+	if (diff_out.size() >= out.size()) {
+		custom_data->enc = full_enc;
+		return false;
+	}
+	custom_data->enc = diff_enc;
+	out.swap(diff_out);
+	return true;
+}
+
+// Queues the full state in the client's protocol.
+void add_snapshot(Client_Data *custom_data) {
+	std::string out;
+	encode_initial_state(custom_data, NULL, out);
+	custom_data->add_string(out);
+}
+
+void replay_client_ready();
+
+// Sends the initial state to a new client, unless already queued, and
+// starts streaming updates to it.
+void start_client(struct ev_io *client, bool snapshot = true) {
+	Client_Data * custom_data = (Client_Data *)client->data;
+	timers.remove(&custom_data->deadline);
+	if (snapshot) {
+		add_snapshot(custom_data);
+	}
+	custom_data->streaming = true;
+	if (custom_data->writeout()) {
+		//proxy_info("Adding client with FD %d", client->fd);
+		startup.finish("first client");
+		join_group(client);
+		if (replay_waiting) {
+			replay_client_ready();
+		}
+	} else {
+		proxy_error("Error accepting client with FD %d", client->fd);
+		delete custom_data;
+		free(client);
+	}
+}
+
+// Frees a client whose socket is already closed.
+void free_client(struct ev_io *client) {
+	Client_Data *custom_data = (Client_Data *)client->data;
+	delete custom_data;
+	free(client);
+}
+
+// Closes and frees a client.
+void drop_client(struct ev_io *client) {
+	ev_io_stop(loop,client);
+	shutdown(client->fd,SHUT_RDWR);
+	close(client->fd);
+	free_client(client);
+}
+
+// No HELLO within -w: the client gets the default text stream.
+void hello_timeout_cb(Timer_Wheel_Entry *e) {
+	start_client((struct ev_io *)e->data);
+}
+
+// Queued data made no progress for -W: the peer is gone or not reading.
+void write_stall_cb(Timer_Wheel_Entry *e) {
+	struct ev_io *client = (struct ev_io *)e->data;
+	Client_Data *custom_data = (Client_Data *)client->data;
+	if (custom_data->len == 0) {
+		return;
+	}
+	uint64_t stalled_ms = monotonic_ms() - custom_data->last_progress_ms;
+	if (stalled_ms < write_deadline_ms) {
+		timers.add(e, write_deadline_ms - stalled_ms);
+		return;
+	}
+	proxy_error("no write progress to client %s for %lums (%zu bytes queued), closing", custom_data->ip, stalled_ms, custom_data->len - custom_data->pos);
+	drop_client(client);
+}
+
+// Sends a heartbeat when nothing else was sent for hb_ms.
+void heartbeat_cb(Timer_Wheel_Entry *e) {
+	struct ev_io *client = (struct ev_io *)e->data;
+	Client_Data *custom_data = (Client_Data *)client->data;
+	uint64_t idle_ms = monotonic_ms() - custom_data->last_send_ms;
+	if (idle_ms >= custom_data->hb_ms) {
+		std::string out;
+		custom_data->enc.heartbeat(out, uint64_t(ev_time() * 1000));
+		custom_data->add_string(out);
+		if (!custom_data->writeout()) {
+			free_client(client);
+			return;
+		}
+		idle_ms = 0;
+	}
+	timers.add(e, custom_data->hb_ms - idle_ms);
+}
+
+// Called once a client can be sent data.
+void client_connected(struct ev_io *client) {
+	if (hello_wait_ms) {
+		Client_Data *custom_data = (Client_Data *)client->data;
+		custom_data->deadline.cb = hello_timeout_cb;
+		timers.add(&custom_data->deadline, hello_wait_ms);
+		return;
+	}
+	start_client(client);
+}
+
+// Applies the client's "HELLO key=value ..." line. The reply echoes the
+// options that were accepted, and the stream restarts with a snapshot in
+// the negotiated protocol, or with what the client lacks when it sent its
+// known set. Returns false if the client must be closed.
+bool process_hello(struct ev_io *client) {
+	Client_Data *custom_data = (Client_Data *)client->data;
+	size_t nl = custom_data->inbuf.find('\n');
+	if (nl + 1 != custom_data->inbuf.size()) {
+		// only one line is expected
+		return false;
+	}
+	std::string line = custom_data->inbuf.substr(0, nl);
+	custom_data->inbuf.clear();
+	if (!line.empty() && line[line.size()-1] == '\r') {
+		line.erase(line.size()-1);
+	}
+	std::istringstream tokens(line);
+	std::string tok;
+	if (!(tokens >> tok) || tok != "HELLO") {
+		return false;
+	}
+	int proto = GTID_WIRE_PROTO_TEXT;
+	bool deflate = false;
+	int deflate_level = DEFAULT_DEFLATE_LEVEL;
+	uint64_t hb_ms = 0;
+	bool has_known = false;
+	GTID_Set known;
+	bool has_policy = false;
+	uint64_t freq_ms = custom_data->freq_ms;
+	bool batching = true;
+	bool want_stale = false;
+	std::string reply = "HELLO";
+	while (tokens >> tok) {
+		size_t eq = tok.find('=');
+		if (eq == std::string::npos) {
+			continue;
+		}
+		std::string key = tok.substr(0, eq);
+		std::string val = tok.substr(eq + 1);
+		// Unknown keys and values are left out of the reply.
+		if (key == "proto" && (val == "text" || val == "bin")) {
+			proto = (val == "bin" ? GTID_WIRE_PROTO_BIN : GTID_WIRE_PROTO_TEXT);
+			reply += " " + tok;
+		} else if (key == "z" && val == "deflate") {
+			deflate = true;
+			reply += " " + tok;
+		} else if (key == "zlevel" && val.size() == 1 && val[0] >= '1' && val[0] <= '9') {
+			deflate_level = val[0] - '0';
+			reply += " " + tok;
+		} else if (key == "hb" && !val.empty() && val.size() <= 9 && val.find_first_not_of("0123456789") == std::string::npos) {
+			hb_ms = std::stoul(val);
+			if (hb_ms < HEARTBEAT_MIN_MS) {
+				hb_ms = HEARTBEAT_MIN_MS;
+			}
+			// The reply carries the interval in effect.
+			reply += " hb=" + std::to_string(hb_ms);
+		} else if (key == "freq" && !val.empty() && val.size() <= 5 && val.find_first_not_of("0123456789") == std::string::npos && std::stoul(val) <= FLUSH_FREQ_MAX_MS) {
+			freq_ms = std::stoul(val);
+			has_policy = true;
+		} else if (key == "batch" && (val == "0" || val == "1")) {
+			batching = (val == "1");
+			has_policy = true;
+		} else if (key == "stale" && val == "1") {
+			want_stale = true;
+		} else if (key == "known") {
+			has_known = gtid_wire_parse_set(val, known);
+			if (!has_known) {
+				known.clear();
+			}
+		}
+	}
+	custom_data->hello_done = true;
+	if (has_policy) {
+		// Without a flush timer there is nothing to batch.
+		custom_data->freq_ms = freq_ms;
+		custom_data->batching = batching && freq_ms;
+		reply += " freq=" + std::to_string(custom_data->freq_ms) + " batch=" + (custom_data->batching ? "1" : "0");
+	}
+	// The policy or the protocol may change: rejoin once the state is queued.
+	leave_group(custom_data);
+	custom_data->enc.set_proto(proto);
+	// Read before encoding: the state may turn current meanwhile, never stale.
+	const bool stale = state_stale;
+	std::string state;
+	bool resumed = encode_initial_state(custom_data, has_known ? &known : NULL, state);
+	if (has_known) {
+		// Tells the client whether its set was kept or replaced.
+		reply += resumed ? " known=diff" : " known=snapshot";
+	}
+	if (want_stale) {
+		reply += stale ? " stale=1" : " stale=0";
+	}
+	custom_data->add_string(reply + "\n");
+	if (deflate) {
+		// Everything after the reply is compressed.
+		if (!custom_data->z.init(deflate_level)) {
+			proxy_error("failed to set up compression for client %s", custom_data->ip);
+			return false;
+		}
+		custom_data->zlevel = deflate_level;
+		deflate_stats.connections++;
+	}
+	if (hb_ms) {
+		custom_data->hb_ms = hb_ms;
+		custom_data->last_send_ms = monotonic_ms();
+		custom_data->heartbeat.cb = heartbeat_cb;
+		timers.add(&custom_data->heartbeat, hb_ms);
+	}
+	custom_data->add_string(state);
+	if (!custom_data->streaming) {
+		start_client(client, false);
+		return true;
+	}
+	if (!custom_data->writeout()) {
+		free_client(client);
+		return true;
+	}
+	join_group(client);
+	return true;
+}
+
+// Until a HELLO was processed, inbound data is the HELLO line. Anything else
+// closes the connection.
+void client_read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
+	Client_Data *custom_data = (Client_Data *)watcher->data;
+	if (!(EV_ERROR & revents) && !custom_data->hello_done) {
+		int rc = custom_data->read_line();
+		if (rc == 0) {
+			return;
+		}
+		if (rc == 1 && process_hello(watcher)) {
+			return;
+		}
+	}
+	read_cb(loop, watcher, revents);
+}
+
+void tls_timeout_cb(Timer_Wheel_Entry *e) {
+	struct ev_io *client = (struct ev_io *)e->data;
+	Client_Data *custom_data = (Client_Data *)client->data;
+	proxy_error("TLS handshake with client %s timed out", custom_data->ip);
+	drop_client(client);
+}
+
+void tls_handshake_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
+	static bool ktls_fallback_logged = false;
+	Client_Data *custom_data = (Client_Data *)watcher->data;
+	if (EV_ERROR & revents) {
+		drop_client(watcher);
+		return;
+	}
+	std::string err;
+	int rc = tls_accept(custom_data->ssl, err);
+	if (rc == TLS_HANDSHAKE_WANT_READ || rc == TLS_HANDSHAKE_WANT_WRITE) {
+		int new_events = (rc == TLS_HANDSHAKE_WANT_READ ? EV_READ : EV_WRITE);
+		if (new_events != watcher->events) {
+			ev_io_stop(loop, watcher);
+			ev_io_set(watcher, watcher->fd, new_events);
+			ev_io_start(loop, watcher);
+		}
+		return;
+	}
+	if (rc == TLS_HANDSHAKE_ERROR) {
+		proxy_error("TLS handshake with client %s failed: %s", custom_data->ip, err.c_str());
+		drop_client(watcher);
+		return;
+	}
+
+	custom_data->tls_handshake = false;
+	timers.remove(&custom_data->deadline);
+	custom_data->ktls = tls_ktls_send(custom_data->ssl);
+	if (!custom_data->ktls && !ktls_fallback_logged) {
+		proxy_info("Kernel TLS offload not available for client %s, encrypting in userspace", custom_data->ip);
+		ktls_fallback_logged = true;
+	}
+	if (watcher->events != EV_READ) {
+		ev_io_stop(loop, watcher);
+		ev_io_set(watcher, watcher->fd, EV_READ);
+		ev_io_start(loop, watcher);
+	}
+	client_connected(watcher);
+}
+
 void io_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
-	if ((EV_READ & revents) || (EV_ERROR & revents)) {
-		read_cb(loop, watcher, revents);
+	Client_Data *custom_data = (Client_Data *)watcher->data;
+	if (custom_data->tls_handshake) {
+		tls_handshake_cb(loop, watcher, revents);
+	} else if ((EV_READ & revents) || (EV_ERROR & revents)) {
+		client_read_cb(loop, watcher, revents);
 	} else if (EV_WRITE & revents) {
 		write_cb(loop, watcher, revents);
 	}
 }
 
+// Lets the kernel notice peers that vanished without a FIN: keepalive probes
+// on an idle connection, and TCP_USER_TIMEOUT for data left unacknowledged.
+void set_keepalive(int fd) {
+	if (!keepalive_sec) {
+		return;
+	}
+	int on = 1;
+	int idle = keepalive_sec;
+	int intvl = keepalive_sec >= 3 ? keepalive_sec / 3 : 1;
+	int cnt = 3;
+	unsigned int user_timeout = keepalive_sec * 1000;
+	if (
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ||
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) ||
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl)) ||
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt)) ||
+		setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout))
+	) {
+		proxy_error("failed to set keepalive on client FD %d: %s", fd, strerror(errno));
+	}
+}
+
 void accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
     typedef union {
 		struct sockaddr_in in;
@@ -464,7 +1224,12 @@ void accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
 		return;
 	}
 	ioctl_FIONBIO(client_sd,1);
+	set_keepalive(client_sd);
 	Client_Data * custom_data = new Client_Data(client);
+	Listener *l = (Listener *)watcher->data;
+	custom_data->freq_ms = l->freq_ms;
+	custom_data->batching = l->batching;
+	custom_data->netbuf_limit = l->max_netbuflen;
 	struct sockaddr *addr = (struct sockaddr *)&client_addr;
 	switch (addr->sa_family) {
 		case AF_INET: {
@@ -485,142 +1250,718 @@ void accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
 	client->data = (void *)custom_data;
 	ev_io_init(client, io_cb, client_sd, EV_READ);
 	ev_io_start(loop, client);
-	pthread_mutex_lock(&pos_mutex);
-	std::string s1 = position_to_string(curpos);
-	pthread_mutex_unlock(&pos_mutex);
-	custom_data->add_string("ST=" + s1 + "\n");
-	if (custom_data->writeout()) {
-		//proxy_info("Adding client with FD %d", client->fd);
-		Clients.push_back(client);
-	} else {
-		proxy_error("Error accepting client with FD %d", client->fd);
-		delete custom_data;
-		free(client);
+	if (tls_ctx.is_enabled()) {
+		// The initial state is sent once the handshake completes.
+		custom_data->ssl = tls_ctx.new_session(client_sd);
+		if (custom_data->ssl == NULL) {
+			proxy_error("Failed to create TLS session for client %s: %s", custom_data->ip, tls_last_error().c_str());
+			drop_client(client);
+			return;
+		}
+		custom_data->tls_handshake = true;
+		custom_data->deadline.cb = tls_timeout_cb;
+		timers.add(&custom_data->deadline, TLS_HANDSHAKE_TIMEOUT_SEC * 1000);
+		tls_handshake_cb(loop, client, EV_READ);
+		return;
 	}
+	client_connected(client);
 }
 
-void write_clients() {
-	pthread_mutex_lock(&pos_mutex);
+// Publishes the pending updates to the shared-memory region, folding runs of
+// consecutive trxids into one interval. Called with pos_mutex held.
+void publish_shm_updates() {
+	std::vector<char *>::size_type i = 0;
+	while (i < server_uuids.size()) {
+		std::vector<char *>::size_type j = i + 1;
+		while (j < server_uuids.size() && trx_ids.at(j) == trx_ids.at(j-1) + 1 && !strcmp(server_uuids.at(j), server_uuids.at(i))) {
+			j++;
+		}
+		shm_writer.publish_update(server_uuids.at(i), trx_ids.at(i), trx_ids.at(j-1));
+		i = j;
+	}
+	if (shm_writer.snapshot_due()) {
+		if (!shm_writer.publish_snapshot(gtid_set_to_string(curpos))) {
+			proxy_error("failed to publish GTID snapshot to %s: %s", shm_path, strerror(errno));
+		}
+	}
+}
 
-	std::vector<struct ev_io *> to_remove;
-	GTID_Set gtid_set;
+// Encodes a group's pending updates once and queues them to every member.
+void flush_group(Flush_Group *g) {
+	std::string out;
+	if (g->reset) {
+		// A client joined: restart I2/I4 and the binary UUID table.
+		g->enc.set_proto(g->proto);
+		g->reset = false;
+	}
+	if (g->batching) {
+		// Group updates into a single I3/I4 message per server.
+		for (auto mit = g->pending_set.map.begin(); mit != g->pending_set.map.end(); mit++) {
+			for (auto it = mit->second.begin(); it != mit->second.end(); it++) {
+				g->enc.update(out, mit->first, *it);
+			}
+		}
+		g->pending_set.map.clear();
+	} else {
+		// Generate a I1/I2 message per update per server.
+		for (std::vector<std::pair<std::string, uint64_t>>::size_type i=0; i<g->pending.size(); i++) {
+			g->enc.update(out, g->pending[i].first, g->pending[i].second);
+		}
+		g->pending.clear();
+	}
+	if (out.empty()) {
+		return;
+	}
 
-	for (std::vector<struct ev_io *>::iterator it=Clients.begin(); it!=Clients.end(); ++it) {
+	std::vector<struct ev_io *> to_remove;
+	for (std::vector<struct ev_io *>::iterator it=g->clients.begin(); it!=g->clients.end(); ++it) {
 		struct ev_io *w = *it;
 		Client_Data * custom_data = (Client_Data *)w->data;
 
-		if (!update_batching) {
-		    // Generate a I1/I2 message per update per server.
-		    for (std::vector<char *>::size_type i=0; i<server_uuids.size(); i++) {
-				if (custom_data->uuid_server[0]==0 || strncmp(custom_data->uuid_server, server_uuids.at(i), strlen(server_uuids.at(i)))) {
-				    strncpy(custom_data->uuid_server,server_uuids.at(i), UUID_SIZE_BYTES);
-					custom_data->add_string("I1=" + std::string(server_uuids.at(i)) + ":" + std::to_string(trx_ids.at(i)) + "\n");
-				} else {
-				    custom_data->add_string("I2=" + std::to_string(trx_ids.at(i)) + "\n");
-				}
-			}
-	    } else {
-	        // Group updates into a single I3/I4 message per server.
-			gtid_set.clear();
-			for (std::vector<char *>::size_type i=0; i<server_uuids.size(); i++) {
-			    gtid_set.add(server_uuids.at(i), trx_ids.at(i));
-			}
-
-			for (auto mit = gtid_set.map.begin(); mit != gtid_set.map.end(); mit++) {
-			    auto uuid = mit->first;
-				auto gtid_sets = mit->second;
-				for (auto it = gtid_sets.begin(); it != gtid_sets.end(); it++) {
-					if (custom_data->uuid_server[0]==0 || strncmp(custom_data->uuid_server, uuid.c_str(), uuid.size())) {
-	                    strncpy(custom_data->uuid_server, uuid.c_str(), UUID_SIZE_BYTES);
-					    custom_data->add_string("I3=" + uuid + ":" + it->to_string() + "\n");
-					} else {
-				        custom_data->add_string("I4=" + it->to_string() + "\n");
-					}
-				}
-			}
-		}
+		custom_data->add_string(out);
 
 		if (!custom_data->writeout()) {
-			delete custom_data;
 			to_remove.push_back(w);
 		} else {
 			// Close connection if the write queue grows too big.
-			if (custom_data->size > max_netbuflen) {
-				proxy_error("network write buffer grew too big (%zu/%zu bytes, max %zu)", custom_data->size, custom_data->max_len, max_netbuflen);
+			if (custom_data->size > custom_data->netbuf_limit) {
+				proxy_error("network write buffer grew too big (%zu/%zu bytes, max %zu)", custom_data->size, custom_data->max_len, custom_data->netbuf_limit);
 				ev_io_stop(loop,w);
 				shutdown(w->fd,SHUT_RDWR);
 				close(w->fd);
-				delete custom_data;
 				to_remove.push_back(w);
 			}
 		}
 	}
+	// Deleting the last member deletes the group too.
 	for (std::vector<struct ev_io *>::iterator it=to_remove.begin(); it!=to_remove.end(); ++it) {
 		struct ev_io *w = *it;
-		std::vector<struct ev_io *>::iterator it2 = find(Clients.begin(), Clients.end(), w);
-		if (it2 != Clients.end()) {
-			Clients.erase(it2);
-			free(w);
+		delete (Client_Data *)w->data;
+		free(w);
+	}
+}
+
+// Takes the GTIDs queued since the last call, publishing them to -S first.
+// Called with pos_mutex held.
+void take_queued_gtids(std::vector<char *>& uuids, std::vector<uint64_t>& trxids) {
+	if (shm_writer.is_open()) {
+		publish_shm_updates();
+	}
+	uuids.swap(server_uuids);
+	trxids.swap(trx_ids);
+}
+
+// Adds GTIDs taken from the queue to every flush group, and flushes the
+// groups without a flush frequency.
+void add_to_groups(std::vector<char *>& uuids, std::vector<uint64_t>& trxids) {
+	if (!uuids.empty()) {
+		// Flushing may delete groups.
+		std::vector<Flush_Group *> groups(Groups);
+		for (std::vector<Flush_Group *>::iterator it=groups.begin(); it!=groups.end(); ++it) {
+			Flush_Group *g = *it;
+			for (std::vector<char *>::size_type i=0; i<uuids.size(); i++) {
+				g->add(uuids.at(i), trxids.at(i));
+			}
+			if (g->freq_ms == 0) {
+				flush_group(g);
+			}
 		}
 	}
-	for (std::vector<char *>::size_type i=0; i<server_uuids.size(); i++) {
-		free(server_uuids.at(i));
+	for (std::vector<char *>::size_type i=0; i<uuids.size(); i++) {
+		free(uuids.at(i));
 	}
-	server_uuids.clear();
-	trx_ids.clear();
+	return;
+}
 
+void write_clients() {
+	std::vector<char *> uuids;
+	std::vector<uint64_t> trxids;
+
+	pthread_mutex_lock(&pos_mutex);
+	take_queued_gtids(uuids, trxids);
 	pthread_mutex_unlock(&pos_mutex);
-	return;
+
+	add_to_groups(uuids, trxids);
 }
 
-void async_cb(struct ev_loop *loop, struct ev_async *watcher, int revents) {
-	write_clients();
-	return;
+// Opens the shared-memory region (-S) with the current state as its snapshot.
+// Reopening it tells consumers to take the new snapshot.
+void open_shm() {
+	pthread_mutex_lock(&pos_mutex);
+	std::string s = gtid_set_to_string(curpos);
+	pthread_mutex_unlock(&pos_mutex);
+	if (shm_writer.open(shm_path) && shm_writer.publish_snapshot(s)) {
+		shm_writer.publish_stale(state_stale);
+		proxy_info("Publishing GTID state to %s", shm_path);
+	} else {
+		proxy_error("failed to create shared-memory region %s: %s", shm_path, strerror(errno));
+	}
 }
 
-void timer_cb(struct ev_loop *loop, struct ev_timer *t, int revents) {
-	write_clients();
-	return;
+// Closes every streaming client; they reconnect and get the current state.
+void drop_streaming_clients() {
+	std::vector<struct ev_io *> clients;
+	for (std::vector<Flush_Group *>::iterator it = Groups.begin(); it != Groups.end(); ++it) {
+		clients.insert(clients.end(), (*it)->clients.begin(), (*it)->clients.end());
+	}
+	for (std::vector<struct ev_io *>::iterator it = clients.begin(); it != clients.end(); ++it) {
+		drop_client(*it);
+	}
+	proxy_info("Closed %zu clients to resend them the GTID state", clients.size());
 }
 
-static void sigint_cb (struct ev_loop *loop, ev_signal *w, int revents) {
+void async_cb(struct ev_loop *loop, struct ev_async *watcher, int revents) {
+	if (clients_reset_pending.exchange(false)) {
+		// The restored state was discarded for the source's set.
+		if (shm_writer.is_open()) {
+			open_shm();
+		}
+		drop_streaming_clients();
+	}
+	write_clients();
+	return;
+}
+
+// Restores the state saved by a previous run (-C), to be served until the
+// source is reached. Called before any thread or loop runs.
+void load_checkpoint() {
+	std::string set;
+	int64_t written_ms = 0;
+	if (!checkpoint.open(checkpoint_path, set, written_ms)) {
+		proxy_error("failed to open GTID checkpoint %s: %s", checkpoint_path, strerror(errno));
+		return;
+	}
+	if (state_restored) {
+		// The state handed over is newer.
+		return;
+	}
+	GTID_Set parsed;
+	if (set.empty() || !gtid_wire_parse_set(set, parsed)) {
+		proxy_info("No GTID checkpoint in %s yet", checkpoint_path);
+		return;
+	}
+	curpos.parseGtid(set);
+	state_restored = true;
+	state_stale = true;
+	proxy_info("Serving the GTID checkpoint from %s, written %ld ms ago, until the source is reached: '%s'", checkpoint_path, long(realtime_ms() - written_ms), set.c_str());
+	if (shm_path) {
+		open_shm();
+	}
+	startup.mark("checkpoint");
+}
+
+// In a process exec'd by SIGUSR2: takes over the state, the listening
+// sockets and the clients of the previous one (see send_handoff()). The
+// clients are adopted once the listeners start. Called before any thread or
+// loop runs.
+void receive_handoff() {
+	pid_t donor = -1;
+	size_t nlisteners = 0;
+	bool done = false;
+	std::string payload;
+	std::vector<int> fds;
+	while (!done && handoff_recv(handoff_fd, payload, fds)) {
+		Handoff_Reader r(payload);
+		uint64_t type = 0;
+		r.get_u64(type);
+		if (type == HANDOFF_STATE) {
+			uint64_t donor_pid;
+			std::string set;
+			GTID_Set parsed;
+			if (r.get_u64(donor_pid) && r.get_str(set)) {
+				donor = pid_t(donor_pid);
+				if (!set.empty() && gtid_wire_parse_set(set, parsed)) {
+					curpos.parseGtid(set);
+					state_restored = true;
+					state_stale = true;
+				}
+			}
+		} else if (type == HANDOFF_LISTENER && fds.size() == 1) {
+			uint64_t port;
+			if (r.get_u64(port)) {
+				for (std::vector<Listener *>::iterator it = Listeners.begin(); it != Listeners.end(); ++it) {
+					if ((*it)->port == port && (*it)->sd < 0) {
+						(*it)->sd = fds[0];
+						fds.clear();
+						nlisteners++;
+						break;
+					}
+				}
+			}
+		} else if (type == HANDOFF_CLIENT && fds.size() == 1) {
+			Handoff_Client hc;
+			if (r.get_str(hc.ip) && r.get_u64(hc.proto) && r.get_u64(hc.freq_ms) && r.get_u64(hc.batching)
+			    && r.get_u64(hc.netbuf_limit) && r.get_u64(hc.hb_ms) && r.get_u64(hc.zlevel)
+			    && r.get_u64(hc.hello_done) && r.get_str(hc.inbuf) && r.get_str(hc.pending)) {
+				hc.fd = fds[0];
+				fds.clear();
+				handoff_clients.push_back(hc);
+			}
+		} else if (type == HANDOFF_END) {
+			done = true;
+		}
+		// Listeners no longer configured, malformed records.
+		for (std::vector<int>::iterator it = fds.begin(); it != fds.end(); ++it) {
+			close(*it);
+		}
+	}
+	if (!done) {
+		proxy_error("The handoff from the previous process ended early: %s", errno ? strerror(errno) : "connection closed");
+	}
+	close(handoff_fd);
+	handoff_fd = -1;
+	if (donor > 0) {
+		waitpid(donor, NULL, 0);
+	}
+	if (state_restored) {
+		pthread_mutex_lock(&pos_mutex);
+		std::string s1 = gtid_set_to_string(curpos);
+		pthread_mutex_unlock(&pos_mutex);
+		proxy_info("Took over %zu listeners and %zu clients from the previous process, serving '%s' until the source is reached", nlisteners, handoff_clients.size(), s1.c_str());
+		if (shm_path) {
+			open_shm();
+		}
+	}
+	startup.mark("handoff");
+}
+
+// Resumes streaming to the clients taken over by receive_handoff(), from
+// where the previous process left them.
+void adopt_handoff_clients() {
+	for (std::vector<Handoff_Client>::iterator it = handoff_clients.begin(); it != handoff_clients.end(); ++it) {
+		struct ev_io *client = (struct ev_io *)malloc(sizeof(struct ev_io));
+		Client_Data *custom_data = new Client_Data(client);
+		free(custom_data->ip);
+		custom_data->ip = strdup(it->ip.c_str());
+		custom_data->freq_ms = it->freq_ms;
+		custom_data->batching = it->batching != 0;
+		custom_data->netbuf_limit = it->netbuf_limit;
+		custom_data->hello_done = it->hello_done != 0;
+		custom_data->inbuf = it->inbuf;
+		custom_data->enc.set_proto(int(it->proto));
+		custom_data->append(it->pending.data(), it->pending.size());
+		client->data = (void *)custom_data;
+		ev_io_init(client, io_cb, it->fd, EV_READ);
+		ev_io_start(loop, client);
+		if (it->zlevel && !custom_data->z.resume(int(it->zlevel))) {
+			proxy_error("failed to resume compression for client %s", custom_data->ip);
+			drop_client(client);
+			continue;
+		}
+		custom_data->zlevel = int(it->zlevel);
+		if (it->hb_ms) {
+			custom_data->hb_ms = it->hb_ms;
+			custom_data->last_send_ms = monotonic_ms();
+			custom_data->heartbeat.cb = heartbeat_cb;
+			timers.add(&custom_data->heartbeat, it->hb_ms);
+		}
+		custom_data->streaming = true;
+		if (!custom_data->writeout()) {
+			free_client(client);
+			continue;
+		}
+		// Joining resets the group's encoding, as for any newcomer.
+		join_group(client);
+	}
+	if (!handoff_clients.empty()) {
+		startup.finish("clients");
+	}
+	handoff_clients.clear();
+}
+
+// Saves the executed set (-C); unchanged sets are not rewritten.
+void write_checkpoint() {
+	pthread_mutex_lock(&pos_mutex);
+	std::string s = gtid_set_to_string(curpos);
+	pthread_mutex_unlock(&pos_mutex);
+	if (s.empty()) {
+		// The source was not reached yet.
+		return;
+	}
+	if (!checkpoint.write(s)) {
+		proxy_error("failed to write GTID checkpoint %s: %s", checkpoint_path, strerror(errno));
+	}
+}
+
+// With a restored state served (-C checkpoint or handoff), once the source
+// is reached: a state the source has executed all of is kept, the dump
+// catches up from it, and it stays stale until the stream covers the
+// source's set. A state with GTIDs the source lacks (it was rebuilt, or another server answers)
+// is discarded for the source's set, and the clients it was served to are
+// closed; so is a state the source cannot dump from: one lacking GTIDs of
+// 'purged', whose binlogs the source no longer has (the reader was down
+// past their expiry, or the source was restored with SET GTID_PURGED), or
+// one the source already refused. Returns the position to dump from.
+slave::Position adopt_source_state(slave::Position source, slave::Position purged) {
+	GTID_Set source_set = position_to_gtid_set(source);
+	GTID_Set missing;
+	GTID_Set unpurged;
+	const char *why = NULL;
+	pthread_mutex_lock(&pos_mutex);
+	const GTID_Set restored = position_to_gtid_set(curpos);
+	if (restored_state_refused) {
+		why = "the source refused to dump from it";
+		restored_state_refused = false;
+	} else if (!gtid_wire_set_diff(source_set, restored, missing)) {
+		why = "it has transactions the source has not executed";
+	} else if (!gtid_wire_set_diff(restored, position_to_gtid_set(purged), unpurged)) {
+		why = "it lacks transactions the source has purged the binlogs of";
+	}
+	if (!why) {
+		catchup_target = source_set;
+		catchup_pending = true;
+		slave::Position from = curpos;
+		pthread_mutex_unlock(&pos_mutex);
+		if (missing.map.empty()) {
+			proxy_info("The source has executed the restored GTID state and nothing more");
+		} else {
+			proxy_info("The source has executed the restored GTID state, catching up on '%s'", missing.to_string().c_str());
+		}
+		return from;
+	}
+	curpos = source;
+	pthread_mutex_unlock(&pos_mutex);
+	state_stale = false;
+	proxy_error("Discarding the restored GTID state for the source's set: %s", why);
+	clients_reset_pending = true;
+	ev_async_send(loop, &async);
+	return source;
+}
+
+// On a dump error: true when it is the source refusing to dump from the
+// restored state, still being caught up from, because it no longer has the
+// binlogs (ER_MASTER_FATAL_ERROR_READING_BINLOG). The state is then to be
+// discarded once the source is reached again.
+bool restored_state_refused_by(unsigned int code) {
+	if (code != ER_MASTER_FATAL_ERROR_READING_BINLOG) {
+		return false;
+	}
+	bool refused = false;
+	pthread_mutex_lock(&pos_mutex);
+	if (catchup_pending || restored_state_refused) {
+		catchup_pending = false;
+		catchup_target.clear();
+		restored_state_refused = true;
+		refused = true;
+	}
+	pthread_mutex_unlock(&pos_mutex);
+	return refused;
+}
+
+// Clears the stale mark once the stream covers what the source had executed
+// when it was reached.
+void check_caught_up() {
+	bool caught_up = false;
+	pthread_mutex_lock(&pos_mutex);
+	if (catchup_pending) {
+		GTID_Set newer;
+		caught_up = gtid_wire_set_diff(position_to_gtid_set(curpos), catchup_target, newer);
+		if (caught_up) {
+			catchup_pending = false;
+			catchup_target.clear();
+		}
+	}
+	pthread_mutex_unlock(&pos_mutex);
+	if (caught_up) {
+		state_stale = false;
+		shm_writer.publish_stale(false);
+		proxy_info("Caught up with the source %.1fms after start, the GTID state is current", (monotonic_ns() - startup.start_ns) / 1e6);
+	}
+}
+
+// Runs in the forked copy of hand_over(): passes the GTID state, the
+// listening sockets and the streaming clients with their queued data to the
+// new process on 'sock'. TLS sessions cannot be moved: those clients, and
+// those still in their handshake or -w wait, are closed when the copy exits.
+// It only reads the state and sends descriptors: the client sockets are
+// shared with the parent, which keeps serving them if the exec fails.
+// Nothing is logged here, as another thread may have held the stdio lock
+// when the process forked.
+bool send_handoff(int sock) {
+	const std::vector<int> no_fds;
+	Handoff_Writer st;
+	st.put_u64(HANDOFF_STATE);
+	st.put_u64(getpid());
+	st.put_str(gtid_set_to_string(curpos));
+	if (!handoff_send(sock, st.data, no_fds)) {
+		return false;
+	}
+	for (std::vector<Listener *>::iterator it = Listeners.begin(); it != Listeners.end(); ++it) {
+		if ((*it)->sd < 0) {
+			continue;
+		}
+		Handoff_Writer w;
+		w.put_u64(HANDOFF_LISTENER);
+		w.put_u64((*it)->port);
+		if (!handoff_send(sock, w.data, std::vector<int>(1, (*it)->sd))) {
+			return false;
+		}
+	}
+	for (std::vector<Flush_Group *>::iterator git = Groups.begin(); git != Groups.end(); ++git) {
+		for (std::vector<struct ev_io *>::iterator it = (*git)->clients.begin(); it != (*git)->clients.end(); ++it) {
+			Client_Data *custom_data = (Client_Data *)(*it)->data;
+			if (custom_data->ssl) {
+				continue;
+			}
+			Handoff_Writer w;
+			w.put_u64(HANDOFF_CLIENT);
+			w.put_str(custom_data->ip);
+			w.put_u64(custom_data->enc.get_proto());
+			w.put_u64(custom_data->freq_ms);
+			w.put_u64(custom_data->batching);
+			w.put_u64(custom_data->netbuf_limit);
+			w.put_u64(custom_data->hb_ms);
+			w.put_u64(custom_data->z.is_active() ? custom_data->zlevel : 0);
+			w.put_u64(custom_data->hello_done);
+			w.put_str(custom_data->inbuf);
+			w.put_str(custom_data->data + custom_data->pos, custom_data->len - custom_data->pos);
+			if (!handoff_send(sock, w.data, std::vector<int>(1, (*it)->fd))) {
+				return false;
+			}
+		}
+	}
+	Handoff_Writer end;
+	end.put_u64(HANDOFF_END);
+	return handoff_send(sock, end.data, no_fds);
+}
+
+// Marks every descriptor above stderr but 'keep' to be closed on exec.
+void set_cloexec_all(int keep) {
+	DIR *d = opendir("/proc/self/fd");
+	if (d == NULL) {
+		const long max_fd = sysconf(_SC_OPEN_MAX);
+		for (int fd = 3; fd < max_fd; fd++) {
+			if (fd != keep) {
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+			}
+		}
+		return;
+	}
+	while (struct dirent *e = readdir(d)) {
+		int fd = atoi(e->d_name);
+		if (fd > 2 && fd != keep) {
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	closedir(d);
+}
+
+// SIGUSR2: replaces this process with the binary at 'exe_path', usually an
+// upgraded one, without closing the clients. A forked copy hands the
+// listeners, the clients and the state over to it (send_handoff()), so
+// the pid stays the same for the angel or the service manager. The new
+// process reconnects to the source and resumes from the handed-over set.
+void hand_over() {
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+		proxy_error("Cannot hand over to a new process: socketpair: %s", strerror(errno));
+		return;
+	}
+	size_t nclients = 0;
+	for (std::vector<Flush_Group *>::iterator it = Groups.begin(); it != Groups.end(); ++it) {
+		nclients += (*it)->clients.size();
+	}
+	proxy_info("Handing over the listeners and %zu clients to a new process running %s", nclients, exe_path);
+	// Queued GTIDs are part of 'curpos': the clients are sent them, and
+	// every pending update, before the copy takes the state, and no GTID
+	// is queued in between.
+	pthread_mutex_lock(&pos_mutex);
+	std::vector<char *> uuids;
+	std::vector<uint64_t> trxids;
+	take_queued_gtids(uuids, trxids);
+	add_to_groups(uuids, trxids);
+	std::vector<Flush_Group *> groups(Groups);
+	for (std::vector<Flush_Group *>::iterator it = groups.begin(); it != groups.end(); ++it) {
+		flush_group(*it);
+	}
+	pid_t donor = fork();
+	if (donor == 0) {
+		pthread_mutex_unlock(&pos_mutex);
+		close(sv[0]);
+		handoff_donor = true;
+		_exit(send_handoff(sv[1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	pthread_mutex_unlock(&pos_mutex);
+	close(sv[1]);
+	if (donor < 0) {
+		proxy_error("Cannot hand over to a new process: fork: %s", strerror(errno));
+		close(sv[0]);
+		return;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	// The new process gets the sockets from the copy; nothing else is kept.
+	set_cloexec_all(sv[0]);
+	fcntl(sv[0], F_SETFD, 0);
+	setenv(HANDOFF_FD_ENV, std::to_string(sv[0]).c_str(), 1);
+	// exec resets the handler, and the default action kills the process with
+	// the clients it takes over: a SIGUSR2 stays pending until the new one
+	// starts its watchers (GTID_Server_Dumper).
+	sigset_t usr2;
+	sigemptyset(&usr2);
+	sigaddset(&usr2, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &usr2, NULL);
+	execv(exe_path, exec_argv.data());
+	// Still serving: the copy has not written to any client, and the
+	// clients have all the updates flushed above.
+	int myerr = errno;
+	pthread_sigmask(SIG_UNBLOCK, &usr2, NULL);
+	unsetenv(HANDOFF_FD_ENV);
+	kill(donor, SIGKILL);
+	waitpid(donor, NULL, 0);
+	close(sv[0]);
+	proxy_error("Cannot hand over to a new process: exec %s: %s", exe_path, strerror(myerr));
+}
+
+void group_timer_cb(struct ev_loop *loop, struct ev_timer *t, int revents) {
+	flush_group((Flush_Group *)t->data);
+	return;
+}
+
+// Wall clock of the last data from the source, heartbeats included, in
+// milliseconds; 0 before the first.
+int64_t source_last_event_ms() {
+	if (native_client) {
+		return native_client->last_event_ms();
+	}
+	if (binlog_tail) {
+		return binlog_tail->last_event_ms();
+	}
+	return sl ? sl->lastEventTime() : 0;
+}
+
+void log_heartbeat_config() {
+	if (source_heartbeat_ms) {
+		proxy_info("Source heartbeat every %ums, reconnecting after %ums without data", source_heartbeat_ms, source_heartbeat_ms * HEARTBEAT_STALL_PERIODS);
+	} else {
+		proxy_info("Source heartbeats disabled");
+	}
+}
+
+void log_source_stats() {
+	const int64_t last = source_last_event_ms();
+	if (last == 0) {
+		proxy_info("binlog stream: nothing received from the source yet");
+	} else {
+		proxy_info("binlog stream: last event %ld ms ago", long(realtime_ms() - last));
+	}
+}
+
+void wheel_cb(struct ev_loop *loop, struct ev_timer *t, int revents) {
+	const uint64_t now = monotonic_ms();
+	timers.advance(now);
+	if (shm_writer.is_open()) {
+		shm_writer.publish_source_event_time(source_last_event_ms());
+	}
+	if (state_stale) {
+		check_caught_up();
+	}
+	if (checkpoint.is_open() && now >= next_checkpoint_ms) {
+		next_checkpoint_ms = now + CHECKPOINT_INTERVAL_MS;
+		write_checkpoint();
+	}
+}
+
+static void sigusr1_cb (struct ev_loop *loop, ev_signal *w, int revents) {
+	log_source_stats();
+	log_deflate_stats();
+}
+
+static void sigusr2_cb (struct ev_loop *loop, ev_signal *w, int revents) {
+	hand_over();
+}
+
+// Stops the server loop, saving the state.
+static void stop_server(struct ev_loop *loop, const char *why) {
 	stopflag = 1;
-	sl->close_connection();
+	if (sl) {
+		sl->close_connection();
+	}
+	if (native_client) {
+		native_client->stop();
+	}
+	if (binlog_tail) {
+		binlog_tail->stop();
+	}
 	//std::cout << " Received signal. Stopping at:" << std::endl;
 	std::string s1 = position_to_string(curpos);
 	//std::cout << s1 << std::endl;
-	proxy_info("Received signal. Stopping at: %s", s1.c_str());
+	proxy_info("%s. Stopping at: %s", why, s1.c_str());
+	log_deflate_stats();
+	if (checkpoint.is_open()) {
+		write_checkpoint();
+		checkpoint.close();
+	}
+	shm_writer.close();
 	ev_break(loop, EVBREAK_ALL);
 }
 
+static void sigint_cb (struct ev_loop *loop, ev_signal *w, int revents) {
+	stop_server(loop, "Received signal");
+}
+
+// Opens the listening socket of 'l'. False with errno set on failure.
+bool open_listener(Listener *l) {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	l->sd = socket(PF_INET, SOCK_STREAM, 0);
+	if (l->sd < 0) {
+		return false;
+	}
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(l->port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+	int arg_on = 1;
+	if (setsockopt(l->sd, SOL_SOCKET, SO_REUSEADDR, (char *)&arg_on, sizeof(arg_on)) == -1
+	    || bind(l->sd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+	    || listen(l->sd, 30) != 0) {
+		int myerr = errno;
+		close(l->sd);
+		l->sd = -1;
+		errno = myerr;
+		return false;
+	}
+	ioctl_FIONBIO(l->sd,1);
+	return true;
+}
+
+// Opens the sockets of all the listeners not open yet. Returns the port that
+// failed, with errno set, or 0.
+unsigned int open_listeners() {
+	for (std::vector<Listener *>::iterator it = Listeners.begin(); it != Listeners.end(); ++it) {
+		if ((*it)->sd < 0 && !open_listener(*it)) {
+			return (*it)->port;
+		}
+	}
+	return 0;
+}
+
+// Starts accepting on the server loop; clients get 'curpos' as their
+// initial state, so it must be set first. Sockets the angel opened are
+// inherited, and clients that connected meanwhile wait in their backlog.
+void start_listeners() {
+	unsigned int failed_port = open_listeners();
+	if (failed_port) {
+		proxy_error("Could not listen on port %u: %s", failed_port, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	for (std::vector<Listener *>::iterator it = Listeners.begin(); it != Listeners.end(); ++it) {
+		Listener *l = *it;
+		ev_io_init(&l->ev_accept, accept_cb, l->sd, EV_READ);
+		l->ev_accept.data = l;
+		ev_io_start(loop, &l->ev_accept);
+		proxy_info("Listening on port %u: %s updates every %lums by default, max network buffer %zu bytes", l->port, l->batching ? "batched" : "non-batched", l->freq_ms, l->max_netbuflen);
+	}
+	startup.mark("listeners");
+	adopt_handoff_clients();
+}
+
 class GTID_Server_Dumper {
 	private:
-	struct sockaddr_in addr;
-	int sd;
-	int port;
-	struct ev_io ev_accept;
 	struct ev_loop *my_loop;
-	struct ev_timer timer;
+	struct ev_timer wheel_timer;
 	public:
-	GTID_Server_Dumper(int _port) {
-		port = _port;
-		sd = socket(PF_INET, SOCK_STREAM, 0);
-		addr.sin_family = AF_INET;
-		addr.sin_port = htons(port);
-		addr.sin_addr.s_addr = INADDR_ANY;
-		int arg_on = 1;
-		if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (char *)&arg_on, sizeof(arg_on)) == -1) {
-			perror("setsocketopt()");
-			close(sd);
-			exit(EXIT_FAILURE);
-		}
-
-		if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
-			perror("bind");
-			exit(EXIT_FAILURE);
-		}
-		ioctl_FIONBIO(sd,1);
-		listen(sd,30);
+	GTID_Server_Dumper() {
 		//struct ev_loop *my_loop = NULL;
 		my_loop = NULL;
 		my_loop = ev_loop_new (EVBACKEND_POLL | EVFLAG_NOENV);
@@ -629,48 +1970,269 @@ class GTID_Server_Dumper {
 			fprintf(stderr,"could not initialise new loop");
 			exit(EXIT_FAILURE);
 		}
-		ev_io_init(&ev_accept, accept_cb, sd, EV_READ);
-		ev_io_start(my_loop, &ev_accept);
-		if (update_freq_ms) {
-			proxy_info("Pushing %s updates every %lums", update_batching ? "batched" : "non-batched", update_freq_ms);
-			ev_timer_init(&timer, timer_cb, update_freq_ms / 1000.0, update_freq_ms / 1000.0);
-			ev_timer_start(my_loop, &timer);
+		if (native_client || binlog_tail) {
+			// Listeners open once the client has the source's executed set,
+			// or right away to serve a restored state.
+			if (native_client) {
+				native_client->start(my_loop);
+			} else {
+				binlog_tail->start(my_loop);
+			}
+			if (state_restored) {
+				start_listeners();
+			}
 		} else {
-			ev_async_init(&async, async_cb);
-			ev_async_start(my_loop, &async);
+			start_listeners();
 		}
+		timers.start(monotonic_ms());
+		ev_timer_init(&wheel_timer, wheel_cb, TIMER_WHEEL_TICK_MS / 1000.0, TIMER_WHEEL_TICK_MS / 1000.0);
+		ev_timer_start(my_loop, &wheel_timer);
+		ev_async_init(&async, async_cb);
+		ev_async_start(my_loop, &async);
 		ev_signal signal_watcher1;
 		ev_signal signal_watcher2;
+		ev_signal signal_watcher3;
+		ev_signal signal_watcher4;
 		ev_signal_init (&signal_watcher1, sigint_cb, SIGINT);
 		ev_signal_init (&signal_watcher2, sigint_cb, SIGTERM);
+		ev_signal_init (&signal_watcher3, sigusr1_cb, SIGUSR1);
+		ev_signal_init (&signal_watcher4, sigusr2_cb, SIGUSR2);
 		ev_signal_start (loop, &signal_watcher1);
 		ev_signal_start (loop, &signal_watcher2);
+		ev_signal_start (loop, &signal_watcher3);
+		ev_signal_start (loop, &signal_watcher4);
+		// Blocked by hand_over() in the previous process, if any.
+		sigset_t usr2;
+		sigemptyset(&usr2);
+		sigaddset(&usr2, SIGUSR2);
+		pthread_sigmask(SIG_UNBLOCK, &usr2, NULL);
 		ev_run(my_loop, 0);
 	}
 	~GTID_Server_Dumper() {
-		close(sd);
+		for (std::vector<Listener *>::iterator it = Listeners.begin(); it != Listeners.end(); ++it) {
+			close((*it)->sd);
+		}
 	}
 };
 
-void bench_xid_callback(unsigned int server_id) {
+// Queues 'count' GTIDs for write_clients() and adds them to 'curpos', under
+// one lock. Returns how many were queued: one that repeats the previous GTID
+// is dropped.
+size_t queue_gtids(const slave::gtid_t *gtids, size_t count) {
+	size_t queued = 0;
 	pthread_mutex_lock(&pos_mutex);
+	for (size_t i = 0; i < count; i++) {
+		const char *uuid=gtids[i].first.c_str();
+		uint64_t trx_id = gtids[i].second;
+		if (last_trx_id == trx_id && !strcmp(last_server_uuid, uuid)) {
+			// do nothing
+			continue;
+		}
 
-	const char *uuid=sl->gtid_next.first.c_str();
-	uint64_t trx_id = sl->gtid_next.second;
-	if (last_trx_id == trx_id && !strcmp(last_server_uuid, uuid)) {
-		// do nothing
-		pthread_mutex_unlock(&pos_mutex);
+		strcpy(last_server_uuid, uuid);
+		last_trx_id = trx_id;
+		server_uuids.push_back(strdup(uuid));
+		trx_ids.push_back(trx_id);
+		curpos.addGtid(gtids[i]);
+		queued++;
+	}
+	pthread_mutex_unlock(&pos_mutex);
+	return queued;
+}
+
+// libslave delivers the GTIDs of a read burst at once.
+void gtid_batch_callback(const slave::gtid_t *gtids, size_t count) {
+	if (!queue_gtids(gtids, count)) {
 		return;
 	}
+	// Clients pick their own flush frequency: hand the updates to the loop,
+	// which queues them to each flush group. One wakeup per batch.
+	ev_async_send(loop, &async);
+}
 
-	strcpy(last_server_uuid, uuid);
-	last_trx_id = trx_id;
-	server_uuids.push_back(strdup(uuid));
-	trx_ids.push_back(trx_id);
-	curpos.addGtid(sl->gtid_next);
+// Once the source's executed and purged sets are known: serves the first,
+// or, after a restored state, returns the set the stream continues from.
+slave::Position source_reached(const slave::Position& executed, const slave::Position& purged) {
+	slave::Position source = executed;
+	std::string s1 = position_to_string(source);
+	proxy_info("Last executed GTID: '%s'", s1.c_str());
+	if (state_restored) {
+		// The listeners are open already.
+		return adopt_source_state(source, purged);
+	}
+	pthread_mutex_lock(&pos_mutex);
+	curpos = executed;
 	pthread_mutex_unlock(&pos_mutex);
-	if (!update_freq_ms) {
-		ev_async_send(loop, &async);
+	if (shm_path) {
+		open_shm();
+	}
+	startup.mark("source");
+	start_listeners();
+	return source;
+}
+
+// Binlog_Client callbacks, on the server loop.
+void native_start_cb(Binlog_Client *c, const slave::Position& executed, const slave::Position& purged) {
+	// Polling reads no binlog: any restored state can be polled against.
+	c->set_executed(source_reached(executed, engine == ENGINE_POLL ? slave::Position() : purged));
+}
+
+void native_dump_error_cb(Binlog_Client *c, unsigned int code) {
+	if (restored_state_refused_by(code)) {
+		c->reread_source();
+	}
+}
+
+void native_gtid_cb(Binlog_Client *c, const std::string& sid, int64_t gno) {
+	const slave::gtid_t gtid(sid, gno);
+	queue_gtids(&gtid, 1);
+}
+
+// Once per read from the source: the GTIDs it carried go out together, with
+// no hop through the async watcher.
+void native_burst_cb(Binlog_Client *c) {
+	write_clients();
+}
+
+void native_log_cb(Binlog_Client *c, bool error, const std::string& msg) {
+	if (error) {
+		proxy_error("Replication client: %s", msg.c_str());
+	} else {
+		proxy_info("%s", msg.c_str());
+	}
+}
+
+// -E replay: from when replay_clients are streaming, or from the start, to
+// when every client was sent every GTID.
+ev_tstamp replay_started_at = 0;
+ev_tstamp replay_done_at = 0;
+double replay_thread_cpu = 0;
+double replay_process_cpu = 0;
+struct ev_timer replay_drain;
+
+double cpu_seconds(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void replay_start() {
+	replay_started_at = ev_time();
+	replay_thread_cpu = cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+	replay_process_cpu = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+// Clients that left, such as connection probes, do not count.
+void replay_client_ready() {
+	size_t streaming = 0;
+	for (std::vector<Flush_Group *>::iterator it = Groups.begin(); it != Groups.end(); ++it) {
+		streaming += (*it)->clients.size();
+	}
+	if (streaming >= replay_clients && binlog_tail) {
+		replay_waiting = false;
+		proxy_info("%zu clients are streaming, replaying", streaming);
+		replay_start();
+		binlog_tail->resume();
+	}
+}
+
+bool clients_drained() {
+	for (std::vector<Flush_Group *>::iterator it = Groups.begin(); it != Groups.end(); ++it) {
+		Flush_Group *g = *it;
+		if (!g->pending.empty() || !g->pending_set.map.empty()) {
+			return false;
+		}
+		for (std::vector<struct ev_io *>::iterator c = g->clients.begin(); c != g->clients.end(); ++c) {
+			if (((Client_Data *)(*c)->data)->len) {
+				return false;
+			}
+			// The socket's send queue too (SIOCOUTQ): exiting with data in it
+			// may reset the connection.
+			int unsent = 0;
+			if (ioctl((*c)->fd, TIOCOUTQ, &unsent) == 0 && unsent > 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Reads go on the loop thread's CPU time as "read and decode"; everything
+// else it spent, in write_clients() and in writing to the clients, as the
+// fan-out.
+void log_replay_stats() {
+	const Binlog_Tail_Stats& st = binlog_tail->get_stats();
+	const double wall = ev_time() - replay_started_at;
+	const double thread_cpu = cpu_seconds(CLOCK_THREAD_CPUTIME_ID) - replay_thread_cpu;
+	const double process_cpu = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID) - replay_process_cpu;
+	const double fanout_cpu = thread_cpu > st.read_cpu ? thread_cpu - st.read_cpu : 0;
+	proxy_info("Replayed %lu events, %lu GTIDs, %.1f MB in %.3fs: %.0f events/s, %.0f GTIDs/s, %.1f MB/s", st.events, st.gtids, st.bytes / 1e6, wall, st.events / wall, st.gtids / wall, st.bytes / 1e6 / wall);
+	proxy_info("Replay CPU: read and decode %.3fs, fan-out %.3fs (%.2fus/GTID, %.3fs in write_clients), process %.3fs", st.read_cpu, fanout_cpu, st.gtids ? fanout_cpu * 1e6 / st.gtids : 0, st.burst_cpu, process_cpu);
+}
+
+void replay_drain_cb(struct ev_loop *loop, struct ev_timer *w, int revents) {
+	if (!clients_drained() && (!write_deadline_ms || ev_now(loop) - replay_done_at < write_deadline_ms / 1000.0)) {
+		return;
+	}
+	ev_timer_stop(loop, w);
+	log_replay_stats();
+	stop_server(loop, "Replay done");
+}
+
+// The clients may still have data queued: the report waits for them.
+void tail_done_cb(Binlog_Tail *t) {
+	if (!replay_started_at) {
+		replay_start();
+	}
+	replay_done_at = ev_time();
+	ev_timer_init(&replay_drain, replay_drain_cb, 0, 0.01);
+	ev_timer_start(loop, &replay_drain);
+}
+
+// Binlog_Tail callbacks, on the server loop. The files have been read up to
+// 'executed' already: the GTIDs a restored state lacks go out at once.
+void tail_start_cb(Binlog_Tail *t, const slave::Position& executed) {
+	slave::Position source = executed;
+	// Files are never purged under the reader.
+	slave::Position from = source_reached(executed, slave::Position());
+	GTID_Set missing;
+	if (!gtid_wire_set_diff(position_to_gtid_set(source), position_to_gtid_set(from), missing)) {
+		return;
+	}
+	for (auto it = missing.map.begin(); it != missing.map.end(); ++it) {
+		for (auto iv = it->second.begin(); iv != it->second.end(); ++iv) {
+			for (trxid_t trx = iv->start; trx <= iv->end; trx++) {
+				const slave::gtid_t gtid(it->first, trx);
+				queue_gtids(&gtid, 1);
+			}
+		}
+	}
+	write_clients();
+	if (t->replay) {
+		if (replay_clients) {
+			proxy_info("Waiting for %u clients before replaying", replay_clients);
+			replay_waiting = true;
+			t->pause();
+		} else {
+			replay_start();
+		}
+	}
+}
+
+void tail_gtid_cb(Binlog_Tail *t, const std::string& sid, int64_t gno) {
+	const slave::gtid_t gtid(sid, gno);
+	queue_gtids(&gtid, 1);
+}
+
+void tail_burst_cb(Binlog_Tail *t) {
+	write_clients();
+}
+
+void tail_log_cb(Binlog_Tail *t, bool error, const std::string& msg) {
+	if (error) {
+		proxy_error("Binlog files: %s", msg.c_str());
+	} else {
+		proxy_info("%s", msg.c_str());
 	}
 }
 
@@ -683,8 +2245,8 @@ void usage(const char* name) {
 	"\n"
 	"Required arguments:\n"
 	"\n"
-	"-h: MySQL host address.\n"
-	"-u: MySQL user.\n"
+	"-h: MySQL host address (not with -E file).\n"
+	"-u: MySQL user (not with -E file).\n"
 	"\n"
 	"Optional arguments:\n"
 	"\n"
@@ -692,16 +2254,86 @@ void usage(const char* name) {
 	"-L: Log file path (default " << DEFAULT_ERRORLOG << ").\n"
 	"-P: MySQL port (default " << DEFAULT_MYSQL_PORT << ").\n"
 	"-p: MySQL password.\n"
-	"-l: Listener port (default " << DEFAULT_LISTEN_PORT << ").\n"
+	"-l: Listener port (default " << DEFAULT_LISTEN_PORT << "), as port[:freq[:batching[:max_netbuflen]]]. Repeatable; empty or\n"
+	"    missing fields take the -t, -b and -B values; freq is at most " << FLUSH_FREQ_MAX_MS << ", batching 0 or 1, and\n"
+	"    max_netbuflen at most " << MAX_NETBUFLEN_LIMIT << ". All listeners share one binlog connection.\n"
 	"-t: Update freqency, in milliseconds. Default is update on every event (0).\n"
 	"-b: Batched updates, 0 or 1 (default 1). Requires ProxySQL v" << PROXYSQL_UPDATE_BATCHING_MIN_VERSION << " or later; set to 0 for older versions.\n"
+	"-S: Publish the GTID state to a shared-memory file at this path (e.g. /dev/shm/proxysql_binlog.gtid).\n"
+	"-C: Checkpoint the GTID state to this file every " << CHECKPOINT_INTERVAL_MS << "ms, and serve it on start until the source is reached.\n"
+	"-T: TLS certificate chain file (PEM). Enables TLS on the listener; requires -K.\n"
+	"-K: TLS private key file (PEM).\n"
+	"-A: CA file (PEM) to verify client certificates against; clients without a valid certificate are rejected.\n"
+	"-w: Time to wait for a client HELLO before sending the initial state, in milliseconds (default 0, send it right away).\n"
+	"-k: TCP keepalive idle time and TCP_USER_TIMEOUT for clients, in seconds (default " << DEFAULT_KEEPALIVE_SEC << ", 0 to disable).\n"
+	"-W: Close clients whose queued data makes no progress for this long, in milliseconds (default " << DEFAULT_WRITE_DEADLINE_MS << ", 0 to disable).\n"
+	"-E: Replication client: libslave (default), or native for the built-in non-blocking client, which reads the binlog\n"
+	"    on the server loop, or poll[:ms] for the same client querying @@global.gtid_executed every ms milliseconds\n"
+	"    (default " << DEFAULT_POLL_INTERVAL_MS << ") instead of reading the binlog, or file to read the binlog files of a\n"
+	"    source on this host (-D) instead of connecting to it, or replay[:clients[:speed]] to replay captured binlog\n"
+	"    files (-D) once clients are streaming, as fast as possible or at speed times their pace, then exit.\n"
+	"-D: Binlog index file of the source, with -E file (e.g. /var/lib/mysql/binlog.index) or replay.\n"
+	"-Z: Compress the binlog connection: zlib, or zstd[:level] (MySQL 8.0.18+, zlib with older sources). Skipped\n"
+	"    events are then assembled in memory. Not supported with -E native or poll.\n"
+	"-H: Heartbeat period asked of the source, in milliseconds (default " << DEFAULT_SOURCE_HEARTBEAT_MS << ", minimum " << HEARTBEAT_MIN_MS << ", 0 to disable).\n"
+	"    The binlog connection is dropped and reopened after " << HEARTBEAT_STALL_PERIODS << " periods without any data.\n"
+	"-c: Binlog checksums to verify with binlog_checksum=CRC32: all, or consumed (default) for only the GTID, ROTATE and\n"
+	"    FORMAT_DESCRIPTION events the reader decodes.\n"
 	"-f: Run in foreground.\n"
 	"-v: Outputs build version.\n"
 	<< std::endl;
 }
 
+// Parses "port[:freq[:batching[:max_netbuflen]]]". Empty or missing fields
+// take the -t, -b and -B values. Returns NULL on malformed input, and on
+// values out of the bounds HELLO puts on freq= and batch=.
+Listener * parse_listener(const std::string& spec) {
+	std::vector<std::string> f;
+	size_t start = 0;
+	while (true) {
+		size_t colon = spec.find(':', start);
+		f.push_back(spec.substr(start, colon == std::string::npos ? std::string::npos : colon - start));
+		if (colon == std::string::npos) {
+			break;
+		}
+		start = colon + 1;
+	}
+	if (f.size() > 4 || f[0].empty()) {
+		return NULL;
+	}
+	for (std::vector<std::string>::iterator it = f.begin(); it != f.end(); ++it) {
+		if (it->size() > 12 || it->find_first_not_of("0123456789") != std::string::npos) {
+			return NULL;
+		}
+	}
+	f.resize(4);
+	if (!f[2].empty() && f[2] != "0" && f[2] != "1") {
+		return NULL;
+	}
+	// Every field fits in 12 digits.
+	const unsigned long long port = std::stoull(f[0]);
+	if (port == 0 || port > 65535 || (!f[1].empty() && std::stoull(f[1]) > FLUSH_FREQ_MAX_MS) ||
+	    (!f[3].empty() && std::stoull(f[3]) > MAX_NETBUFLEN_LIMIT)) {
+		return NULL;
+	}
+	Listener *l = new Listener();
+	l->port = port;
+	l->freq_ms = f[1].empty() ? update_freq_ms : std::stoull(f[1]);
+	l->batching = f[2].empty() ? update_batching : f[2] == "1";
+	l->max_netbuflen = f[3].empty() ? max_netbuflen : std::stoull(f[3]);
+	l->sd = -1;
+	// Disable batching, if frequency is 0.
+	if (!l->freq_ms) {
+		l->batching = false;
+	}
+	if (!l->max_netbuflen) {
+		l->max_netbuflen = size_t(l->freq_ms ? DEFAULT_MAX_NETBUFLEN_STREAMING : DEFAULT_MAX_NETBUFLEN_BATCHED);
+	}
+	return l;
+}
+
 void * server(void *args) {
-	GTID_Server_Dumper * serv_dump = new GTID_Server_Dumper(listen_port);
+	GTID_Server_Dumper * serv_dump = new GTID_Server_Dumper();
 	return NULL;
 }
 
@@ -710,12 +2342,28 @@ int main(int argc, char** argv) {
 	std::string user;
 	std::string password;
 	std::string errorstr;
+	std::vector<std::string> listen_specs;
 	unsigned int port = DEFAULT_MYSQL_PORT;
+	// -Z, as libslave's mysql_compression list.
+	std::string compression;
+	unsigned int zstd_level = 0;
 
 	bool error = false;
 
+	startup.begin();
+	ssize_t exe_len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+	exe_path[exe_len > 0 ? exe_len : 0] = '\0';
+	for (int i = 0; i < argc; i++) {
+		exec_argv.push_back(strdup(argv[i]));
+	}
+	exec_argv.push_back(NULL);
+	const char *handoff_env = getenv(HANDOFF_FD_ENV);
+	if (handoff_env) {
+		handoff_fd = atoi(handoff_env);
+		unsetenv(HANDOFF_FD_ENV);
+	}
 	int c;
-	while (-1 != (c = ::getopt(argc, argv, "vfB:b:t:h:u:p:P:l:L:"))) {
+	while (-1 != (c = ::getopt(argc, argv, "vfB:b:c:C:D:E:H:t:h:Z:u:p:P:l:L:S:T:K:A:w:k:W:"))) {
 		switch (c) {
 			case 'B': max_netbuflen = size_t(std::stoi(optarg)); break;
 			case 'f': foreground=true; break;
@@ -726,10 +2374,88 @@ int main(int argc, char** argv) {
 				memset(optarg,'x',strlen(optarg));
 				break;
 			case 'P': port = std::stoi(optarg); break;
-			case 'l': listen_port = std::stoi(optarg); break;
+			case 'l': listen_specs.push_back(optarg); break;
 			case 'L': errorstr = optarg; break;
 			case 't': update_freq_ms = std::stoi(optarg); break;
 			case 'b': update_batching = std::stoi(optarg) ? true : false; break;
+			case 'S': shm_path = strdup(optarg); break;
+			case 'C': checkpoint_path = strdup(optarg); break;
+			case 'D': binlog_index = strdup(optarg); break;
+			case 'T': tls_cert = strdup(optarg); break;
+			case 'K': tls_key = strdup(optarg); break;
+			case 'A': tls_ca = strdup(optarg); break;
+			case 'c':
+				if (!strcmp(optarg, "all")) {
+					verify_all_checksums = true;
+				} else if (!strcmp(optarg, "consumed")) {
+					verify_all_checksums = false;
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'E':
+				if (!strcmp(optarg, "libslave")) {
+					engine = ENGINE_LIBSLAVE;
+				} else if (!strcmp(optarg, "native")) {
+					engine = ENGINE_NATIVE;
+				} else if (!strcmp(optarg, "file")) {
+					engine = ENGINE_FILE;
+				} else if (!strcmp(optarg, "replay") || !strncmp(optarg, "replay:", 7)) {
+					engine = ENGINE_REPLAY;
+					if (optarg[6] == ':') {
+						char *end = NULL;
+						replay_clients = strtoul(optarg + 7, &end, 10);
+						if (*end == ':') {
+							replay_speed = strtod(end + 1, &end);
+						}
+						if (*end != '\0' || replay_speed < 0) {
+							usage(argv[0]);
+							return 1;
+						}
+					}
+				} else if (!strcmp(optarg, "poll") || !strncmp(optarg, "poll:", 5)) {
+					engine = ENGINE_POLL;
+					if (optarg[4] == ':') {
+						poll_interval_ms = std::stoul(optarg + 5);
+						if (poll_interval_ms == 0) {
+							usage(argv[0]);
+							return 1;
+						}
+					}
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'Z': {
+				const std::string z = optarg;
+				if (z == "zlib") {
+					compression = "zlib";
+				} else if (z == "zstd" || z.compare(0, 5, "zstd:") == 0) {
+					// zlib for sources without zstd.
+					compression = "zstd,zlib";
+					zstd_level = z.size() > 5 ? std::stoul(z.substr(5)) : 0;
+					if (zstd_level > 22) {
+						usage(argv[0]);
+						return 1;
+					}
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			}
+			case 'H':
+				source_heartbeat_ms = std::stoul(optarg);
+				if (source_heartbeat_ms && source_heartbeat_ms < HEARTBEAT_MIN_MS) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'w': hello_wait_ms = std::stoi(optarg); break;
+			case 'k': keepalive_sec = std::stoi(optarg); break;
+			case 'W': write_deadline_ms = std::stoi(optarg); break;
 			case 'v':
 				std::cout << "proxysql_binlog_reader version " << BINLOG_VERSION << std::endl;
 				return 1;
@@ -745,27 +2471,73 @@ int main(int argc, char** argv) {
 		errorlog = strdup(errorstr.c_str());
 	}
 
-	// Disable batching, if frequency is 0.
+	if (listen_specs.empty()) {
+		listen_specs.push_back(std::to_string(DEFAULT_LISTEN_PORT));
+	}
+	for (std::vector<std::string>::iterator it = listen_specs.begin(); it != listen_specs.end(); ++it) {
+		Listener *l = parse_listener(*it);
+		if (l == NULL) {
+			std::cerr << "Invalid listener '" << *it << "'\n";
+			usage(argv[0]);
+			return 1;
+		}
+		for (std::vector<Listener *>::iterator it2 = Listeners.begin(); it2 != Listeners.end(); ++it2) {
+			if ((*it2)->port == l->port) {
+				std::cerr << "Listener port " << l->port << " given twice\n";
+				return 1;
+			}
+		}
+		Listeners.push_back(l);
+	}
+	// Listeners took the raw -b value. Disable batching, if frequency is 0.
 	if (!update_freq_ms) {
 		update_batching = false;
 	}
 
+	// Client_Data default; accepted clients take their listener's limit.
 	if (!max_netbuflen) {
 		max_netbuflen = size_t(update_freq_ms ? DEFAULT_MAX_NETBUFLEN_STREAMING : DEFAULT_MAX_NETBUFLEN_BATCHED);
 	}
 
-	if (host.empty() || user.empty())
+	// The files need no connection to the source.
+	if (engine == ENGINE_FILE || engine == ENGINE_REPLAY ? !binlog_index : (host.empty() || user.empty()))
 	{
 		usage(argv[0]);
 		return 1;
 	}
+
+	if (engine != ENGINE_LIBSLAVE && !compression.empty()) {
+		std::cerr << "-Z is not supported with -E native, poll, file or replay\n";
+		return 1;
+	}
+
+	if (engine == ENGINE_REPLAY && checkpoint_path) {
+		std::cerr << "-C is not supported with -E replay\n";
+		return 1;
+	}
+
+	if (tls_cert || tls_key || tls_ca) {
+		if (!tls_cert || !tls_key) {
+			usage(argv[0]);
+			return 1;
+		}
+		// Loaded before daemonizing: relative paths still resolve, and errors
+		// are reported on the terminal.
+		std::string tls_err;
+		if (!tls_ctx.init(tls_cert, tls_key, tls_ca, tls_err)) {
+			proxy_error("Failed to set up TLS listener: %s", tls_err.c_str());
+			return 1;
+		}
+	}
 	if (!ev_default_loop (EVBACKEND_POLL | EVFLAG_NOENV)) {
 		fprintf(stderr,"could not initialise libev");
 		exit(EXIT_FAILURE);
 	}
 
 
-	if (foreground==false) {
+	// A process exec'd by SIGUSR2 runs where the previous one did, under the
+	// same angel if any.
+	if (foreground==false && handoff_fd < 0) {
 	daemonize_phase1((char *)argv[0]);
 	if ((pid = daemon_fork()) < 0) {
 			/* Exit on error */
@@ -780,24 +2552,34 @@ int main(int argc, char** argv) {
 			if (daemonize_phase2()==false) {
 				goto finish;
 			}
+			struct sigaction sa;
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler = angel_sigusr2_handler;
+			sa.sa_flags = SA_RESTART;
+			sigaction(SIGUSR2, &sa, NULL);
 
 		}
 
 
 	laststart=0;
+	bool restarted = false;
 	if (true) {
 gotofork:
 		if (laststart) {
-			int currenttime=time(NULL);
-			if (currenttime == laststart) { /// we do not want to restart multiple times in the same second
+			restarted = true;
+			if (monotonic_ms() - laststart >= ANGEL_STABLE_MS) {
+				// The child ran long enough: restart it right away.
+				restart_backoff.reset();
+			} else {
 				// if restart is too frequent, something really bad is going on
+				const unsigned int delay_ms = restart_backoff.next_ms();
 				parent_open_error_log();
-				fprintf(stderr,"Angel process is waiting %d seconds before starting a new process\n", 1);
+				fprintf(stderr,"Angel process is waiting %u ms before starting a new process\n", delay_ms);
 				parent_close_error_log();
-				sleep(1);
+				usleep(delay_ms * 1000);
 			}
 		}
-		laststart=time(NULL);
+		laststart=monotonic_ms();
 		pid = fork();
 		if (pid < 0) {
 			parent_open_error_log();
@@ -816,6 +2598,9 @@ gotofork:
 			// we open the files also on the child process
 			// this is required if the child process was created after a crash
 			parent_open_error_log();
+			if (restarted) {
+				startup.begin();
+			}
 		}
 	}
 
@@ -829,6 +2614,84 @@ __start_label:
 
 {
 	pthread_mutex_init(&pos_mutex, NULL);
+	startup.mark("process");
+	if (handoff_fd >= 0) {
+		receive_handoff();
+	}
+	if (checkpoint_path) {
+		load_checkpoint();
+	}
+
+	if (engine == ENGINE_FILE || engine == ENGINE_REPLAY) {
+		proxy_info("proxysql_binlog_reader version %s", BINLOG_VERSION);
+		if (tls_ctx.is_enabled()) {
+			proxy_info("TLS enabled on the listener, kernel TLS offload %s", TLS_Server_Context::ktls_supported() ? "enabled" : "not supported by this OpenSSL build");
+		}
+
+		Binlog_Tail tail;
+		tail.index_path = binlog_index;
+		tail.start_cb = tail_start_cb;
+		tail.gtid_cb = tail_gtid_cb;
+		tail.burst_cb = tail_burst_cb;
+		tail.log_cb = tail_log_cb;
+		if (engine == ENGINE_REPLAY) {
+			tail.replay = true;
+			tail.replay_speed = replay_speed;
+			tail.done_cb = tail_done_cb;
+			if (replay_speed) {
+				proxy_info("Replaying the binlog files listed in %s at %gx their pace...", binlog_index, replay_speed);
+			} else {
+				proxy_info("Replaying the binlog files listed in %s...", binlog_index);
+			}
+		} else {
+			proxy_info("Reading the binlog files listed in %s...", binlog_index);
+		}
+
+		// The files are read on the server loop, in this thread.
+		binlog_tail = &tail;
+		server(NULL);
+		binlog_tail = NULL;
+		goto finish;
+	}
+
+	if (engine == ENGINE_NATIVE || engine == ENGINE_POLL) {
+		proxy_info("proxysql_binlog_reader version %s", BINLOG_VERSION);
+		if (tls_ctx.is_enabled()) {
+			proxy_info("TLS enabled on the listener, kernel TLS offload %s", TLS_Server_Context::ktls_supported() ? "enabled" : "not supported by this OpenSSL build");
+		}
+
+		Binlog_Client client;
+		client.host = host;
+		client.port = port;
+		client.user = user;
+		client.password = password;
+		// As libslave picks its server_id.
+		client.server_id = uint32_t(time(NULL) ^ (getpid() << 16));
+		client.verify_all_checksums = verify_all_checksums;
+		client.heartbeat_period_ms = source_heartbeat_ms;
+		client.start_cb = native_start_cb;
+		client.gtid_cb = native_gtid_cb;
+		client.burst_cb = native_burst_cb;
+		client.log_cb = native_log_cb;
+		client.dump_error_cb = native_dump_error_cb;
+		if (engine == ENGINE_POLL) {
+			// No binlog is read: no checksums, and the poll replies stand in
+			// for heartbeats.
+			client.heartbeat_period_ms = 0;
+			client.poll_interval_ms = poll_interval_ms;
+			proxy_info("Polling the executed GTID set of %s:%u every %ums...", host.c_str(), port, poll_interval_ms);
+		} else {
+			proxy_info("Binlog checksums: %s CRC32, verifying %s events", proxysql_crc32_impl(), verify_all_checksums ? "all" : "consumed");
+			log_heartbeat_config();
+			proxy_info("Reading binlogs with the native client from %s:%u...", host.c_str(), port);
+		}
+
+		// The client runs on the server loop, in this thread.
+		native_client = &client;
+		server(NULL);
+		native_client = NULL;
+		goto finish;
+	}
 
 	slave::MasterInfo masterinfo;
 
@@ -836,39 +2699,103 @@ __start_label:
 	masterinfo.conn_options.mysql_port = port;
 	masterinfo.conn_options.mysql_user = user;
 	masterinfo.conn_options.mysql_pass = password;
+	masterinfo.conn_options.mysql_compression = compression;
+	masterinfo.conn_options.mysql_zstd_level = zstd_level;
+	masterinfo.heartbeat_period_ms = source_heartbeat_ms;
+	// Reconnects back off from tens of milliseconds up to this.
+	masterinfo.connect_retry = SOURCE_RETRY_MAX_SEC;
 
 	try {
 		proxy_info("proxysql_binlog_reader version %s", BINLOG_VERSION);
+		if (tls_ctx.is_enabled()) {
+			proxy_info("TLS enabled on the listener, kernel TLS offload %s", TLS_Server_Context::ktls_supported() ? "enabled" : "not supported by this OpenSSL build");
+		}
 
 		slave::DefaultExtState sDefExtState;
 		slave::Slave slave(masterinfo, sDefExtState);
 		sl = &slave;
 
-		slave.setXidCallback(bench_xid_callback);
+		slave.setGtidBatchCallback(gtid_batch_callback);
+		// No table callbacks: row events are skipped undecoded, and drained
+		// off the socket without being assembled in memory.
+		slave.setGtidOnly(true);
+		slave::set_checksum_function(proxysql_crc32);
+		slave.setVerifySkippedEvents(verify_all_checksums);
+		proxy_info("Binlog checksums: %s CRC32, verifying %s events", proxysql_crc32_impl(), verify_all_checksums ? "all" : "consumed");
+		log_heartbeat_config();
+		if (compression == "zlib") {
+			proxy_info("Binlog connection compression: zlib");
+		} else if (!compression.empty()) {
+			proxy_info("Binlog connection compression: zstd level %s, zlib with older sources", zstd_level ? std::to_string(zstd_level).c_str() : "default");
+		}
+
+	pthread_t thread_id;
+		if (state_restored) {
+			// Clients get the restored state while the source is being reached.
+			pthread_create(&thread_id, NULL, server , NULL);
+		}
 
 		//std::cout << "Initializing client..." << std::endl;
 		proxy_info("Initializing client...");
-		slave.init();
+		// Serving a restored state, keep trying an unreachable source instead of
+		// exiting and closing the listeners.
+		Backoff init_retry(SOURCE_RETRY_MIN_MS, SOURCE_RETRY_MAX_SEC * 1000);
+		for (bool initialized = false; !initialized; ) {
+			try {
+				slave.init();
+				initialized = true;
+			} catch (std::exception& ex) {
+				if (!state_restored || isStopping()) {
+					throw;
+				}
+				const unsigned int delay_ms = init_retry.next_ms();
+				proxy_error("Error in initializing slave: %s, retrying in %u ms", ex.what(), delay_ms);
+				usleep(delay_ms * 1000);
+			}
+		}
 		// enable GTID
 		slave.enableGtid();
 
-		curpos = slave.getLastBinlogPos();
-		std::string s1 = position_to_string(curpos);
+		slave::Position source = slave.getLastBinlogPos();
+		std::string s1 = position_to_string(source);
 
 		// Wait until a valid 'GTID' has been executed for requesting binlog
 		while (s1.empty() && !isStopping()) {
 			proxy_info("'Executed_Gtid_Set' found empty, retrying...");
 			usleep(1000 * 1000);
 
-			curpos = slave.getLastBinlogPos();
-			s1 = position_to_string(curpos);
+			source = slave.getLastBinlogPos();
+			s1 = position_to_string(source);
 		}
 		proxy_info("Last executed GTID: '%s'", s1.c_str());
 
-		sDefExtState.setMasterPosition(curpos);
-
-	pthread_t thread_id;
-	pthread_create(&thread_id, NULL, server , NULL);
+		if (state_restored) {
+			if (!s1.empty()) {
+				sDefExtState.setMasterPosition(adopt_source_state(source, slave.getGtidPurged()));
+			}
+			// Called on this thread, before libslave reconnects to dump
+			// from the position in sDefExtState.
+			slave.setDumpErrorCallback([&] (unsigned int code)
+				{
+					if (!restored_state_refused_by(code)) {
+						return;
+					}
+					try {
+						sDefExtState.setMasterPosition(adopt_source_state(slave.getLastBinlogPos(), slave::Position()));
+					} catch (std::exception& ex) {
+						// Tried again on the next refusal.
+						proxy_error("Error in reading the source's GTID state: %s", ex.what());
+					}
+				});
+		} else {
+			curpos = source;
+			sDefExtState.setMasterPosition(curpos);
+			if (shm_path) {
+				open_shm();
+			}
+			startup.mark("source");
+			pthread_create(&thread_id, NULL, server , NULL);
+		}
 
 		try {
 
@@ -0,0 +1,633 @@
+#include "proxysql_binlog_tail.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proxysql_binlog_event.h"
+#include "proxysql_crc32.h"
+
+namespace {
+
+// QUERY body: thread id, execution time, database name length, error code,
+// status variables length; then the status variables, the database name
+// and its NUL, and the statement.
+const size_t QUERY_DB_LEN_OFFSET = EVENT_HEADER_LEN + 8;
+const size_t QUERY_STATUS_LEN_OFFSET = EVENT_HEADER_LEN + 11;
+const size_t QUERY_HEADER_LEN = EVENT_HEADER_LEN + 13;
+// Enough of a statement to tell BEGIN, COMMIT and XA START from the rest.
+const size_t QUERY_PREFIX_LEN = 16;
+// ROTATE body: position in the next file, its name.
+const size_t ROTATE_NAME_OFFSET = EVENT_HEADER_LEN + 8;
+
+std::string dir_of(const std::string& path) {
+	const size_t slash = path.rfind('/');
+	if (slash == std::string::npos) return ".";
+	return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+std::string base_of(const std::string& path) {
+	const size_t slash = path.rfind('/');
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+double thread_cpu() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Binlog names only grow in length past 999999.
+bool name_before(const std::string& a, const std::string& b) {
+	return a.size() != b.size() ? a.size() < b.size() : a < b;
+}
+
+}  // namespace
+
+Binlog_Tail::Binlog_Tail() :
+	replay(false), replay_speed(0),
+	start_cb(NULL), gtid_cb(NULL), burst_cb(NULL), log_cb(NULL), done_cb(NULL), data(NULL),
+	loop(NULL), started(false), ifd(-1), dir_wd(-1), file_wd(-1), last_read(0),
+	index_dirty(true), paused(false), held(false), pace_started(false), pace_first_us(0),
+	pace_first_at(0), stats(), fd(-1), pos(0), checksums(false), file_done(false),
+	trx_open(false), trx_gno(0), trx_end(0), trx_begun(false), burst_gtids(false),
+	buf_off(0), buf_len(0)
+{
+	ev_io_init(&iio, inotify_cb, -1, EV_READ);
+	ev_timer_init(&timer, timer_cb, 0, 0);
+	iio.data = this;
+	timer.data = this;
+}
+
+Binlog_Tail::~Binlog_Tail() {
+	stop();
+}
+
+// The first check runs from the loop, as the first connection of
+// Binlog_Client does.
+void Binlog_Tail::start(struct ev_loop *_loop) {
+	loop = _loop;
+	buf.resize(BINLOG_TAIL_BUFFER_SIZE);
+	if (replay) {
+		// A capture does not change.
+		ev_timer_set(&timer, 0, 0);
+		ev_timer_start(loop, &timer);
+		return;
+	}
+	ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd >= 0) {
+		dir_wd = inotify_add_watch(ifd, dir_of(index_path).c_str(), IN_CREATE | IN_MOVED_TO);
+	}
+	if (ifd < 0 || dir_wd < 0) {
+		info(std::string("Cannot watch the binlog directory (") + strerror(errno) + "), checking every " + std::to_string(BINLOG_TAIL_CHECK_MS) + "ms");
+	}
+	if (ifd >= 0) {
+		ev_io_set(&iio, ifd, EV_READ);
+		ev_io_start(loop, &iio);
+	}
+	ev_timer_set(&timer, 0, BINLOG_TAIL_CHECK_MS / 1000.0);
+	ev_timer_start(loop, &timer);
+}
+
+void Binlog_Tail::stop() {
+	if (!loop) return;
+	close_file();
+	ev_timer_stop(loop, &timer);
+	ev_io_stop(loop, &iio);
+	if (ifd >= 0) {
+		close(ifd);
+		ifd = -1;
+	}
+	dir_wd = -1;
+	loop = NULL;
+}
+
+void Binlog_Tail::pause() {
+	paused = true;
+}
+
+void Binlog_Tail::resume() {
+	if (!paused) return;
+	paused = false;
+	if (!loop) return;
+	ev_timer_stop(loop, &timer);
+	ev_timer_set(&timer, 0, 0);
+	ev_timer_start(loop, &timer);
+}
+
+void Binlog_Tail::info(const std::string& msg) {
+	if (log_cb) log_cb(this, false, msg);
+}
+
+// A replay is not retried.
+void Binlog_Tail::fail(const std::string& msg) {
+	if (log_cb) log_cb(this, true, msg);
+	close_file();
+	if (replay) finish();
+}
+
+void Binlog_Tail::finish() {
+	if (!loop) return;
+	burst();
+	stop();
+	if (done_cb) done_cb(this);
+}
+
+void Binlog_Tail::burst() {
+	if (!burst_gtids) return;
+	burst_gtids = false;
+	if (!burst_cb) return;
+	if (!replay) {
+		burst_cb(this);
+		return;
+	}
+	const double cpu = thread_cpu();
+	burst_cb(this);
+	stats.burst_cpu += thread_cpu() - cpu;
+}
+
+void Binlog_Tail::close_file() {
+	if (file_wd >= 0) {
+		inotify_rm_watch(ifd, file_wd);
+		file_wd = -1;
+	}
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+	buf_len = 0;
+	trx_open = false;
+}
+
+void Binlog_Tail::inotify_cb(struct ev_loop *loop, ev_io *w, int revents) {
+	Binlog_Tail *t = (Binlog_Tail *)w->data;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		const ssize_t n = read(t->ifd, events, sizeof(events));
+		if (n <= 0) break;
+		for (const char *p = events; p < events + n; ) {
+			const struct inotify_event *e = (const struct inotify_event *)p;
+			if (e->wd == t->dir_wd || (e->mask & IN_Q_OVERFLOW)) {
+				t->index_dirty = true;
+			}
+			p += sizeof(struct inotify_event) + e->len;
+		}
+	}
+	t->check();
+}
+
+void Binlog_Tail::timer_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+	Binlog_Tail *t = (Binlog_Tail *)w->data;
+	t->index_dirty = true;
+	t->check();
+}
+
+std::string Binlog_Tail::resolve(const std::string& dir, const std::string& name) const {
+	if (!name.empty() && name[0] == '/') return name;
+	return dir + "/" + (name.compare(0, 2, "./") == 0 ? name.substr(2) : name);
+}
+
+bool Binlog_Tail::read_index(std::vector<std::string>& files) {
+	files.clear();
+	const int ifile = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (ifile < 0) return false;
+	std::string text;
+	char tmp[4096];
+	ssize_t n;
+	while ((n = read(ifile, tmp, sizeof(tmp))) > 0 || (n < 0 && errno == EINTR)) {
+		if (n > 0) text.append(tmp, n);
+	}
+	const int myerr = errno;
+	close(ifile);
+	if (n < 0) {
+		errno = myerr;
+		return false;
+	}
+	const std::string dir = dir_of(index_path);
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t nl = text.find('\n', start);
+		if (nl == std::string::npos) nl = text.size();
+		std::string name = text.substr(start, nl - start);
+		while (!name.empty() && (name.back() == '\r' || name.back() == ' ')) name.pop_back();
+		if (!name.empty()) files.push_back(resolve(dir, name));
+		start = nl + 1;
+	}
+	return true;
+}
+
+// The file after the current one in the index, once it is listed.
+bool Binlog_Tail::next_in_index(std::string& next) {
+	std::vector<std::string> files;
+	if (!read_index(files)) return false;
+	for (size_t i = 0; i + 1 < files.size(); i++) {
+		if (files[i] == file) {
+			next = files[i + 1];
+			return true;
+		}
+	}
+	return false;
+}
+
+// False while waiting for the file to appear, or after an error.
+bool Binlog_Tail::open_file() {
+	fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		const int myerr = errno;
+		if (myerr == ENOENT && !replay) {
+			// A ROTATE names the next file before the source creates it; one
+			// that the index lists, or that a later one replaced, is gone.
+			std::vector<std::string> files;
+			bool gone = false;
+			if (read_index(files) && !files.empty()) {
+				gone = name_before(base_of(file), base_of(files.back()));
+				for (size_t i = 0; i < files.size(); i++) {
+					if (files[i] == file) gone = true;
+				}
+			}
+			if (!gone) return false;
+			const std::string missing = file;
+			file.clear();
+			fail("cannot open " + missing + ": " + strerror(myerr) + "; continuing from the last file in " + index_path);
+			return false;
+		}
+		fail("cannot open " + file + ": " + strerror(myerr));
+		return false;
+	}
+	if (ifd >= 0) {
+		file_wd = inotify_add_watch(ifd, file.c_str(), IN_MODIFY);
+	}
+	pos = 0;
+	checksums = false;
+	file_done = false;
+	next_file.clear();
+	buf_len = 0;
+	trx_open = false;
+	info("Reading binlog file " + file);
+	return true;
+}
+
+void Binlog_Tail::check() {
+	if (!loop) return;
+	if (fd < 0) {
+		if (file.empty()) {
+			std::vector<std::string> files;
+			if (!read_index(files)) {
+				fail("cannot read " + index_path + ": " + strerror(errno));
+				return;
+			}
+			if (files.empty()) {
+				fail("no binlog file in " + index_path);
+				return;
+			}
+			file = replay ? files.front() : files.back();
+		}
+		if (!open_file()) return;
+	}
+	advance();
+}
+
+// Reads what the current file has, and moves on to the next file once it
+// has ended.
+void Binlog_Tail::advance() {
+	const double cpu = replay ? thread_cpu() : 0;
+	const double burst_cpu = stats.burst_cpu;
+	burst_gtids = false;
+	while (fd >= 0) {
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			fail("cannot stat " + file + ": " + strerror(errno));
+			break;
+		}
+		const uint64_t size = st.st_size;
+		const uint64_t from = pos;
+		held = false;
+		if (!read_events(size)) break;
+		if (pos > from) {
+			last_read = ev_now(loop);
+		}
+		// A replay starts at the first GTID of the first file, whatever was
+		// executed before it.
+		if (!started && (replay || !executed.gtid_executed.empty())) {
+			started = true;
+			if (start_cb) {
+				start_cb(this, executed);
+			}
+			if (fd < 0) break;
+			if (replay) continue;
+		}
+		if (replay) {
+			if (held) break;
+			// The end of a captured file: the index says what comes next.
+			if (pos < size) {
+				info("The last " + std::to_string(size - pos) + " bytes of " + file + " are not a complete event or transaction, skipped");
+			}
+			std::string next;
+			if (!next_in_index(next)) {
+				finish();
+				break;
+			}
+			close_file();
+			file = next;
+			if (!open_file()) break;
+			continue;
+		}
+		if (file_done) {
+			std::string next = next_file;
+			if (next.empty()) {
+				// STOP: the source names the next file in the index only.
+				if (!index_dirty) break;
+				index_dirty = false;
+				if (!next_in_index(next)) break;
+			}
+			if (trx_open) {
+				info("GTID " + trx_sid + ":" + std::to_string(trx_gno) + " has no complete transaction in " + file + ", skipped");
+			}
+			close_file();
+			file = next;
+			if (!open_file()) break;
+			continue;
+		}
+		if (index_dirty) {
+			// A file that ends without a ROTATE or a STOP (the source crashed)
+			// is done once the index lists another: read what it has, then
+			// move on.
+			index_dirty = false;
+			std::string next;
+			if (next_in_index(next)) {
+				file_done = true;
+				next_file = next;
+				continue;
+			}
+		}
+		break;
+	}
+	burst();
+	if (replay) {
+		stats.read_cpu += thread_cpu() - cpu - (stats.burst_cpu - burst_cpu);
+	}
+}
+
+// Returns a pointer to 'len' bytes of the file at 'off', which 'size' holds.
+const unsigned char *Binlog_Tail::fetch(uint64_t off, size_t len, uint64_t size) {
+	if (off >= buf_off && off + len <= buf_off + buf_len) {
+		return buf.data() + (off - buf_off);
+	}
+	if (len > buf.size()) {
+		fail("event of " + std::to_string(len) + " bytes at " + file + ":" + std::to_string(off) + " is too large to decode");
+		return NULL;
+	}
+	// A burst is what one read delivered.
+	burst();
+	const size_t want = size - off < buf.size() ? size_t(size - off) : buf.size();
+	ssize_t n;
+	do {
+		n = pread(fd, buf.data(), want, off);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		fail("read error on " + file + ": " + strerror(errno));
+		return NULL;
+	}
+	buf_off = off;
+	buf_len = n;
+	if (size_t(n) < len) {
+		fail(file + " was truncated at " + std::to_string(off + n));
+		return NULL;
+	}
+	return buf.data();
+}
+
+// Consumes the complete events in the first 'size' bytes of the file. Only
+// the headers of most are read; the decoded ones are read whole.
+bool Binlog_Tail::read_events(uint64_t size) {
+	while (fd >= 0) {
+		if (pos > size) {
+			fail(file + " was truncated at " + std::to_string(size));
+			return false;
+		}
+		if (pos == 0) {
+			if (size < sizeof(BINLOG_MAGIC)) return true;
+			const unsigned char *m = fetch(0, sizeof(BINLOG_MAGIC), size);
+			if (!m) return false;
+			if (memcmp(m, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0) {
+				fail(file + " is not a binlog file, or is encrypted");
+				return false;
+			}
+			pos = sizeof(BINLOG_MAGIC);
+			stats.bytes += sizeof(BINLOG_MAGIC);
+			continue;
+		}
+		if (trx_open && trx_end) {
+			// The transaction length said where it ends.
+			if (size < trx_end) return true;
+			stats.bytes += trx_end - pos;
+			pos = trx_end;
+			end_trx();
+			continue;
+		}
+		if (size - pos < EVENT_HEADER_LEN) return true;
+		const unsigned char *h = fetch(pos, EVENT_HEADER_LEN, size);
+		if (!h) return false;
+		const size_t len = get_uint4(h + EVENT_LEN_OFFSET);
+		const unsigned char type = h[EVENT_TYPE_OFFSET];
+		if (len < EVENT_HEADER_LEN) {
+			fail("malformed event at " + file + ":" + std::to_string(pos));
+			return false;
+		}
+		if (size - pos < len) return true;
+		switch (type) {
+			case FORMAT_DESCRIPTION_EVENT:
+			case PREVIOUS_GTIDS_LOG_EVENT:
+			case GTID_LOG_EVENT:
+			case ROTATE_EVENT: {
+				const unsigned char *ev = fetch(pos, len, size);
+				if (!ev) return false;
+				if (replay && type == GTID_LOG_EVENT && !gtid_due(ev, len)) {
+					held = true;
+					return true;
+				}
+				if (!handle_event(ev, len)) return false;
+				break;
+			}
+			case STOP_EVENT:
+				file_done = true;
+				break;
+			case XID_EVENT:
+			case XA_PREPARE_LOG_EVENT:
+				if (trx_open) end_trx();
+				break;
+			case QUERY_EVENT:
+				if (trx_open) {
+					bool ends = false;
+					if (!query_ends_trx(pos, len, size, ends)) return false;
+					if (ends) end_trx();
+				}
+				break;
+			default:
+				break;
+		}
+		pos += len;
+		stats.events++;
+		stats.bytes += len;
+	}
+	return false;
+}
+
+// Replay: false before the first GTID, while paused, and until the GTID at
+// 'ev' is due, with the timer armed for then.
+bool Binlog_Tail::gtid_due(const unsigned char *ev, size_t len) {
+	if (!started || paused) return false;
+	if (replay_speed <= 0) return true;
+	// The commit timestamp in microseconds (MySQL 8.0), else the event's in
+	// seconds.
+	int64_t us = int64_t(get_uint4(ev)) * 1000000;
+	const uint64_t ts = gtid_commit_ts(ev, len - (checksums ? CHECKSUM_LEN : 0));
+	if (ts) us = int64_t(ts);
+	const ev_tstamp now = ev_time();
+	if (!pace_started) {
+		pace_started = true;
+		pace_first_us = us;
+		pace_first_at = now;
+		return true;
+	}
+	const ev_tstamp due = pace_first_at + (us - pace_first_us) / 1e6 / replay_speed;
+	if (due <= now) return true;
+	ev_timer_stop(loop, &timer);
+	ev_timer_set(&timer, due - now, 0);
+	ev_timer_start(loop, &timer);
+	return false;
+}
+
+// The event starts at 'pos'.
+bool Binlog_Tail::handle_event(const unsigned char *ev, size_t len) {
+	const unsigned char type = ev[EVENT_TYPE_OFFSET];
+	if (type == FORMAT_DESCRIPTION_EVENT) {
+		// Its own checksum setting is in it; it is not verified.
+		fde_checksums(ev, len, checksums);
+		return true;
+	}
+	if (checksums && (len < EVENT_HEADER_LEN + CHECKSUM_LEN || proxysql_crc32(0, ev, len - CHECKSUM_LEN) != get_uint4(ev + len - CHECKSUM_LEN))) {
+		fail("CRC32 check failed on the event at " + file + ":" + std::to_string(pos));
+		return false;
+	}
+	const size_t body_end = len - (checksums ? CHECKSUM_LEN : 0);
+
+	if (type == GTID_LOG_EVENT) {
+		if (body_end < GTID_MIN_LEN) {
+			fail("malformed GTID event at " + file + ":" + std::to_string(pos));
+			return false;
+		}
+		// A new transaction: the previous one is complete.
+		if (trx_open) end_trx();
+		trx_open = true;
+		trx_sid = hex_sid(ev + GTID_SID_OFFSET);
+		trx_gno = int64_t(get_uint8(ev + GTID_GNO_OFFSET));
+		trx_begun = false;
+		trx_end = 0;
+		const uint64_t trx_len = gtid_trx_len(ev, body_end);
+		if (trx_len >= len) {
+			trx_end = pos + trx_len;
+		}
+		return true;
+	}
+
+	if (type == PREVIOUS_GTIDS_LOG_EVENT) {
+		// Only the first file read says what was executed before it; after
+		// that, the GTID events are.
+		if (started) return true;
+		const unsigned char *p = ev + EVENT_HEADER_LEN;
+		const unsigned char *end = ev + body_end;
+		slave::Position prev;
+		bool ok = end - p >= 8;
+		uint64_t n_sids = ok ? get_uint8(p) : 0;
+		p += ok ? 8 : 0;
+		for (uint64_t i = 0; ok && i < n_sids; i++) {
+			ok = end - p >= 16 + 8;
+			if (!ok) break;
+			const std::string sid = hex_sid(p);
+			const uint64_t n_intervals = get_uint8(p + 16);
+			p += 16 + 8;
+			ok = uint64_t(end - p) / 16 >= n_intervals;
+			for (uint64_t j = 0; ok && j < n_intervals; j++, p += 16) {
+				// The end is exclusive.
+				prev.gtid_executed[sid].push_back(slave::gtid_interval_t(int64_t(get_uint8(p)), int64_t(get_uint8(p + 8)) - 1));
+			}
+		}
+		if (!ok) {
+			fail("malformed PREVIOUS_GTIDS event at " + file + ":" + std::to_string(pos));
+			return false;
+		}
+		executed = prev;
+		return true;
+	}
+
+	// ROTATE: the next file, in the same directory.
+	if (body_end < ROTATE_NAME_OFFSET) {
+		fail("malformed ROTATE event at " + file + ":" + std::to_string(pos));
+		return false;
+	}
+	next_file = resolve(dir_of(file), std::string((const char *)ev + ROTATE_NAME_OFFSET, body_end - ROTATE_NAME_OFFSET));
+	file_done = true;
+	return true;
+}
+
+// Without a transaction length: a QUERY event ends the transaction when it
+// is not within BEGIN (DDL), or when it commits or rolls back what BEGIN or
+// XA START opened.
+bool Binlog_Tail::query_ends_trx(uint64_t off, size_t len, uint64_t size, bool& ends) {
+	const size_t body_end = len - (checksums ? CHECKSUM_LEN : 0);
+	if (body_end < QUERY_HEADER_LEN) {
+		fail("malformed QUERY event at " + file + ":" + std::to_string(off));
+		return false;
+	}
+	const unsigned char *h = fetch(off, QUERY_HEADER_LEN, size);
+	if (!h) return false;
+	const size_t q_off = QUERY_HEADER_LEN + get_uint2(h + QUERY_STATUS_LEN_OFFSET) + h[QUERY_DB_LEN_OFFSET] + 1;
+	if (q_off > body_end) {
+		fail("malformed QUERY event at " + file + ":" + std::to_string(off));
+		return false;
+	}
+	const size_t q_len = body_end - q_off < QUERY_PREFIX_LEN ? body_end - q_off : QUERY_PREFIX_LEN;
+	const unsigned char *q = fetch(off + q_off, q_len, size);
+	if (!q) return false;
+	const std::string stmt((const char *)q, q_len);
+	if (stmt == "BEGIN" || stmt.compare(0, 8, "XA START") == 0) {
+		trx_begun = true;
+		ends = false;
+	} else {
+		ends = !trx_begun || stmt == "COMMIT" || stmt == "ROLLBACK";
+	}
+	return true;
+}
+
+void Binlog_Tail::end_trx() {
+	trx_open = false;
+	deliver(trx_sid, trx_gno);
+}
+
+// Each GTID once, even when a file is read again after an error.
+void Binlog_Tail::deliver(const std::string& sid, int64_t gno) {
+	if (has_gtid(sid, gno)) return;
+	executed.addGtid(slave::gtid_t(sid, gno));
+	if (started) {
+		if (gtid_cb) {
+			gtid_cb(this, sid, gno);
+		}
+		burst_gtids = true;
+		stats.gtids++;
+	}
+}
+
+bool Binlog_Tail::has_gtid(const std::string& sid, int64_t gno) const {
+	auto it = executed.gtid_executed.find(sid);
+	if (it == executed.gtid_executed.end()) return false;
+	for (auto iv = it->second.rbegin(); iv != it->second.rend(); ++iv) {
+		if (gno >= iv->first && gno <= iv->second) return true;
+		if (gno > iv->second) return false;
+	}
+	return false;
+}
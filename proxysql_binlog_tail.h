@@ -0,0 +1,175 @@
+#ifndef PROXYSQL_BINLOG_TAIL
+#define PROXYSQL_BINLOG_TAIL
+
+// Binlog file reader for a reader on the source's own host (-E file).
+//
+// Instead of a replication connection, it reads the binlog files the source
+// writes, following the index file given with -D:
+//
+//   - on start, the last file in the index: its PREVIOUS_GTIDS event and
+//     the GTIDs after it make the executed set handed to start_cb;
+//   - then every transaction appended to it, and to the files after it,
+//     through the ROTATE event that ends each file, or through the index
+//     when a file ends without one (the source stopped or crashed).
+//
+// Files are read with pread() into one buffer, at the offset of the next
+// event. Only FORMAT_DESCRIPTION, PREVIOUS_GTIDS, GTID and ROTATE events
+// are read whole; any other event is stepped over on its header, and
+// with the transaction length MySQL 8.0 puts in the GTID event, so is the
+// rest of the transaction. A GTID is handed to the owner once its whole
+// transaction is in the file; a partly written event or transaction is
+// left for the next wakeup. Without the transaction length (MySQL 5.7),
+// the end of a transaction is found from the headers of its XID, QUERY and
+// XA_PREPARE events.
+//
+// inotify wakes it when the current file is written and when files appear
+// in its directory, and a timer checks every BINLOG_TAIL_CHECK_MS in case
+// a change went unnoticed. On an error the file is closed, and read again
+// from its start on the next check: GTIDs already handed over are not
+// repeated.
+//
+// In replay mode (-E replay) the files are a capture: every file in the
+// index is read once, from the first, with no inotify and no checks. The
+// reading can be paused before the next GTID, and paced by the GTIDs'
+// commit times; done_cb runs once the last file has been read.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <ev.h>
+#include "binlog_pos.h"
+
+#define BINLOG_TAIL_BUFFER_SIZE (1024 * 1024)
+#define BINLOG_TAIL_CHECK_MS    1000
+
+struct Binlog_Tail_Stats {
+	// Events whose header was read; the rest of a transaction skipped on its
+	// length is not counted.
+	uint64_t events;
+	// Bytes of the files read through, skipped ones included.
+	uint64_t bytes;
+	uint64_t gtids;
+	// Thread CPU time reading and decoding, and in burst_cb, in seconds;
+	// measured in replay mode only.
+	double read_cpu;
+	double burst_cpu;
+};
+
+class Binlog_Tail {
+	public:
+	// The binlog index file, e.g. /var/lib/mysql/binlog.index; set before
+	// start(). Relative names in it are relative to its directory.
+	std::string index_path;
+	// Replay the files instead of following them; with 'replay_speed', at
+	// that many times the pace they were written at, else as fast as
+	// possible.
+	bool replay;
+	double replay_speed;
+
+	// Called on the loop thread, as for Binlog_Client: start_cb gets the
+	// executed set once the last file has been read to its end; gtid_cb then
+	// gets every GTID that follows, and burst_cb runs after each wakeup that
+	// delivered any.
+	void (*start_cb)(Binlog_Tail *t, const slave::Position& executed);
+	void (*gtid_cb)(Binlog_Tail *t, const std::string& sid, int64_t gno);
+	void (*burst_cb)(Binlog_Tail *t);
+	void (*log_cb)(Binlog_Tail *t, bool error, const std::string& msg);
+	// Replay only: the files were read to their end, or could not be.
+	void (*done_cb)(Binlog_Tail *t);
+	void *data;
+
+	Binlog_Tail();
+	~Binlog_Tail();
+
+	// Starts following the index on '_loop'.
+	void start(struct ev_loop *_loop);
+	void stop();
+	// Replay only: holds the reading before the next GTID, e.g. from start_cb
+	// until clients are connected.
+	void pause();
+	void resume();
+
+	const slave::Position& get_executed() const { return executed; }
+	// Wall clock of the last read that found new events, in milliseconds; 0
+	// before the first.
+	int64_t last_event_ms() const { return int64_t(last_read * 1000); }
+	const Binlog_Tail_Stats& get_stats() const { return stats; }
+
+	private:
+	struct ev_loop *loop;
+	bool started;
+	int ifd;
+	int dir_wd;
+	int file_wd;
+	ev_io iio;
+	ev_timer timer;
+	ev_tstamp last_read;
+	// The index changed, or may have: read it again at the next end of file.
+	bool index_dirty;
+	// Replay: the reading stopped before a GTID (paused, or not due yet);
+	// the commit time of the first GTID and when it was delivered.
+	bool paused;
+	bool held;
+	bool pace_started;
+	int64_t pace_first_us;
+	ev_tstamp pace_first_at;
+	Binlog_Tail_Stats stats;
+
+	// The current file, and its descriptor once open. 'file' is set but not
+	// open while waiting for the next file to appear.
+	std::string file;
+	int fd;
+	// Offset of the next event.
+	uint64_t pos;
+	bool checksums;
+	// A ROTATE or STOP event ended the file; 'next_file' is the ROTATE's.
+	bool file_done;
+	std::string next_file;
+
+	// A GTID whose transaction is not entirely in the file yet. 'trx_end' is
+	// its end offset, or 0 when the GTID event did not say; 'trx_begun' once
+	// a BEGIN (or XA START) query opened it.
+	bool trx_open;
+	std::string trx_sid;
+	int64_t trx_gno;
+	uint64_t trx_end;
+	bool trx_begun;
+	bool burst_gtids;
+
+	slave::Position executed;
+
+	// File bytes [buf_off, buf_off + buf_len).
+	std::vector<unsigned char> buf;
+	uint64_t buf_off;
+	size_t buf_len;
+
+	static void inotify_cb(struct ev_loop *loop, ev_io *w, int revents);
+	static void timer_cb(struct ev_loop *loop, ev_timer *t, int revents);
+
+	void info(const std::string& msg);
+	void fail(const std::string& msg);
+	void finish();
+	void burst();
+	bool gtid_due(const unsigned char *ev, size_t len);
+	void close_file();
+	bool read_index(std::vector<std::string>& files);
+	std::string resolve(const std::string& dir, const std::string& name) const;
+	bool open_file();
+	void check();
+	void advance();
+	bool next_in_index(std::string& next);
+
+	// These may fail, and close the file; callers check 'fd' afterwards.
+	const unsigned char *fetch(uint64_t off, size_t len, uint64_t size);
+	bool read_events(uint64_t size);
+	bool handle_event(const unsigned char *ev, size_t len);
+	bool query_ends_trx(uint64_t off, size_t len, uint64_t size, bool& ends);
+	void end_trx();
+	void deliver(const std::string& sid, int64_t gno);
+	bool has_gtid(const std::string& sid, int64_t gno) const;
+};
+
+#endif /* PROXYSQL_BINLOG_TAIL */
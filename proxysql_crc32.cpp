@@ -0,0 +1,199 @@
+#include "proxysql_crc32.h"
+
+#include <string.h>
+
+#include <zlib.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+// Older arm_acle.h only declares the CRC intrinsics when the extension is
+// enabled; only crc32_armv8() is built with it.
+#pragma GCC push_options
+#pragma GCC target("arch=armv8-a+crc")
+#include <arm_acle.h>
+#pragma GCC pop_options
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+namespace {
+
+typedef uint32_t (*crc32_fn)(uint32_t, const unsigned char*, size_t);
+
+uint32_t crc32_zlib(uint32_t crc, const unsigned char* buf, size_t len) {
+	// zlib takes a uInt length.
+	while (len > 0x40000000) {
+		crc = crc32(crc, buf, 0x40000000);
+		buf += 0x40000000;
+		len -= 0x40000000;
+	}
+	return crc32(crc, buf, uInt(len));
+}
+
+#if defined(__x86_64__)
+
+// Folding constants for the reflected polynomial 0xedb88320, from Intel's
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ" (as in
+// zlib's and Chromium's crc32_simd).
+const uint64_t k1k2[2] __attribute__((aligned(16))) = {0x0154442bd4ULL, 0x01c6e41596ULL};
+const uint64_t k3k4[2] __attribute__((aligned(16))) = {0x01751997d0ULL, 0x00ccaa009eULL};
+const uint64_t k5k0[2] __attribute__((aligned(16))) = {0x0163cd6124ULL, 0x0000000000ULL};
+const uint64_t poly[2] __attribute__((aligned(16))) = {0x01db710641ULL, 0x01f7011641ULL};
+
+// Folds 'len' bytes (a multiple of 16, at least 64) into the inverted CRC
+// 'crc'; returns the inverted CRC.
+__attribute__((target("pclmul,sse4.1")))
+uint32_t fold_pclmul(uint32_t crc, const unsigned char* buf, size_t len) {
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	buf += 64;
+	len -= 64;
+
+	// Four lanes of 128 bits, 64 bytes per iteration.
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buf += 64;
+		len -= 64;
+	}
+
+	// Fold the lanes into one.
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Remaining 16-byte blocks.
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	// 128 to 64 bits.
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits.
+	x0 = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return uint32_t(_mm_extract_epi32(x1, 1));
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const unsigned char* buf, size_t len) {
+	if (len >= 64) {
+		size_t chunk = len & ~size_t(15);
+		crc = ~fold_pclmul(~crc, buf, chunk);
+		buf += chunk;
+		len -= chunk;
+	}
+	return len ? crc32_zlib(crc, buf, len) : crc;
+}
+
+bool cpu_has_pclmul() {
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#elif defined(__aarch64__)
+
+#pragma GCC push_options
+#pragma GCC target("arch=armv8-a+crc")
+uint32_t crc32_armv8(uint32_t crc, const unsigned char* buf, size_t len) {
+	crc = ~crc;
+	while (len && (uintptr_t(buf) & 7)) {
+		crc = __crc32b(crc, *buf++);
+		len--;
+	}
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, buf, 8);
+		crc = __crc32d(crc, v);
+		buf += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = __crc32b(crc, *buf++);
+	}
+	return ~crc;
+}
+#pragma GCC pop_options
+
+#endif
+
+const char* impl_name = "zlib";
+
+crc32_fn pick() {
+#if defined(__x86_64__)
+	if (cpu_has_pclmul()) {
+		impl_name = "pclmul";
+		return crc32_pclmul;
+	}
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		impl_name = "armv8";
+		return crc32_armv8;
+	}
+#endif
+	return crc32_zlib;
+}
+
+// Resolved during static initialisation, before any thread starts.
+const crc32_fn impl = pick();
+
+}  // namespace
+
+uint32_t proxysql_crc32(uint32_t crc, const unsigned char* buf, size_t len) {
+	return impl(crc, buf, len);
+}
+
+const char* proxysql_crc32_impl() {
+	return impl_name;
+}
@@ -0,0 +1,23 @@
+#ifndef PROXYSQL_CRC32
+#define PROXYSQL_CRC32
+
+// CRC-32 (the zlib / binlog_checksum=CRC32 polynomial) for binlog event
+// checksums.
+//
+// On x86-64 with PCLMULQDQ and SSE4.1 the input is folded 64 bytes at a
+// time with carry-less multiplies; on ARMv8 with the CRC extension it uses
+// the crc32x instructions. Otherwise, and for short inputs, it falls back to
+// zlib's crc32(). The implementation is picked once, at startup, from what
+// the CPU reports.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Same contract as zlib's crc32(): 'crc' is 0 or the result of a previous
+// call over the preceding bytes.
+uint32_t proxysql_crc32(uint32_t crc, const unsigned char* buf, size_t len);
+
+// "pclmul", "armv8" or "zlib".
+const char* proxysql_crc32_impl();
+
+#endif /* PROXYSQL_CRC32 */
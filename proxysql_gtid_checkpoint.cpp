@@ -0,0 +1,210 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "proxysql_crc32.h"
+#include "proxysql_gtid_checkpoint.h"
+
+namespace {
+
+size_t align_up(size_t n) {
+	return (n + 63) & ~size_t(63);
+}
+
+size_t slot_offset(int i, size_t capacity) {
+	return align_up(sizeof(GTID_Checkpoint_Header)) + i * align_up(sizeof(GTID_Checkpoint_Slot) + capacity);
+}
+
+size_t file_size(size_t capacity) {
+	return slot_offset(2, capacity);
+}
+
+int64_t now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return int64_t(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+uint32_t slot_crc(const GTID_Checkpoint_Slot *s) {
+	uint32_t crc = proxysql_crc32(0, (const unsigned char *)&s->generation, sizeof(s->generation));
+	crc = proxysql_crc32(crc, (const unsigned char *)&s->written_ms, sizeof(s->written_ms));
+	crc = proxysql_crc32(crc, (const unsigned char *)&s->len, sizeof(s->len));
+	return proxysql_crc32(crc, (const unsigned char *)(s + 1), s->len);
+}
+
+}  // namespace
+
+GTID_Checkpoint::GTID_Checkpoint() {
+	fd = -1;
+	base = NULL;
+	size = 0;
+	hdr = NULL;
+	generation = 0;
+}
+
+GTID_Checkpoint::~GTID_Checkpoint() {
+	close();
+}
+
+GTID_Checkpoint_Slot *GTID_Checkpoint::slot(int i) const {
+	return (GTID_Checkpoint_Slot *)(base + slot_offset(i, hdr->slot_capacity));
+}
+
+// Maps the file at 'path' if it is a checkpoint of this version, of the size
+// its header implies.
+bool GTID_Checkpoint::map_existing() {
+	int nfd = ::open(path.c_str(), O_RDWR);
+	if (nfd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(nfd, &st) != 0 || size_t(st.st_size) < sizeof(GTID_Checkpoint_Header)) {
+		::close(nfd);
+		return false;
+	}
+	char *nbase = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, nfd, 0);
+	if (nbase == MAP_FAILED) {
+		::close(nfd);
+		return false;
+	}
+	const GTID_Checkpoint_Header *h = (const GTID_Checkpoint_Header *)nbase;
+	if (h->magic != GTID_CHECKPOINT_MAGIC || h->version != GTID_CHECKPOINT_VERSION
+	    || h->header_size != sizeof(GTID_Checkpoint_Header)
+	    || h->slot_capacity > size_t(st.st_size) || file_size(h->slot_capacity) != size_t(st.st_size)) {
+		munmap(nbase, st.st_size);
+		::close(nfd);
+		return false;
+	}
+	fd = nfd;
+	base = nbase;
+	size = st.st_size;
+	hdr = (GTID_Checkpoint_Header *)nbase;
+	return true;
+}
+
+// Builds a new file next to 'path' holding 'set', if any, and renames
+// it in place: the old checkpoint stays valid until the new one is.
+bool GTID_Checkpoint::create(size_t capacity, const std::string& set) {
+	std::string tmp = path + ".tmp";
+	int nfd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (nfd < 0) {
+		return false;
+	}
+	capacity = align_up(capacity);
+	const size_t nsize = file_size(capacity);
+	if (ftruncate(nfd, nsize) != 0) {
+		int myerr = errno;
+		::close(nfd);
+		unlink(tmp.c_str());
+		errno = myerr;
+		return false;
+	}
+	char *nbase = (char *)mmap(NULL, nsize, PROT_READ | PROT_WRITE, MAP_SHARED, nfd, 0);
+	if (nbase == MAP_FAILED) {
+		int myerr = errno;
+		::close(nfd);
+		unlink(tmp.c_str());
+		errno = myerr;
+		return false;
+	}
+	unmap();
+	fd = nfd;
+	base = nbase;
+	size = nsize;
+	hdr = (GTID_Checkpoint_Header *)nbase;
+	// ftruncate() zero-fills: both slots fail their CRC until written.
+	hdr->magic = GTID_CHECKPOINT_MAGIC;
+	hdr->version = GTID_CHECKPOINT_VERSION;
+	hdr->header_size = sizeof(GTID_Checkpoint_Header);
+	hdr->slot_capacity = capacity;
+	if (!set.empty()) {
+		fill(set);
+	}
+	if (msync(base, size, MS_SYNC) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+		int myerr = errno;
+		unmap();
+		unlink(tmp.c_str());
+		errno = myerr;
+		return false;
+	}
+	return true;
+}
+
+// Generation g lives in slot g % 2, so the next one overwrites the older
+// slot. Returns the slot written.
+GTID_Checkpoint_Slot *GTID_Checkpoint::fill(const std::string& set) {
+	generation++;
+	GTID_Checkpoint_Slot *s = slot(generation % 2);
+	s->generation = generation;
+	s->written_ms = now_ms();
+	s->len = set.size();
+	memcpy(s + 1, set.data(), set.size());
+	s->crc = slot_crc(s);
+	last = set;
+	return s;
+}
+
+void GTID_Checkpoint::unmap() {
+	if (hdr) {
+		munmap(base, size);
+		::close(fd);
+	}
+	fd = -1;
+	base = NULL;
+	size = 0;
+	hdr = NULL;
+}
+
+bool GTID_Checkpoint::open(const char *_path, std::string& set, int64_t& written_ms) {
+	path = _path;
+	generation = 0;
+	last.clear();
+	set.clear();
+	written_ms = 0;
+	if (!map_existing()) {
+		return create(GTID_CHECKPOINT_MIN_CAPACITY, std::string());
+	}
+	const GTID_Checkpoint_Slot *best = NULL;
+	for (int i = 0; i < 2; i++) {
+		const GTID_Checkpoint_Slot *s = slot(i);
+		if (s->generation == 0 || s->len > hdr->slot_capacity || s->crc != slot_crc(s)) {
+			continue;
+		}
+		if (best == NULL || s->generation > best->generation) {
+			best = s;
+		}
+	}
+	if (best) {
+		generation = best->generation;
+		set.assign((const char *)(best + 1), best->len);
+		written_ms = best->written_ms;
+		last = set;
+	}
+	return true;
+}
+
+void GTID_Checkpoint::close() {
+	unmap();
+}
+
+bool GTID_Checkpoint::write(const std::string& set) {
+	if (hdr == NULL) {
+		return false;
+	}
+	if (set == last) {
+		return true;
+	}
+	if (set.size() > hdr->slot_capacity) {
+		return create(set.size() * 2, set);
+	}
+	GTID_Checkpoint_Slot *s = fill(set);
+	// Page-aligned start, as msync() requires.
+	const size_t page = sysconf(_SC_PAGESIZE);
+	char *start = (char *)((uintptr_t)s & ~(uintptr_t)(page - 1));
+	msync(start, (char *)(s + 1) + set.size() - start, MS_ASYNC);
+	return true;
+}
@@ -0,0 +1,77 @@
+#ifndef PROXYSQL_GTID_CHECKPOINT
+#define PROXYSQL_GTID_CHECKPOINT
+
+// Persistent checkpoint of the reader's executed GTID set (-C).
+//
+// The file is mapped by the reader and holds, after a header, two slots
+// that are written alternately. Each slot has the set in the ST= form, a
+// generation number, the wall clock of the write and a CRC32 over all of
+// them. A write cut short by a crash leaves the other slot intact, and
+// loading picks the valid slot with the highest generation.
+//
+// Writes land in the page cache, and msync(MS_ASYNC) only schedules them:
+// a reader that crashed or was restarted finds the last checkpoint, a host
+// that crashed may find an older one. Either way the set is one the source
+// already executed, which the reader can serve at once and dump from.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define GTID_CHECKPOINT_MAGIC        0x31504b4344495447ULL  // "GTIDCKP1"
+#define GTID_CHECKPOINT_VERSION      1
+#define GTID_CHECKPOINT_MIN_CAPACITY (64 * 1024)
+
+struct GTID_Checkpoint_Header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	// Bytes of set text each slot can hold.
+	uint64_t slot_capacity;
+};
+
+// Followed by slot_capacity bytes of text. The CRC covers 'generation',
+// 'written_ms', 'len' and the text.
+struct GTID_Checkpoint_Slot {
+	uint64_t generation;
+	int64_t written_ms;
+	uint64_t len;
+	uint32_t crc;
+	uint32_t reserved;
+};
+
+class GTID_Checkpoint {
+	private:
+	std::string path;
+	int fd;
+	char *base;
+	size_t size;
+	GTID_Checkpoint_Header *hdr;
+	uint64_t generation;
+	// Last set written, to skip rewriting an unchanged one.
+	std::string last;
+
+	GTID_Checkpoint_Slot *slot(int i) const;
+	bool map_existing();
+	bool create(size_t capacity, const std::string& set);
+	GTID_Checkpoint_Slot *fill(const std::string& set);
+	void unmap();
+
+	public:
+	GTID_Checkpoint();
+	~GTID_Checkpoint();
+
+	// Opens the checkpoint at '_path', creating it when it is missing or
+	// not a valid checkpoint. 'set' receives the newest valid set, empty if
+	// there is none, and 'written_ms' the wall clock it was written at.
+	// False with errno set when the file cannot be created.
+	bool open(const char *_path, std::string& set, int64_t& written_ms);
+	void close();
+	bool is_open() const { return hdr != NULL; }
+
+	// Writes 'set' over the older slot. A set larger than a slot moves the
+	// checkpoint to a bigger file.
+	bool write(const std::string& set);
+};
+
+#endif /* PROXYSQL_GTID_CHECKPOINT */
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "proxysql_gtid_shm.h"
+
+namespace {
+
+// Aligns the ring and the snapshot on cache lines.
+size_t align_up(size_t n) {
+	return (n + 63) & ~size_t(63);
+}
+
+size_t ring_offset() {
+	return align_up(sizeof(GTID_Shm_Header));
+}
+
+size_t snapshot_offset() {
+	return ring_offset() + align_up(sizeof(GTID_Shm_Update) * GTID_SHM_RING_SIZE);
+}
+
+// read_snapshot() retries while the writer holds the seqlock: busy for the
+// first tries, then yielding, then sleeping 1 ms, for about a second in all.
+const int SNAPSHOT_SPINS = 64;
+const int SNAPSHOT_YIELDS = 1024;
+const int SNAPSHOT_TRIES = SNAPSHOT_YIELDS + 1000;
+
+// A writer killed between the two stores of the seqlock leaves it odd for
+// good, and the region ACTIVE.
+bool writer_gone(const GTID_Shm_Header *hdr) {
+	if (hdr->state.load(std::memory_order_acquire) != GTID_SHM_STATE_ACTIVE) {
+		return true;
+	}
+	return hdr->writer_pid > 0 && kill(pid_t(hdr->writer_pid), 0) != 0 && errno == ESRCH;
+}
+
+int64_t now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return int64_t(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+}  // namespace
+
+GTID_Shm_Writer::GTID_Shm_Writer() {
+	fd = -1;
+	base = NULL;
+	size = 0;
+	hdr = NULL;
+	ring = NULL;
+	snapshot = NULL;
+	seq = 0;
+}
+
+GTID_Shm_Writer::~GTID_Shm_Writer() {
+	close();
+}
+
+// Creates a new region next to 'path' and atomically renames it in place, so
+// consumers never map a half-initialized file.
+bool GTID_Shm_Writer::create(size_t snapshot_capacity) {
+	std::string tmp = path + ".tmp";
+	int nfd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (nfd < 0) {
+		return false;
+	}
+	size_t nsize = snapshot_offset() + align_up(snapshot_capacity);
+	if (ftruncate(nfd, nsize) != 0) {
+		int myerr = errno;
+		::close(nfd);
+		unlink(tmp.c_str());
+		errno = myerr;
+		return false;
+	}
+	char *nbase = (char *)mmap(NULL, nsize, PROT_READ | PROT_WRITE, MAP_SHARED, nfd, 0);
+	if (nbase == MAP_FAILED) {
+		int myerr = errno;
+		::close(nfd);
+		unlink(tmp.c_str());
+		errno = myerr;
+		return false;
+	}
+
+	// ftruncate() zero-fills, which is a valid initial state for every field.
+	GTID_Shm_Header *nhdr = (GTID_Shm_Header *)nbase;
+	nhdr->magic = GTID_SHM_MAGIC;
+	nhdr->version = GTID_SHM_VERSION;
+	nhdr->header_size = sizeof(GTID_Shm_Header);
+	nhdr->region_size = nsize;
+	nhdr->ring_size = GTID_SHM_RING_SIZE;
+	nhdr->update_size = sizeof(GTID_Shm_Update);
+	nhdr->snapshot_capacity = align_up(snapshot_capacity);
+	nhdr->writer_pid = getpid();
+	nhdr->update_seq.store(seq, std::memory_order_relaxed);
+	nhdr->publish_time_ms.store(now_ms(), std::memory_order_relaxed);
+	nhdr->source_event_time_ms.store(hdr ? hdr->source_event_time_ms.load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+	nhdr->stale.store(hdr ? hdr->stale.load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+	nhdr->state.store(GTID_SHM_STATE_ACTIVE, std::memory_order_release);
+
+	if (rename(tmp.c_str(), path.c_str()) != 0) {
+		int myerr = errno;
+		munmap(nbase, nsize);
+		::close(nfd);
+		unlink(tmp.c_str());
+		errno = myerr;
+		return false;
+	}
+
+	// Consumers of the previous region are told to reopen the path.
+	unmap(GTID_SHM_STATE_SUPERSEDED);
+
+	fd = nfd;
+	base = nbase;
+	size = nsize;
+	hdr = nhdr;
+	ring = (GTID_Shm_Update *)(base + ring_offset());
+	snapshot = base + snapshot_offset();
+	return true;
+}
+
+void GTID_Shm_Writer::unmap(uint32_t final_state) {
+	if (hdr) {
+		hdr->state.store(final_state, std::memory_order_release);
+		munmap(base, size);
+		::close(fd);
+	}
+	fd = -1;
+	base = NULL;
+	size = 0;
+	hdr = NULL;
+	ring = NULL;
+	snapshot = NULL;
+}
+
+bool GTID_Shm_Writer::open(const char *_path, size_t snapshot_capacity) {
+	path = _path;
+	if (snapshot_capacity < GTID_SHM_MIN_SNAPSHOT_SIZE) {
+		snapshot_capacity = GTID_SHM_MIN_SNAPSHOT_SIZE;
+	}
+	return create(snapshot_capacity);
+}
+
+// Marks the region closed and unlinks it. Consumers keep their mapping until
+// they notice the state change.
+void GTID_Shm_Writer::close() {
+	if (hdr) {
+		unmap(GTID_SHM_STATE_CLOSED);
+		unlink(path.c_str());
+	}
+}
+
+// Appends one interval to the ring.
+void GTID_Shm_Writer::publish_update(const char *uuid, trxid_t start, trxid_t end) {
+	if (hdr == NULL) {
+		return;
+	}
+	seq++;
+	GTID_Shm_Update& e = ring[seq % GTID_SHM_RING_SIZE];
+	e.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	strncpy(e.uuid, uuid, GTID_SHM_UUID_LEN);
+	e.start = start;
+	e.end = end;
+	e.seq.store(seq, std::memory_order_release);
+	hdr->update_seq.store(seq, std::memory_order_release);
+	hdr->publish_time_ms.store(now_ms(), std::memory_order_relaxed);
+}
+
+// Rewrites the snapshot; it covers every update published so far. A snapshot
+// larger than the region's capacity moves the publication to a bigger region.
+bool GTID_Shm_Writer::publish_snapshot(const std::string& s) {
+	if (hdr == NULL) {
+		return false;
+	}
+	if (s.size() > hdr->snapshot_capacity) {
+		if (!create(s.size() * 2)) {
+			return false;
+		}
+	}
+	uint64_t lock = hdr->snapshot_lock.load(std::memory_order_relaxed);
+	hdr->snapshot_lock.store(lock + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(snapshot, s.data(), s.size());
+	hdr->snapshot_len = s.size();
+	hdr->snapshot_seq = seq;
+	hdr->snapshot_lock.store(lock + 2, std::memory_order_release);
+	hdr->publish_time_ms.store(now_ms(), std::memory_order_relaxed);
+	return true;
+}
+
+// The snapshot is refreshed before the ring wraps past it, so a consumer that
+// just took a snapshot can always catch up from the ring.
+bool GTID_Shm_Writer::snapshot_due() const {
+	return hdr && (seq - hdr->snapshot_seq) >= GTID_SHM_RING_SIZE / 2;
+}
+
+void GTID_Shm_Writer::publish_source_event_time(int64_t ms) {
+	if (hdr) {
+		hdr->source_event_time_ms.store(ms, std::memory_order_relaxed);
+	}
+}
+
+void GTID_Shm_Writer::publish_stale(bool stale) {
+	if (hdr) {
+		hdr->stale.store(stale ? 1 : 0, std::memory_order_release);
+	}
+}
+
+GTID_Shm_Reader::GTID_Shm_Reader() {
+	base = NULL;
+	size = 0;
+	hdr = NULL;
+	ring = NULL;
+	snapshot = NULL;
+}
+
+GTID_Shm_Reader::~GTID_Shm_Reader() {
+	close();
+}
+
+bool GTID_Shm_Reader::open(const char *_path) {
+	close();
+	path = _path;
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < snapshot_offset()) {
+		::close(fd);
+		errno = EINVAL;
+		return false;
+	}
+	char *nbase = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (nbase == MAP_FAILED) {
+		return false;
+	}
+	const GTID_Shm_Header *nhdr = (const GTID_Shm_Header *)nbase;
+	if (
+		nhdr->magic != GTID_SHM_MAGIC || nhdr->version != GTID_SHM_VERSION ||
+		nhdr->header_size != sizeof(GTID_Shm_Header) || nhdr->region_size != size_t(st.st_size) ||
+		nhdr->ring_size != GTID_SHM_RING_SIZE || nhdr->update_size != sizeof(GTID_Shm_Update)
+	) {
+		munmap(nbase, st.st_size);
+		errno = EINVAL;
+		return false;
+	}
+	base = nbase;
+	size = st.st_size;
+	hdr = nhdr;
+	ring = (const GTID_Shm_Update *)(base + ring_offset());
+	snapshot = base + snapshot_offset();
+	return true;
+}
+
+void GTID_Shm_Reader::close() {
+	if (base) {
+		munmap(base, size);
+	}
+	base = NULL;
+	size = 0;
+	hdr = NULL;
+	ring = NULL;
+	snapshot = NULL;
+}
+
+bool GTID_Shm_Reader::superseded() const {
+	return hdr == NULL || hdr->state.load(std::memory_order_acquire) != GTID_SHM_STATE_ACTIVE;
+}
+
+bool GTID_Shm_Reader::reopen() {
+	std::string p = path;
+	return open(p.c_str());
+}
+
+uint64_t GTID_Shm_Reader::last_seq() const {
+	return hdr ? hdr->update_seq.load(std::memory_order_acquire) : 0;
+}
+
+int64_t GTID_Shm_Reader::source_event_time_ms() const {
+	return hdr ? hdr->source_event_time_ms.load(std::memory_order_relaxed) : 0;
+}
+
+bool GTID_Shm_Reader::stale() const {
+	return hdr && hdr->stale.load(std::memory_order_acquire) != 0;
+}
+
+bool GTID_Shm_Reader::read_snapshot(std::string& out, uint64_t& upto_seq) const {
+	if (hdr == NULL) {
+		return false;
+	}
+	for (int tries = 0; tries < SNAPSHOT_TRIES; tries++) {
+		if (tries >= SNAPSHOT_SPINS) {
+			if (writer_gone(hdr)) {
+				return false;
+			}
+			if (tries < SNAPSHOT_YIELDS) {
+				sched_yield();
+			} else {
+				usleep(1000);
+			}
+		}
+		uint64_t l1 = hdr->snapshot_lock.load(std::memory_order_acquire);
+		if (l1 & 1) {
+			continue;
+		}
+		uint64_t len = hdr->snapshot_len;
+		uint64_t upto = hdr->snapshot_seq;
+		if (len > hdr->snapshot_capacity) {
+			// torn read, the lock check below rejects it
+			len = 0;
+		}
+		out.assign(snapshot, len);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t l2 = hdr->snapshot_lock.load(std::memory_order_relaxed);
+		if (l1 == l2) {
+			upto_seq = upto;
+			return true;
+		}
+	}
+	return false;
+}
+
+int GTID_Shm_Reader::read_update(uint64_t n, GTID_Shm_Entry& out) const {
+	if (hdr == NULL || n == 0) {
+		return -1;
+	}
+	uint64_t last = hdr->update_seq.load(std::memory_order_acquire);
+	if (n > last) {
+		return 0;
+	}
+	if (last - n >= GTID_SHM_RING_SIZE) {
+		return -1;
+	}
+	const GTID_Shm_Update& e = ring[n % GTID_SHM_RING_SIZE];
+	if (e.seq.load(std::memory_order_acquire) != n) {
+		return -1;
+	}
+	char uuid[GTID_SHM_UUID_LEN];
+	memcpy(uuid, e.uuid, GTID_SHM_UUID_LEN);
+	int64_t start = e.start;
+	int64_t end = e.end;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (e.seq.load(std::memory_order_relaxed) != n) {
+		return -1;
+	}
+	out.seq = n;
+	out.uuid.assign(uuid, strnlen(uuid, GTID_SHM_UUID_LEN));
+	out.interval = TrxId_Interval(start, end);
+	return 1;
+}
@@ -0,0 +1,165 @@
+#ifndef PROXYSQL_GTID_SHM
+#define PROXYSQL_GTID_SHM
+
+// Shared-memory publication of the reader's GTID state.
+//
+// The region is a file (typically under /dev/shm) mapped by one writer, the
+// reader's event loop, and any number of read-only consumers on the same host.
+// It holds:
+//
+//   - a header with the sequence counters;
+//   - a ring of the most recent updates, one entry per trxid interval;
+//   - a text snapshot of the whole executed set, in the same format as the
+//     body of an ST= line, guarded by a seqlock.
+//
+// A consumer takes a snapshot, which tells it the last update sequence number
+// the snapshot already includes, and then follows the ring from the next one.
+// When it falls more than a ring behind, it takes a new snapshot. Neither path
+// involves a syscall once the region is mapped.
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "proxysql_gtid.h"
+
+#define GTID_SHM_MAGIC             0x314d485344495447ULL  // "GTIDSHM1"
+#define GTID_SHM_VERSION           2
+#define GTID_SHM_RING_SIZE         4096
+#define GTID_SHM_UUID_LEN          32
+#define GTID_SHM_MIN_SNAPSHOT_SIZE (4 * 1024 * 1024)
+
+#define GTID_SHM_STATE_ACTIVE      1
+#define GTID_SHM_STATE_SUPERSEDED  2
+#define GTID_SHM_STATE_CLOSED      3
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared-memory publication needs lock-free 64-bit atomics");
+
+// One ring entry: a trxid interval for a UUID, in the same form as an I3= line
+// (hex UUID without dashes). 'seq' is written last and doubles as the entry's
+// validity marker: 0 while the entry is being rewritten.
+struct GTID_Shm_Update {
+	std::atomic<uint64_t> seq;
+	char uuid[GTID_SHM_UUID_LEN];
+	int64_t start;
+	int64_t end;
+};
+
+struct GTID_Shm_Header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t region_size;
+	uint32_t ring_size;
+	uint32_t update_size;
+	uint64_t snapshot_capacity;
+	int64_t writer_pid;
+
+	std::atomic<uint32_t> state;
+	// 1 while the published set comes from the reader's checkpoint (-C) and
+	// the binlog stream has not caught up with the source yet.
+	std::atomic<uint32_t> stale;
+
+	// Highest published ring sequence number; 0 when nothing was published.
+	std::atomic<uint64_t> update_seq;
+	// Wall clock of the last publication, in milliseconds.
+	std::atomic<int64_t> publish_time_ms;
+	// Wall clock of the last data the reader received from the source,
+	// heartbeats included, in milliseconds; 0 before the first. Unlike
+	// publish_time_ms it keeps moving while the source is idle, so its age
+	// tells a quiet source from a stalled stream.
+	std::atomic<int64_t> source_event_time_ms;
+
+	// Seqlock over snapshot_len, snapshot_seq and the snapshot text: odd
+	// while the writer is rewriting them.
+	std::atomic<uint64_t> snapshot_lock;
+	uint64_t snapshot_len;
+	// Last ring sequence number already folded into the snapshot.
+	uint64_t snapshot_seq;
+};
+
+// Copy of a ring entry, as returned to consumers.
+struct GTID_Shm_Entry {
+	uint64_t seq;
+	std::string uuid;
+	TrxId_Interval interval;
+
+	GTID_Shm_Entry() : seq(0), interval(trxid_t(0)) {}
+};
+
+// Writer side, owned by the reader's event loop.
+class GTID_Shm_Writer {
+	private:
+	std::string path;
+	int fd;
+	char *base;
+	size_t size;
+	GTID_Shm_Header *hdr;
+	GTID_Shm_Update *ring;
+	char *snapshot;
+	uint64_t seq;
+
+	bool create(size_t snapshot_capacity);
+	void unmap(uint32_t final_state);
+
+	public:
+	GTID_Shm_Writer();
+	~GTID_Shm_Writer();
+
+	bool open(const char *_path, size_t snapshot_capacity = GTID_SHM_MIN_SNAPSHOT_SIZE);
+	void close();
+	bool is_open() const { return hdr != NULL; }
+
+	void publish_update(const char *uuid, trxid_t start, trxid_t end);
+	bool publish_snapshot(const std::string& s);
+	bool snapshot_due() const;
+	void publish_source_event_time(int64_t ms);
+	void publish_stale(bool stale);
+};
+
+// Consumer side. Maps the region read-only.
+class GTID_Shm_Reader {
+	private:
+	std::string path;
+	char *base;
+	size_t size;
+	const GTID_Shm_Header *hdr;
+	const GTID_Shm_Update *ring;
+	const char *snapshot;
+
+	public:
+	GTID_Shm_Reader();
+	~GTID_Shm_Reader();
+
+	bool open(const char *_path);
+	void close();
+	bool is_open() const { return hdr != NULL; }
+
+	// True when the writer replaced or closed this region; reopen() to follow it.
+	bool superseded() const;
+	bool reopen();
+
+	// Highest published update sequence number.
+	uint64_t last_seq() const;
+
+	// Wall clock of the last data from the source, in milliseconds.
+	int64_t source_event_time_ms() const;
+
+	// True while the set may lag behind the source: it was restored from
+	// the reader's checkpoint, and the binlog stream is still catching up.
+	bool stale() const;
+
+	// Copies a consistent snapshot. 'upto_seq' receives the last update
+	// sequence number the snapshot already includes. False when none could
+	// be taken within about a second, at once if the writer is gone or the
+	// region superseded: reopen() if superseded(), else fall back to the
+	// reader's listener.
+	bool read_snapshot(std::string& out, uint64_t& upto_seq) const;
+
+	// Reads update 'n'. Returns 1 on success, 0 when it was not published
+	// yet, -1 when it was already overwritten and a new snapshot is needed.
+	int read_update(uint64_t n, GTID_Shm_Entry& out) const;
+};
+
+#endif /* PROXYSQL_GTID_SHM */
@@ -0,0 +1,512 @@
+#include <string.h>
+
+#include "proxysql_gtid_wire.h"
+
+namespace {
+
+// Longest payload of an UPDATE frame: three 10-byte varints.
+const size_t UPDATE_PAYLOAD_MAX = 30;
+
+inline uint64_t zigzag(int64_t v) {
+	return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+	return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+inline size_t put_varint(unsigned char* buf, uint64_t v) {
+	size_t n = 0;
+	while (v >= 0x80) {
+		buf[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (unsigned char)v;
+	return n;
+}
+
+inline int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// 32 hex digits to 16 bytes; false for anything else.
+bool uuid_to_bytes(const std::string& uuid, unsigned char* out) {
+	if (uuid.size() != 32) {
+		return false;
+	}
+	for (size_t i = 0; i < 16; i++) {
+		int hi = hex_value(uuid[2*i]);
+		int lo = hex_value(uuid[2*i+1]);
+		if (hi < 0 || lo < 0) {
+			return false;
+		}
+		out[i] = (unsigned char)((hi << 4) | lo);
+	}
+	return true;
+}
+
+std::string uuid_from_bytes(const unsigned char* in) {
+	static const char digits[] = "0123456789abcdef";
+	std::string uuid(32, '0');
+	for (size_t i = 0; i < 16; i++) {
+		uuid[2*i] = digits[in[i] >> 4];
+		uuid[2*i+1] = digits[in[i] & 0x0f];
+	}
+	return uuid;
+}
+
+std::string dashed_uuid(const std::string& uuid) {
+	std::string s = uuid;
+	if (s.size() == 32) {
+		s.insert(8,"-");
+		s.insert(13,"-");
+		s.insert(18,"-");
+		s.insert(23,"-");
+	}
+	return s;
+}
+
+void append_interval(std::string& out, const TrxId_Interval& iv) {
+	out += std::to_string(iv.start);
+	if (iv.start != iv.end) {
+		out += "-";
+		out += std::to_string(iv.end);
+	}
+}
+
+// Strict "N" or "N-M" with 0 < N <= M.
+bool parse_interval(const std::string& s, trxid_t& start, trxid_t& end) {
+	size_t dash = s.find('-');
+	std::string a = s.substr(0, dash);
+	std::string b = (dash == std::string::npos) ? a : s.substr(dash + 1);
+	if (
+		a.empty() || b.empty() || a.size() > 18 || b.size() > 18 ||
+		a.find_first_not_of("0123456789") != std::string::npos ||
+		b.find_first_not_of("0123456789") != std::string::npos
+	) {
+		return false;
+	}
+	start = std::stoll(a);
+	end = std::stoll(b);
+	return start > 0 && start <= end;
+}
+
+}  // namespace
+
+bool gtid_wire_parse_set(const std::string& s, GTID_Set& out) {
+	size_t pos = 0;
+	while (pos < s.size()) {
+		size_t comma = s.find(',', pos);
+		if (comma == std::string::npos) {
+			comma = s.size();
+		}
+		std::string entry = s.substr(pos, comma - pos);
+		pos = comma + 1;
+		size_t colon = entry.find(':');
+		if (colon == std::string::npos) {
+			return false;
+		}
+		std::string uuid;
+		for (size_t i = 0; i < colon; i++) {
+			if (entry[i] != '-') uuid += entry[i];
+		}
+		unsigned char raw[16];
+		if (!uuid_to_bytes(uuid, raw)) {
+			return false;
+		}
+		for (size_t i = 0; i < uuid.size(); i++) {
+			uuid[i] = tolower(uuid[i]);
+		}
+		while (colon != std::string::npos) {
+			size_t next = entry.find(':', colon + 1);
+			trxid_t start, end;
+			if (!parse_interval(entry.substr(colon + 1, next == std::string::npos ? std::string::npos : next - colon - 1), start, end)) {
+				return false;
+			}
+			out.add(uuid, start, end);
+			colon = next;
+		}
+	}
+	return true;
+}
+
+bool gtid_wire_set_diff(const GTID_Set& have, const GTID_Set& known, GTID_Set& diff) {
+	for (auto kit = known.map.begin(); kit != known.map.end(); ++kit) {
+		auto hit = have.map.find(kit->first);
+		if (hit == have.map.end()) {
+			if (!kit->second.empty()) {
+				return false;
+			}
+			continue;
+		}
+		// Both lists are sorted and merged: each known interval must fall
+		// within one of ours.
+		auto h = hit->second.begin();
+		for (auto k = kit->second.begin(); k != kit->second.end(); ++k) {
+			while (h != hit->second.end() && h->end < k->start) {
+				++h;
+			}
+			if (h == hit->second.end() || h->start > k->start || h->end < k->end) {
+				return false;
+			}
+		}
+	}
+	for (auto hit = have.map.begin(); hit != have.map.end(); ++hit) {
+		auto kit = known.map.find(hit->first);
+		if (kit == known.map.end()) {
+			for (auto h = hit->second.begin(); h != hit->second.end(); ++h) {
+				diff.add(hit->first, *h);
+			}
+			continue;
+		}
+		auto k = kit->second.begin();
+		for (auto h = hit->second.begin(); h != hit->second.end(); ++h) {
+			trxid_t next = h->start;
+			while (k != kit->second.end() && k->end < next) {
+				++k;
+			}
+			for (auto kk = k; kk != kit->second.end() && kk->start <= h->end; ++kk) {
+				if (kk->start > next) {
+					diff.add(hit->first, next, kk->start - 1);
+				}
+				next = kk->end + 1;
+			}
+			if (next <= h->end) {
+				diff.add(hit->first, next, h->end);
+			}
+		}
+	}
+	return true;
+}
+
+void gtid_wire_put_varint(std::string& out, uint64_t v) {
+	unsigned char buf[10];
+	out.append((const char *)buf, put_varint(buf, v));
+}
+
+bool gtid_wire_get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v) {
+	v = 0;
+	for (int shift = 0; shift < 70 && p < end; shift += 7) {
+		unsigned char b = *p++;
+		v |= uint64_t(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+GTID_Wire_Encoder::GTID_Wire_Encoder(int _proto) {
+	proto = _proto;
+}
+
+void GTID_Wire_Encoder::set_proto(int _proto) {
+	proto = _proto;
+	last_uuid.clear();
+	ids.clear();
+	last_end.clear();
+}
+
+void GTID_Wire_Encoder::frame(std::string& out, unsigned char type, const unsigned char* payload, size_t len) {
+	unsigned char hdr[11];
+	hdr[0] = type;
+	size_t n = 1 + put_varint(hdr + 1, len);
+	out.append((const char *)hdr, n);
+	out.append((const char *)payload, len);
+}
+
+// Returns the id of a UUID, defining it on the stream first if needed.
+uint64_t GTID_Wire_Encoder::uuid_id(std::string& out, const std::string& uuid) {
+	auto it = ids.find(uuid);
+	if (it != ids.end()) {
+		return it->second;
+	}
+	uint64_t id = last_end.size();
+	ids[uuid] = id;
+	last_end.push_back(0);
+
+	std::string payload;
+	gtid_wire_put_varint(payload, id);
+	unsigned char raw[16];
+	if (uuid_to_bytes(uuid, raw)) {
+		payload.append((const char *)raw, 16);
+	} else {
+		payload += uuid;
+	}
+	frame(out, GTID_WIRE_UUID, (const unsigned char *)payload.data(), payload.size());
+	return id;
+}
+
+void GTID_Wire_Encoder::snapshot(std::string& out, const GTID_Set& set, bool per_interval) {
+	if (proto == GTID_WIRE_PROTO_TEXT) {
+		out += "ST=";
+		bool first = true;
+		for (auto it = set.map.begin(); it != set.map.end(); ++it) {
+			std::string uuid = dashed_uuid(it->first);
+			if (per_interval) {
+				for (auto itr = it->second.begin(); itr != it->second.end(); ++itr) {
+					if (!first) out += ",";
+					out += uuid + ":";
+					append_interval(out, *itr);
+					first = false;
+				}
+			} else {
+				if (!first) out += ",";
+				out += uuid;
+				for (auto itr = it->second.begin(); itr != it->second.end(); ++itr) {
+					out += ":";
+					append_interval(out, *itr);
+				}
+				first = false;
+			}
+		}
+		out += "\n";
+		return;
+	}
+
+	std::vector<uint64_t> set_ids;
+	for (auto it = set.map.begin(); it != set.map.end(); ++it) {
+		set_ids.push_back(uuid_id(out, it->first));
+	}
+	std::string payload;
+	gtid_wire_put_varint(payload, set.map.size());
+	size_t i = 0;
+	for (auto it = set.map.begin(); it != set.map.end(); ++it, ++i) {
+		gtid_wire_put_varint(payload, set_ids[i]);
+		gtid_wire_put_varint(payload, it->second.size());
+		trxid_t prev = 0;
+		for (auto itr = it->second.begin(); itr != it->second.end(); ++itr) {
+			gtid_wire_put_varint(payload, zigzag(itr->start - prev));
+			gtid_wire_put_varint(payload, uint64_t(itr->end - itr->start));
+			prev = itr->end;
+		}
+		last_end[set_ids[i]] = prev;
+	}
+	frame(out, GTID_WIRE_SNAPSHOT, (const unsigned char *)payload.data(), payload.size());
+}
+
+void GTID_Wire_Encoder::update(std::string& out, const std::string& uuid, trxid_t trxid) {
+	if (proto == GTID_WIRE_PROTO_TEXT) {
+		if (last_uuid != uuid) {
+			last_uuid = uuid;
+			out += "I1=" + uuid + ":" + std::to_string(trxid) + "\n";
+		} else {
+			out += "I2=" + std::to_string(trxid) + "\n";
+		}
+		return;
+	}
+	update(out, uuid, TrxId_Interval(trxid));
+}
+
+void GTID_Wire_Encoder::update(std::string& out, const std::string& uuid, const TrxId_Interval& iv) {
+	if (proto == GTID_WIRE_PROTO_TEXT) {
+		if (last_uuid != uuid) {
+			last_uuid = uuid;
+			out += "I3=" + uuid + ":";
+		} else {
+			out += "I4=";
+		}
+		append_interval(out, iv);
+		out += "\n";
+		return;
+	}
+
+	uint64_t id = uuid_id(out, uuid);
+	unsigned char payload[UPDATE_PAYLOAD_MAX];
+	size_t n = put_varint(payload, id);
+	n += put_varint(payload + n, zigzag(iv.start - last_end[id]));
+	n += put_varint(payload + n, uint64_t(iv.end - iv.start));
+	last_end[id] = iv.end;
+	frame(out, GTID_WIRE_UPDATE, payload, n);
+}
+
+void GTID_Wire_Encoder::heartbeat(std::string& out, uint64_t now_ms) {
+	if (proto == GTID_WIRE_PROTO_TEXT) {
+		out += "HB=" + std::to_string(now_ms) + "\n";
+		return;
+	}
+	unsigned char payload[10];
+	frame(out, GTID_WIRE_HEARTBEAT, payload, put_varint(payload, now_ms));
+}
+
+long GTID_Wire_Decoder::decode(const char* buf, size_t len, GTID_Wire_Msg& msg) {
+	const unsigned char* p = (const unsigned char *)buf;
+	const unsigned char* end = p + len;
+	if (p == end) {
+		return 0;
+	}
+	unsigned char type = *p++;
+	uint64_t plen;
+	const unsigned char* lp = p;
+	if (!gtid_wire_get_varint(p, end, plen)) {
+		// Either truncated, or a varint that can never end.
+		return (end - lp) >= 10 ? -1 : 0;
+	}
+	if (plen > size_t(end - p)) {
+		return 0;
+	}
+	const unsigned char* pend = p + plen;
+	long consumed = long(pend - (const unsigned char *)buf);
+
+	msg.type = type;
+	uint64_t id, n, v, d;
+	switch (type) {
+		case GTID_WIRE_UUID: {
+			if (!gtid_wire_get_varint(p, pend, id) || id > uuids.size()) {
+				return -1;
+			}
+			if (id == uuids.size()) {
+				uuids.push_back(std::string());
+				last_end.push_back(0);
+			}
+			// An existing id is redefined when the sender restarts its table.
+			if (pend - p == 16) {
+				uuids[id] = uuid_from_bytes(p);
+			} else {
+				uuids[id] = std::string((const char *)p, pend - p);
+			}
+			last_end[id] = 0;
+			return consumed;
+		}
+		case GTID_WIRE_SNAPSHOT: {
+			if (!gtid_wire_get_varint(p, pend, n)) {
+				return -1;
+			}
+			msg.set.clear();
+			for (uint64_t i = 0; i < n; i++) {
+				uint64_t nivs;
+				if (!gtid_wire_get_varint(p, pend, id) || id >= uuids.size() || !gtid_wire_get_varint(p, pend, nivs)) {
+					return -1;
+				}
+				trxid_t prev = 0;
+				for (uint64_t j = 0; j < nivs; j++) {
+					if (!gtid_wire_get_varint(p, pend, d) || !gtid_wire_get_varint(p, pend, v)) {
+						return -1;
+					}
+					trxid_t start = prev + unzigzag(d);
+					prev = start + trxid_t(v);
+					msg.set.add(uuids[id], start, prev);
+				}
+				last_end[id] = prev;
+			}
+			return p == pend ? consumed : -1;
+		}
+		case GTID_WIRE_UPDATE: {
+			if (
+				!gtid_wire_get_varint(p, pend, id) || id >= uuids.size() ||
+				!gtid_wire_get_varint(p, pend, d) || !gtid_wire_get_varint(p, pend, v)
+			) {
+				return -1;
+			}
+			msg.start = last_end[id] + unzigzag(d);
+			msg.end = msg.start + trxid_t(v);
+			msg.uuid = uuids[id];
+			last_end[id] = msg.end;
+			return p == pend ? consumed : -1;
+		}
+		case GTID_WIRE_HEARTBEAT: {
+			if (!gtid_wire_get_varint(p, pend, v)) {
+				return -1;
+			}
+			msg.start = trxid_t(v);
+			return consumed;
+		}
+		default:
+			// Unknown frame types are skipped.
+			return consumed;
+	}
+}
+
+GTID_Wire_Deflater::GTID_Wire_Deflater() {
+	memset(&zs, 0, sizeof(zs));
+	active = false;
+}
+
+GTID_Wire_Deflater::~GTID_Wire_Deflater() {
+	if (active) {
+		deflateEnd(&zs);
+	}
+}
+
+bool GTID_Wire_Deflater::init(int level) {
+	if (active) {
+		return true;
+	}
+	active = (deflateInit(&zs, level) == Z_OK);
+	return active;
+}
+
+bool GTID_Wire_Deflater::resume(int level) {
+	if (active) {
+		return true;
+	}
+	active = (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+	return active;
+}
+
+bool GTID_Wire_Deflater::write(std::string& out, const char* buf, size_t len) {
+	zs.next_in = (Bytef *)buf;
+	zs.avail_in = (uInt)len;
+	size_t off = out.size();
+	// A sync flush adds at most 6 bytes past the usual bound.
+	size_t room = deflateBound(&zs, (uLong)len) + 6;
+	do {
+		out.resize(off + room);
+		zs.next_out = (Bytef *)&out[off];
+		zs.avail_out = (uInt)room;
+		if (deflate(&zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+			out.resize(off);
+			return false;
+		}
+		off += room - zs.avail_out;
+		room = 256;
+	} while (zs.avail_out == 0);
+	out.resize(off);
+	return true;
+}
+
+GTID_Wire_Inflater::GTID_Wire_Inflater() {
+	memset(&zs, 0, sizeof(zs));
+	active = false;
+}
+
+GTID_Wire_Inflater::~GTID_Wire_Inflater() {
+	end();
+}
+
+bool GTID_Wire_Inflater::init() {
+	end();
+	active = (inflateInit(&zs) == Z_OK);
+	return active;
+}
+
+void GTID_Wire_Inflater::end() {
+	if (active) {
+		inflateEnd(&zs);
+		memset(&zs, 0, sizeof(zs));
+		active = false;
+	}
+}
+
+bool GTID_Wire_Inflater::write(std::string& out, const char* buf, size_t len) {
+	zs.next_in = (Bytef *)buf;
+	zs.avail_in = (uInt)len;
+	do {
+		unsigned char chunk[16384];
+		zs.next_out = chunk;
+		zs.avail_out = sizeof(chunk);
+		int rc = inflate(&zs, Z_SYNC_FLUSH);
+		if (rc != Z_OK && rc != Z_BUF_ERROR) {
+			return false;
+		}
+		out.append((const char *)chunk, sizeof(chunk) - zs.avail_out);
+		if (rc == Z_BUF_ERROR) {
+			// no progress possible: all input was consumed
+			break;
+		}
+	} while (zs.avail_in || zs.avail_out == 0);
+	return true;
+}
@@ -0,0 +1,162 @@
+#ifndef PROXYSQL_GTID_WIRE
+#define PROXYSQL_GTID_WIRE
+
+// Encoders for the GTID stream sent to clients.
+//
+// The text protocol is the historical one: an ST= line with the executed
+// set, then I1/I2 lines (one trxid) or I3/I4 lines (one interval). I2/I4
+// omit the UUID when it is the same as the previous line's. Clients that
+// negotiated heartbeats also get "HB=<sender wall clock, ms>" lines.
+//
+// A client can negotiate the binary protocol by sending "HELLO proto=bin".
+// Every binary frame is:
+//
+//   type (1 byte) | payload length (varint) | payload
+//
+// Integers are unsigned LEB128 varints; signed deltas are zigzag-encoded
+// first. Frame types:
+//
+//   GTID_WIRE_UUID      id, uuid (16 bytes, or the raw key when it is not
+//                       a 32-digit hex UUID). Defines an id, sent before
+//                       the first use of a UUID. The reader restarts its
+//                       table when a client joins a shared stream, so an id
+//                       may be redefined; its last end then restarts at 0.
+//   GTID_WIRE_SNAPSHOT  n_uuids, then per UUID: id, n_intervals, then per
+//                       interval: zigzag(start - previous end), end - start.
+//                       The first interval's start is relative to 0.
+//   GTID_WIRE_UPDATE    id, zigzag(start - last end sent for id), end - start.
+//   GTID_WIRE_HEARTBEAT sender wall clock, in ms.
+//
+// Both sides keep the last end per UUID, so an update usually costs 5 bytes.
+// Frames of unknown types must be skipped by clients.
+//
+// Independently of the protocol, "HELLO z=deflate" wraps everything after
+// the HELLO reply in one zlib stream. Each batch of updates ends with a
+// sync flush, so a client can inflate it as soon as it arrives.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <zlib.h>
+
+#include "proxysql_gtid.h"
+
+#define GTID_WIRE_PROTO_TEXT  0
+#define GTID_WIRE_PROTO_BIN   1
+
+#define GTID_WIRE_UUID        0x01
+#define GTID_WIRE_SNAPSHOT    0x02
+#define GTID_WIRE_UPDATE      0x03
+#define GTID_WIRE_HEARTBEAT   0x04
+
+// Parses a set in the ST= form ("uuid:1-10:12,uuid2:5"). UUIDs are stored
+// without dashes, as the reader does. False on malformed input.
+bool gtid_wire_parse_set(const std::string& s, GTID_Set& out);
+// Puts in 'diff' the intervals of 'have' that 'known' lacks. Returns false
+// when 'known' holds GTIDs that 'have' does not: updates cannot remove them.
+bool gtid_wire_set_diff(const GTID_Set& have, const GTID_Set& known, GTID_Set& diff);
+
+void gtid_wire_put_varint(std::string& out, uint64_t v);
+// Returns false when the varint is truncated or longer than 10 bytes.
+bool gtid_wire_get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v);
+
+// Stream encoder. It keeps the state the I2/I4 lines and the binary UUID
+// table depend on, so one instance serves the clients of one stream.
+class GTID_Wire_Encoder {
+	private:
+	int proto;
+	std::string last_uuid;
+	std::unordered_map<std::string, uint64_t> ids;
+	std::vector<trxid_t> last_end;
+
+	uint64_t uuid_id(std::string& out, const std::string& uuid);
+	void frame(std::string& out, unsigned char type, const unsigned char* payload, size_t len);
+
+	public:
+	explicit GTID_Wire_Encoder(int _proto = GTID_WIRE_PROTO_TEXT);
+
+	int get_proto() const { return proto; }
+	// Switches protocol; the new stream must start with a snapshot.
+	void set_proto(int _proto);
+
+	// Full state. In text mode 'per_interval' selects the ST= form without
+	// batching support: one comma-separated entry per interval.
+	void snapshot(std::string& out, const GTID_Set& set, bool per_interval);
+	// A single trxid: I1/I2 in text mode.
+	void update(std::string& out, const std::string& uuid, trxid_t trxid);
+	// An interval: I3/I4 in text mode.
+	void update(std::string& out, const std::string& uuid, const TrxId_Interval& iv);
+	// Keeps an idle connection alive: HB= in text mode.
+	void heartbeat(std::string& out, uint64_t now_ms);
+};
+
+// A decoded binary frame. SNAPSHOT frames fill 'set'; UPDATE frames fill
+// 'uuid', 'start' and 'end' only, so the per-update path does not build a
+// set. HEARTBEAT frames put the sender's clock in 'start'. UUID frames are
+// absorbed by the decoder.
+struct GTID_Wire_Msg {
+	int type;
+	GTID_Set set;
+	std::string uuid;
+	trxid_t start;
+	trxid_t end;
+};
+
+class GTID_Wire_Decoder {
+	private:
+	std::vector<std::string> uuids;
+	std::vector<trxid_t> last_end;
+
+	public:
+	// Decodes the frame at 'buf'. Returns the bytes consumed, 0 when the
+	// frame is incomplete, -1 when it is malformed.
+	long decode(const char* buf, size_t len, GTID_Wire_Msg& msg);
+};
+
+// Sending side of a "z=deflate" connection.
+class GTID_Wire_Deflater {
+	private:
+	z_stream zs;
+	bool active;
+
+	GTID_Wire_Deflater(const GTID_Wire_Deflater&);
+	GTID_Wire_Deflater& operator=(const GTID_Wire_Deflater&);
+
+	public:
+	GTID_Wire_Deflater();
+	~GTID_Wire_Deflater();
+
+	bool init(int level);
+	// Continues a stream that another deflater started and sync-flushed:
+	// raw deflate blocks, with no header and no references to earlier data.
+	bool resume(int level);
+	bool is_active() const { return active; }
+	// Compresses one batch and appends it to 'out', sync-flushed.
+	bool write(std::string& out, const char* buf, size_t len);
+};
+
+// Receiving side of a "z=deflate" connection.
+class GTID_Wire_Inflater {
+	private:
+	z_stream zs;
+	bool active;
+
+	GTID_Wire_Inflater(const GTID_Wire_Inflater&);
+	GTID_Wire_Inflater& operator=(const GTID_Wire_Inflater&);
+
+	public:
+	GTID_Wire_Inflater();
+	~GTID_Wire_Inflater();
+
+	bool init();
+	void end();
+	bool is_active() const { return active; }
+	// Appends the inflated form of 'buf' to 'out'. False on a corrupt or
+	// finished stream.
+	bool write(std::string& out, const char* buf, size_t len);
+};
+
+#endif /* PROXYSQL_GTID_WIRE */
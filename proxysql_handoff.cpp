@@ -0,0 +1,163 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "proxysql_handoff.h"
+
+void Handoff_Writer::put_u64(uint64_t v) {
+	data.append((const char *)&v, sizeof(v));
+}
+
+void Handoff_Writer::put_str(const char *p, size_t len) {
+	put_u64(len);
+	data.append(p, len);
+}
+
+void Handoff_Writer::put_str(const std::string& s) {
+	put_str(s.data(), s.size());
+}
+
+bool Handoff_Reader::get_u64(uint64_t& v) {
+	if (data.size() - pos < sizeof(v)) {
+		return false;
+	}
+	memcpy(&v, data.data() + pos, sizeof(v));
+	pos += sizeof(v);
+	return true;
+}
+
+bool Handoff_Reader::get_str(std::string& s) {
+	uint64_t len;
+	if (!get_u64(len) || data.size() - pos < len) {
+		return false;
+	}
+	s.assign(data.data() + pos, len);
+	pos += len;
+	return true;
+}
+
+namespace {
+
+bool write_all(int sock, const char *p, size_t len) {
+	while (len) {
+		ssize_t rc = send(sock, p, len, MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += rc;
+		len -= rc;
+	}
+	return true;
+}
+
+// A short read past the header is a truncated stream.
+bool read_all(int sock, char *p, size_t len) {
+	while (len) {
+		ssize_t rc = read(sock, p, len);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if (rc == 0) {
+			errno = EPIPE;
+			return false;
+		}
+		p += rc;
+		len -= rc;
+	}
+	return true;
+}
+
+}  // namespace
+
+bool handoff_send(int sock, const std::string& payload, const std::vector<int>& fds) {
+	if (fds.size() > HANDOFF_MAX_FDS || payload.size() > HANDOFF_MAX_PAYLOAD) {
+		errno = EINVAL;
+		return false;
+	}
+	uint32_t hdr[2] = { uint32_t(payload.size()), uint32_t(fds.size()) };
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	char cbuf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	if (!fds.empty()) {
+		memset(cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+		memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+	}
+	ssize_t rc;
+	do {
+		rc = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0) {
+		return false;
+	}
+	// The descriptors went with the first byte; the rest is plain data.
+	return write_all(sock, (const char *)hdr + rc, sizeof(hdr) - rc)
+		&& write_all(sock, payload.data(), payload.size());
+}
+
+bool handoff_recv(int sock, std::string& payload, std::vector<int>& fds) {
+	uint32_t hdr[2];
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	char cbuf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	ssize_t rc;
+	do {
+		rc = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+	fds.clear();
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int *p = (const int *)CMSG_DATA(cmsg);
+			fds.insert(fds.end(), p, p + n);
+		}
+	}
+	if (rc <= 0) {
+		if (rc == 0) {
+			errno = 0;
+		}
+		return false;
+	}
+	bool ok = read_all(sock, (char *)hdr + rc, sizeof(hdr) - rc);
+	if (ok && (hdr[1] != fds.size() || (msg.msg_flags & MSG_CTRUNC) || hdr[0] > HANDOFF_MAX_PAYLOAD)) {
+		errno = EPROTO;
+		ok = false;
+	}
+	if (ok) {
+		payload.resize(hdr[0]);
+		ok = (hdr[0] == 0 || read_all(sock, &payload[0], hdr[0]));
+	}
+	if (!ok) {
+		int myerr = errno;
+		for (size_t i = 0; i < fds.size(); i++) {
+			close(fds[i]);
+		}
+		fds.clear();
+		errno = myerr;
+	}
+	return ok;
+}
@@ -0,0 +1,50 @@
+#ifndef PROXYSQL_HANDOFF
+#define PROXYSQL_HANDOFF
+
+// Records passed between two reader processes over a Unix stream socket,
+// for a binary upgrade without closing the client connections (SIGUSR2).
+//
+// A record is a payload with up to HANDOFF_MAX_FDS file descriptors. Its
+// 8-byte header (payload length, number of descriptors) carries the
+// descriptors as SCM_RIGHTS, so the receiver gets them with the header and
+// then reads the payload. The socket is blocking on both ends.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define HANDOFF_MAX_FDS     16
+#define HANDOFF_MAX_PAYLOAD (256 * 1024 * 1024)
+
+// Builds a payload from integers and length-prefixed strings.
+class Handoff_Writer {
+	public:
+	std::string data;
+
+	void put_u64(uint64_t v);
+	void put_str(const std::string& s);
+	void put_str(const char *p, size_t len);
+};
+
+// Reads a payload back in the order it was written. Every get fails once
+// the payload is exhausted.
+class Handoff_Reader {
+	private:
+	const std::string& data;
+	size_t pos;
+
+	public:
+	Handoff_Reader(const std::string& _data) : data(_data), pos(0) {}
+
+	bool get_u64(uint64_t& v);
+	bool get_str(std::string& s);
+};
+
+// Sends one record. False with errno set.
+bool handoff_send(int sock, const std::string& payload, const std::vector<int>& fds);
+
+// Receives one record; the descriptors are the receiver's to close. False
+// with errno set, or with errno 0 at the end of the stream.
+bool handoff_recv(int sock, std::string& payload, std::vector<int>& fds);
+
+#endif /* PROXYSQL_HANDOFF */
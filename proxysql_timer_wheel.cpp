@@ -0,0 +1,140 @@
+#include "proxysql_timer_wheel.h"
+
+namespace {
+
+const uint64_t SLOT_MASK = TIMER_WHEEL_SLOTS - 1;
+const uint64_t MAX_TICKS = (uint64_t(1) << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+inline void list_init(Timer_Wheel_Entry *head) {
+	head->prev = head;
+	head->next = head;
+}
+
+inline void list_unlink(Timer_Wheel_Entry *e) {
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	e->prev = NULL;
+	e->next = NULL;
+}
+
+inline void list_append(Timer_Wheel_Entry *head, Timer_Wheel_Entry *e) {
+	e->prev = head->prev;
+	e->next = head;
+	head->prev->next = e;
+	head->prev = e;
+}
+
+// Moves the whole list from 'from' to the empty head 'to'.
+inline void list_splice(Timer_Wheel_Entry *from, Timer_Wheel_Entry *to) {
+	if (from->next == from) {
+		list_init(to);
+		return;
+	}
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	list_init(from);
+}
+
+}  // namespace
+
+Timer_Wheel::Timer_Wheel(uint64_t _tick_ms) {
+	tick_ms = _tick_ms ? _tick_ms : 1;
+	current = 0;
+	started = false;
+	count = 0;
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+		for (int s = 0; s < TIMER_WHEEL_SLOTS; s++) {
+			list_init(&slots[l][s]);
+		}
+	}
+}
+
+// Puts 'e' in the lowest level whose turn still covers its expiry.
+void Timer_Wheel::place(Timer_Wheel_Entry *e) {
+	if (e->expires <= current) {
+		// Due on the next tick.
+		e->expires = current + 1;
+	}
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+		int shift = TIMER_WHEEL_BITS * l;
+		if ((e->expires >> shift) - (current >> shift) < TIMER_WHEEL_SLOTS) {
+			list_append(&slots[l][(e->expires >> shift) & SLOT_MASK], e);
+			return;
+		}
+	}
+	// Clamped by add(); not reached.
+	list_append(&slots[TIMER_WHEEL_LEVELS-1][(current >> (TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS-1))) & SLOT_MASK], e);
+}
+
+void Timer_Wheel::cascade(int level) {
+	Timer_Wheel_Entry pending;
+	list_splice(&slots[level][(current >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK], &pending);
+	while (pending.next != &pending) {
+		Timer_Wheel_Entry *e = pending.next;
+		list_unlink(e);
+		place(e);
+	}
+}
+
+void Timer_Wheel::start(uint64_t now_ms) {
+	current = now_ms / tick_ms;
+	started = true;
+}
+
+void Timer_Wheel::add(Timer_Wheel_Entry *e, uint64_t delay_ms) {
+	if (e->is_pending()) {
+		list_unlink(e);
+	} else {
+		count++;
+	}
+	// 'current' may lag the caller's clock by up to a tick: round up and add
+	// one so the timer never fires early.
+	uint64_t ticks = (delay_ms + tick_ms - 1) / tick_ms + 1;
+	if (ticks > MAX_TICKS) {
+		ticks = MAX_TICKS;
+	}
+	e->expires = current + ticks;
+	place(e);
+}
+
+void Timer_Wheel::remove(Timer_Wheel_Entry *e) {
+	if (e->is_pending()) {
+		list_unlink(e);
+		count--;
+	}
+}
+
+void Timer_Wheel::advance(uint64_t now_ms) {
+	uint64_t target = now_ms / tick_ms;
+	if (!started) {
+		start(now_ms);
+		return;
+	}
+	while (current < target) {
+		current++;
+		if ((current & SLOT_MASK) == 0) {
+			for (int l = 1; l < TIMER_WHEEL_LEVELS; l++) {
+				cascade(l);
+				if (((current >> (TIMER_WHEEL_BITS * l)) & SLOT_MASK) != 0) {
+					break;
+				}
+			}
+		}
+		// Detach the slot first: callbacks may add or remove any timer,
+		// including others in this slot.
+		Timer_Wheel_Entry due;
+		list_splice(&slots[0][current & SLOT_MASK], &due);
+		while (due.next != &due) {
+			Timer_Wheel_Entry *e = due.next;
+			list_unlink(e);
+			if (e->expires > current) {
+				place(e);
+				continue;
+			}
+			count--;
+			e->cb(e);
+		}
+	}
+}
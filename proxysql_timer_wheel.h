@@ -0,0 +1,64 @@
+#ifndef PROXYSQL_TIMER_WHEEL
+#define PROXYSQL_TIMER_WHEEL
+
+// Hierarchical timer wheel for per-client deadlines.
+//
+// With one ev_timer per client, libev keeps thousands of timers in its heap
+// and every re-arm is O(log n). Here a single periodic ev_timer calls
+// advance(), and arming, re-arming or cancelling a timer is O(1).
+//
+// Level 0 has one slot per tick. A slot of level n spans a full turn of
+// level n-1; its timers are moved down ("cascaded") when the lower level
+// wraps around to them. Timers fire no earlier than requested and at most
+// two ticks late. Delays beyond the top level's range are clamped to it.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+
+// Embedded in the owner's structure; 'data' points back to it.
+struct Timer_Wheel_Entry {
+	Timer_Wheel_Entry *prev;
+	Timer_Wheel_Entry *next;
+	uint64_t expires;
+	void (*cb)(Timer_Wheel_Entry *);
+	void *data;
+
+	Timer_Wheel_Entry() : prev(NULL), next(NULL), expires(0), cb(NULL), data(NULL) {}
+	bool is_pending() const { return next != NULL; }
+};
+
+class Timer_Wheel {
+	private:
+	// List heads; an empty slot points to itself.
+	Timer_Wheel_Entry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	uint64_t tick_ms;
+	// Ticks since the epoch of the time base passed to advance().
+	uint64_t current;
+	bool started;
+	size_t count;
+
+	void place(Timer_Wheel_Entry *e);
+	void cascade(int level);
+
+	public:
+	explicit Timer_Wheel(uint64_t _tick_ms);
+
+	uint64_t get_tick_ms() const { return tick_ms; }
+	size_t size() const { return count; }
+
+	// Sets the time base. Call before arming timers; advance() calls it on
+	// first use otherwise.
+	void start(uint64_t now_ms);
+	// Arms 'e' to call its 'cb' after 'delay_ms'. A pending entry is moved.
+	void add(Timer_Wheel_Entry *e, uint64_t delay_ms);
+	// Cancels 'e' if pending. Safe to call from any callback.
+	void remove(Timer_Wheel_Entry *e);
+	// Moves the wheel to 'now_ms' (a monotonic clock), firing due timers.
+	void advance(uint64_t now_ms);
+};
+
+#endif /* PROXYSQL_TIMER_WHEEL */
@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <string.h>
+
+#include <openssl/err.h>
+
+#include "proxysql_tls.h"
+
+// AEAD suites only: these are the ones the kernel can take over for TLS 1.2.
+// TLS 1.3 suites are all AEAD and left at OpenSSL's defaults.
+#define TLS12_CIPHER_LIST "ECDHE+AESGCM:ECDHE+CHACHA20"
+
+TLS_Server_Context::TLS_Server_Context() {
+	ctx = NULL;
+}
+
+TLS_Server_Context::~TLS_Server_Context() {
+	if (ctx) {
+		SSL_CTX_free(ctx);
+	}
+}
+
+bool TLS_Server_Context::ktls_supported() {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool TLS_Server_Context::init(const char *cert_file, const char *key_file, const char *ca_file, std::string& err) {
+	OPENSSL_init_ssl(0, NULL);
+	SSL_CTX *nctx = SSL_CTX_new(TLS_server_method());
+	if (nctx == NULL) {
+		err = tls_last_error();
+		return false;
+	}
+	SSL_CTX_set_min_proto_version(nctx, TLS1_2_VERSION);
+	long opts = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	opts |= SSL_OP_ENABLE_KTLS;
+#endif
+	SSL_CTX_set_options(nctx, opts);
+	// The client buffer is compacted with memmove() between partial writes.
+	SSL_CTX_set_mode(nctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	// Clients connect once and stay; without tickets nothing is left queued in
+	// OpenSSL after the handshake, so the socket can be handed to the kernel.
+	SSL_CTX_set_num_tickets(nctx, 0);
+	SSL_CTX_set_session_cache_mode(nctx, SSL_SESS_CACHE_OFF);
+
+	if (
+		SSL_CTX_set_cipher_list(nctx, TLS12_CIPHER_LIST) != 1 ||
+		SSL_CTX_use_certificate_chain_file(nctx, cert_file) != 1 ||
+		SSL_CTX_use_PrivateKey_file(nctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+		SSL_CTX_check_private_key(nctx) != 1
+	) {
+		err = tls_last_error();
+		SSL_CTX_free(nctx);
+		return false;
+	}
+	if (ca_file) {
+		if (SSL_CTX_load_verify_locations(nctx, ca_file, NULL) != 1) {
+			err = tls_last_error();
+			SSL_CTX_free(nctx);
+			return false;
+		}
+		SSL_CTX_set_verify(nctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+	}
+
+	if (ctx) {
+		SSL_CTX_free(ctx);
+	}
+	ctx = nctx;
+	return true;
+}
+
+SSL *TLS_Server_Context::new_session(int fd) const {
+	SSL *ssl = SSL_new(ctx);
+	if (ssl == NULL) {
+		return NULL;
+	}
+	if (SSL_set_fd(ssl, fd) != 1) {
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_accept_state(ssl);
+	return ssl;
+}
+
+int tls_accept(SSL *ssl, std::string& err) {
+	ERR_clear_error();
+	errno = 0;
+	int rc = SSL_accept(ssl);
+	if (rc == 1) {
+		return TLS_HANDSHAKE_DONE;
+	}
+	int myerr = errno;
+	switch (SSL_get_error(ssl, rc)) {
+		case SSL_ERROR_WANT_READ:
+			return TLS_HANDSHAKE_WANT_READ;
+		case SSL_ERROR_WANT_WRITE:
+			return TLS_HANDSHAKE_WANT_WRITE;
+		case SSL_ERROR_SYSCALL:
+			if (ERR_peek_error() == 0) {
+				err = myerr ? strerror(myerr) : "connection closed by peer";
+				return TLS_HANDSHAKE_ERROR;
+			}
+			break;
+		default:
+			break;
+	}
+	err = tls_last_error();
+	return TLS_HANDSHAKE_ERROR;
+}
+
+bool tls_ktls_send(SSL *ssl) {
+	return BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+ssize_t tls_write(SSL *ssl, const void *buf, size_t len) {
+	ERR_clear_error();
+	errno = 0;
+	int rc = SSL_write(ssl, buf, len);
+	if (rc > 0) {
+		return rc;
+	}
+	switch (SSL_get_error(ssl, rc)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			break;
+		case SSL_ERROR_SYSCALL:
+			if (errno == 0) {
+				errno = EIO;
+			}
+			break;
+		default:
+			errno = EIO;
+			break;
+	}
+	return -1;
+}
+
+ssize_t tls_read(SSL *ssl, void *buf, size_t len) {
+	ERR_clear_error();
+	errno = 0;
+	int rc = SSL_read(ssl, buf, len);
+	if (rc > 0) {
+		return rc;
+	}
+	switch (SSL_get_error(ssl, rc)) {
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			break;
+		case SSL_ERROR_SYSCALL:
+			if (errno == 0) {
+				// EOF without close_notify
+				return 0;
+			}
+			break;
+		default:
+			errno = EIO;
+			break;
+	}
+	return -1;
+}
+
+std::string tls_last_error() {
+	unsigned long e = ERR_get_error();
+	if (e == 0) {
+		return "unknown TLS error";
+	}
+	char buf[256];
+	ERR_error_string_n(e, buf, sizeof(buf));
+	return buf;
+}
@@ -0,0 +1,65 @@
+#ifndef PROXYSQL_TLS
+#define PROXYSQL_TLS
+
+// TLS termination for the GTID listener.
+//
+// The handshake runs in userspace through OpenSSL on the non-blocking client
+// socket. When OpenSSL and the kernel support it, the session's transmit
+// direction is then handed to the kernel (kTLS): from that point the socket
+// accepts plain write(2)/sendmsg(2) calls and the kernel builds and encrypts
+// the records, so the fan-out path does not copy through an SSL buffer.
+// Sessions that cannot be offloaded fall back to SSL_write().
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+
+#include <openssl/ssl.h>
+
+#define TLS_HANDSHAKE_DONE        1
+#define TLS_HANDSHAKE_WANT_READ   2
+#define TLS_HANDSHAKE_WANT_WRITE  3
+#define TLS_HANDSHAKE_ERROR      -1
+
+class TLS_Server_Context {
+	private:
+	SSL_CTX *ctx;
+
+	public:
+	TLS_Server_Context();
+	~TLS_Server_Context();
+
+	// Loads the certificate chain and key. With a CA file, clients must
+	// present a certificate signed by it.
+	bool init(const char *cert_file, const char *key_file, const char *ca_file, std::string& err);
+	bool is_enabled() const { return ctx != NULL; }
+
+	// True when this OpenSSL build can offload sessions to kTLS.
+	static bool ktls_supported();
+
+	// Creates a server session on an accepted, non-blocking socket.
+	SSL *new_session(int fd) const;
+};
+
+// Advances a server handshake. Returns one of the TLS_HANDSHAKE_* values;
+// on TLS_HANDSHAKE_ERROR 'err' describes the failure.
+int tls_accept(SSL *ssl, std::string& err);
+
+// True when the kernel encrypts the session's outgoing records, i.e. the
+// socket can be written to directly.
+bool tls_ktls_send(SSL *ssl);
+
+// Writes through OpenSSL with write(2) semantics: the number of bytes
+// written, or -1 with errno set to EAGAIN when the socket is full, or to
+// EIO on a TLS failure.
+ssize_t tls_write(SSL *ssl, const void *buf, size_t len);
+
+// Reads through OpenSSL with read(2) semantics: the number of bytes read,
+// 0 when the peer closed the session, or -1 with errno set as for
+// tls_write().
+ssize_t tls_read(SSL *ssl, void *buf, size_t len);
+
+// Text of the last OpenSSL error, for logging.
+std::string tls_last_error();
+
+#endif /* PROXYSQL_TLS */
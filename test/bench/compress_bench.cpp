@@ -0,0 +1,279 @@
+/* compress_bench
+ *
+ * Measures the bandwidth/CPU trade-off of protocol compression (-Z) on the
+ * binlog connection, on a synthetic row-heavy stream: per transaction a
+ * GTID, a BEGIN query, a TABLE_MAP, -r ROWS events of -s bytes of row
+ * images (ids, timestamps, short words and numbers, as ROW format carries
+ * them) and an XID, CRC32-checksummed.
+ *
+ * Every event is one protocol packet, which the source compresses on its
+ * own, as its binlog sender flushes after each event: packets under 50
+ * bytes, or that do not shrink, go out uncompressed, and each gets the
+ * 7-byte compressed-protocol header. For each algorithm it reports wire
+ * bytes per binlog byte, and the source's compression and the reader's
+ * decompression CPU ms per MB of binlog.
+ *
+ * zstd rows need the bench built with HAVE_ZSTD (the Makefile sets it when
+ * pkg-config finds libzstd). No MySQL server is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Below this the source sends a packet uncompressed (MIN_COMPRESS_LENGTH).
+static const size_t MIN_COMPRESS_LENGTH = 50;
+static const size_t COMP_HEADER_SIZE = 7;
+// MySQL's zlib level; only the zstd level can be chosen.
+static const int ZLIB_LEVEL = 6;
+
+struct Stream {
+	// Protocol packets: 4-byte header, OK marker, event.
+	std::vector<std::string> packets;
+	size_t bytes;
+};
+
+static int64_t cpu_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void put_le(std::string& out, uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		out.push_back(char((v >> (8 * i)) & 0xff));
+	}
+}
+
+static uint32_t rnd(uint32_t& x) {
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/** Appends one event with a v4 header and a CRC32 trailer, as a packet. */
+static void add_event(Stream& s, unsigned char type, const std::string& body, size_t& log_pos) {
+	std::string ev;
+	const uint32_t len = uint32_t(19 + body.size() + 4);
+	log_pos += len;
+	put_le(ev, 1700000000, 4);
+	ev.push_back(char(type));
+	put_le(ev, 1, 4);
+	put_le(ev, len, 4);
+	put_le(ev, log_pos, 4);
+	put_le(ev, 0, 2);
+	ev += body;
+	put_le(ev, crc32(0, (const Bytef*)ev.data(), uInt(ev.size())), 4);
+
+	std::string pkt;
+	put_le(pkt, ev.size() + 1, 3);
+	pkt.push_back(char(s.packets.size()));
+	pkt.push_back('\0');
+	pkt += ev;
+	s.bytes += pkt.size();
+	s.packets.push_back(pkt);
+}
+
+static Stream make_stream(size_t trxs, size_t rows_per_trx, size_t row_bytes) {
+	static const char* words[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot",
+	                              "golf", "hotel", "india", "juliet", "kilo", "lima",
+	                              "mike", "november", "oscar", "papa"};
+	Stream s;
+	s.bytes = 0;
+	size_t log_pos = 4;
+	uint32_t x = 2463534242u;
+	uint64_t id = 1;
+	const unsigned char sid[16] = {0x3e, 0x11, 0xfa, 0x47, 0x71, 0xca, 0x11, 0xe1,
+	                               0x9e, 0x33, 0xc8, 0x0a, 0xa9, 0x42, 0x95, 0x62};
+	for (size_t t = 0; t < trxs; t++) {
+		std::string b;
+		b.push_back(1);
+		b.append((const char*)sid, 16);
+		put_le(b, t + 1, 8);
+		b.append(17, '\0');
+		add_event(s, 33, b, log_pos);                // GTID_LOG_EVENT
+
+		b.assign(13, '\0');
+		b += "test";
+		b.push_back('\0');
+		b += "BEGIN";
+		add_event(s, 2, b, log_pos);                 // QUERY_EVENT
+
+		b.clear();
+		put_le(b, 108, 6);
+		put_le(b, 1, 2);
+		b += "\x04test\0\x05orders\0\x05\x08\x12\x0f\x0f\x03\x04\x00\x00\x80\x00\x01\x00";
+		add_event(s, 19, b, log_pos);                // TABLE_MAP_EVENT
+
+		for (size_t r = 0; r < rows_per_trx; r++) {
+			b.clear();
+			put_le(b, 108, 6);
+			put_le(b, 1, 2);
+			put_le(b, 2, 2);
+			b.push_back(5);
+			b.push_back('\x1f');
+			// Rows: null bitmap, bigint id, timestamp, two short strings, int.
+			while (b.size() + 48 < row_bytes) {
+				b.push_back('\0');
+				put_le(b, id++, 8);
+				put_le(b, 0x99b5000000ULL + (id >> 4), 5);
+				const char* w = words[rnd(x) & 15];
+				b.push_back(char(strlen(w)));
+				b += w;
+				char num[16];
+				const int n = snprintf(num, sizeof(num), "%u", rnd(x) % 100000);
+				b.push_back(char(n));
+				b.append(num, n);
+				put_le(b, rnd(x) % 1000, 4);
+			}
+			add_event(s, 30, b, log_pos);            // WRITE_ROWS_EVENT
+		}
+
+		b.clear();
+		put_le(b, t + 1, 8);
+		add_event(s, 16, b, log_pos);                // XID_EVENT
+	}
+	return s;
+}
+
+struct Codec {
+	const char* name;
+	int level;
+	bool zstd;
+};
+
+/** One-shot compression of a packet; false if the codec failed. */
+static bool compress_packet(const Codec& c, const std::string& in, std::string& out, void* ctx) {
+#ifdef HAVE_ZSTD
+	if (c.zstd) {
+		out.resize(ZSTD_compressBound(in.size()));
+		const size_t n = ZSTD_compressCCtx((ZSTD_CCtx*)ctx, &out[0], out.size(), in.data(), in.size(), c.level);
+		if (ZSTD_isError(n)) return false;
+		out.resize(n);
+		return true;
+	}
+#endif
+	(void)ctx;
+	uLongf n = compressBound(uLong(in.size()));
+	out.resize(n);
+	if (compress2((Bytef*)&out[0], &n, (const Bytef*)in.data(), uLong(in.size()), c.level) != Z_OK) return false;
+	out.resize(n);
+	return true;
+}
+
+static bool decompress_packet(const Codec& c, const std::string& in, std::string& out, void* ctx) {
+#ifdef HAVE_ZSTD
+	if (c.zstd) {
+		const size_t n = ZSTD_decompressDCtx((ZSTD_DCtx*)ctx, &out[0], out.size(), in.data(), in.size());
+		return !ZSTD_isError(n) && n == out.size();
+	}
+#endif
+	(void)c;
+	(void)ctx;
+	uLongf n = uLongf(out.size());
+	return uncompress((Bytef*)&out[0], &n, (const Bytef*)in.data(), uLong(in.size())) == Z_OK && n == out.size();
+}
+
+static void run(const Codec& c, const Stream& s) {
+	void* cctx = NULL;
+	void* dctx = NULL;
+#ifdef HAVE_ZSTD
+	if (c.zstd) {
+		cctx = ZSTD_createCCtx();
+		dctx = ZSTD_createDCtx();
+	}
+#endif
+	// Compressed payloads, or empty for the packets sent as they are.
+	std::vector<std::string> comp(s.packets.size());
+	size_t wire = 0;
+	bool ok = true;
+
+	const int64_t c0 = cpu_ns();
+	for (size_t i = 0; i < s.packets.size(); i++) {
+		const std::string& p = s.packets[i];
+		if (p.size() >= MIN_COMPRESS_LENGTH) {
+			ok = compress_packet(c, p, comp[i], cctx) && ok;
+			if (comp[i].size() >= p.size()) comp[i].clear();
+		}
+		wire += COMP_HEADER_SIZE + (comp[i].empty() ? p.size() : comp[i].size());
+	}
+	const int64_t c1 = cpu_ns();
+
+	std::string out;
+	size_t check = 0;
+	for (size_t i = 0; i < s.packets.size(); i++) {
+		if (comp[i].empty()) {
+			check += s.packets[i].size();
+			continue;
+		}
+		out.resize(s.packets[i].size());
+		ok = decompress_packet(c, comp[i], out, dctx) && ok;
+		check += out.size();
+	}
+	const int64_t c2 = cpu_ns();
+
+	if (check != s.bytes) ok = false;
+	const double mb = s.bytes / 1048576.0;
+	printf("%-10s %12.3f %14.2f %16.2f   (%s)\n", c.name, double(wire) / s.bytes, (c1 - c0) / 1e6 / mb,
+	       (c2 - c1) / 1e6 / mb, ok ? "roundtrip ok" : "ROUNDTRIP FAILED");
+#ifdef HAVE_ZSTD
+	if (c.zstd) {
+		ZSTD_freeCCtx((ZSTD_CCtx*)cctx);
+		ZSTD_freeDCtx((ZSTD_DCtx*)dctx);
+	}
+#endif
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-n: number of transactions (default 20000)\n"
+	        "-r: ROWS events per transaction (default 4)\n"
+	        "-s: bytes per ROWS event body (default 4096)\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	size_t trxs = 20000, rows = 4, row_bytes = 4096;
+	int c;
+	while ((c = getopt(argc, argv, "n:r:s:")) != -1) {
+		switch (c) {
+			case 'n': trxs = strtoull(optarg, nullptr, 10); break;
+			case 'r': rows = strtoull(optarg, nullptr, 10); break;
+			case 's': row_bytes = strtoull(optarg, nullptr, 10); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (trxs == 0 || row_bytes < 64) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const Stream s = make_stream(trxs, rows, row_bytes);
+	printf("%zu transactions, %zu ROWS events of %zu bytes each: %zu packets, %.1f MB\n\n", trxs, rows,
+	       row_bytes, s.packets.size(), s.bytes / 1048576.0);
+
+	printf("%-10s %12s %14s %16s\n", "codec", "wire/binlog", "source ms/MB", "reader ms/MB");
+	printf("%-10s %12.3f %14.2f %16.2f\n", "none", 1.0, 0.0, 0.0);
+	run(Codec{"zlib", ZLIB_LEVEL, false}, s);
+#ifdef HAVE_ZSTD
+	run(Codec{"zstd-1", 1, true}, s);
+	run(Codec{"zstd-3", 3, true}, s);
+	run(Codec{"zstd-7", 7, true}, s);
+#else
+	printf("(zstd rows skipped: built without HAVE_ZSTD)\n");
+#endif
+	return 0;
+}
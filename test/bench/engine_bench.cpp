@@ -0,0 +1,377 @@
+/* engine_bench
+ *
+ * Compares what the reader's replication engines cost the MySQL source,
+ * and how late they deliver, on a row-heavy write load. Run it once
+ * against a reader reading the binlog (-E libslave or native), once
+ * against one polling the executed set (-E poll[:ms]) and once against one
+ * reading the binlog files (-E file).
+ *
+ *   1. Find the reader's connection on the source in performance_schema:
+ *      the one other than ours with the reader's user (-U). Its command
+ *      tells the engine: a binlog dump, or a connection that polls; with
+ *      none, the reader reads the files.
+ *   2. Connect one client to the reader and read its ST=.
+ *   3. Commit -c transactions of -n rows of -s bytes each, at -R per
+ *      second, one at a time.
+ *   4. The j-th trxid the client receives is matched with the j-th commit,
+ *      so the source must not see other writes meanwhile.
+ *   5. Report notification latency (commit issued -> trxid received), the
+ *      bytes the source sent on the reader's connection (Bytes_sent in
+ *      performance_schema.status_by_thread, MySQL 8.0), the CPU time of
+ *      that connection's server thread with -m, and the reader's CPU time
+ *      and bytes read (and their rate) with -r. CPU times need the
+ *      processes on this host.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mysql.h>
+
+struct Options {
+	std::string reader_host = "127.0.0.1";
+	int reader_port = 6020;
+	std::string reader_user;
+	std::string mysql_host = "127.0.0.1";
+	int mysql_port = 3306;
+	std::string mysql_user = "root";
+	std::string mysql_pass;
+	int commits = 1000;
+	int rows = 100;
+	int row_size = 1024;
+	int rate = 100;
+	pid_t mysqld_pid = 0;
+	pid_t reader_pid = 0;
+};
+
+// The reader's connection on the source.
+struct Source_Thread {
+	std::string thread_id;
+	long os_id = 0;
+	std::string command;
+};
+
+static int64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** utime + stime from a /proc stat file, in microseconds; -1 if unavailable. */
+static int64_t stat_cpu_us(const char* path) {
+	FILE* f = fopen(path, "r");
+	if (f == nullptr) return -1;
+	char line[2048];
+	size_t n = fread(line, 1, sizeof(line) - 1, f);
+	fclose(f);
+	line[n] = 0;
+	// Fields after the command name, which may itself contain spaces.
+	const char* p = strrchr(line, ')');
+	if (p == nullptr) return -1;
+	unsigned long long utime = 0, stime = 0;
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+		return -1;
+	}
+	return int64_t(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+static int64_t process_cpu_us(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	return stat_cpu_us(path);
+}
+
+static int64_t thread_cpu_us(pid_t pid, long tid) {
+	char path[96];
+	snprintf(path, sizeof(path), "/proc/%d/task/%ld/stat", (int)pid, tid);
+	return stat_cpu_us(path);
+}
+
+/** Bytes a process read, sockets included (rchar); -1 if unavailable. */
+static int64_t process_rchar(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	FILE* f = fopen(path, "r");
+	if (f == nullptr) return -1;
+	long long v = -1;
+	char key[64];
+	long long val;
+	while (fscanf(f, "%63s %lld", key, &val) == 2) {
+		if (!strcmp(key, "rchar:")) {
+			v = val;
+			break;
+		}
+	}
+	fclose(f);
+	return v;
+}
+
+/** First column of the first row of 'q'; empty on error or no row. */
+static std::string query_value(MYSQL* db, const std::string& q) {
+	std::string v;
+	if (mysql_query(db, q.c_str())) return v;
+	MYSQL_RES* res = mysql_store_result(db);
+	if (res == nullptr) return v;
+	MYSQL_ROW row = mysql_fetch_row(res);
+	if (row && row[0]) v = row[0];
+	mysql_free_result(res);
+	return v;
+}
+
+/** Number of connections of 'user' other than ours, -1 on error; 't' is the last. */
+static int find_source_thread(MYSQL* db, const std::string& user, Source_Thread& t) {
+	std::string q = "SELECT THREAD_ID, THREAD_OS_ID, PROCESSLIST_COMMAND FROM performance_schema.threads "
+	                "WHERE PROCESSLIST_USER = '" + user + "' AND PROCESSLIST_ID <> CONNECTION_ID()";
+	if (mysql_query(db, q.c_str())) return -1;
+	MYSQL_RES* res = mysql_store_result(db);
+	if (res == nullptr) return -1;
+	int rows = 0;
+	MYSQL_ROW row;
+	while ((row = mysql_fetch_row(res))) {
+		rows++;
+		t.thread_id = row[0] ? row[0] : "";
+		t.os_id = row[1] ? atol(row[1]) : 0;
+		t.command = row[2] ? row[2] : "";
+	}
+	mysql_free_result(res);
+	return rows;
+}
+
+static int64_t source_bytes_sent(MYSQL* db, const Source_Thread& t) {
+	if (t.thread_id.empty()) return 0;
+	std::string v = query_value(db, "SELECT VARIABLE_VALUE FROM performance_schema.status_by_thread "
+	                                "WHERE THREAD_ID = " + t.thread_id + " AND VARIABLE_NAME = 'Bytes_sent'");
+	return v.empty() ? -1 : strtoll(v.c_str(), nullptr, 10);
+}
+
+/** Number of trxids carried by one update line; 0 for anything else. */
+static size_t line_trxids(const std::string& line) {
+	if (line.size() < 4 || line[0] != 'I' || line[2] != '=') return 0;
+	if (line[1] == '1' || line[1] == '2') return 1;
+	if (line[1] != '3' && line[1] != '4') return 0;
+	size_t colon = line.rfind(':');
+	std::string iv = line.substr(colon == std::string::npos ? 3 : colon + 1);
+	size_t dash = iv.find('-');
+	if (dash == std::string::npos) return 1;
+	return strtoull(iv.c_str() + dash + 1, nullptr, 10) - strtoull(iv.c_str(), nullptr, 10) + 1;
+}
+
+static int connect_reader(const Options& o) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	struct timeval tv = {1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(o.reader_port);
+	inet_pton(AF_INET, o.reader_host.c_str(), &addr.sin_addr);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-H: reader host (default 127.0.0.1)\n"
+	        "-l: reader port (default 6020)\n"
+	        "-U: MySQL user of the reader (default: -u)\n"
+	        "-h: MySQL host (default 127.0.0.1)\n"
+	        "-P: MySQL port (default 3306)\n"
+	        "-u: MySQL user (default root)\n"
+	        "-p: MySQL password\n"
+	        "-c: number of commits (default 1000)\n"
+	        "-n: rows per commit (default 100)\n"
+	        "-s: bytes per row (default 1024)\n"
+	        "-R: commits per second (default 100)\n"
+	        "-m: mysqld PID, to report the CPU time of the reader's connection\n"
+	        "-r: reader PID, to report its CPU time and bytes read\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	int c;
+	while ((c = getopt(argc, argv, "H:l:U:h:P:u:p:c:n:s:R:m:r:")) != -1) {
+		switch (c) {
+			case 'H': o.reader_host = optarg; break;
+			case 'l': o.reader_port = atoi(optarg); break;
+			case 'U': o.reader_user = optarg; break;
+			case 'h': o.mysql_host = optarg; break;
+			case 'P': o.mysql_port = atoi(optarg); break;
+			case 'u': o.mysql_user = optarg; break;
+			case 'p': o.mysql_pass = optarg; break;
+			case 'c': o.commits = atoi(optarg); break;
+			case 'n': o.rows = atoi(optarg); break;
+			case 's': o.row_size = atoi(optarg); break;
+			case 'R': o.rate = atoi(optarg); break;
+			case 'm': o.mysqld_pid = atoi(optarg); break;
+			case 'r': o.reader_pid = atoi(optarg); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (o.reader_user.empty()) o.reader_user = o.mysql_user;
+	if (o.commits <= 0 || o.rows <= 0 || o.row_size <= 0 || o.rate <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	MYSQL* db = mysql_init(nullptr);
+	if (!mysql_real_connect(db, o.mysql_host.c_str(), o.mysql_user.c_str(), o.mysql_pass.c_str(),
+	                        nullptr, o.mysql_port, nullptr, 0)) {
+		fprintf(stderr, "cannot connect to MySQL: %s\n", mysql_error(db));
+		return 1;
+	}
+	mysql_query(db, "CREATE DATABASE IF NOT EXISTS binlog_reader_bench");
+	mysql_query(db, "CREATE TABLE IF NOT EXISTS binlog_reader_bench.bulk (id INT PRIMARY KEY AUTO_INCREMENT, v LONGBLOB)");
+	// Let the reader publish the DDL before the client takes its ST=.
+	sleep(1);
+
+	// Found before the writer connects, which may have the same user.
+	Source_Thread st;
+	const int threads = find_source_thread(db, o.reader_user, st);
+	if (threads < 0 || threads > 1) {
+		fprintf(stderr, "cannot tell the reader's connection on the source: it must be the only other one of user %s\n",
+		        o.reader_user.c_str());
+		return 1;
+	}
+	// No connection: -E file.
+	const bool files = threads == 0;
+	MYSQL* wdb = mysql_init(nullptr);
+	if (!mysql_real_connect(wdb, o.mysql_host.c_str(), o.mysql_user.c_str(), o.mysql_pass.c_str(),
+	                        nullptr, o.mysql_port, nullptr, 0)) {
+		fprintf(stderr, "cannot connect to MySQL: %s\n", mysql_error(wdb));
+		return 1;
+	}
+	const bool dump = st.command.find("Binlog Dump") != std::string::npos;
+
+	int fd = connect_reader(o);
+	if (fd < 0) {
+		fprintf(stderr, "cannot connect to the reader at %s:%d: %s\n", o.reader_host.c_str(), o.reader_port,
+		        strerror(errno));
+		return 1;
+	}
+	std::string buf;
+	while (buf.find('\n') == std::string::npos) {
+		char tmp[4096];
+		ssize_t rc = read(fd, tmp, sizeof(tmp));
+		if (rc <= 0) {
+			fprintf(stderr, "no ST= from the reader\n");
+			return 1;
+		}
+		buf.append(tmp, rc);
+	}
+	buf.erase(0, buf.find('\n') + 1);
+
+	std::string insert = "INSERT INTO binlog_reader_bench.bulk (v) VALUES ";
+	for (int i = 0; i < o.rows; i++) {
+		insert += (i ? ",(REPEAT('x', " : "(REPEAT('x', ") + std::to_string(o.row_size) + "))";
+	}
+
+	std::vector<std::atomic<int64_t>> issued(o.commits);
+	for (auto& t : issued) t.store(0);
+	std::atomic<bool> writer_done(false);
+
+	const int64_t src_bytes_start = source_bytes_sent(db, st);
+	const int64_t src_cpu_start = o.mysqld_pid && !files ? thread_cpu_us(o.mysqld_pid, st.os_id) : -1;
+	const int64_t cpu_start = o.reader_pid ? process_cpu_us(o.reader_pid) : -1;
+	const int64_t rchar_start = o.reader_pid ? process_rchar(o.reader_pid) : -1;
+	const int64_t start = now_us();
+	std::thread writer([&]() {
+		const int64_t period = 1000000 / o.rate;
+		for (int j = 0; j < o.commits; j++) {
+			const int64_t due = start + j * period;
+			const int64_t wait = due - now_us();
+			if (wait > 0) usleep(wait);
+			issued[j].store(now_us());
+			if (mysql_query(wdb, insert.c_str())) {
+				fprintf(stderr, "INSERT failed: %s\n", mysql_error(wdb));
+				break;
+			}
+		}
+		writer_done.store(true);
+	});
+
+	std::vector<uint32_t> latencies;
+	latencies.reserve(o.commits);
+	size_t received = 0;
+	int64_t done_at = 0;
+	while (received < size_t(o.commits)) {
+		if (writer_done.load() && done_at == 0) done_at = now_us();
+		if (done_at && now_us() - done_at > 30 * 1000000) break;
+		char tmp[16384];
+		ssize_t rc = read(fd, tmp, sizeof(tmp));
+		if (rc == 0) break;
+		if (rc < 0) continue;
+		buf.append(tmp, rc);
+		const int64_t t = now_us();
+		size_t nl;
+		while ((nl = buf.find('\n')) != std::string::npos) {
+			size_t k = line_trxids(buf.substr(0, nl));
+			for (; k > 0 && received < size_t(o.commits); k--, received++) {
+				latencies.push_back(uint32_t(std::max<int64_t>(0, t - issued[received].load())));
+			}
+			buf.erase(0, nl + 1);
+		}
+	}
+	const int64_t elapsed = now_us() - start;
+	const int64_t src_bytes_end = source_bytes_sent(db, st);
+	const int64_t src_cpu_end = o.mysqld_pid && !files ? thread_cpu_us(o.mysqld_pid, st.os_id) : -1;
+	const int64_t cpu_end = o.reader_pid ? process_cpu_us(o.reader_pid) : -1;
+	const int64_t rchar_end = o.reader_pid ? process_rchar(o.reader_pid) : -1;
+	writer.join();
+
+	std::sort(latencies.begin(), latencies.end());
+	auto pct = [&](double p) -> uint32_t {
+		if (latencies.empty()) return 0;
+		return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+	};
+	if (files) {
+		printf("engine:             binlog files (no source thread)\n");
+	} else {
+		printf("engine:             %s (source thread %s: %s)\n", dump ? "binlog dump" : "poll",
+		       st.thread_id.c_str(), st.command.c_str());
+	}
+	printf("commits:            %d x %d rows x %d bytes, %d/s\n", o.commits, o.rows, o.row_size, o.rate);
+	printf("notified:           %zu in %.3f s\n", received, elapsed / 1e6);
+	printf("latency p50/p99/p999/max: %u / %u / %u / %u us\n", pct(0.50), pct(0.99), pct(0.999),
+	       latencies.empty() ? 0 : latencies.back());
+	if (src_bytes_start >= 0 && src_bytes_end >= 0) {
+		printf("source bytes sent:  %lld (%.1f per commit)\n", (long long)(src_bytes_end - src_bytes_start),
+		       double(src_bytes_end - src_bytes_start) / o.commits);
+	}
+	if (src_cpu_start >= 0 && src_cpu_end >= 0) {
+		printf("source thread cpu:  %.3f s (%.1f us/commit)\n", (src_cpu_end - src_cpu_start) / 1e6,
+		       double(src_cpu_end - src_cpu_start) / o.commits);
+	}
+	if (cpu_start >= 0 && cpu_end >= 0) {
+		printf("reader cpu:         %.3f s (%.1f us/commit)\n", (cpu_end - cpu_start) / 1e6,
+		       double(cpu_end - cpu_start) / o.commits);
+	}
+	if (rchar_start >= 0 && rchar_end >= 0) {
+		printf("reader bytes read:  %lld (%.1f MB/s)\n", (long long)(rchar_end - rchar_start),
+		       (rchar_end - rchar_start) / (elapsed / 1e6) / 1e6);
+	}
+
+	close(fd);
+	mysql_close(wdb);
+	mysql_close(db);
+	return received == size_t(o.commits) ? 0 : 1;
+}
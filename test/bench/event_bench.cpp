@@ -0,0 +1,316 @@
+/* event_bench
+ *
+ * Measures what the binlog thread spends on events the reader does not
+ * need, with libslave's own decoding functions on a synthetic row-heavy
+ * stream: per transaction a GTID, a BEGIN query, a TABLE_MAP, -r ROWS
+ * events of -s bytes each and an XID, CRC32-checksummed like a MySQL 5.6+
+ * source sends them.
+ *
+ *   - "full" does per event what Slave::get_remote_binlog() does without
+ *     GTID-only mode: read_log_event() (header, sanity and CRC checks) and
+ *     the decoding of process_event(): Query_event_info, Table_map_event_info
+ *     plus the table id map, Row_event_info plus apply_row_event().
+ *   - "gtid-only" dispatches on the type byte first, as setGtidOnly(true)
+ *     does, and only decodes FORMAT_DESCRIPTION, ROTATE and GTID events.
+ *
+ * With -f, the stream is read from binlog files instead (e.g. captured
+ * from the TAP fleet's sandboxes with mysqlbinlog --raw), concatenated in
+ * the order given, with the checksum setting of their FORMAT_DESCRIPTION.
+ *
+ * It reports events/s, MB/s of binlog and CPU ms per MB. Needs the patched
+ * libslave built by the top-level Makefile; no MySQL server is used.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "SlaveStats.h"
+#include "relayloginfo.h"
+#include "slave_log_event.h"
+
+struct Stream {
+	std::string data;
+	std::vector<size_t> offsets;
+	size_t gtids;
+	// Sum of the GTID numbers, and log_pos of the last event.
+	uint64_t gno_sum;
+	size_t end_pos;
+	slave::enum_binlog_checksum_alg checksum_alg;
+};
+
+// The "\xfebin" a binlog file starts with.
+static const size_t BINLOG_MAGIC_LEN = 4;
+
+static int64_t clock_ns(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t get_le32(const char* p) {
+	const unsigned char* u = (const unsigned char*)p;
+	return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+static void put_le(std::string& out, uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		out.push_back(char((v >> (8 * i)) & 0xff));
+	}
+}
+
+/** Appends one event with a v4 header and a CRC32 trailer. */
+static void add_event(Stream& s, slave::Log_event_type type, const std::string& body) {
+	const size_t start = s.data.size();
+	const uint32_t len = uint32_t(LOG_EVENT_HEADER_LEN + body.size() + BINLOG_CHECKSUM_LEN);
+	put_le(s.data, 1700000000, 4);               // timestamp
+	s.data.push_back(char(type));
+	put_le(s.data, 1, 4);                        // server id
+	put_le(s.data, len, 4);
+	put_le(s.data, start + len, 4);              // log pos
+	put_le(s.data, 0, 2);                        // flags
+	s.data += body;
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, (const Bytef*)s.data.data() + start, uInt(len - BINLOG_CHECKSUM_LEN));
+	put_le(s.data, crc, 4);
+	s.offsets.push_back(start);
+}
+
+static Stream make_stream(size_t trxs, size_t rows_per_trx, size_t row_bytes) {
+	Stream s;
+	s.gtids = trxs;
+	s.gno_sum = uint64_t(trxs) * (trxs + 1) / 2;
+	s.checksum_alg = slave::BINLOG_CHECKSUM_ALG_CRC32;
+	s.data.reserve(trxs * (rows_per_trx * (row_bytes + 32) + 256));
+	const unsigned char sid[16] = {0x3e, 0x11, 0xfa, 0x47, 0x71, 0xca, 0x11, 0xe1,
+	                               0x9e, 0x33, 0xc8, 0x0a, 0xa9, 0x42, 0x95, 0x62};
+	for (size_t t = 0; t < trxs; t++) {
+		std::string b;
+		b.push_back(1);                          // commit flag
+		b.append((const char*)sid, 16);
+		put_le(b, t + 1, 8);                     // gno
+		b.append(17, '\0');                      // logical clock
+		add_event(s, slave::GTID_LOG_EVENT, b);
+
+		b.clear();
+		put_le(b, 7, 4);                         // thread id
+		put_le(b, 0, 4);                         // exec time
+		b.push_back(4);                          // db name length
+		put_le(b, 0, 2);                         // error code
+		put_le(b, 0, 2);                         // status vars length
+		b += "test";
+		b.push_back('\0');
+		b += "BEGIN";
+		add_event(s, slave::QUERY_EVENT, b);
+
+		b.clear();
+		put_le(b, 108, 6);                       // table id
+		put_le(b, 1, 2);
+		b.push_back(4);
+		b += "test";
+		b.push_back('\0');
+		b.push_back(5);
+		b += "bench";
+		b.push_back('\0');
+		b.push_back(2);                          // columns
+		b.push_back(char(MYSQL_TYPE_LONG));
+		b.push_back(char(MYSQL_TYPE_BLOB));
+		b.push_back(1);                          // metadata length
+		b.push_back(2);
+		b.push_back(0);                          // null bits
+		add_event(s, slave::TABLE_MAP_EVENT, b);
+
+		for (size_t r = 0; r < rows_per_trx; r++) {
+			b.clear();
+			put_le(b, 108, 6);
+			put_le(b, 1, 2);
+			put_le(b, 2, 2);                     // no extra row data
+			b.push_back(2);
+			b.push_back(3);                      // columns present
+			while (b.size() < row_bytes) {
+				b.push_back(char(b.size() * 31));
+			}
+			add_event(s, slave::WRITE_ROWS_EVENT, b);
+		}
+
+		b.clear();
+		put_le(b, t + 1, 8);                     // xid
+		add_event(s, slave::XID_EVENT, b);
+	}
+	s.end_pos = s.data.size();
+	return s;
+}
+
+/** Appends the events of binlog file 'path'; false with a message on error. */
+static bool load_file(Stream& s, const char* path) {
+	FILE* f = fopen(path, "rb");
+	if (f == nullptr) {
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	std::string file;
+	char tmp[1 << 16];
+	size_t n;
+	while ((n = fread(tmp, 1, sizeof(tmp), f)) > 0) {
+		file.append(tmp, n);
+	}
+	fclose(f);
+	if (file.compare(0, BINLOG_MAGIC_LEN, "\xfe" "bin", BINLOG_MAGIC_LEN) != 0) {
+		fprintf(stderr, "%s is not a binlog file\n", path);
+		return false;
+	}
+	size_t pos = BINLOG_MAGIC_LEN;
+	while (pos + LOG_EVENT_HEADER_LEN <= file.size()) {
+		const char* ev = file.data() + pos;
+		const size_t len = get_le32(ev + EVENT_LEN_OFFSET);
+		if (len < LOG_EVENT_HEADER_LEN || pos + len > file.size()) {
+			break;
+		}
+		const unsigned char type = (unsigned char)ev[EVENT_TYPE_OFFSET];
+		if (type == slave::FORMAT_DESCRIPTION_EVENT) {
+			// The algorithm precedes the event's own checksum.
+			s.checksum_alg = slave::enum_binlog_checksum_alg(ev[len - BINLOG_CHECKSUM_LEN - 1]);
+		} else if (type == slave::GTID_LOG_EVENT && len >= LOG_EVENT_HEADER_LEN + 25) {
+			uint64_t gno = 0;
+			for (int i = 0; i < 8; i++) {
+				gno |= uint64_t((unsigned char)ev[LOG_EVENT_HEADER_LEN + 17 + i]) << (8 * i);
+			}
+			s.gno_sum += gno;
+			s.gtids++;
+		}
+		s.offsets.push_back(s.data.size() + pos - BINLOG_MAGIC_LEN);
+		pos += len;
+	}
+	if (pos != file.size()) {
+		fprintf(stderr, "%s: the last %zu bytes are not a complete event, skipped\n", path, file.size() - pos);
+	}
+	s.data.append(file, BINLOG_MAGIC_LEN, pos - BINLOG_MAGIC_LEN);
+	s.end_pos = pos;
+	return true;
+}
+
+/** Returns the sum of the GTID numbers seen, so neither path is optimised away. */
+static uint64_t run_pass(const Stream& s, bool gtid_only, size_t& decoded) {
+	slave::MasterInfo mi;
+	mi.checksum_alg = s.checksum_alg;
+	slave::RelayLogInfo rli;
+	slave::EmptyExtState ext_state;
+	uint64_t check = 0;
+	size_t log_pos = 0;
+	decoded = 0;
+
+	for (size_t i = 0; i < s.offsets.size(); i++) {
+		const size_t end = (i + 1 < s.offsets.size()) ? s.offsets[i + 1] : s.data.size();
+		const char* buf = s.data.data() + s.offsets[i];
+		const unsigned int len = unsigned(end - s.offsets[i]);
+
+		if (gtid_only && !slave::is_gtid_tracking_event((unsigned char)buf[EVENT_TYPE_OFFSET])) {
+			log_pos = get_le32(buf + LOG_POS_OFFSET);
+			continue;
+		}
+		decoded++;
+		slave::Basic_event_info event;
+		if (!slave::read_log_event(buf, len, event, nullptr, true, mi)) {
+			continue;
+		}
+		log_pos = event.log_pos;
+		switch (event.type) {
+			case slave::GTID_LOG_EVENT: {
+				slave::Gtid_event_info gei(event.buf, event.event_len);
+				check += gei.m_gno;
+				break;
+			}
+			case slave::QUERY_EVENT: {
+				slave::Query_event_info qei(event.buf, event.event_len);
+				check += qei.query.size() ? 0 : 1;
+				break;
+			}
+			case slave::TABLE_MAP_EVENT: {
+				slave::Table_map_event_info tmi(event.buf, event.event_len);
+				rli.setTableName(tmi.m_table_id, tmi.m_tblnam, tmi.m_dbnam);
+				break;
+			}
+			case slave::WRITE_ROWS_EVENT: {
+				slave::Row_event_info roi(event.buf, event.event_len, false, true);
+				slave::apply_row_event(rli, event, roi, ext_state, nullptr);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+	return check + (log_pos == s.end_pos ? 0 : 1);
+}
+
+static void run(const char* name, const Stream& s, bool gtid_only) {
+	size_t decoded;
+	const int64_t w0 = clock_ns(CLOCK_MONOTONIC);
+	const int64_t c0 = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	const uint64_t check = run_pass(s, gtid_only, decoded);
+	const int64_t c1 = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	const int64_t w1 = clock_ns(CLOCK_MONOTONIC);
+
+	const double secs = (w1 - w0) / 1e9;
+	const double mb = s.data.size() / 1048576.0;
+	const uint64_t want = s.gno_sum;
+	printf("%-10s %14.0f %10.1f %12.2f %10zu   (%s)\n", name, s.offsets.size() / secs, mb / secs,
+	       (c1 - c0) / 1e6 / mb, decoded, check == want ? "gtids ok" : "GTID MISMATCH");
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-n: number of transactions (default 100000)\n"
+	        "-r: ROWS events per transaction (default 4)\n"
+	        "-s: bytes per ROWS event body (default 1024)\n"
+	        "-f: binlog file to decode instead (repeatable)\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	size_t trxs = 100000, rows = 4, row_bytes = 1024;
+	std::vector<const char*> files;
+	int c;
+	while ((c = getopt(argc, argv, "n:r:s:f:")) != -1) {
+		switch (c) {
+			case 'n': trxs = strtoull(optarg, nullptr, 10); break;
+			case 'r': rows = strtoull(optarg, nullptr, 10); break;
+			case 's': row_bytes = strtoull(optarg, nullptr, 10); break;
+			case 'f': files.push_back(optarg); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (trxs == 0 || row_bytes < 16) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	Stream s;
+	if (files.empty()) {
+		s = make_stream(trxs, rows, row_bytes);
+		printf("%zu transactions, %zu ROWS events of %zu bytes each: %zu events, %.1f MB\n\n", trxs, rows,
+		       row_bytes, s.offsets.size(), s.data.size() / 1048576.0);
+	} else {
+		s.gtids = 0;
+		s.gno_sum = 0;
+		s.checksum_alg = slave::BINLOG_CHECKSUM_ALG_OFF;
+		for (size_t i = 0; i < files.size(); i++) {
+			if (!load_file(s, files[i])) return 1;
+		}
+		printf("%zu files, %zu GTIDs: %zu events, %.1f MB\n\n", files.size(), s.gtids, s.offsets.size(),
+		       s.data.size() / 1048576.0);
+	}
+	printf("%-10s %14s %10s %12s %10s\n", "path", "events/s", "MB/s", "CPU ms/MB", "decoded");
+	run("full", s, false);
+	run("gtid-only", s, true);
+	return 0;
+}
@@ -0,0 +1,312 @@
+/* fanout_bench
+ *
+ * Measures how fast a running proxysql_binlog_reader fans GTID updates out
+ * to many clients, over plaintext or TLS.
+ *
+ *   1. Connect -n clients to the reader (TLS with -s) and read their ST=.
+ *   2. Commit -c single-row transactions on the MySQL source, one at a time.
+ *   3. Every client counts the trxids it receives (I1/I2 = one, I3/I4 = the
+ *      interval length). The j-th trxid a client receives is matched with
+ *      the j-th commit, so the source must not see other writes meanwhile.
+ *   4. Report delivery latency (commit issued -> trxid received) across all
+ *      clients, and, with -r, the reader's CPU time per commit.
+ *
+ * Run it once with and once without -s against readers started with and
+ * without -T/-K to compare the TLS and plaintext fan-out paths.
+ *
+ * With -N there is no MySQL: the clients read until the reader closes them,
+ * as a reader replaying binlog files (-E replay) does once it is done, or
+ * until no trxid arrived for a second, as with a reader on mock_source once
+ * its -c transactions are out. The trxids they received are reported
+ * instead of latencies, over the time from the first to the last.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mysql.h>
+#include <openssl/ssl.h>
+
+struct Options {
+	std::string reader_host = "127.0.0.1";
+	int reader_port = 6020;
+	int clients = 500;
+	bool tls = false;
+	std::string mysql_host = "127.0.0.1";
+	int mysql_port = 3306;
+	std::string mysql_user = "root";
+	std::string mysql_pass;
+	int commits = 1000;
+	bool replay = false;
+	pid_t reader_pid = 0;
+};
+
+struct Client {
+	int fd = -1;
+	SSL* ssl = nullptr;
+	std::string buf;
+	size_t received = 0;
+	bool closed = false;
+};
+
+static int64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** utime + stime of a process, in microseconds; -1 if unavailable. */
+static int64_t process_cpu_us(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE* f = fopen(path, "r");
+	if (f == nullptr) return -1;
+	char line[2048];
+	size_t n = fread(line, 1, sizeof(line) - 1, f);
+	fclose(f);
+	line[n] = 0;
+	// Fields after the command name, which may itself contain spaces.
+	const char* p = strrchr(line, ')');
+	if (p == nullptr) return -1;
+	unsigned long long utime = 0, stime = 0;
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+		return -1;
+	}
+	return int64_t(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+/** Number of trxids carried by one update line; 0 for anything else. */
+static size_t line_trxids(const std::string& line) {
+	if (line.size() < 4 || line[0] != 'I' || line[2] != '=') return 0;
+	if (line[1] == '1' || line[1] == '2') return 1;
+	if (line[1] != '3' && line[1] != '4') return 0;
+	size_t colon = line.rfind(':');
+	std::string iv = line.substr(colon == std::string::npos ? 3 : colon + 1);
+	size_t dash = iv.find('-');
+	if (dash == std::string::npos) return 1;
+	return strtoull(iv.c_str() + dash + 1, nullptr, 10) - strtoull(iv.c_str(), nullptr, 10) + 1;
+}
+
+static bool connect_client(const Options& o, SSL_CTX* ctx, Client& c) {
+	c.fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c.fd < 0) return false;
+	struct timeval tv = {5, 0};
+	setsockopt(c.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(o.reader_port);
+	inet_pton(AF_INET, o.reader_host.c_str(), &addr.sin_addr);
+	if (connect(c.fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) return false;
+	if (ctx) {
+		c.ssl = SSL_new(ctx);
+		SSL_set_fd(c.ssl, c.fd);
+		if (SSL_connect(c.ssl) != 1) return false;
+	}
+	// Blocking read of the ST= line; the rest is driven by epoll.
+	while (c.buf.find('\n') == std::string::npos) {
+		char tmp[4096];
+		int rc = c.ssl ? SSL_read(c.ssl, tmp, sizeof(tmp)) : read(c.fd, tmp, sizeof(tmp));
+		if (rc <= 0) return false;
+		c.buf.append(tmp, rc);
+	}
+	if (c.buf.compare(0, 3, "ST=") != 0) return false;
+	c.buf.erase(0, c.buf.find('\n') + 1);
+	fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+	return true;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-H: reader host (default 127.0.0.1)\n"
+	        "-l: reader port (default 6020)\n"
+	        "-n: number of clients (default 500)\n"
+	        "-s: connect to the reader over TLS\n"
+	        "-h: MySQL host (default 127.0.0.1)\n"
+	        "-P: MySQL port (default 3306)\n"
+	        "-u: MySQL user (default root)\n"
+	        "-p: MySQL password\n"
+	        "-c: number of commits (default 1000)\n"
+	        "-N: no MySQL: read until the reader closes the clients (-E replay) or a second\n"
+	        "    passes without trxids (a reader on mock_source)\n"
+	        "-r: reader PID, to report its CPU time\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	int c;
+	while ((c = getopt(argc, argv, "H:l:n:sh:P:u:p:c:Nr:")) != -1) {
+		switch (c) {
+			case 'H': o.reader_host = optarg; break;
+			case 'l': o.reader_port = atoi(optarg); break;
+			case 'n': o.clients = atoi(optarg); break;
+			case 's': o.tls = true; break;
+			case 'h': o.mysql_host = optarg; break;
+			case 'P': o.mysql_port = atoi(optarg); break;
+			case 'u': o.mysql_user = optarg; break;
+			case 'p': o.mysql_pass = optarg; break;
+			case 'c': o.commits = atoi(optarg); break;
+			case 'N': o.replay = true; break;
+			case 'r': o.reader_pid = atoi(optarg); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	SSL_CTX* ctx = nullptr;
+	if (o.tls) {
+		ctx = SSL_CTX_new(TLS_client_method());
+		SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+	}
+
+	MYSQL* db = mysql_init(nullptr);
+	if (!o.replay) {
+		if (!mysql_real_connect(db, o.mysql_host.c_str(), o.mysql_user.c_str(), o.mysql_pass.c_str(),
+		                        nullptr, o.mysql_port, nullptr, 0)) {
+			fprintf(stderr, "cannot connect to MySQL: %s\n", mysql_error(db));
+			return 1;
+		}
+		mysql_query(db, "CREATE DATABASE IF NOT EXISTS binlog_reader_bench");
+		mysql_query(db, "CREATE TABLE IF NOT EXISTS binlog_reader_bench.t (id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+		// Let the reader publish the DDL before the clients take their ST=.
+		sleep(1);
+	}
+
+	std::vector<Client> clients(o.clients);
+	int ep = epoll_create1(0);
+	for (int i = 0; i < o.clients; i++) {
+		if (!connect_client(o, ctx, clients[i])) {
+			fprintf(stderr, "client %d failed to connect to %s:%d: %s\n", i, o.reader_host.c_str(),
+			        o.reader_port, strerror(errno));
+			return 1;
+		}
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl(ep, EPOLL_CTL_ADD, clients[i].fd, &ev);
+	}
+	fprintf(stderr, "%d %s clients connected\n", o.clients, o.tls ? "TLS" : "plaintext");
+
+	std::vector<std::atomic<int64_t>> issued(o.commits);
+	for (auto& t : issued) t.store(0);
+	std::atomic<bool> writer_done(false);
+
+	const int64_t cpu_start = o.reader_pid ? process_cpu_us(o.reader_pid) : -1;
+	const int64_t start = now_us();
+	std::thread writer([&]() {
+		for (int j = 0; j < o.commits && !o.replay; j++) {
+			issued[j].store(now_us());
+			if (mysql_query(db, "INSERT INTO binlog_reader_bench.t (v) VALUES (1)")) {
+				fprintf(stderr, "INSERT failed: %s\n", mysql_error(db));
+				break;
+			}
+		}
+		writer_done.store(true);
+	});
+
+	std::vector<uint32_t> latencies;
+	latencies.reserve(o.replay ? 0 : size_t(o.clients) * o.commits);
+	size_t replayed = 0;
+	size_t complete = 0;
+	int64_t done_at = 0;
+	int64_t first_delivery = 0, last_delivery = 0;
+	std::vector<struct epoll_event> events(1024);
+	while (complete < clients.size()) {
+		if (writer_done.load() && done_at == 0 && !o.replay) done_at = now_us();
+		if (done_at && now_us() - done_at > 30 * 1000000) break;
+		if (o.replay && last_delivery && now_us() - last_delivery > 1000000) break;
+		int n = epoll_wait(ep, events.data(), events.size(), 100);
+		for (int e = 0; e < n; e++) {
+			Client& cl = clients[events[e].data.u32];
+			const size_t before = cl.received;
+			char tmp[16384];
+			while (true) {
+				int rc = cl.ssl ? SSL_read(cl.ssl, tmp, sizeof(tmp)) : read(cl.fd, tmp, sizeof(tmp));
+				if (rc == 0) cl.closed = true;
+				if (rc <= 0) break;
+				cl.buf.append(tmp, rc);
+			}
+			const int64_t t = now_us();
+			size_t from = 0, nl;
+			while ((nl = cl.buf.find('\n', from)) != std::string::npos) {
+				size_t k = line_trxids(cl.buf.substr(from, nl - from));
+				if (o.replay) {
+					cl.received += k;
+					replayed += k;
+					if (k && !first_delivery) first_delivery = t;
+					if (k) last_delivery = t;
+					k = 0;
+				}
+				for (; k > 0 && cl.received < size_t(o.commits); k--, cl.received++) {
+					latencies.push_back(uint32_t(std::max<int64_t>(0, t - issued[cl.received].load())));
+				}
+				from = nl + 1;
+			}
+			cl.buf.erase(0, from);
+			if (o.replay) {
+				if (cl.closed) {
+					epoll_ctl(ep, EPOLL_CTL_DEL, cl.fd, nullptr);
+					complete++;
+				}
+			} else if (before < size_t(o.commits) && cl.received >= size_t(o.commits)) {
+				complete++;
+			}
+		}
+	}
+	const int64_t elapsed = o.replay ? last_delivery - first_delivery : now_us() - start;
+	const int64_t cpu_end = o.reader_pid ? process_cpu_us(o.reader_pid) : -1;
+	writer.join();
+
+	std::sort(latencies.begin(), latencies.end());
+	auto pct = [&](double p) -> uint32_t {
+		if (latencies.empty()) return 0;
+		return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+	};
+	printf("transport:          %s\n", o.tls ? "tls" : "plaintext");
+	printf("clients:            %d (%zu complete)\n", o.clients, complete);
+	if (o.replay) {
+		size_t least = clients.empty() ? 0 : clients[0].received;
+		for (auto& cl : clients) least = std::min(least, cl.received);
+		printf("elapsed:            %.3f s\n", elapsed / 1e6);
+		printf("deliveries:         %zu trxids (%.0f/s), at least %zu per client\n", replayed,
+		       replayed / (elapsed / 1e6), least);
+		if (cpu_start >= 0 && cpu_end >= 0) {
+			printf("reader cpu:         %.3f s\n", (cpu_end - cpu_start) / 1e6);
+		}
+	} else {
+		printf("commits:            %d\n", o.commits);
+		printf("elapsed:            %.3f s\n", elapsed / 1e6);
+		printf("deliveries:         %zu (%.0f/s)\n", latencies.size(), latencies.size() / (elapsed / 1e6));
+		printf("latency p50/p99/p999/max: %u / %u / %u / %u us\n", pct(0.50), pct(0.99), pct(0.999),
+		       latencies.empty() ? 0 : latencies.back());
+		if (cpu_start >= 0 && cpu_end >= 0) {
+			printf("reader cpu:         %.3f s (%.1f us/commit)\n", (cpu_end - cpu_start) / 1e6,
+			       double(cpu_end - cpu_start) / o.commits);
+		}
+	}
+
+	for (auto& cl : clients) {
+		if (cl.ssl) SSL_free(cl.ssl);
+		close(cl.fd);
+	}
+	if (ctx) SSL_CTX_free(ctx);
+	mysql_close(db);
+	return complete == clients.size() || (o.replay && last_delivery) ? 0 : 1;
+}
@@ -0,0 +1,947 @@
+/* mock_source
+ *
+ * A stand-in MySQL replication source, for end-to-end benchmarks of the
+ * reader on one box without MySQL. It speaks as much of the protocol as the
+ * reader's engines use:
+ *
+ *   - the handshake, accepting any user and password (the client is
+ *     switched to mysql_native_password); no TLS, no compression;
+ *   - the startup queries of libslave, -E native and -E poll, alone or as
+ *     one multi-statement query: SET, SELECT of VERSION() and variables,
+ *     SHOW GLOBAL VARIABLES LIKE, and SHOW MASTER STATUS / SHOW BINARY LOG
+ *     STATUS;
+ *   - COM_REGISTER_SLAVE, COM_PING, COM_QUIT and COM_BINLOG_DUMP_GTID, which
+ *     streams every transaction missing from the requested set, with
+ *     heartbeats at the period the client asked for once it is caught up.
+ *
+ * The binlog is synthetic and the same for every connection. Transaction k
+ * goes to the (k % -u)-th UUID, whose GNOs run from 1, skipping one after
+ * every -g. Each transaction is GTID, BEGIN, TABLE_MAP, -r WRITE_ROWS of one
+ * -s byte row and XID, with CRC32 checksums, as MySQL 8.0 writes them; as
+ * 5.7 does with -V 5.7.x, without commit timestamps or transaction length.
+ * Files rotate at BINLOG_FILE_SIZE.
+ *
+ * The first -i transactions are executed from the start. The next -c (no
+ * limit by default) are committed from the first dump request on, after -w
+ * seconds: -R per second, or without -R as fast as the fastest dump takes
+ * them. SHOW MASTER STATUS and @@global.gtid_executed follow them.
+ *
+ * The binlogs of the first -p of the initial transactions are purged: they
+ * are @@global.gtid_purged, and a dump from a set lacking any of them fails
+ * with error 1236, as MySQL's does.
+ *
+ * Every connection has its own thread; each dump reports what it sent when
+ * its connection ends.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "proxysql_binlog_event.h"
+#include "proxysql_crc32.h"
+
+struct Options {
+	int port = 3306;
+	std::string version = "8.0.36";
+	unsigned int uuids = 1;
+	uint64_t gap = 0;
+	uint64_t rate = 0;
+	uint64_t count = 0;
+	uint64_t initial = 100;
+	uint64_t purged = 0;
+	unsigned int rows = 1;
+	size_t row_size = 100;
+	double wait = 0;
+};
+
+static Options o;
+
+namespace {
+
+const unsigned char COM_QUIT             = 0x01;
+const unsigned char COM_QUERY            = 0x03;
+const unsigned char COM_PING             = 0x0e;
+const unsigned char COM_REGISTER_SLAVE   = 0x15;
+const unsigned char COM_BINLOG_DUMP_GTID = 0x1e;
+
+// Capability flags of the handshake.
+const uint32_t CLIENT_LONG_PASSWORD     = 0x00000001;
+const uint32_t CLIENT_LONG_FLAG         = 0x00000004;
+const uint32_t CLIENT_CONNECT_WITH_DB   = 0x00000008;
+const uint32_t CLIENT_PROTOCOL_41       = 0x00000200;
+const uint32_t CLIENT_TRANSACTIONS      = 0x00002000;
+const uint32_t CLIENT_SECURE_CONNECTION = 0x00008000;
+const uint32_t CLIENT_MULTI_STATEMENTS  = 0x00010000;
+const uint32_t CLIENT_MULTI_RESULTS     = 0x00020000;
+const uint32_t CLIENT_PLUGIN_AUTH       = 0x00080000;
+
+const uint16_t SERVER_STATUS_AUTOCOMMIT   = 0x0002;
+const uint16_t SERVER_MORE_RESULTS_EXISTS = 0x0008;
+
+const unsigned char CHARSET_UTF8_GENERAL_CI = 33;
+const unsigned char MYSQL_TYPE_VAR_STRING = 0xfd;
+const unsigned char MYSQL_TYPE_BLOB = 0xfc;
+const size_t MAX_PACKET_LENGTH = 0xffffff;
+const size_t SCRAMBLE_LENGTH = 20;
+
+// Event types the reader does not parse; the rest are in
+// proxysql_binlog_event.h.
+const unsigned char TABLE_MAP_EVENT     = 19;
+const unsigned char HEARTBEAT_LOG_EVENT = 27;
+const unsigned char WRITE_ROWS_EVENT    = 30;
+
+const uint16_t LOG_EVENT_ARTIFICIAL_F = 0x20;
+const uint16_t STMT_END_F = 1;
+const uint32_t SERVER_ID = 1;
+const uint64_t TABLE_ID = 108;
+
+// Post-header lengths of MySQL 8.0's FORMAT_DESCRIPTION, one per event type
+// from 1; 5.7 knows the first 38. The entry for FORMAT_DESCRIPTION itself is
+// filled in.
+const unsigned char POST_HEADER_LEN[] = {
+	56, 13, 0, 8, 0, 18, 0, 4, 4, 4, 4, 18, 0, 0, 0, 0, 4, 26, 8, 0, 0,
+	0, 8, 8, 8, 2, 0, 0, 0, 10, 10, 10, 42, 42, 0, 18, 52, 0, 10, 40, 0,
+};
+const size_t EVENT_TYPES_80 = sizeof(POST_HEADER_LEN);
+const size_t EVENT_TYPES_57 = 38;
+
+const uint64_t BINLOG_FILE_SIZE = 1ULL << 30;
+// A dump writes once it has this much, or is caught up.
+const size_t DUMP_WRITE_SIZE = 256 * 1024;
+
+// UUIDs are 4d4f434b-0000-4000-8000-<index>.
+const unsigned char UUID_PREFIX[10] = { 0x4d, 0x4f, 0x43, 0x4b, 0, 0, 0x40, 0, 0x80, 0 };
+
+inline void put_uint(std::string& s, uint64_t v, size_t bytes) {
+	for (size_t i = 0; i < bytes; i++) {
+		s.push_back(char(v >> (8 * i)));
+	}
+}
+
+inline void store_uint(unsigned char *p, uint64_t v, size_t bytes) {
+	for (size_t i = 0; i < bytes; i++) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+size_t packed_size(uint64_t v) {
+	return v < 251 ? 1 : v < 0x10000 ? 3 : v < 0x1000000 ? 4 : 9;
+}
+
+void put_packed(std::string& s, uint64_t v) {
+	switch (packed_size(v)) {
+		case 1: s.push_back(char(v)); break;
+		case 3: s.push_back(char(0xfc)); put_uint(s, v, 2); break;
+		case 4: s.push_back(char(0xfd)); put_uint(s, v, 3); break;
+		default: s.push_back(char(0xfe)); put_uint(s, v, 8); break;
+	}
+}
+
+void put_lenenc_str(std::string& s, const std::string& v) {
+	put_packed(s, v.size());
+	s += v;
+}
+
+int64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t wall_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool is_57() {
+	return o.version.compare(0, 2, "5.") == 0;
+}
+
+// "8.0.36" → 80036.
+uint32_t version_id() {
+	unsigned int major = 0, minor = 0, patch = 0;
+	sscanf(o.version.c_str(), "%u.%u.%u", &major, &minor, &patch);
+	return major * 10000 + minor * 100 + patch;
+}
+
+std::string uuid_bytes(unsigned int u) {
+	std::string s((const char *)UUID_PREFIX, sizeof(UUID_PREFIX));
+	for (int i = 5; i >= 0; i--) {
+		s.push_back(char(uint64_t(u) >> (8 * i)));
+	}
+	return s;
+}
+
+std::string uuid_text(unsigned int u) {
+	const std::string b = uuid_bytes(u);
+	std::string s;
+	char hex[3];
+	for (size_t i = 0; i < b.size(); i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) s += '-';
+		snprintf(hex, sizeof(hex), "%02x", (unsigned char)b[i]);
+		s += hex;
+	}
+	return s;
+}
+
+// The j-th transaction of a UUID, from 0, and how many of them have a GNO up
+// to 'gno'.
+int64_t gno_of(uint64_t j) {
+	return int64_t(j + 1 + (o.gap ? j / o.gap : 0));
+}
+
+uint64_t trx_upto(int64_t gno) {
+	if (gno <= 0) return 0;
+	return o.gap ? gno - gno / (o.gap + 1) : gno;
+}
+
+/** The GTID set of the first 'n' transactions, as MySQL prints it. */
+std::string gtid_set_text(uint64_t n) {
+	std::string s;
+	for (unsigned int u = 0; u < o.uuids; u++) {
+		const uint64_t m = n / o.uuids + (u < n % o.uuids ? 1 : 0);
+		if (m == 0) continue;
+		if (!s.empty()) s += ",\n";
+		s += uuid_text(u);
+		const int64_t last = gno_of(m - 1);
+		const int64_t step = o.gap ? int64_t(o.gap) + 1 : last;
+		for (int64_t a = 1; a <= last; a += step) {
+			const int64_t b = std::min(last, a + step - (o.gap ? 2 : 1));
+			s += ":" + std::to_string(a);
+			if (b > a) s += "-" + std::to_string(b);
+		}
+	}
+	return s;
+}
+
+/** One event, with a checksum over 'ts' and 'log_pos'. */
+std::string event(unsigned char type, const std::string& body, uint32_t ts, uint32_t log_pos, uint16_t flags = 0) {
+	std::string e;
+	put_uint(e, ts, 4);
+	e.push_back(char(type));
+	put_uint(e, SERVER_ID, 4);
+	put_uint(e, EVENT_HEADER_LEN + body.size() + CHECKSUM_LEN, 4);
+	put_uint(e, log_pos, 4);
+	put_uint(e, flags, 2);
+	e += body;
+	put_uint(e, proxysql_crc32(0, (const unsigned char *)e.data(), e.size()), 4);
+	return e;
+}
+
+std::string fde_event(uint32_t ts, uint32_t log_pos) {
+	const size_t types = is_57() ? EVENT_TYPES_57 : EVENT_TYPES_80;
+	std::string b;
+	put_uint(b, 4, 2);
+	std::string version = o.version;
+	version.resize(50, '\0');
+	b += version;
+	put_uint(b, 0, 4);
+	b.push_back(char(EVENT_HEADER_LEN));
+	std::string lens((const char *)POST_HEADER_LEN, types);
+	lens[FORMAT_DESCRIPTION_EVENT - 1] = char(2 + 50 + 4 + 1 + types);
+	b += lens;
+	// binlog_checksum=CRC32.
+	b.push_back(1);
+	return event(FORMAT_DESCRIPTION_EVENT, b, ts, log_pos);
+}
+
+std::string binlog_name(uint64_t file) {
+	char name[32];
+	snprintf(name, sizeof(name), "binlog.%06llu", (unsigned long long)file + 1);
+	return name;
+}
+
+// The events of every transaction, framed as dump packets; the sequence
+// numbers, times, positions, GTID and XID are filled in as it is sent.
+struct Trx_Template {
+	std::string packets;
+	std::vector<size_t> events;
+	// Bytes of the binlog.
+	size_t len;
+};
+
+Trx_Template trx_tmpl;
+size_t file_header_len;
+size_t rotate_len;
+uint64_t trx_per_file;
+
+void build_template() {
+	std::vector<std::string> events;
+
+	std::string begin;
+	put_uint(begin, 0, 4 + 4);
+	begin.push_back(0);
+	put_uint(begin, 0, 2 + 2);
+	begin += std::string("\0BEGIN", 6);
+	events.push_back(event(QUERY_EVENT, begin, 0, 0));
+
+	// One nullable LONGBLOB column in mock.t.
+	std::string map;
+	put_uint(map, TABLE_ID, 6);
+	put_uint(map, 1, 2);
+	map += std::string("\4mock\0\1t\0", 9);
+	put_packed(map, 1);
+	map.push_back(char(MYSQL_TYPE_BLOB));
+	put_packed(map, 1);
+	map.push_back(4);
+	map.push_back(1);
+	events.push_back(event(TABLE_MAP_EVENT, map, 0, 0));
+
+	for (unsigned int r = 0; r < o.rows; r++) {
+		std::string rows;
+		put_uint(rows, TABLE_ID, 6);
+		put_uint(rows, r + 1 == o.rows ? STMT_END_F : 0, 2);
+		put_uint(rows, 2, 2);
+		put_packed(rows, 1);
+		rows.push_back(1);
+		rows.push_back(0);
+		put_uint(rows, o.row_size, 4);
+		rows += std::string(o.row_size, 'x');
+		events.push_back(event(WRITE_ROWS_EVENT, rows, 0, 0));
+	}
+
+	std::string xid;
+	put_uint(xid, 0, 8);
+	events.push_back(event(XID_EVENT, xid, 0, 0));
+
+	size_t rest = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		rest += events[i].size();
+	}
+
+	std::string gtid;
+	gtid.push_back(0);
+	gtid += uuid_bytes(0);
+	put_uint(gtid, 0, 8);
+	gtid.push_back(2);
+	put_uint(gtid, 0, 8 + 8);
+	if (!is_57()) {
+		put_uint(gtid, 0, 7);
+		// The length covers the GTID event, whose size depends on how the
+		// length is packed.
+		const size_t fixed = EVENT_HEADER_LEN + gtid.size() + 4 + CHECKSUM_LEN + rest;
+		size_t n = 1;
+		while (packed_size(fixed + n) != n) {
+			n = packed_size(fixed + n);
+		}
+		put_packed(gtid, fixed + n);
+		put_uint(gtid, version_id(), 4);
+	}
+	events.insert(events.begin(), event(GTID_LOG_EVENT, gtid, 0, 0));
+
+	trx_tmpl.len = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		trx_tmpl.events.push_back(trx_tmpl.packets.size());
+		put_uint(trx_tmpl.packets, events[i].size() + 1, 3);
+		trx_tmpl.packets.push_back(0);
+		trx_tmpl.packets.push_back(0);
+		trx_tmpl.packets += events[i];
+		trx_tmpl.len += events[i].size();
+	}
+
+	file_header_len = BINLOG_MAGIC_LEN + fde_event(0, 0).size();
+	std::string rotate;
+	put_uint(rotate, BINLOG_MAGIC_LEN, 8);
+	rotate += binlog_name(0);
+	rotate_len = EVENT_HEADER_LEN + rotate.size() + CHECKSUM_LEN;
+	trx_per_file = std::max<uint64_t>(1, (BINLOG_FILE_SIZE - file_header_len - rotate_len) / trx_tmpl.len);
+}
+
+uint64_t file_of(uint64_t k) {
+	return k / trx_per_file;
+}
+
+uint64_t pos_of(uint64_t k) {
+	return file_header_len + (k % trx_per_file) * trx_tmpl.len;
+}
+
+// When the first dump asked for the binlog, plus -w; 0 before.
+std::atomic<int64_t> load_start(0);
+// Without -R: the transactions the fastest dump has sent.
+std::atomic<uint64_t> executed(0);
+
+/** Transactions that may have been committed by 'now'. */
+uint64_t due(int64_t now) {
+	const int64_t start = load_start.load();
+	if (start == 0 || now < start) return o.initial;
+	uint64_t n = o.count ? o.count : UINT64_MAX - o.initial;
+	if (o.rate) {
+		n = std::min(n, uint64_t(double(now - start) * o.rate / 1e6));
+	}
+	return o.initial + n;
+}
+
+uint64_t committed() {
+	return o.rate ? due(now_us()) : executed.load();
+}
+
+struct Conn {
+	int fd;
+	std::string peer;
+	unsigned char seq;
+	std::string out;
+	uint64_t heartbeat_ns;
+
+	Conn(int _fd, const std::string& _peer) : fd(_fd), peer(_peer), seq(0), heartbeat_ns(0) {}
+};
+
+bool read_full(int fd, unsigned char *p, size_t len) {
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool read_packet(Conn& c, std::string& p) {
+	unsigned char hdr[4];
+	if (!read_full(c.fd, hdr, sizeof(hdr))) return false;
+	const size_t len = get_uint3(hdr);
+	// Commands never need more than one packet here.
+	if (len == MAX_PACKET_LENGTH) return false;
+	p.resize(len);
+	if (len && !read_full(c.fd, (unsigned char *)&p[0], len)) return false;
+	c.seq = hdr[3] + 1;
+	return true;
+}
+
+void packet(Conn& c, const std::string& payload) {
+	put_uint(c.out, payload.size(), 3);
+	c.out.push_back(char(c.seq++));
+	c.out += payload;
+}
+
+bool flush(Conn& c) {
+	const char *p = c.out.data();
+	size_t len = c.out.size();
+	while (len > 0) {
+		ssize_t n = write(c.fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+	c.out.clear();
+	return true;
+}
+
+void ok_packet(Conn& c, uint16_t status = SERVER_STATUS_AUTOCOMMIT) {
+	std::string p(3, '\0');
+	put_uint(p, status, 2);
+	put_uint(p, 0, 2);
+	packet(c, p);
+}
+
+void err_packet(Conn& c, uint16_t code, const char *state, const std::string& msg) {
+	std::string p(1, char(0xff));
+	put_uint(p, code, 2);
+	p += '#';
+	p += state;
+	p += msg;
+	packet(c, p);
+}
+
+void eof_packet(Conn& c, uint16_t status) {
+	std::string p(1, char(0xfe));
+	put_uint(p, 0, 2);
+	put_uint(p, status, 2);
+	packet(c, p);
+}
+
+void result(Conn& c, const std::vector<std::string>& names, const std::vector<std::vector<std::string> >& rows,
+            uint16_t status) {
+	std::string p;
+	put_packed(p, names.size());
+	packet(c, p);
+	for (size_t i = 0; i < names.size(); i++) {
+		p.clear();
+		put_lenenc_str(p, "def");
+		put_lenenc_str(p, "");
+		put_lenenc_str(p, "");
+		put_lenenc_str(p, "");
+		put_lenenc_str(p, names[i]);
+		put_lenenc_str(p, names[i]);
+		p.push_back(0x0c);
+		put_uint(p, CHARSET_UTF8_GENERAL_CI, 2);
+		put_uint(p, 1024, 4);
+		p.push_back(char(MYSQL_TYPE_VAR_STRING));
+		put_uint(p, 0, 2 + 1 + 2);
+		packet(c, p);
+	}
+	eof_packet(c, status);
+	for (size_t r = 0; r < rows.size(); r++) {
+		p.clear();
+		for (size_t i = 0; i < rows[r].size(); i++) {
+			put_lenenc_str(p, rows[r][i]);
+		}
+		packet(c, p);
+	}
+	eof_packet(c, status);
+}
+
+std::string trim(const std::string& s) {
+	const size_t a = s.find_first_not_of(" \t\r\n");
+	if (a == std::string::npos) return "";
+	return s.substr(a, s.find_last_not_of(" \t\r\n") - a + 1);
+}
+
+bool starts_with(const std::string& s, const char *prefix) {
+	return strncasecmp(s.c_str(), prefix, strlen(prefix)) == 0;
+}
+
+/** A global or user variable, by name without its @ or @@global. */
+bool variable(const std::string& name, std::string& value) {
+	if (!strcasecmp(name.c_str(), "version") || !strcasecmp(name.c_str(), "VERSION()")) {
+		value = o.version + "-mock";
+	} else if (!strcasecmp(name.c_str(), "gtid_mode")) {
+		value = "ON";
+	} else if (!strcasecmp(name.c_str(), "binlog_format")) {
+		value = "ROW";
+	} else if (!strcasecmp(name.c_str(), "binlog_checksum") || !strcasecmp(name.c_str(), "master_binlog_checksum") ||
+	           !strcasecmp(name.c_str(), "source_binlog_checksum")) {
+		value = "CRC32";
+	} else if (!strcasecmp(name.c_str(), "gtid_executed")) {
+		value = gtid_set_text(committed());
+	} else if (!strcasecmp(name.c_str(), "gtid_purged")) {
+		value = gtid_set_text(o.purged);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// The period in nanoseconds from "SET ... @master_heartbeat_period = N".
+void parse_heartbeat(Conn& c, const std::string& stmt) {
+	std::string lower(stmt);
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	const size_t at = lower.find("heartbeat_period");
+	if (at == std::string::npos) return;
+	const size_t eq = lower.find('=', at);
+	if (eq == std::string::npos) return;
+	c.heartbeat_ns = strtoull(lower.c_str() + eq + 1, NULL, 10);
+}
+
+/** Answers one statement; false after an error, which ends a multi-statement query. */
+bool answer(Conn& c, const std::string& stmt, uint16_t status) {
+	std::vector<std::vector<std::string> > rows;
+	if (starts_with(stmt, "SET ")) {
+		parse_heartbeat(c, stmt);
+		ok_packet(c, status);
+		return true;
+	}
+	if (starts_with(stmt, "SHOW MASTER STATUS") || starts_with(stmt, "SHOW BINARY LOG STATUS")) {
+		const uint64_t n = committed();
+		std::vector<std::string> row;
+		row.push_back(binlog_name(file_of(n)));
+		row.push_back(std::to_string(pos_of(n)));
+		row.push_back("");
+		row.push_back("");
+		row.push_back(gtid_set_text(n));
+		rows.push_back(row);
+		std::vector<std::string> names;
+		names.push_back("File");
+		names.push_back("Position");
+		names.push_back("Binlog_Do_DB");
+		names.push_back("Binlog_Ignore_DB");
+		names.push_back("Executed_Gtid_Set");
+		result(c, names, rows, status);
+		return true;
+	}
+	if (starts_with(stmt, "SHOW GLOBAL VARIABLES LIKE ")) {
+		const size_t a = stmt.find('\'');
+		const size_t b = a == std::string::npos ? a : stmt.find('\'', a + 1);
+		std::string value;
+		if (b != std::string::npos && variable(stmt.substr(a + 1, b - a - 1), value)) {
+			rows.push_back(std::vector<std::string>());
+			rows.back().push_back(stmt.substr(a + 1, b - a - 1));
+			rows.back().push_back(value);
+		}
+		std::vector<std::string> names;
+		names.push_back("Variable_name");
+		names.push_back("Value");
+		result(c, names, rows, status);
+		return true;
+	}
+	if (starts_with(stmt, "SELECT ")) {
+		std::vector<std::string> names;
+		rows.push_back(std::vector<std::string>());
+		size_t from = 7;
+		while (from <= stmt.size()) {
+			size_t comma = stmt.find(',', from);
+			if (comma == std::string::npos) comma = stmt.size();
+			const std::string expr = trim(stmt.substr(from, comma - from));
+			std::string name = expr;
+			if (starts_with(name, "@@global.")) name = name.substr(9);
+			else if (starts_with(name, "@@")) name = name.substr(2);
+			else if (starts_with(name, "@")) name = name.substr(1);
+			std::string value;
+			if (!variable(name, value)) {
+				err_packet(c, 1193, "HY000", "Unknown system variable '" + name + "'");
+				return false;
+			}
+			names.push_back(expr);
+			rows.back().push_back(value);
+			from = comma + 1;
+		}
+		result(c, names, rows, status);
+		return true;
+	}
+	err_packet(c, 1064, "42000", "mock_source does not support: " + stmt);
+	return false;
+}
+
+void query(Conn& c, const std::string& q) {
+	std::vector<std::string> stmts;
+	size_t from = 0;
+	while (from <= q.size()) {
+		size_t semi = q.find(';', from);
+		if (semi == std::string::npos) semi = q.size();
+		const std::string s = trim(q.substr(from, semi - from));
+		if (!s.empty()) stmts.push_back(s);
+		from = semi + 1;
+	}
+	if (stmts.empty()) {
+		err_packet(c, 1065, "42000", "Query was empty");
+	}
+	for (size_t i = 0; i < stmts.size(); i++) {
+		const uint16_t more = i + 1 < stmts.size() ? SERVER_MORE_RESULTS_EXISTS : 0;
+		if (!answer(c, stmts[i], SERVER_STATUS_AUTOCOMMIT | more)) break;
+	}
+}
+
+bool handshake(Conn& c) {
+	std::string scramble(SCRAMBLE_LENGTH, '\0');
+	for (size_t i = 0; i < scramble.size(); i++) {
+		scramble[i] = char(1 + rand() % 126);
+	}
+	const uint32_t caps = CLIENT_LONG_PASSWORD | CLIENT_LONG_FLAG | CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41 |
+	                      CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_MULTI_STATEMENTS |
+	                      CLIENT_MULTI_RESULTS | CLIENT_PLUGIN_AUTH;
+	std::string p(1, 10);
+	p += o.version + "-mock";
+	p.push_back(0);
+	put_uint(p, uint32_t(c.fd), 4);
+	p += scramble.substr(0, 8);
+	p.push_back(0);
+	put_uint(p, caps & 0xffff, 2);
+	p.push_back(char(CHARSET_UTF8_GENERAL_CI));
+	put_uint(p, SERVER_STATUS_AUTOCOMMIT, 2);
+	put_uint(p, caps >> 16, 2);
+	p.push_back(char(SCRAMBLE_LENGTH + 1));
+	p += std::string(10, '\0');
+	p += scramble.substr(8);
+	p.push_back(0);
+	p += "mysql_native_password";
+	p.push_back(0);
+	c.seq = 0;
+	packet(c, p);
+	std::string r;
+	if (!flush(c) || !read_packet(c, r)) return false;
+
+	// Whatever plugin the client picked, switch it to this one; any password
+	// is good.
+	p.assign(1, char(0xfe));
+	p += "mysql_native_password";
+	p.push_back(0);
+	p += scramble;
+	p.push_back(0);
+	packet(c, p);
+	if (!flush(c) || !read_packet(c, r)) return false;
+	ok_packet(c);
+	return flush(c);
+}
+
+void dump_event(Conn& c, const std::string& ev) {
+	put_uint(c.out, ev.size() + 1, 3);
+	c.out.push_back(char(c.seq++));
+	c.out.push_back(0);
+	c.out += ev;
+}
+
+void put_trx(Conn& c, uint64_t k, uint32_t ts, int64_t commit_us) {
+	const size_t at = c.out.size();
+	c.out += trx_tmpl.packets;
+	unsigned char *base = (unsigned char *)&c.out[at];
+	uint64_t log_pos = pos_of(k);
+	for (size_t e = 0; e < trx_tmpl.events.size(); e++) {
+		unsigned char *pk = base + trx_tmpl.events[e];
+		pk[3] = c.seq++;
+		unsigned char *ev = pk + 5;
+		const size_t len = get_uint4(ev + EVENT_LEN_OFFSET);
+		log_pos += len;
+		store_uint(ev, ts, 4);
+		store_uint(ev + LOG_POS_OFFSET, log_pos, 4);
+		if (e == 0) {
+			const uint64_t u = k % o.uuids;
+			for (size_t i = sizeof(UUID_PREFIX); i < 16; i++) {
+				ev[GTID_SID_OFFSET + i] = (unsigned char)(u >> (8 * (15 - i)));
+			}
+			store_uint(ev + GTID_GNO_OFFSET, gno_of(k / o.uuids), 8);
+			store_uint(ev + GTID_CLOCK_OFFSET, k, 8);
+			store_uint(ev + GTID_CLOCK_OFFSET + 8, k + 1, 8);
+			if (!is_57()) store_uint(ev + GTID_COMMIT_TS_OFFSET, commit_us, GTID_COMMIT_TS_LEN);
+		} else if (e + 1 == trx_tmpl.events.size()) {
+			store_uint(ev + EVENT_HEADER_LEN, k, 8);
+		}
+		store_uint(ev + len - CHECKSUM_LEN, proxysql_crc32(0, ev, len - CHECKSUM_LEN), 4);
+	}
+}
+
+/** ROTATE at the end of 'file', then the next file's FORMAT_DESCRIPTION. */
+void rotate(Conn& c, uint64_t file, uint32_t ts) {
+	std::string b;
+	put_uint(b, BINLOG_MAGIC_LEN, 8);
+	b += binlog_name(file + 1);
+	const uint64_t end = file_header_len + trx_per_file * trx_tmpl.len + rotate_len;
+	dump_event(c, event(ROTATE_EVENT, b, ts, end));
+	dump_event(c, fde_event(ts, file_header_len));
+}
+
+void dump(Conn& c, const std::string& p) {
+	// flags, server_id, file name, position, then the GTID set.
+	const unsigned char *q = (const unsigned char *)p.data() + 1;
+	const unsigned char *end = (const unsigned char *)p.data() + p.size();
+	std::vector<uint64_t> have(o.uuids, 0);
+	bool good = end - q >= 10;
+	if (good) {
+		q += 6;
+		const size_t name_len = get_uint4(q);
+		q += 4;
+		good = size_t(end - q) >= name_len + 8 + 4 + 8;
+		if (good) q += name_len + 8 + 4;
+	}
+	uint64_t sids = good ? get_uint8(q) : 0;
+	if (good) q += 8;
+	for (; good && sids > 0; sids--) {
+		good = end - q >= 16 + 8;
+		if (!good) break;
+		const unsigned char *sid = q;
+		uint64_t ivs = get_uint8(q + 16);
+		q += 16 + 8;
+		good = uint64_t(end - q) >= ivs * 16;
+		if (!good || ivs == 0) continue;
+		const int64_t last = int64_t(get_uint8(q + (ivs - 1) * 16 + 8)) - 1;
+		q += ivs * 16;
+		if (memcmp(sid, UUID_PREFIX, sizeof(UUID_PREFIX)) != 0) continue;
+		uint64_t u = 0;
+		for (size_t i = sizeof(UUID_PREFIX); i < 16; i++) {
+			u = u << 8 | sid[i];
+		}
+		if (u < o.uuids) have[u] = trx_upto(last);
+	}
+	if (!good) {
+		err_packet(c, 1236, "HY000", "malformed COM_BINLOG_DUMP_GTID");
+		flush(c);
+		return;
+	}
+
+	int64_t expected = 0;
+	const int64_t requested = now_us();
+	if (load_start.compare_exchange_strong(expected, requested + int64_t(o.wait * 1e6))) {
+		fprintf(stderr, "load starts in %.1f s\n", o.wait);
+	}
+
+	uint64_t k = UINT64_MAX;
+	for (unsigned int u = 0; u < o.uuids; u++) {
+		k = std::min(k, have[u] * o.uuids + u);
+	}
+	if (k < o.purged) {
+		fprintf(stderr, "dump from %s: transaction %llu is purged\n", c.peer.c_str(), (unsigned long long)k);
+		err_packet(c, 1236, "HY000", "Cannot replicate because the source purged required binary logs");
+		flush(c);
+		return;
+	}
+	uint64_t file = file_of(k);
+	fprintf(stderr, "dump from %s: from transaction %llu, %s:%llu\n", c.peer.c_str(), (unsigned long long)k,
+	        binlog_name(file).c_str(), (unsigned long long)pos_of(k));
+
+	std::string b;
+	put_uint(b, BINLOG_MAGIC_LEN, 8);
+	b += binlog_name(file);
+	dump_event(c, event(ROTATE_EVENT, b, 0, 0, LOG_EVENT_ARTIFICIAL_F));
+	dump_event(c, fde_event(uint32_t(time(NULL)), 0));
+
+	const int64_t heartbeat_us = c.heartbeat_ns / 1000;
+	int64_t next_heartbeat = requested + heartbeat_us;
+	uint64_t sent = 0, bytes = 0;
+	const char *why = "closed";
+	while (true) {
+		const int64_t now = now_us();
+		const uint64_t limit = due(now);
+		if (k < limit) {
+			const uint32_t ts = uint32_t(time(NULL));
+			const int64_t commit_us = wall_us();
+			while (k < limit && c.out.size() < DUMP_WRITE_SIZE) {
+				if (file_of(k) != file) {
+					rotate(c, file, ts);
+					file = file_of(k);
+				}
+				if (k / o.uuids >= have[k % o.uuids]) {
+					put_trx(c, k, ts, commit_us);
+					sent++;
+				}
+				k++;
+			}
+			bytes += c.out.size();
+			if (!flush(c)) break;
+			if (!o.rate) {
+				uint64_t n = executed.load();
+				while (n < k && !executed.compare_exchange_weak(n, k)) {
+				}
+			}
+			next_heartbeat = now + heartbeat_us;
+			continue;
+		}
+		if (heartbeat_us && now >= next_heartbeat) {
+			dump_event(c, event(HEARTBEAT_LOG_EVENT, binlog_name(file), 0, pos_of(k), LOG_EVENT_ARTIFICIAL_F));
+			if (!flush(c)) break;
+			next_heartbeat = now + heartbeat_us;
+		}
+		// Paced: the next transactions are due within a millisecond. Otherwise
+		// only heartbeats or the client closing are waited for.
+		const int64_t start = load_start.load();
+		const bool running = o.rate && now >= start && (o.count == 0 || k < o.initial + o.count);
+		int64_t wait_ms = running ? 1 : now < start ? std::min<int64_t>(100, (start - now) / 1000 + 1) : 100;
+		if (heartbeat_us) wait_ms = std::min(wait_ms, (next_heartbeat - now) / 1000 + 1);
+		struct pollfd pfd = { c.fd, POLLIN, 0 };
+		if (poll(&pfd, 1, int(wait_ms)) > 0) {
+			// Only COM_QUIT or the end of the connection can come.
+			char tmp[256];
+			const ssize_t n = read(c.fd, tmp, sizeof(tmp));
+			if (n <= 0 || (n > 4 && tmp[4] == COM_QUIT)) {
+				why = "ended by the client";
+				break;
+			}
+		}
+	}
+	const double secs = (now_us() - requested) / 1e6;
+	fprintf(stderr, "dump from %s %s: %llu transactions, %.1f MB in %.3f s (%.0f transactions/s, %.1f MB/s)\n",
+	        c.peer.c_str(), why, (unsigned long long)sent, bytes / 1e6, secs, sent / secs, bytes / 1e6 / secs);
+}
+
+void serve(int fd, std::string peer) {
+	Conn c(fd, peer);
+	std::string p;
+	if (handshake(c)) {
+		while (read_packet(c, p) && !p.empty()) {
+			const unsigned char cmd = p[0];
+			if (cmd == COM_QUIT) break;
+			if (cmd == COM_BINLOG_DUMP_GTID) {
+				dump(c, p);
+				break;
+			}
+			if (cmd == COM_QUERY) {
+				query(c, p.substr(1));
+			} else if (cmd == COM_REGISTER_SLAVE || cmd == COM_PING) {
+				ok_packet(c);
+			} else {
+				err_packet(c, 1047, "08S01", "Unknown command");
+			}
+			if (!flush(c)) break;
+		}
+	}
+	close(fd);
+}
+
+} // namespace
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-P: port to listen on, on 127.0.0.1 (default 3306)\n"
+	        "-V: MySQL version to report (default 8.0.36; 5.7.x writes 5.7 GTID events)\n"
+	        "-u: number of source UUIDs (default 1)\n"
+	        "-g: skip one GNO after every that many transactions of a UUID (default 0: no gaps)\n"
+	        "-i: transactions executed at start (default 100)\n"
+	        "-p: initial transactions whose binlogs are purged (default 0)\n"
+	        "-R: transactions per second (default 0: as fast as the fastest dump reads)\n"
+	        "-c: transactions to commit, then only heartbeats (default 0: no end)\n"
+	        "-w: seconds from the first dump request until the load starts (default 0)\n"
+	        "-r: row events per transaction (default 1)\n"
+	        "-s: bytes of the row in each row event (default 100)\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	int c;
+	while ((c = getopt(argc, argv, "P:V:u:g:i:p:R:c:w:r:s:")) != -1) {
+		switch (c) {
+			case 'P': o.port = atoi(optarg); break;
+			case 'V': o.version = optarg; break;
+			case 'u': o.uuids = strtoul(optarg, nullptr, 10); break;
+			case 'g': o.gap = strtoull(optarg, nullptr, 10); break;
+			case 'i': o.initial = strtoull(optarg, nullptr, 10); break;
+			case 'p': o.purged = strtoull(optarg, nullptr, 10); break;
+			case 'R': o.rate = strtoull(optarg, nullptr, 10); break;
+			case 'c': o.count = strtoull(optarg, nullptr, 10); break;
+			case 'w': o.wait = strtod(optarg, nullptr); break;
+			case 'r': o.rows = strtoul(optarg, nullptr, 10); break;
+			case 's': o.row_size = strtoull(optarg, nullptr, 10); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	// A row event must fit in one packet.
+	if (o.port <= 0 || o.uuids == 0 || version_id() < 50700 || o.wait < 0 || o.row_size > 16000000 ||
+	    o.purged > o.initial) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	srand(time(NULL));
+	build_template();
+	executed.store(o.initial);
+
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(o.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0) {
+		fprintf(stderr, "cannot listen on 127.0.0.1:%d: %s\n", o.port, strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "MySQL %s on 127.0.0.1:%d: %u UUID(s), %zu-byte transactions, %llu per file; %llu executed\n",
+	        o.version.c_str(), o.port, o.uuids, trx_tmpl.len, (unsigned long long)trx_per_file,
+	        (unsigned long long)o.initial);
+
+	while (true) {
+		struct sockaddr_in peer = {};
+		socklen_t len = sizeof(peer);
+		int fd = accept(lfd, (struct sockaddr*)&peer, &len);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			fprintf(stderr, "accept: %s\n", strerror(errno));
+			return 1;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		char ip[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+		std::thread(serve, fd, std::string(ip) + ":" + std::to_string(ntohs(peer.sin_port))).detach();
+	}
+}
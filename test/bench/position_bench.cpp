@@ -0,0 +1,104 @@
+/* position_bench
+ *
+ * Measures what the binlog thread spends per transaction keeping libslave's
+ * position current, with the patched libslave: a GTID set of -u source
+ * UUIDs with -i intervals each, then -n transactions of one source added to
+ * it, each handed to a DefaultExtState the way get_remote_binlog() does.
+ *
+ *   - "copy" calls setMasterPosition(), which copies the whole set.
+ *   - "advance" calls advanceMasterPosition(), which applies only the new
+ *     GTID and log position.
+ *
+ * It reports ns per transaction and checks both states end up equal to the
+ * Slave-side position. No MySQL server is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "DefaultExtState.h"
+
+static int64_t clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static std::string uuid_of(size_t n) {
+	char buf[48];
+	snprintf(buf, sizeof(buf), "3e11fa47-71ca-11e1-9e33-%012zx", n);
+	return buf;
+}
+
+/** -u sources with -i intervals of 10 transactions, one apart. */
+static slave::Position make_position(size_t uuids, size_t intervals) {
+	slave::Position pos("binlog.000001", 4);
+	for (size_t u = 0; u < uuids; u++) {
+		auto& list = pos.gtid_executed[uuid_of(u)];
+		for (size_t i = 0; i < intervals; i++) {
+			list.emplace_back(int64_t(i * 11 + 1), int64_t(i * 11 + 10));
+		}
+	}
+	return pos;
+}
+
+static void run(const char* name, size_t uuids, size_t intervals, size_t trxs, bool advance) {
+	slave::Position pos = make_position(uuids, intervals);
+	slave::DefaultExtState state;
+	state.setMasterPosition(pos);
+
+	slave::gtid_t gtid(uuid_of(0), pos.gtid_executed[uuid_of(0)].back().second);
+	const int64_t t0 = clock_ns();
+	for (size_t t = 0; t < trxs; t++) {
+		gtid.second++;
+		pos.addGtid(gtid);
+		pos.log_pos += 1000;
+		if (advance)
+			state.advanceMasterPosition(pos, gtid);
+		else
+			state.setMasterPosition(pos);
+	}
+	const int64_t t1 = clock_ns();
+
+	slave::Position got;
+	state.getMasterPosition(got);
+	const bool same = got.log_pos == pos.log_pos && got.str() == pos.str();
+	printf("%-8s %12.0f   (%s)\n", name, double(t1 - t0) / trxs, same ? "state ok" : "STATE MISMATCH");
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-n: number of transactions (default 100000)\n"
+	        "-u: source UUIDs in the GTID set (default 16)\n"
+	        "-i: intervals per UUID (default 64)\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	size_t trxs = 100000, uuids = 16, intervals = 64;
+	int c;
+	while ((c = getopt(argc, argv, "n:u:i:")) != -1) {
+		switch (c) {
+			case 'n': trxs = strtoull(optarg, nullptr, 10); break;
+			case 'u': uuids = strtoull(optarg, nullptr, 10); break;
+			case 'i': intervals = strtoull(optarg, nullptr, 10); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (trxs == 0 || uuids == 0 || intervals == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%zu transactions on a set of %zu UUIDs x %zu intervals\n\n", trxs, uuids, intervals);
+	printf("%-8s %12s\n", "path", "ns/trx");
+	run("copy", uuids, intervals, trxs, false);
+	run("advance", uuids, intervals, trxs, true);
+	return 0;
+}
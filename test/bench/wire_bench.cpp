@@ -0,0 +1,217 @@
+/* wire_bench
+ *
+ * Compares the text and binary client protocols on a synthetic update
+ * stream, with the same encoder the reader uses (proxysql_gtid_wire).
+ *
+ * For each protocol, in streaming (one trxid per update: I1/I2) and batched
+ * (one interval per update: I3/I4) form, it reports:
+ *
+ *   - bytes/update on the wire;
+ *   - encode ns/update on the reader side;
+ *   - parse ns/update on the client side. The text parser follows what a
+ *     line-oriented client does (split lines, strtoll the numbers); the
+ *     binary one is GTID_Wire_Decoder.
+ *
+ * The "+z" rows wrap the same stream in deflate with a sync flush every -F
+ * updates, as a "z=deflate" connection does per batch, and report the
+ * compressed bytes/update, deflate ns/update and inflate ns/update.
+ *
+ * No reader or MySQL is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "proxysql_gtid.h"
+#include "proxysql_gtid_wire.h"
+
+struct Update {
+	size_t uuid;
+	TrxId_Interval iv;
+	Update(size_t u, trxid_t s, trxid_t e) : uuid(u), iv(s, e) {}
+};
+
+static int64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * `n` updates over `uuids` sources, switching source every `run` updates.
+ * Each update covers `batch` consecutive trxids of its source.
+ */
+static std::vector<Update> make_stream(size_t n, size_t uuids, size_t run, size_t batch) {
+	std::vector<Update> out;
+	std::vector<trxid_t> next(uuids, 1000000);
+	out.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		size_t u = (i / run) % uuids;
+		out.push_back(Update(u, next[u], next[u] + trxid_t(batch) - 1));
+		next[u] += trxid_t(batch);
+	}
+	return out;
+}
+
+/** Parses one text line the way a line-oriented client does. */
+static bool parse_text_line(const char* p, const char* end, std::string& uuid, trxid_t& start, trxid_t& stop) {
+	if (end - p < 4 || p[0] != 'I' || p[2] != '=') return false;
+	p += 3;
+	if (p[-2] == '1' || p[-2] == '3') {
+		const char* colon = (const char*)memchr(p, ':', end - p);
+		if (colon == nullptr) return false;
+		uuid.assign(p, colon - p);
+		p = colon + 1;
+	}
+	char* q;
+	start = strtoll(p, &q, 10);
+	stop = (*q == '-') ? strtoll(q + 1, &q, 10) : start;
+	return q == end;
+}
+
+/** Deflates `in` with a sync flush at every `flush_every`-th mark, then inflates it back. */
+static void run_deflate(const char* name, const std::string& in, const std::vector<size_t>& marks,
+                        size_t flush_every, int level) {
+	GTID_Wire_Deflater z;
+	GTID_Wire_Inflater unz;
+	if (!z.init(level) || !unz.init()) {
+		fprintf(stderr, "zlib init failed\n");
+		exit(1);
+	}
+	std::string out;
+	out.reserve(in.size() + 1024);
+
+	int64_t t0 = now_ns();
+	size_t prev = 0;
+	for (size_t i = flush_every - 1; i < marks.size(); i += flush_every) {
+		z.write(out, in.data() + prev, marks[i] - prev);
+		prev = marks[i];
+	}
+	if (prev < in.size()) {
+		z.write(out, in.data() + prev, in.size() - prev);
+	}
+	int64_t t1 = now_ns();
+	std::string back;
+	back.reserve(in.size());
+	bool ok = unz.write(back, out.data(), out.size());
+	int64_t t2 = now_ns();
+
+	const double n = double(marks.size());
+	printf("%-20s %10.2f %12.1f %12.1f   (ratio %.2f, %s)\n", name, out.size() / n, (t1 - t0) / n,
+	       (t2 - t1) / n, double(in.size()) / out.size(), (ok && back == in) ? "round-trip ok" : "MISMATCH");
+}
+
+static void run(const char* name, int proto, bool batched, const std::vector<Update>& stream,
+                const std::vector<std::string>& uuids, size_t flush_every, int level) {
+	GTID_Wire_Encoder enc(proto);
+	std::string out;
+	out.reserve(stream.size() * 48);
+	std::vector<size_t> marks;
+	marks.reserve(stream.size());
+
+	int64_t t0 = now_ns();
+	for (const Update& u : stream) {
+		if (batched) {
+			enc.update(out, uuids[u.uuid], u.iv);
+		} else {
+			enc.update(out, uuids[u.uuid], u.iv.start);
+		}
+		marks.push_back(out.size());
+	}
+	int64_t t1 = now_ns();
+
+	size_t parsed = 0;
+	trxid_t check = 0;
+	if (proto == GTID_WIRE_PROTO_TEXT) {
+		std::string uuid;
+		const char* p = out.data();
+		const char* end = p + out.size();
+		while (p < end) {
+			const char* nl = (const char*)memchr(p, '\n', end - p);
+			trxid_t s, e;
+			if (nl == nullptr || !parse_text_line(p, nl, uuid, s, e)) break;
+			check += e;
+			parsed++;
+			p = nl + 1;
+		}
+	} else {
+		GTID_Wire_Decoder dec;
+		GTID_Wire_Msg msg;
+		size_t off = 0;
+		while (off < out.size()) {
+			long n = dec.decode(out.data() + off, out.size() - off, msg);
+			if (n <= 0) break;
+			off += size_t(n);
+			if (msg.type == GTID_WIRE_UPDATE) {
+				check += msg.end;
+				parsed++;
+			}
+		}
+	}
+	int64_t t2 = now_ns();
+
+	const double n = double(stream.size());
+	printf("%-20s %10.2f %12.1f %12.1f   (%zu/%zu parsed, check %lld)\n", name, out.size() / n,
+	       (t1 - t0) / n, (t2 - t1) / n, parsed, stream.size(), (long long)check);
+
+	std::string zname = std::string(name) + " +z";
+	run_deflate(zname.c_str(), out, marks, flush_every, level);
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+	        "Usage: %s [args]\n"
+	        "\n"
+	        "-n: number of updates (default 1000000)\n"
+	        "-u: number of source UUIDs (default 1)\n"
+	        "-r: updates before switching to the next UUID (default 16)\n"
+	        "-b: trxids per update in batched form (default 8)\n"
+	        "-F: updates per deflate sync flush (default 1)\n"
+	        "-z: deflate level, 1-9 (default 1)\n",
+	        name);
+}
+
+int main(int argc, char** argv) {
+	size_t n = 1000000, nuuids = 1, run_len = 16, batch = 8, flush_every = 1;
+	int level = 1;
+	int c;
+	while ((c = getopt(argc, argv, "n:u:r:b:F:z:")) != -1) {
+		switch (c) {
+			case 'n': n = strtoull(optarg, nullptr, 10); break;
+			case 'u': nuuids = strtoull(optarg, nullptr, 10); break;
+			case 'r': run_len = strtoull(optarg, nullptr, 10); break;
+			case 'b': batch = strtoull(optarg, nullptr, 10); break;
+			case 'F': flush_every = strtoull(optarg, nullptr, 10); break;
+			case 'z': level = atoi(optarg); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (n == 0 || nuuids == 0 || run_len == 0 || batch == 0 || flush_every == 0 || level < 1 || level > 9) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<std::string> uuids;
+	for (size_t i = 0; i < nuuids; i++) {
+		char buf[33];
+		snprintf(buf, sizeof(buf), "3e11fa4771ca11e19e33c80a%08x", unsigned(i));
+		uuids.push_back(buf);
+	}
+
+	printf("%zu updates, %zu uuid(s), run %zu, batch %zu, flush every %zu, deflate level %d\n\n", n, nuuids,
+	       run_len, batch, flush_every, level);
+	printf("%-20s %10s %12s %12s\n", "protocol", "bytes/upd", "encode ns", "parse ns");
+	std::vector<Update> streaming = make_stream(n, nuuids, run_len, 1);
+	std::vector<Update> batched = make_stream(n, nuuids, run_len, batch);
+	run("text streaming", GTID_WIRE_PROTO_TEXT, false, streaming, uuids, flush_every, level);
+	run("bin streaming", GTID_WIRE_PROTO_BIN, false, streaming, uuids, flush_every, level);
+	run("text batched", GTID_WIRE_PROTO_TEXT, true, batched, uuids, flush_every, level);
+	run("bin batched", GTID_WIRE_PROTO_BIN, true, batched, uuids, flush_every, level);
+	return 0;
+}
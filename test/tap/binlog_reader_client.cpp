@@ -234,16 +234,20 @@ void BinlogReaderClient::disconnect() {
 		fd_ = -1;
 	}
 	buf_.clear();
+	wire_ = GTID_Wire_Decoder();
+	zin_.end();
 }
 
 /**
- * Block until more bytes are available, appending recv'd bytes to buf_.
+ * Block until more bytes are available, appending recv'd bytes to buf_
+ * (inflated first on a z=deflate connection).
  *
  * @param timeout_ms Poll deadline.
  *
  * @return true on a successful recv; false otherwise — errno conveys
  *         the reason: ETIMEDOUT for poll timeout, 0 for clean peer
- *         close, else the underlying poll/recv errno.
+ *         close, EBADMSG for a corrupt compressed stream, else the
+ *         underlying poll/recv errno.
  */
 bool BinlogReaderClient::fill_buffer(int timeout_ms) {
 	pollfd pfd {};
@@ -265,6 +269,13 @@ bool BinlogReaderClient::fill_buffer(int timeout_ms) {
 	}
 	if (n < 0)
 		return false;
+	if (zin_.is_active()) {
+		if (!zin_.write(buf_, tmp, static_cast<size_t>(n))) {
+			errno = EBADMSG;
+			return false;
+		}
+		return true;
+	}
 	buf_.append(tmp, static_cast<size_t>(n));
 	return true;
 }
@@ -324,12 +335,21 @@ BinlogReaderMsg BinlogReaderClient::read_line(int timeout_ms) {
 	}
 	const std::string head = msg.raw.substr(0, 2);
 	if (head != "ST" && head != "I1" && head != "I2" && head != "I3" &&
-	    head != "I4") {
+	    head != "I4" && head != "HB") {
 		msg.error = ERR_INVALID_FORMAT;
 		return msg;
 	}
 	msg.kind = head;
 
+	if (msg.kind == "HB") {
+		if (msg.raw.size() == 3 ||
+		    msg.raw.find_first_not_of("0123456789", 3) != std::string::npos) {
+			msg.kind.clear();
+			msg.error = ERR_INVALID_FORMAT;
+		}
+		return msg;
+	}
+
 	const bool parsed = (msg.kind == "ST") ? parse_st_line(msg)
 	                                       : parse_iv_line(msg);
 	if (!parsed) {
@@ -340,3 +360,104 @@ BinlogReaderMsg BinlogReaderClient::read_line(int timeout_ms) {
 	}
 	return msg;
 }
+
+/**
+ * Send "HELLO <options>" and wait for the reader's HELLO reply.
+ *
+ * @param options    Space-separated key=value pairs, e.g. "proto=bin".
+ * @param timeout_ms Deadline for the send and the reply.
+ *
+ * @return The reply without its '\n'; empty on failure.
+ */
+std::string BinlogReaderClient::hello(const std::string& options,
+                                      int timeout_ms) {
+	if (fd_ < 0)
+		return "";
+
+	const auto deadline = std::chrono::steady_clock::now() +
+	                      std::chrono::milliseconds(timeout_ms);
+	const std::string line = "HELLO " + options + "\n";
+	size_t sent = 0;
+	while (sent < line.size()) {
+		ssize_t n = send(fd_, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+		if (n > 0) {
+			sent += static_cast<size_t>(n);
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR)
+			return "";
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			return "";
+		pollfd pfd {};
+		pfd.fd = fd_;
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, static_cast<int>(
+		    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()));
+	}
+
+	while (true) {
+		const size_t nl = buf_.find('\n');
+		if (nl != std::string::npos) {
+			std::string reply = buf_.substr(0, nl);
+			buf_.erase(0, nl + 1);
+			if (reply.compare(0, 5, "HELLO") != 0)
+				continue;
+			if ((reply + " ").find(" z=deflate ") != std::string::npos) {
+				// The bytes after the reply are already compressed.
+				std::string rest;
+				rest.swap(buf_);
+				if (!zin_.init() || !zin_.write(buf_, rest.data(), rest.size()))
+					return "";
+			}
+			return reply;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			return "";
+		const auto remaining =
+		    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+		        .count();
+		if (!fill_buffer(static_cast<int>(remaining)))
+			return "";
+	}
+}
+
+/**
+ * Read the next SNAPSHOT or UPDATE frame of the binary protocol.
+ *
+ * @param msg        Out: the decoded frame.
+ * @param timeout_ms Deadline for the whole read.
+ *
+ * @return true on success; false on timeout, peer close, socket error
+ *         or a malformed frame.
+ */
+bool BinlogReaderClient::read_frame(GTID_Wire_Msg& msg, int timeout_ms) {
+	if (fd_ < 0)
+		return false;
+
+	const auto deadline = std::chrono::steady_clock::now() +
+	                      std::chrono::milliseconds(timeout_ms);
+
+	while (true) {
+		const long n = wire_.decode(buf_.data(), buf_.size(), msg);
+		if (n < 0)
+			return false;
+		if (n > 0) {
+			buf_.erase(0, static_cast<size_t>(n));
+			if (msg.type == GTID_WIRE_SNAPSHOT || msg.type == GTID_WIRE_UPDATE)
+				return true;
+			continue;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			return false;
+		const auto remaining =
+		    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+		        .count();
+		if (!fill_buffer(static_cast<int>(remaining)))
+			return false;
+	}
+}
@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "proxysql_gtid.h"
+#include "proxysql_gtid_wire.h"
 
 /**
  * One parsed line of the proxysql_binlog_reader on-wire protocol.
@@ -16,8 +17,10 @@
  *   I2=<trxid>                             same uuid as previous I1
  *   I3=<uuid>:<interval>                   batched: new uuid + interval
  *   I4=<interval>                          batched: same uuid as previous I3
+ *   HB=<unix time, ms>                     heartbeat, after HELLO hb=<ms>
  *
- * `intervals` holds one entry for I1/I2/I3/I4 and one-or-more for ST.
+ * `intervals` holds one entry for I1/I2/I3/I4, one-or-more for ST and
+ * none for HB.
  * `uuid` is empty for I2/I4 (tests carry it over from the preceding
  * I1/I3).
  *
@@ -82,18 +85,51 @@ class BinlogReaderClient {
 	 */
 	BinlogReaderMsg read_line(int timeout_ms = 5000);
 
+	/**
+	 * Send "HELLO <options>" and wait for the reader's HELLO reply.
+	 *
+	 * Text lines queued before the reply (an ST= sent before the reader
+	 * read the HELLO) are discarded. Whatever follows the reply is in the
+	 * negotiated protocol. When the reply accepts z=deflate, the rest of the
+	 * stream is inflated transparently.
+	 *
+	 * @param options    Space-separated key=value pairs, e.g. "proto=bin".
+	 * @param timeout_ms Deadline for the send and the reply.
+	 *
+	 * @return The reply without its '\n', e.g. "HELLO proto=bin"; empty on
+	 *         failure.
+	 */
+	std::string hello(const std::string& options, int timeout_ms = 5000);
+
+	/**
+	 * Read the next SNAPSHOT or UPDATE frame of the binary protocol.
+	 *
+	 * UUID frames are absorbed by the connection's decoder.
+	 *
+	 * @param msg        Out: the decoded frame.
+	 * @param timeout_ms Deadline for the whole read.
+	 *
+	 * @return true on success; false on timeout, peer close, socket error
+	 *         or a malformed frame.
+	 */
+	bool read_frame(GTID_Wire_Msg& msg, int timeout_ms = 5000);
+
    private:
 	int fd_ = -1;
 	std::string buf_;
+	GTID_Wire_Decoder wire_;
+	GTID_Wire_Inflater zin_;
 
 	/**
-	 * Block until more bytes are available, appending recv'd bytes to buf_.
+	 * Block until more bytes are available, appending recv'd bytes to buf_
+	 * (inflated first on a z=deflate connection).
 	 *
 	 * @param timeout_ms Poll deadline.
 	 *
 	 * @return true on a successful recv; false otherwise — errno conveys
 	 *         the reason: ETIMEDOUT for poll timeout, 0 for clean peer
-	 *         close, else the underlying poll/recv errno.
+	 *         close, EBADMSG for a corrupt compressed stream, else the
+	 *         underlying poll/recv errno.
 	 */
 	bool fill_buffer(int timeout_ms);
 };
@@ -85,6 +85,10 @@ bool BinlogReaderProcess::start() {
 
 	argv.push_back("-l");
 	argv.push_back(std::to_string(listen_port));
+	for (const std::string& l : extra_listeners) {
+		argv.push_back("-l");
+		argv.push_back(l);
+	}
 
 	if (freq_ms >= 0) {
 		argv.push_back("-t");
@@ -101,6 +105,38 @@ bool BinlogReaderProcess::start() {
 		argv.push_back(std::to_string(max_netbuflen));
 	}
 
+	if (!shm_path.empty()) {
+		argv.push_back("-S");
+		argv.push_back(shm_path);
+	}
+
+	if (!checkpoint_path.empty()) {
+		argv.push_back("-C");
+		argv.push_back(checkpoint_path);
+	}
+
+	if (!tls_cert.empty()) {
+		argv.push_back("-T");
+		argv.push_back(tls_cert);
+		argv.push_back("-K");
+		argv.push_back(tls_key);
+	}
+
+	if (!engine.empty()) {
+		argv.push_back("-E");
+		argv.push_back(engine);
+	}
+
+	if (!binlog_index.empty()) {
+		argv.push_back("-D");
+		argv.push_back(binlog_index);
+	}
+
+	if (heartbeat_ms >= 0) {
+		argv.push_back("-H");
+		argv.push_back(std::to_string(heartbeat_ms));
+	}
+
 	if (foreground)
 		argv.push_back("-f");
 
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 /** Thin wrapper to start/stop proxysql_binlog_reader process. */
 class BinlogReaderProcess {
@@ -14,10 +15,23 @@ class BinlogReaderProcess {
 	std::string mysql_user = "root";
 	std::string mysql_password = "root";
 	int         listen_port = 6020;
+	// Further -l values ("port[:freq[:batching[:max_netbuflen]]]").
+	std::vector<std::string> extra_listeners;
 	std::string log_file_path;
 	int         freq_ms = -1;
 	int         batching = -1;
 	long        max_netbuflen = -1;
+	std::string shm_path;
+	// -C value; empty runs without a checkpoint.
+	std::string checkpoint_path;
+	std::string tls_cert;
+	std::string tls_key;
+	// -E value; empty leaves the reader's default.
+	std::string engine;
+	// -D value, for -E file.
+	std::string binlog_index;
+	// -H value; negative leaves the reader's default.
+	int         heartbeat_ms = -1;
 	bool        foreground = true;
 
 	BinlogReaderProcess() = default;
@@ -0,0 +1,168 @@
+/* test_binary_handoff-t
+ *
+ * On SIGUSR2 the reader execs its binary again and hands the listening
+ * socket, its clients and the GTID state to the new process over a Unix
+ * socket. Clients must not notice.
+ *
+ *   1. handoff_send()/handoff_recv() alone: a payload of integers and
+ *      strings and a descriptor arrive intact; the descriptor refers to
+ *      the same pipe; too many descriptors are refused; the end of the
+ *      stream reads as such.
+ *   2. With a spawned reader: one text client and one z=deflate client
+ *      read ST=, then the reader gets SIGUSR2.
+ *   3. INSERT once: both connections, still open, get the next trxid.
+ *   4. The reader pid is still alive and a new client gets ST=.
+ *   5. Two SIGUSR2 back to back, the second while the new process starts:
+ *      it does not die, and after one INSERT both clients get the trxid.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_handoff.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+static trxid_t max_interval_end(const std::vector<TrxId_Interval>& ivs) {
+	trxid_t mx = 0;
+	for (auto& iv : ivs) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+static void test_records() {
+	int sv[2];
+	int p[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 || pipe(p) != 0) {
+		BAIL_OUT("socketpair/pipe: %s", strerror(errno));
+	}
+	// Larger than the socket buffer: the sender must not block for good.
+	const std::string big(1 << 20, 'x');
+	Handoff_Writer w;
+	w.put_u64(42);
+	w.put_str("10.0.0.1:3306");
+	w.put_str(big);
+	std::thread sender([&]() {
+		handoff_send(sv[0], w.data, std::vector<int>(1, p[1]));
+		handoff_send(sv[0], "", std::vector<int>());
+	});
+	std::string payload;
+	std::vector<int> fds;
+	bool got = handoff_recv(sv[1], payload, fds);
+	uint64_t n = 0;
+	std::string ip, data;
+	Handoff_Reader r(payload);
+	bool parsed = r.get_u64(n) && r.get_str(ip) && r.get_str(data) && !r.get_u64(n);
+	bool same_pipe = false;
+	if (fds.size() == 1) {
+		char c = 0;
+		same_pipe = write(fds[0], "!", 1) == 1 && read(p[0], &c, 1) == 1 && c == '!';
+		close(fds[0]);
+	}
+	ok(got && parsed && n == 42 && ip == "10.0.0.1:3306" && data == big && same_pipe,
+	   "record with a descriptor received (%zu bytes, %zu fds)", payload.size(), fds.size());
+
+	bool empty = handoff_recv(sv[1], payload, fds) && payload.empty() && fds.empty();
+	sender.join();
+	std::vector<int> too_many(HANDOFF_MAX_FDS + 1, p[1]);
+	bool refused = !handoff_send(sv[0], "", too_many) && errno == EINVAL;
+	close(sv[0]);
+	bool eof = !handoff_recv(sv[1], payload, fds) && errno == 0;
+	ok(empty && refused && eof, "empty record, too many descriptors refused, end of stream");
+	close(sv[1]);
+	close(p[0]);
+	close(p[1]);
+}
+
+int main() {
+	CommandLine cli;
+
+	plan(6);
+
+	test_records();
+
+	if (cli.reader_bin.empty()) {
+		skip(4, "handing over clients needs a spawned reader");
+		return exit_status();
+	}
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+	db.reset_gtid_set();
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.handoff_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient text, deflated;
+	if (!text.connect(reader_host, cli.reader_port, 2000) ||
+	    !deflated.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader");
+	}
+	BinlogReaderMsg st = text.read_line(10000);
+	const std::string reply = deflated.hello("z=deflate");
+	BinlogReaderMsg st_z = deflated.read_line(5000);
+	const trxid_t st_max = max_interval_end(st.intervals);
+	ok(st.valid() && st.kind == "ST" && reply == "HELLO z=deflate" && st_z.kind == "ST",
+	   "both clients have ST= (max %lld), reply='%s'", (long long)st_max, reply.c_str());
+
+	kill(reader.pid(), SIGUSR2);
+	// Let the new process take over before the INSERT.
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	db.exec("INSERT INTO binlog_reader_test.handoff_t (v) VALUES (1)");
+	BinlogReaderMsg m1 = text.read_line(5000);
+	BinlogReaderMsg m2 = deflated.read_line(5000);
+	const trxid_t got1 = m1.intervals.empty() ? 0 : m1.intervals[0].start;
+	const trxid_t got2 = m2.intervals.empty() ? 0 : m2.intervals[0].start;
+	ok(m1.valid() && m2.valid() && got1 == st_max + 1 && got2 == st_max + 1,
+	   "both connections got trxid %lld after the handoff (text='%s', deflate='%s')",
+	   (long long)(st_max + 1), m1.raw.c_str(), m2.raw.c_str());
+
+	BinlogReaderClient fresh;
+	BinlogReaderMsg st2;
+	if (fresh.connect(reader_host, cli.reader_port, 2000)) {
+		st2 = fresh.read_line(5000);
+	}
+	ok(kill(reader.pid(), 0) == 0 && st2.valid() && st2.kind == "ST" &&
+	   max_interval_end(st2.intervals) == st_max + 1,
+	   "same pid %d still serving new clients (raw='%s')", reader.pid(), st2.raw.c_str());
+
+	// The default action of SIGUSR2 terminates: the new process must hold
+	// it until it can hand over again.
+	kill(reader.pid(), SIGUSR2);
+	kill(reader.pid(), SIGUSR2);
+	int term_signal = 0;
+	const bool died = reader.wait_exit(1000, nullptr, &term_signal);
+
+	db.exec("INSERT INTO binlog_reader_test.handoff_t (v) VALUES (2)");
+	BinlogReaderMsg m3 = text.read_line(5000);
+	BinlogReaderMsg m4 = deflated.read_line(5000);
+	const trxid_t got3 = m3.intervals.empty() ? 0 : m3.intervals[0].start;
+	const trxid_t got4 = m4.intervals.empty() ? 0 : m4.intervals[0].start;
+	ok(!died && got3 == st_max + 2 && got4 == st_max + 2,
+	   "two SIGUSR2 back to back: still serving (signal %d, text='%s', deflate='%s')", term_signal,
+	   m3.raw.c_str(), m4.raw.c_str());
+
+	return exit_status();
+}
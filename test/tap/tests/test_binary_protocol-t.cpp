@@ -0,0 +1,102 @@
+/* test_binary_protocol-t
+ *
+ * A client that sends "HELLO proto=bin" switches the connection to the
+ * binary framing; the stream restarts with a SNAPSHOT frame.
+ *
+ *   1. Start reader; read the text ST= line.
+ *   2. Send HELLO proto=bin — the reply must echo proto=bin.
+ *   3. The next frame is a SNAPSHOT with the same uuid and the same last
+ *      trxid as the ST= line.
+ *   4. INSERT once — the next frame is an UPDATE for that uuid with the
+ *      next trxid.
+ */
+
+#include <string>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "proxysql_gtid_wire.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Highest trxid for `uuid` in a set, or 0. */
+static trxid_t last_trxid(const GTID_Set& set, const std::string& uuid) {
+	trxid_t mx = 0;
+	auto it = set.map.find(uuid);
+	if (it == set.map.end()) return 0;
+	for (auto& iv : it->second) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+int main() {
+	plan(4);
+
+	CommandLine cli;
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	if (!cli.reader_bin.empty())  // reset gtid only in spawn mode
+		db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.binproto_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+
+	BinlogReaderMsg st = client.read_line(10000);
+	if (!st.valid() || st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", st.error.c_str(),
+		         st.raw.c_str());
+	}
+	const std::string uuid = strip_dashes(st.uuid);
+	trxid_t st_last = 0;
+	for (auto& iv : st.intervals) {
+		if (iv.end > st_last) st_last = iv.end;
+	}
+
+	const std::string reply = client.hello("proto=bin");
+	ok(reply == "HELLO proto=bin", "HELLO reply echoes proto=bin (reply='%s')",
+	   reply.c_str());
+
+	GTID_Wire_Msg snap;
+	bool got_snap = client.read_frame(snap, 5000);
+	ok(got_snap && snap.type == GTID_WIRE_SNAPSHOT,
+	   "first binary frame is a SNAPSHOT (type=%d)", got_snap ? snap.type : -1);
+	const trxid_t snap_last = got_snap ? last_trxid(snap.set, uuid) : 0;
+	ok(snap_last == st_last, "SNAPSHOT matches ST= for %s (last trxid %lld, ST= %lld)",
+	   uuid.c_str(), (long long)snap_last, (long long)st_last);
+
+	if (!db.exec("INSERT INTO binlog_reader_test.binproto_t (v) VALUES (1)")) {
+		BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+	}
+	GTID_Wire_Msg upd;
+	bool got_upd = client.read_frame(upd, 5000);
+	const bool is_upd = got_upd && upd.type == GTID_WIRE_UPDATE && upd.uuid == uuid;
+	const trxid_t upd_last = is_upd ? upd.end : 0;
+	ok(is_upd && upd_last == snap_last + 1,
+	   "UPDATE frame carries %s:%lld (expected %lld)", uuid.c_str(),
+	   (long long)upd_last, (long long)(snap_last + 1));
+
+	return exit_status();
+}
@@ -0,0 +1,278 @@
+/* test_binlog_files-t
+ *
+ * The reader with -E file reads the binlog files listed in an index
+ * instead of connecting to a source. The files here are written by the
+ * test, event by event, so no MySQL is needed.
+ *
+ *   1. A file with PREVIOUS_GTIDS 1-10 and two transactions → ST=1-12.
+ *   2. Half a transaction is appended → nothing; the rest → trxid 13.
+ *   3. A transaction without a length (MySQL 5.7) and a DDL → 14, 15.
+ *   4. ROTATE, then the next file in the index → 16.
+ *   5. A file left without ROTATE (a crash), the next one listed → 17.
+ *   6. A new reader on the same files → ST=1-17.
+ *   7. -E replay:1 on the same files: the client gets ST=1-10 from the
+ *      first file, then trxids 11-17 in order.
+ *   8. The replay then closes the client and the reader exits with 0.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "proxysql_crc32.h"
+#include "tap.h"
+
+static const char SID_TEXT[] = "3e11fa47-71ca-11e1-9e33-c80aa9429562";
+static const unsigned char SID[16] = { 0x3e, 0x11, 0xfa, 0x47, 0x71, 0xca, 0x11, 0xe1,
+                                       0x9e, 0x33, 0xc8, 0x0a, 0xa9, 0x42, 0x95, 0x62 };
+
+static void put_int(std::string& s, uint64_t v, size_t n) {
+	for (size_t i = 0; i < n; i++) s += char((v >> (8 * i)) & 0xff);
+}
+
+/** One event with a CRC32 checksum. */
+static std::string event(unsigned char type, const std::string& body) {
+	std::string e;
+	const size_t len = 19 + body.size() + 4;
+	put_int(e, 0, 4);
+	e += char(type);
+	put_int(e, 1, 4);
+	put_int(e, len, 4);
+	put_int(e, 0, 4);
+	put_int(e, 0, 2);
+	e += body;
+	put_int(e, proxysql_crc32(0, (const unsigned char*)e.data(), e.size()), 4);
+	return e;
+}
+
+/** Magic, FORMAT_DESCRIPTION and PREVIOUS_GTIDS 1-'last'. */
+static std::string file_header(int64_t last) {
+	std::string fde;
+	put_int(fde, 4, 2);
+	std::string version("8.0.36");
+	version.resize(50, '\0');
+	fde += version;
+	put_int(fde, 0, 4);
+	fde += char(19);
+	fde += std::string(40, '\0');
+	fde += char(1);
+	std::string prev;
+	put_int(prev, 1, 8);
+	prev += std::string((const char*)SID, 16);
+	put_int(prev, 1, 8);
+	put_int(prev, 1, 8);
+	put_int(prev, last + 1, 8);
+	return std::string("\xfe" "bin", 4) + event(15, fde) + event(35, prev);
+}
+
+static std::string gtid_event(int64_t gno, uint64_t trx_len) {
+	std::string b;
+	b += '\0';
+	b += std::string((const char*)SID, 16);
+	put_int(b, gno, 8);
+	b += char(2);
+	put_int(b, 0, 8);
+	put_int(b, 1, 8);
+	if (trx_len) {
+		// Commit timestamp, then the length as a 3-byte packed integer.
+		put_int(b, 0, 7);
+		b += char(0xfd);
+		put_int(b, trx_len, 3);
+		put_int(b, 80036, 4);
+	}
+	return event(33, b);
+}
+
+static std::string query_event(const std::string& q) {
+	std::string b;
+	put_int(b, 1, 4);
+	put_int(b, 0, 4);
+	b += char(4);
+	put_int(b, 0, 2);
+	put_int(b, 0, 2);
+	b += std::string("test", 5);
+	b += q;
+	return event(2, b);
+}
+
+static std::string row_event() {
+	return event(30, std::string(200, 'x'));
+}
+
+static std::string xid_event() {
+	std::string b;
+	put_int(b, 7, 8);
+	return event(16, b);
+}
+
+/** BEGIN, a row event, XID; with MySQL 8.0's transaction length unless 'v57'. */
+static std::string transaction(int64_t gno, bool v57 = false) {
+	const std::string body = query_event("BEGIN") + row_event() + xid_event();
+	if (v57) return gtid_event(gno, 0) + body;
+	// The length covers the GTID event, whose size does not depend on it.
+	const size_t gtid_len = gtid_event(gno, 1).size();
+	return gtid_event(gno, gtid_len + body.size()) + body;
+}
+
+static std::string rotate_event(const std::string& next) {
+	std::string b;
+	put_int(b, 4, 8);
+	b += next;
+	return event(4, b);
+}
+
+static bool append(const std::string& path, const std::string& data) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) return false;
+	bool done = write(fd, data.data(), data.size()) == ssize_t(data.size());
+	close(fd);
+	return done;
+}
+
+/** Reads update lines until 'count' trxids arrived, or one read times out. */
+static std::vector<trxid_t> next_trxids(BinlogReaderClient& client, size_t count, int timeout_ms,
+                                        std::string& raw) {
+	std::vector<trxid_t> got;
+	raw.clear();
+	while (got.size() < count) {
+		BinlogReaderMsg u = client.read_line(timeout_ms);
+		if (!u.valid() || u.intervals.empty()) break;
+		raw += (raw.empty() ? "" : " ") + u.raw;
+		for (auto& iv : u.intervals) {
+			for (trxid_t t = iv.start; t <= iv.end; t++) got.push_back(t);
+		}
+	}
+	return got;
+}
+
+static bool trxids_are(const std::vector<trxid_t>& got, trxid_t first, size_t count) {
+	if (got.size() != count) return false;
+	for (size_t i = 0; i < count; i++) {
+		if (got[i] != first + trxid_t(i)) return false;
+	}
+	return true;
+}
+
+static bool start_reader(const CommandLine& cli, const std::string& index, BinlogReaderProcess& reader,
+                         const std::string& engine = "file") {
+	reader.binary = cli.reader_bin;
+	reader.listen_port = cli.reader_port;
+	reader.engine = engine;
+	reader.binlog_index = index;
+	if (!cli.reader_log_file.empty()) reader.log_file_path = cli.reader_log_file;
+	return reader.start();
+}
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("-E file needs a spawned reader");
+	}
+
+	plan(8);
+
+	char dir_template[] = "/tmp/binlog_files_XXXXXX";
+	const char* dir_p = mkdtemp(dir_template);
+	if (!dir_p) {
+		BAIL_OUT("mkdtemp: %s", strerror(errno));
+	}
+	const std::string dir(dir_p);
+	const std::string index = dir + "/binlog.index";
+	const std::string file1 = dir + "/binlog.000001";
+	const std::string file2 = dir + "/binlog.000002";
+	const std::string file3 = dir + "/binlog.000003";
+	if (!append(file1, file_header(10) + transaction(11) + transaction(12)) ||
+	    !append(index, "./binlog.000001\n")) {
+		BAIL_OUT("cannot write %s", file1.c_str());
+	}
+
+	BinlogReaderProcess reader;
+	if (!start_reader(cli, index, reader) || !reader.wait_ready(15000)) {
+		BAIL_OUT("failed to start reader");
+	}
+	BinlogReaderClient client;
+	if (!client.connect("127.0.0.1", cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader on port %d", cli.reader_port);
+	}
+	BinlogReaderMsg st = client.read_line(5000);
+	const std::string expected = std::string("ST=") + SID_TEXT + ":1-12";
+	ok(st.valid() && st.raw == expected, "ST= from the file (raw='%s', expected '%s')", st.raw.c_str(),
+	   expected.c_str());
+
+	std::string raw;
+	const std::string trx = transaction(13);
+	append(file1, trx.substr(0, trx.size() / 2));
+	std::vector<trxid_t> early = next_trxids(client, 1, 500, raw);
+	append(file1, trx.substr(trx.size() / 2));
+	std::vector<trxid_t> got = next_trxids(client, 1, 5000, raw);
+	ok(early.empty() && trxids_are(got, 13, 1), "half a transaction held back, then delivered (raw='%s')",
+	   raw.c_str());
+
+	append(file1, transaction(14, true) + gtid_event(15, 0) + query_event("CREATE TABLE t (a INT)"));
+	got = next_trxids(client, 2, 5000, raw);
+	ok(trxids_are(got, 14, 2), "transactions without a length delivered (raw='%s', expected 14-15)",
+	   raw.c_str());
+
+	append(file1, rotate_event("binlog.000002"));
+	append(file2, file_header(15) + transaction(16));
+	append(index, "./binlog.000002\n");
+	got = next_trxids(client, 1, 5000, raw);
+	ok(trxids_are(got, 16, 1), "next file read after ROTATE (raw='%s', expected 16)", raw.c_str());
+
+	// No ROTATE ends binlog.000002: only the index says it is done.
+	append(file3, file_header(16) + transaction(17));
+	append(index, "./binlog.000003\n");
+	got = next_trxids(client, 1, 5000, raw);
+	ok(trxids_are(got, 17, 1), "next file read after a file without ROTATE (raw='%s', expected 17)",
+	   raw.c_str());
+
+	reader.stop();
+	client.disconnect();
+	BinlogReaderProcess again;
+	BinlogReaderMsg st2;
+	if (start_reader(cli, index, again) && again.wait_ready(15000) &&
+	    client.connect("127.0.0.1", cli.reader_port, 2000)) {
+		st2 = client.read_line(5000);
+	}
+	const std::string expected2 = std::string("ST=") + SID_TEXT + ":1-17";
+	ok(st2.valid() && st2.raw == expected2, "a new reader starts from the last file (raw='%s', expected '%s')",
+	   st2.raw.c_str(), expected2.c_str());
+	again.stop();
+	client.disconnect();
+
+	// The replay waits for one client: no wait_ready() probe, it would be it.
+	BinlogReaderProcess replay;
+	BinlogReaderMsg st3;
+	if (start_reader(cli, index, replay, "replay:1")) {
+		for (int i = 0; i < 150 && !client.connect("127.0.0.1", cli.reader_port, 100); i++) {
+			usleep(100000);
+		}
+		st3 = client.read_line(5000);
+	}
+	got = next_trxids(client, 7, 5000, raw);
+	const std::string expected3 = std::string("ST=") + SID_TEXT + ":1-10";
+	ok(st3.valid() && st3.raw == expected3 && trxids_are(got, 11, 7),
+	   "replay from the first file (ST='%s', updates='%s', expected 11-17)", st3.raw.c_str(), raw.c_str());
+
+	BinlogReaderMsg eof = client.read_line(5000);
+	int code = -1;
+	const bool exited = replay.wait_exit(5000, &code);
+	ok(!eof.valid() && exited && code == 0, "replay done: client closed, exit code %d", code);
+	replay.stop();
+
+	unlink(file1.c_str());
+	unlink(file2.c_str());
+	unlink(file3.c_str());
+	unlink(index.c_str());
+	rmdir(dir.c_str());
+	return exit_status();
+}
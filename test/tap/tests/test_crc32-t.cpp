@@ -0,0 +1,64 @@
+/* test_crc32-t
+ *
+ * proxysql_crc32(), which the reader installs as libslave's event checksum
+ * function, must agree with zlib's crc32() whatever implementation the CPU
+ * selected. No reader or MySQL is needed.
+ *
+ *   1. Every length from 0 to 1100 bytes at every offset from 0 to 15: the
+ *      folded bulk, the 16-byte tail and unaligned loads.
+ *   2. Chained calls (crc of a prefix fed into the next call) match one
+ *      zlib call over the whole buffer.
+ *   3. A 4 MB buffer, the size of a large row event, matches.
+ */
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <zlib.h>
+
+#include "proxysql_crc32.h"
+#include "tap.h"
+
+static std::vector<unsigned char> random_bytes(size_t n) {
+	std::vector<unsigned char> v(n);
+	uint32_t x = 2463534242u;
+	for (size_t i = 0; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		v[i] = (unsigned char)x;
+	}
+	return v;
+}
+
+int main() {
+	plan(3);
+	diag("proxysql_crc32 implementation: %s", proxysql_crc32_impl());
+
+	const std::vector<unsigned char> buf = random_bytes(4 << 20);
+
+	int bad = 0;
+	for (size_t off = 0; off < 16; off++) {
+		for (size_t len = 0; len <= 1100; len++) {
+			if (proxysql_crc32(0, buf.data() + off, len) != crc32(0, buf.data() + off, uInt(len)))
+				bad++;
+		}
+	}
+	ok(bad == 0, "all lengths and offsets match zlib (%d mismatches)", bad);
+
+	bad = 0;
+	for (size_t split = 0; split <= 300; split += 7) {
+		uint32_t crc = proxysql_crc32(0, buf.data(), split);
+		crc = proxysql_crc32(crc, buf.data() + split, 4096 - split);
+		if (crc != crc32(0, buf.data(), 4096))
+			bad++;
+	}
+	ok(bad == 0, "chained calls match one zlib call (%d mismatches)", bad);
+
+	const uint32_t ours = proxysql_crc32(0, buf.data(), buf.size());
+	const uint32_t zlib = uint32_t(crc32(0, buf.data(), uInt(buf.size())));
+	ok(ours == zlib, "4 MB event: %08x, zlib %08x", ours, zlib);
+
+	return exit_status();
+}
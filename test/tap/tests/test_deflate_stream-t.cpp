@@ -0,0 +1,94 @@
+/* test_deflate_stream-t
+ *
+ * A client that sends "HELLO z=deflate" gets the rest of the stream as one
+ * zlib stream, flushed after every batch.
+ *
+ *   1. Start reader; read the text ST= line.
+ *   2. Send HELLO z=deflate — the reply must echo z=deflate.
+ *   3. The next (inflated) line is an ST= with the same uuid and last
+ *      trxid.
+ *   4. INSERT once — the next inflated line is an I1 (or I3 when the
+ *      reader batches) carrying the next trxid, without waiting for more
+ *      traffic: the batch was flushed.
+ */
+
+#include <string>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Highest trxid of an ST= line. */
+static trxid_t last_trxid(const BinlogReaderMsg& st) {
+	trxid_t mx = 0;
+	for (auto& iv : st.intervals) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+int main() {
+	plan(4);
+
+	CommandLine cli;
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	if (!cli.reader_bin.empty())  // reset gtid only in spawn mode
+		db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.deflate_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+
+	BinlogReaderMsg st = client.read_line(10000);
+	if (!st.valid() || st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", st.error.c_str(),
+		         st.raw.c_str());
+	}
+	const std::string uuid = strip_dashes(st.uuid);
+
+	const std::string reply = client.hello("z=deflate");
+	ok(reply == "HELLO z=deflate", "HELLO reply echoes z=deflate (reply='%s')",
+	   reply.c_str());
+
+	BinlogReaderMsg st2 = client.read_line(5000);
+	ok(st2.valid() && st2.kind == "ST", "inflated stream starts with ST= (error='%s', raw='%s')",
+	   st2.error.c_str(), st2.raw.c_str());
+	ok(strip_dashes(st2.uuid) == uuid && last_trxid(st2) == last_trxid(st),
+	   "ST= matches the one before HELLO (last trxid %lld, expected %lld)",
+	   (long long)last_trxid(st2), (long long)last_trxid(st));
+
+	if (!db.exec("INSERT INTO binlog_reader_test.deflate_t (v) VALUES (1)")) {
+		BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+	}
+	BinlogReaderMsg m = client.read_line(5000);
+	const trxid_t got = m.intervals.empty() ? 0 : m.intervals[0].end;
+	ok(m.valid() && (m.kind == "I1" || m.kind == "I3") && m.uuid == uuid &&
+	       got == last_trxid(st) + 1,
+	   "update %s:%lld arrives inflated (expected %lld, raw='%s')",
+	   m.uuid.c_str(), (long long)got, (long long)(last_trxid(st) + 1), m.raw.c_str());
+
+	return exit_status();
+}
@@ -0,0 +1,115 @@
+/* test_flush_policy-t
+ *
+ * Clients choose their flush policy with "HELLO freq=<ms> batch=0|1"; the
+ * reader keeps one binlog connection and flushes each policy on its own.
+ *
+ *   1. Start reader; connect two clients and read their ST= lines.
+ *   2. Client A sends HELLO freq=300 batch=1 — the reply echoes the policy.
+ *   3. Client B sends HELLO freq=0 — the reply says freq=0 batch=0, as
+ *      batching needs a flush interval.
+ *   4. INSERT three times — A gets one I3 covering the three trxids.
+ *   5. B gets one I1/I2 line per trxid.
+ */
+
+#include <string>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Highest trxid of an ST= line. */
+static trxid_t last_trxid(const BinlogReaderMsg& st) {
+	trxid_t mx = 0;
+	for (auto& iv : st.intervals) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+/** Connects a client, reads its ST= line and sends HELLO with `options`. */
+static std::string negotiate(BinlogReaderClient& client, const std::string& host, int port,
+                             const std::string& options, BinlogReaderMsg& st) {
+	if (!client.connect(host, port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", host.c_str(), port);
+	}
+	st = client.read_line(10000);
+	if (!st.valid() || st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", st.error.c_str(),
+		         st.raw.c_str());
+	}
+	const std::string reply = client.hello(options);
+	BinlogReaderMsg st2 = client.read_line(5000);
+	if (!st2.valid() || st2.kind != "ST") {
+		BAIL_OUT("no ST= after HELLO (error='%s', raw='%s')", st2.error.c_str(),
+		         st2.raw.c_str());
+	}
+	return reply;
+}
+
+int main() {
+	plan(4);
+
+	CommandLine cli;
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	if (!cli.reader_bin.empty())  // reset gtid only in spawn mode
+		db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.flush_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient a, b;
+	BinlogReaderMsg st_a, st_b;
+	const std::string reply_a = negotiate(a, reader_host, cli.reader_port, "freq=300 batch=1", st_a);
+	ok(reply_a == "HELLO freq=300 batch=1", "batched client: reply echoes the policy (reply='%s')",
+	   reply_a.c_str());
+	const std::string reply_b = negotiate(b, reader_host, cli.reader_port, "freq=0", st_b);
+	ok(reply_b == "HELLO freq=0 batch=0", "streaming client: batching is off (reply='%s')",
+	   reply_b.c_str());
+
+	const std::string uuid = strip_dashes(st_a.uuid);
+	const trxid_t first = last_trxid(st_a) + 1;
+	// Quick enough to land in one 300ms flush.
+	for (int i = 0; i < 3; i++) {
+		if (!db.exec("INSERT INTO binlog_reader_test.flush_t (v) VALUES (1)")) {
+			BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+		}
+	}
+
+	BinlogReaderMsg m = a.read_line(5000);
+	const bool one_interval = m.valid() && m.kind == "I3" && m.uuid == uuid &&
+	                          m.intervals.size() == 1 && m.intervals[0].start == first &&
+	                          m.intervals[0].end == first + 2;
+	ok(one_interval, "batched client: one I3 for the three trxids (raw='%s', expected %lld-%lld)",
+	   m.raw.c_str(), (long long)first, (long long)(first + 2));
+
+	std::vector<trxid_t> got;
+	for (int i = 0; i < 3; i++) {
+		BinlogReaderMsg u = b.read_line(5000);
+		if (!u.valid() || (u.kind != "I1" && u.kind != "I2") || u.intervals.size() != 1)
+			break;
+		got.push_back(u.intervals[0].end);
+	}
+	ok(got.size() == 3 && got[0] == first && got[1] == first + 1 && got[2] == first + 2,
+	   "streaming client: one I1/I2 line per trxid (%zu lines)", got.size());
+
+	return exit_status();
+}
@@ -0,0 +1,261 @@
+/* test_gtid_checkpoint-t
+ *
+ * With -C, the reader checkpoints its GTID set to a file and, when
+ * restarted, serves that set before the source is reached.
+ *
+ *   1. GTID_Checkpoint alone: a missing or foreign file opens empty; the
+ *      last set written is loaded back; a corrupted newest slot falls
+ *      back to the older one; a set larger than a slot grows the file.
+ *   2. With a spawned reader: INSERT once and stop the reader, which
+ *      writes a final checkpoint.
+ *   3. Restart it against a closed MySQL port: the listener still serves
+ *      ST= with the INSERT, and HELLO stale=1 answers stale=1.
+ *   4. Restart it against MySQL: stale turns to 0 once the stream has
+ *      caught up with the source.
+ *   5. Stop it, RESET MASTER and SET GTID_PURGED past the checkpoint, then
+ *      INSERT: the source can no longer dump from the checkpoint. Restarted,
+ *      the reader drops it for the source's set, and catches up.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid_checkpoint.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+static off_t file_size(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// Flips the first byte of 'needle' in the file; false if it is not there.
+static bool corrupt(const std::string& path, const std::string& needle) {
+	int fd = open(path.c_str(), O_RDWR);
+	if (fd < 0) return false;
+	const off_t size = file_size(path);
+	char *p = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+	char *hit = (char *)memmem(p, size, needle.data(), needle.size());
+	if (hit) *hit ^= 0x20;
+	munmap(p, size);
+	return hit != NULL;
+}
+
+static std::string reopen(const std::string& path) {
+	GTID_Checkpoint ck;
+	std::string set;
+	int64_t written_ms = 0;
+	if (!ck.open(path.c_str(), set, written_ms)) return "<open failed>";
+	return set;
+}
+
+static void test_checkpoint_file(const std::string& path) {
+	unlink(path.c_str());
+	std::string set;
+	int64_t written_ms = -1;
+	{
+		GTID_Checkpoint ck;
+		bool opened = ck.open(path.c_str(), set, written_ms);
+		ok(opened && set.empty() && written_ms == 0 && file_size(path) > GTID_CHECKPOINT_MIN_CAPACITY,
+		   "a missing checkpoint is created empty (size=%lld)", (long long)file_size(path));
+	}
+
+	const std::string a = "3e11fa47-71ca-11e1-9e33-c80aa9429562:1-100";
+	const std::string b = "3e11fa47-71ca-11e1-9e33-c80aa9429562:1-105";
+	{
+		GTID_Checkpoint ck;
+		ck.open(path.c_str(), set, written_ms);
+		ck.write(a);
+		ck.write(b);
+	}
+	std::string got = reopen(path);
+	ok(got == b, "the last set written is loaded (got '%s')", got.c_str());
+
+	bool hit = corrupt(path, b);
+	got = reopen(path);
+	ok(hit && got == a, "a corrupted newest slot falls back to the older one (got '%s')", got.c_str());
+
+	// One interval per uuid: far more than a 64 KB slot holds.
+	std::string big;
+	for (int i = 0; i < 2000; i++) {
+		char uuid[64];
+		snprintf(uuid, sizeof(uuid), "%s%08x-0000-0000-0000-000000000000:1-%d",
+		         big.empty() ? "" : ",", i, i + 1);
+		big += uuid;
+	}
+	{
+		GTID_Checkpoint ck;
+		ck.open(path.c_str(), set, written_ms);
+		ck.write(big);
+	}
+	got = reopen(path);
+	ok(got == big && file_size(path) > off_t(2 * big.size()),
+	   "a set of %zu bytes grows the file to %lld bytes", big.size(), (long long)file_size(path));
+
+	int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+	if (fd >= 0) {
+		(void)!write(fd, "not a checkpoint\n", 17);
+		close(fd);
+	}
+	got = reopen(path);
+	ok(got.empty() && file_size(path) > GTID_CHECKPOINT_MIN_CAPACITY,
+	   "a foreign file is replaced by an empty checkpoint");
+	unlink(path.c_str());
+}
+
+// Repeats HELLO stale=1 on fresh connections until the reply ends with
+// 'want' or the deadline passes; returns the last reply.
+static std::string wait_stale(const std::string& host, int port, const std::string& want, int timeout_ms) {
+	std::string reply;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	do {
+		BinlogReaderClient client;
+		if (client.connect(host, port, 2000)) {
+			reply = client.hello("stale=1", 2000);
+		}
+		if (reply.size() >= want.size() && reply.compare(reply.size() - want.size(), want.size(), want) == 0) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	} while (std::chrono::steady_clock::now() < deadline);
+	return reply;
+}
+
+// Reads ST= on fresh connections until its highest trxid is 'want' or the
+// deadline passes; returns the last highest trxid.
+static trxid_t wait_st_max(const std::string& host, int port, trxid_t want, int timeout_ms) {
+	trxid_t st_max = 0;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	do {
+		BinlogReaderClient client;
+		if (client.connect(host, port, 2000)) {
+			BinlogReaderMsg st = client.read_line(2000);
+			st_max = 0;
+			for (auto& iv : st.intervals) {
+				if (iv.end > st_max) st_max = iv.end;
+			}
+		}
+		if (st_max == want) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	} while (std::chrono::steady_clock::now() < deadline);
+	return st_max;
+}
+
+int main() {
+	CommandLine cli;
+
+	plan(9);
+
+	const std::string ck_path =
+	    "/tmp/proxysql_binlog_reader_tap_" + std::to_string(cli.reader_port) + ".ckpt";
+	test_checkpoint_file(ck_path);
+
+	if (cli.reader_bin.empty()) {
+		skip(4, "restarting from a checkpoint needs a spawned reader");
+		return exit_status();
+	}
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+	db.reset_gtid_set();
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.checkpoint_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderMsg m1;
+	{
+		BinlogReaderProcess reader;
+		reader.checkpoint_path = ck_path;
+		auto reader_host = setup_reader(cli, reader);
+		if (reader_host.empty()) {
+			BAIL_OUT("failed to start reader");
+		}
+		BinlogReaderClient client;
+		if (!client.connect(reader_host, cli.reader_port, 2000)) {
+			BAIL_OUT("cannot connect to reader");
+		}
+		client.read_line(10000);
+		db.exec("INSERT INTO binlog_reader_test.checkpoint_t (v) VALUES (1)");
+		m1 = client.read_line(5000);
+		ok(m1.valid() && m1.kind == "I1" && !m1.intervals.empty(),
+		   "first run streamed the INSERT (raw='%s')", m1.raw.c_str());
+		reader.stop();
+	}
+	const trxid_t want = m1.intervals.empty() ? 0 : m1.intervals[0].start;
+
+	{
+		CommandLine down = cli;
+		down.mysql_port = 1;
+		BinlogReaderProcess reader;
+		reader.checkpoint_path = ck_path;
+		auto reader_host = setup_reader(down, reader);
+		if (reader_host.empty()) {
+			BAIL_OUT("reader did not listen without its source");
+		}
+		BinlogReaderClient client;
+		client.connect(reader_host, cli.reader_port, 2000);
+		BinlogReaderMsg st = client.read_line(2000);
+		trxid_t st_max = 0;
+		for (auto& iv : st.intervals) {
+			if (iv.end > st_max) st_max = iv.end;
+		}
+		const std::string reply = wait_stale(reader_host, cli.reader_port, "stale=1", 2000);
+		ok(st.valid() && st.kind == "ST" && st_max == want && reply == "HELLO stale=1",
+		   "checkpoint served with the source down (ST max=%lld, want %lld, reply='%s')",
+		   (long long)st_max, (long long)want, reply.c_str());
+	}
+
+	{
+		BinlogReaderProcess reader;
+		reader.checkpoint_path = ck_path;
+		auto reader_host = setup_reader(cli, reader);
+		if (reader_host.empty()) {
+			BAIL_OUT("failed to restart reader");
+		}
+		const std::string reply = wait_stale(reader_host, cli.reader_port, "stale=0", 10000);
+		ok(reply == "HELLO stale=0", "the state is current once the source is reached (reply='%s')",
+		   reply.c_str());
+	}
+
+	{
+		// The checkpoint now ends at 'want'; the source purges past it.
+		const std::string executed = db.gtid_executed();
+		const std::string uuid = executed.substr(0, executed.find(':'));
+		const trxid_t purged = want + 5;
+		db.reset_gtid_set();
+		db.exec("SET GLOBAL gtid_purged = '" + uuid + ":1-" + std::to_string(purged) + "'");
+		db.exec("INSERT INTO binlog_reader_test.checkpoint_t (v) VALUES (2)");
+
+		BinlogReaderProcess reader;
+		reader.checkpoint_path = ck_path;
+		auto reader_host = setup_reader(cli, reader);
+		if (reader_host.empty()) {
+			BAIL_OUT("failed to restart reader");
+		}
+		const trxid_t st_max = wait_st_max(reader_host, cli.reader_port, purged + 1, 10000);
+		const std::string reply = wait_stale(reader_host, cli.reader_port, "stale=0", 10000);
+		ok(st_max == purged + 1 && reply == "HELLO stale=0",
+		   "a checkpoint the source purged past is dropped for its set (ST max=%lld, want %lld, reply='%s')",
+		   (long long)st_max, (long long)(purged + 1), reply.c_str());
+	}
+
+	unlink(ck_path.c_str());
+	return exit_status();
+}
@@ -0,0 +1,93 @@
+/* test_heartbeat-t
+ *
+ * A client that sends "HELLO hb=<ms>" gets an HB= line whenever nothing
+ * else was sent to it for that long, so it can tell a quiet source from a
+ * dead reader.
+ *
+ *   1. Start reader; read the text ST= line.
+ *   2. Send HELLO hb=200 — the reply must echo hb=200; the stream restarts
+ *      with ST=.
+ *   3. Without writing to the source, an HB= line arrives within 2s; its
+ *      clock is within a minute of ours.
+ *   4. A second client asking for hb=10 gets the minimum interval back.
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <string>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+int main() {
+	plan(4);
+
+	CommandLine cli;
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	if (!cli.reader_bin.empty())  // reset gtid only in spawn mode
+		db.reset_gtid_set();
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+
+	BinlogReaderMsg st = client.read_line(10000);
+	if (!st.valid() || st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", st.error.c_str(),
+		         st.raw.c_str());
+	}
+
+	const std::string reply = client.hello("hb=200");
+	BinlogReaderMsg st2 = client.read_line(5000);
+	ok(reply == "HELLO hb=200" && st2.valid() && st2.kind == "ST",
+	   "HELLO reply echoes hb=200 and the stream restarts (reply='%s', raw='%s')",
+	   reply.c_str(), st2.raw.c_str());
+
+	// Updates from other writers may come first; skip them.
+	BinlogReaderMsg hb;
+	for (int i = 0; i < 100; i++) {
+		hb = client.read_line(2000);
+		if (!hb.valid() || hb.kind == "HB")
+			break;
+	}
+	ok(hb.valid() && hb.kind == "HB", "HB= arrives on an idle connection (error='%s', raw='%s')",
+	   hb.error.c_str(), hb.raw.c_str());
+
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	const long long ours = (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	const long long theirs = hb.valid() ? atoll(hb.raw.c_str() + 3) : 0;
+	ok(llabs(ours - theirs) < 60000, "HB= carries the reader's clock (%lld, ours %lld)",
+	   theirs, ours);
+
+	BinlogReaderClient client2;
+	if (!client2.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+	const std::string reply2 = client2.hello("hb=10");
+	ok(reply2 == "HELLO hb=100", "hb below the minimum is raised (reply='%s')",
+	   reply2.c_str());
+
+	return exit_status();
+}
@@ -0,0 +1,150 @@
+/* test_large_event-t
+ *
+ * Row events the reader does not need are drained off the replication
+ * socket in fixed-size chunks; a transaction larger than a protocol packet
+ * must not grow the reader's memory by its size.
+ *
+ *   1. Start reader; read the ST= line and the reader's peak RSS (VmHWM).
+ *   2. INSERT a 32MB row — its ROWS event spans several 16MB packets. The
+ *      client gets an I1/I2 line for the trxid.
+ *   3. The reader's peak RSS grew by less than 16MB.
+ *   4. A small INSERT afterwards still arrives: the stream stayed in sync.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+static const long ROW_BYTES = 32L * 1024 * 1024;
+
+/** Highest trxid of an ST= line. */
+static trxid_t last_trxid(const BinlogReaderMsg& st) {
+	trxid_t mx = 0;
+	for (auto& iv : st.intervals) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+/** Peak resident set of `pid` in kB, from /proc; -1 if unreadable. */
+static long peak_rss_kb(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE* f = fopen(path, "r");
+	if (!f) return -1;
+	char line[256];
+	long kb = -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "VmHWM:", 6) == 0) {
+			kb = strtol(line + 6, nullptr, 10);
+			break;
+		}
+	}
+	fclose(f);
+	return kb;
+}
+
+/** `@@global.max_allowed_packet`, or -1. */
+static long max_allowed_packet(MySQLClient& db) {
+	if (mysql_query(db.raw(), "SELECT @@global.max_allowed_packet") != 0) return -1;
+	MYSQL_RES* r = mysql_store_result(db.raw());
+	if (!r) return -1;
+	long v = -1;
+	MYSQL_ROW row = mysql_fetch_row(r);
+	if (row && row[0]) v = strtol(row[0], nullptr, 10);
+	mysql_free_result(r);
+	return v;
+}
+
+/** Reads the next update line and returns its trxid, or 0. */
+static trxid_t next_trxid(BinlogReaderClient& client, std::string& raw) {
+	BinlogReaderMsg u = client.read_line(10000);
+	raw = u.raw;
+	if (!u.valid() || (u.kind != "I1" && u.kind != "I2") || u.intervals.size() != 1) return 0;
+	return u.intervals[0].end;
+}
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("measuring the reader's memory needs a spawned reader");
+	}
+
+	plan(3);
+
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient setup;
+	if (!setup.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", setup.last_error().c_str());
+	}
+	// REPEAT() is capped by the session max_allowed_packet, taken from the
+	// global one at connect time.
+	if (max_allowed_packet(setup) < 2 * ROW_BYTES &&
+	    !setup.exec("SET GLOBAL max_allowed_packet = " + std::to_string(2 * ROW_BYTES))) {
+		BAIL_OUT("cannot raise max_allowed_packet: %s", setup.last_error().c_str());
+	}
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.large_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v LONGBLOB)");
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(), cli.reader_port);
+	}
+	BinlogReaderMsg st = client.read_line(10000);
+	if (!st.valid() || st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", st.error.c_str(),
+		         st.raw.c_str());
+	}
+	const trxid_t first = last_trxid(st) + 1;
+	const long rss_before = peak_rss_kb(reader.pid());
+
+	if (!db.exec("INSERT INTO binlog_reader_test.large_t (v) VALUES (REPEAT('x', " +
+	             std::to_string(ROW_BYTES) + "))")) {
+		BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+	}
+	std::string raw;
+	const trxid_t got = next_trxid(client, raw);
+	ok(got == first, "32MB transaction delivered (raw='%s', expected trxid %lld)", raw.c_str(),
+	   (long long)first);
+
+	const long rss_after = peak_rss_kb(reader.pid());
+	ok(rss_before > 0 && rss_after - rss_before < 16 * 1024,
+	   "reader peak RSS grew by %ld kB (before=%ld kB, after=%ld kB)", rss_after - rss_before,
+	   rss_before, rss_after);
+
+	if (!db.exec("INSERT INTO binlog_reader_test.large_t (v) VALUES ('y')")) {
+		BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+	}
+	const trxid_t next = next_trxid(client, raw);
+	ok(next == first + 1, "next transaction still delivered (raw='%s', expected trxid %lld)",
+	   raw.c_str(), (long long)(first + 1));
+
+	return exit_status();
+}
@@ -0,0 +1,138 @@
+/* test_multi_listener-t
+ *
+ * One reader, one binlog connection, two listeners with their own output
+ * mode: "-l <port>:0:0" streams every event as I1/I2, "-l <port+1>:300:1"
+ * sends one batched I3 per 300ms.
+ *
+ *   1. Start reader with both listeners; connect a client to each and
+ *      read the ST= lines.
+ *   2. Both ST= lines describe the same set.
+ *   3. INSERT three times — the streaming port gets one I1/I2 per trxid.
+ *   4. The batched port gets one I3 covering the three trxids.
+ *   5. Malformed specs (batching not 0 or 1, freq or max_netbuflen out of
+ *      bounds, too many digits) end the reader with the usage, exit code 1.
+ */
+
+#include <string>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Highest trxid of an ST= line. */
+static trxid_t last_trxid(const BinlogReaderMsg& st) {
+	trxid_t mx = 0;
+	for (auto& iv : st.intervals) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+/** Connects to `port` and returns its ST= line. */
+static BinlogReaderMsg initial_state(BinlogReaderClient& client, const std::string& host, int port) {
+	if (!client.connect(host, port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", host.c_str(), port);
+	}
+	BinlogReaderMsg st = client.read_line(10000);
+	if (!st.valid() || st.kind != "ST") {
+		BAIL_OUT("no ST= from port %d (error='%s', raw='%s')", port, st.error.c_str(),
+		         st.raw.c_str());
+	}
+	return st;
+}
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("multiple listeners need a spawned reader");
+	}
+
+	plan(5);
+
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.listener_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	const int batched_port = cli.reader_port + 1;
+	cli.freq_ms = 0;
+	cli.batching = 0;
+	BinlogReaderProcess reader;
+	reader.extra_listeners.push_back(std::to_string(batched_port) + ":300:1");
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient streaming, batched;
+	BinlogReaderMsg st_s = initial_state(streaming, reader_host, cli.reader_port);
+	BinlogReaderMsg st_b = initial_state(batched, reader_host, batched_port);
+	ok(strip_dashes(st_s.uuid) == strip_dashes(st_b.uuid) && last_trxid(st_s) == last_trxid(st_b),
+	   "both listeners start from the same set (streaming='%s', batched='%s')",
+	   st_s.raw.c_str(), st_b.raw.c_str());
+
+	const std::string uuid = strip_dashes(st_s.uuid);
+	const trxid_t first = last_trxid(st_s) + 1;
+	// Quick enough to land in one 300ms flush.
+	for (int i = 0; i < 3; i++) {
+		if (!db.exec("INSERT INTO binlog_reader_test.listener_t (v) VALUES (1)")) {
+			BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+		}
+	}
+
+	std::vector<trxid_t> got;
+	for (int i = 0; i < 3; i++) {
+		BinlogReaderMsg u = streaming.read_line(5000);
+		if (!u.valid() || (u.kind != "I1" && u.kind != "I2") || u.intervals.size() != 1)
+			break;
+		got.push_back(u.intervals[0].end);
+	}
+	ok(got.size() == 3 && got[0] == first && got[2] == first + 2,
+	   "streaming port: one I1/I2 line per trxid (%zu lines)", got.size());
+
+	BinlogReaderMsg m = batched.read_line(5000);
+	ok(m.valid() && m.kind == "I3" && m.uuid == uuid && m.intervals.size() == 1 &&
+	       m.intervals[0].start == first && m.intervals[0].end == first + 2,
+	   "batched port: one I3 for the three trxids (raw='%s', expected %lld-%lld)",
+	   m.raw.c_str(), (long long)first, (long long)(first + 2));
+	BinlogReaderMsg none = batched.read_line(500);
+	ok(!none.valid() && none.error == "timeout", "batched port: nothing else follows (raw='%s')",
+	   none.raw.c_str());
+
+	reader.stop();
+	const char *const bad_specs[] = { "10:99999999999", "10:2", "99999:1", "10:1:999999999999", "1234567890123" };
+	std::string failed;
+	for (const char *spec : bad_specs) {
+		BinlogReaderProcess bad;
+		bad.binary = cli.reader_bin;
+		bad.mysql_host = cli.mysql_host;
+		bad.mysql_port = cli.mysql_port;
+		bad.listen_port = cli.reader_port;
+		bad.extra_listeners.push_back(std::to_string(batched_port) + ":" + spec);
+		if (!cli.reader_log_file.empty()) bad.log_file_path = cli.reader_log_file;
+		int code = -1, sig = 0;
+		if (!bad.start() || !bad.wait_exit(5000, &code, &sig) || code != 1) {
+			failed += std::string(failed.empty() ? "" : ", ") + spec + " (exit " + std::to_string(code) +
+			          ", signal " + std::to_string(sig) + ")";
+		}
+		bad.stop();
+	}
+	ok(failed.empty(), "malformed listener specs refused with the usage%s%s", failed.empty() ? "" : ": ",
+	   failed.c_str());
+
+	return exit_status();
+}
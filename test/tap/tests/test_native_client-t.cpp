@@ -0,0 +1,126 @@
+/* test_native_client-t
+ *
+ * The reader with -E native reads the binlog with its own non-blocking
+ * replication client instead of libslave. Clients must see the same stream.
+ *
+ *   1. Start reader with -E native; its ST= line equals the source's
+ *      @@global.gtid_executed.
+ *   2. INSERT → next line is an I1/I2 update for the next trxid.
+ *   3. A multi-statement transaction with a large row → one update, for the
+ *      trxid after it.
+ *   4. KILL the reader's binlog dump thread on the source; the client
+ *      reconnects from the set it has seen, and the next INSERT arrives
+ *      with no gap and no repeat.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Ids of the source's binlog dump threads. */
+static std::vector<std::string> dump_threads(MySQLClient& db) {
+	std::vector<std::string> ids;
+	if (mysql_query(db.raw(), "SELECT ID FROM information_schema.PROCESSLIST "
+	                          "WHERE COMMAND LIKE 'Binlog Dump%'") != 0)
+		return ids;
+	MYSQL_RES* r = mysql_store_result(db.raw());
+	if (!r) return ids;
+	while (MYSQL_ROW row = mysql_fetch_row(r)) {
+		if (row[0]) ids.push_back(row[0]);
+	}
+	mysql_free_result(r);
+	return ids;
+}
+
+/** Reads the next update line and returns its trxid, or 0. */
+static trxid_t next_trxid(BinlogReaderClient& client, std::string& raw) {
+	BinlogReaderMsg u = client.read_line(10000);
+	raw = u.raw;
+	if (!u.valid() || (u.kind != "I1" && u.kind != "I2") || u.intervals.size() != 1) return 0;
+	return u.intervals[0].end;
+}
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("-E native needs a spawned reader");
+	}
+
+	plan(4);
+
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.native_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v LONGBLOB)");
+
+	BinlogReaderProcess reader;
+	reader.engine = "native";
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(), cli.reader_port);
+	}
+	BinlogReaderMsg st = client.read_line(10000);
+	// The source separates UUIDs with ",\n".
+	std::string executed = db.gtid_executed();
+	executed.erase(std::remove(executed.begin(), executed.end(), '\n'), executed.end());
+	ok(st.valid() && st.kind == "ST" && st.raw == "ST=" + executed,
+	   "ST= matches gtid_executed (raw='%s', source='%s')", st.raw.c_str(), executed.c_str());
+	if (!st.valid() || st.intervals.empty()) {
+		BAIL_OUT("no usable ST= from reader (error='%s')", st.error.c_str());
+	}
+	const trxid_t first = st.intervals.back().end + 1;
+
+	std::string raw;
+	db.exec("INSERT INTO binlog_reader_test.native_t (v) VALUES ('a')");
+	trxid_t got = next_trxid(client, raw);
+	ok(got == first, "INSERT delivered (raw='%s', expected trxid %lld)", raw.c_str(),
+	   (long long)first);
+
+	// 4MB row: several reads' worth of skipped event after the GTID.
+	db.exec("BEGIN");
+	db.exec("INSERT INTO binlog_reader_test.native_t (v) VALUES (REPEAT('x', 4194304))");
+	db.exec("INSERT INTO binlog_reader_test.native_t (v) VALUES ('b')");
+	db.exec("COMMIT");
+	got = next_trxid(client, raw);
+	ok(got == first + 1, "large transaction delivered once (raw='%s', expected trxid %lld)",
+	   raw.c_str(), (long long)(first + 1));
+
+	const std::vector<std::string> ids = dump_threads(db);
+	for (const std::string& id : ids) {
+		db.exec("KILL " + id);
+	}
+	// The client retries after a second.
+	sleep(2);
+	db.exec("INSERT INTO binlog_reader_test.native_t (v) VALUES ('c')");
+	got = next_trxid(client, raw);
+	ok(!ids.empty() && got == first + 2,
+	   "INSERT after reconnect delivered (raw='%s', expected trxid %lld)", raw.c_str(),
+	   (long long)(first + 2));
+
+	return exit_status();
+}
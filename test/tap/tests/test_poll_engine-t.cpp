@@ -0,0 +1,139 @@
+/* test_poll_engine-t
+ *
+ * The reader with -E poll queries @@global.gtid_executed at an interval
+ * instead of reading the binlog. Clients must see the same stream, only
+ * later.
+ *
+ *   1. Start reader with -E poll:50; its ST= line equals the source's
+ *      @@global.gtid_executed, and the source runs no binlog dump thread.
+ *   2. INSERT → next line is an update for the next trxid.
+ *   3. Five INSERTs in a row, most within one interval → the next five
+ *      trxids, in order, with no gap and no repeat.
+ *   4. KILL the reader's connection on the source and INSERT while it is
+ *      down; once it reconnects, that trxid and the next INSERT's arrive.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Ids of the source's connections matching 'where', other than ours. */
+static std::vector<std::string> threads(MySQLClient& db, const std::string& where) {
+	std::vector<std::string> ids;
+	const std::string q = "SELECT ID FROM information_schema.PROCESSLIST WHERE " + where +
+	                      " AND ID <> CONNECTION_ID()";
+	if (mysql_query(db.raw(), q.c_str()) != 0)
+		return ids;
+	MYSQL_RES* r = mysql_store_result(db.raw());
+	if (!r) return ids;
+	while (MYSQL_ROW row = mysql_fetch_row(r)) {
+		if (row[0]) ids.push_back(row[0]);
+	}
+	mysql_free_result(r);
+	return ids;
+}
+
+/** Reads update lines until 'count' trxids arrived; returns them in order. */
+static std::vector<trxid_t> next_trxids(BinlogReaderClient& client, size_t count, std::string& raw) {
+	std::vector<trxid_t> got;
+	raw.clear();
+	while (got.size() < count) {
+		BinlogReaderMsg u = client.read_line(10000);
+		if (!u.valid() || u.intervals.empty()) break;
+		raw += (raw.empty() ? "" : " ") + u.raw;
+		for (auto& iv : u.intervals) {
+			for (trxid_t t = iv.start; t <= iv.end; t++) got.push_back(t);
+		}
+	}
+	return got;
+}
+
+static bool consecutive(const std::vector<trxid_t>& got, trxid_t first, size_t count) {
+	if (got.size() != count) return false;
+	for (size_t i = 0; i < count; i++) {
+		if (got[i] != first + trxid_t(i)) return false;
+	}
+	return true;
+}
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("-E poll needs a spawned reader");
+	}
+
+	plan(4);
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.poll_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderProcess reader;
+	reader.engine = "poll:50";
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(), cli.reader_port);
+	}
+	BinlogReaderMsg st = client.read_line(10000);
+	// The source separates UUIDs with ",\n".
+	std::string executed = db.gtid_executed();
+	executed.erase(std::remove(executed.begin(), executed.end(), '\n'), executed.end());
+	const std::vector<std::string> dumps = threads(db, "COMMAND LIKE 'Binlog Dump%'");
+	ok(st.valid() && st.kind == "ST" && st.raw == "ST=" + executed && dumps.empty(),
+	   "ST= matches gtid_executed, %zu dump threads (raw='%s', source='%s')", dumps.size(),
+	   st.raw.c_str(), executed.c_str());
+	if (!st.valid() || st.intervals.empty()) {
+		BAIL_OUT("no usable ST= from reader (error='%s')", st.error.c_str());
+	}
+	const trxid_t first = st.intervals.back().end + 1;
+
+	std::string raw;
+	db.exec("INSERT INTO binlog_reader_test.poll_t (v) VALUES (1)");
+	std::vector<trxid_t> got = next_trxids(client, 1, raw);
+	ok(consecutive(got, first, 1), "INSERT delivered (raw='%s', expected trxid %lld)", raw.c_str(),
+	   (long long)first);
+
+	for (int i = 0; i < 5; i++) {
+		db.exec("INSERT INTO binlog_reader_test.poll_t (v) VALUES (2)");
+	}
+	got = next_trxids(client, 5, raw);
+	ok(consecutive(got, first + 1, 5), "five INSERTs delivered in order (raw='%s', expected %lld-%lld)",
+	   raw.c_str(), (long long)(first + 1), (long long)(first + 5));
+
+	const std::vector<std::string> ids = threads(db, "USER = '" + cli.mysql_user + "'");
+	for (const std::string& id : ids) {
+		db.exec("KILL " + id);
+	}
+	db.exec("INSERT INTO binlog_reader_test.poll_t (v) VALUES (3)");
+	// The client retries within a second.
+	sleep(2);
+	db.exec("INSERT INTO binlog_reader_test.poll_t (v) VALUES (4)");
+	got = next_trxids(client, 2, raw);
+	ok(!ids.empty() && consecutive(got, first + 6, 2),
+	   "INSERTs around a reconnect delivered (raw='%s', expected %lld-%lld)", raw.c_str(),
+	   (long long)(first + 6), (long long)(first + 7));
+
+	return exit_status();
+}
@@ -0,0 +1,131 @@
+/* test_resume_known_set-t
+ *
+ * A reconnecting client can send the set it already has with
+ * "HELLO known=<set>"; the reader then sends only the missing intervals, as
+ * I3/I4 lines, instead of a full ST=.
+ *
+ *   1. Start reader; read ST= and keep it as the "old" set.
+ *   2. INSERT twice; a fresh client's ST= is the "current" set.
+ *   3. HELLO known=<old> — reply says known=diff, and the next line is an
+ *      I3 covering exactly the two new trxids.
+ *   4. HELLO known=<current> — reply says known=diff, and nothing follows.
+ *   5. HELLO known=<set ahead of the reader> — reply says known=snapshot,
+ *      and a full ST= follows.
+ */
+
+#include <string>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Highest trxid of an ST= line. */
+static trxid_t last_trxid(const BinlogReaderMsg& st) {
+	trxid_t mx = 0;
+	for (auto& iv : st.intervals) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+/** Connects a new client and sends HELLO with `options`; returns the reply. */
+static std::string resume(BinlogReaderClient& client, const std::string& host, int port,
+                          const std::string& options) {
+	if (!client.connect(host, port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", host.c_str(), port);
+	}
+	return client.hello(options);
+}
+
+int main() {
+	plan(5);
+
+	CommandLine cli;
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	if (!cli.reader_bin.empty())  // reset gtid only in spawn mode
+		db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.resume_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	BinlogReaderProcess reader;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+	BinlogReaderMsg old_st = client.read_line(10000);
+	if (!old_st.valid() || old_st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", old_st.error.c_str(),
+		         old_st.raw.c_str());
+	}
+	const std::string uuid = strip_dashes(old_st.uuid);
+	const trxid_t old_last = last_trxid(old_st);
+
+	for (int i = 0; i < 2; i++) {
+		if (!db.exec("INSERT INTO binlog_reader_test.resume_t (v) VALUES (1)")) {
+			BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+		}
+		BinlogReaderMsg m = client.read_line(5000);
+		if (!m.valid()) {
+			BAIL_OUT("no update after INSERT (error='%s')", m.error.c_str());
+		}
+	}
+	// The first client has seen both updates; a new client's ST= now
+	// includes them.
+	BinlogReaderClient probe;
+	if (!probe.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+	BinlogReaderMsg cur_st = probe.read_line(5000);
+	if (!cur_st.valid() || cur_st.kind != "ST") {
+		BAIL_OUT("no ST= from reader (error='%s', raw='%s')", cur_st.error.c_str(),
+		         cur_st.raw.c_str());
+	}
+
+	BinlogReaderClient c1;
+	const std::string r1 = resume(c1, reader_host, cli.reader_port, "known=" + old_st.raw.substr(3));
+	BinlogReaderMsg d1 = c1.read_line(5000);
+	const bool d1_ok = d1.valid() && d1.kind == "I3" && d1.uuid == uuid &&
+	                   d1.intervals.size() == 1 && d1.intervals[0].start == old_last + 1 &&
+	                   d1.intervals[0].end == old_last + 2;
+	ok(r1 == "HELLO known=diff" && d1_ok,
+	   "behind by two: only the missing interval is sent (reply='%s', raw='%s', expected %lld-%lld)",
+	   r1.c_str(), d1.raw.c_str(), (long long)(old_last + 1), (long long)(old_last + 2));
+
+	BinlogReaderClient c2;
+	const std::string r2 = resume(c2, reader_host, cli.reader_port, "known=" + cur_st.raw.substr(3));
+	ok(r2 == "HELLO known=diff", "up to date: reply says known=diff (reply='%s')", r2.c_str());
+	BinlogReaderMsg d2 = c2.read_line(500);
+	ok(!d2.valid() && d2.error == "timeout", "up to date: nothing is sent (error='%s', raw='%s')",
+	   d2.error.c_str(), d2.raw.c_str());
+
+	BinlogReaderClient c3;
+	const std::string ahead = old_st.uuid + ":1-" + std::to_string(last_trxid(cur_st) + 1000);
+	const std::string r3 = resume(c3, reader_host, cli.reader_port, "known=" + ahead);
+	BinlogReaderMsg d3 = c3.read_line(5000);
+	ok(r3 == "HELLO known=snapshot", "ahead of the reader: reply says known=snapshot (reply='%s')",
+	   r3.c_str());
+	ok(d3.valid() && d3.kind == "ST" && last_trxid(d3) == last_trxid(cur_st),
+	   "ahead of the reader: a full ST= follows (raw='%s')", d3.raw.c_str());
+
+	return exit_status();
+}
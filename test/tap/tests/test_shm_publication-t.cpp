@@ -0,0 +1,197 @@
+/* test_shm_publication-t
+ *
+ * With -S, the reader publishes its GTID state into a shared-memory
+ * file. A local consumer must see the same state as a TCP client,
+ * without connecting to the listener.
+ *
+ *   1. Reset GTID state.
+ *   2. Start reader with -S <path>; read ST= over TCP.
+ *   3. Map the region and take a snapshot — it must describe the
+ *      same uuid and the same last trxid as the ST= line.
+ *   4. INSERT once; the TCP client gets I1=<uuid>:<trxid>.
+ *   5. Follow the ring past the snapshot — the next update must be
+ *      the same uuid and trxid as the I1.
+ *
+ * First, without a reader, on a region written by the test itself:
+ *
+ *   6. The seqlock held odd by a live writer: read_snapshot() gives up
+ *      within a few seconds.
+ *   7. Held odd by a writer that died: it gives up at once.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "proxysql_gtid_shm.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+static trxid_t max_interval_end(const std::vector<TrxId_Interval>& ivs) {
+	trxid_t mx = 0;
+	for (auto& iv : ivs) {
+		if (iv.end > mx) mx = iv.end;
+	}
+	return mx;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+// A writer stopped between the two stores of the seqlock leaves it odd.
+static void test_stuck_lock() {
+	const std::string path = "/tmp/proxysql_binlog_reader_tap_stuck_" + std::to_string(getpid()) + ".gtid";
+	GTID_Shm_Writer writer;
+	GTID_Shm_Reader shm;
+	int fd = -1;
+	void *map = MAP_FAILED;
+	struct stat st;
+	if (!writer.open(path.c_str()) || !writer.publish_snapshot("3e11fa4771ca11e19e33c80aa9429562:1-10") ||
+	    !shm.open(path.c_str()) || (fd = open(path.c_str(), O_RDWR)) < 0 || fstat(fd, &st) != 0 ||
+	    (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		BAIL_OUT("cannot set up %s", path.c_str());
+	}
+	GTID_Shm_Header *hdr = (GTID_Shm_Header *)map;
+	hdr->snapshot_lock.fetch_add(1);
+
+	std::string snapshot;
+	uint64_t upto_seq = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	bool got = shm.read_snapshot(snapshot, upto_seq);
+	const double live = seconds_since(t0);
+	ok(!got && live < 5, "lock held by a live writer: no snapshot, after %.3fs", live);
+
+	pid_t child = fork();
+	if (child == 0) _exit(0);
+	waitpid(child, NULL, 0);
+	const int64_t pid = hdr->writer_pid;
+	hdr->writer_pid = child;
+	t0 = std::chrono::steady_clock::now();
+	got = shm.read_snapshot(snapshot, upto_seq);
+	const double dead = seconds_since(t0);
+	hdr->writer_pid = pid;
+	hdr->snapshot_lock.fetch_add(1);
+	const bool after = shm.read_snapshot(snapshot, upto_seq);
+	ok(!got && dead < 0.5 && after, "lock held by a dead writer: no snapshot, after %.3fs; one once released",
+	   dead);
+
+	munmap(map, st.st_size);
+	close(fd);
+	shm.close();
+	writer.close();
+}
+
+int main() {
+	CommandLine cli;
+
+	plan(6);
+
+	test_stuck_lock();
+
+	if (cli.reader_bin.empty()) {
+		skip(4, "shared-memory publication needs a spawned reader");
+		return exit_status();
+	}
+
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.shm_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	const std::string shm_path =
+	    "/tmp/proxysql_binlog_reader_tap_" + std::to_string(cli.reader_port) + ".gtid";
+
+	BinlogReaderProcess reader;
+	reader.shm_path = shm_path;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+
+	BinlogReaderMsg st = client.read_line(10000);
+	ok(st.valid() && st.kind == "ST" && !st.uuid.empty(),
+	   "ST= received (uuid='%s', raw='%s')", st.uuid.c_str(), st.raw.c_str());
+	if (!st.valid()) return exit_status();
+
+	GTID_Shm_Reader shm;
+	if (!shm.open(shm_path.c_str())) {
+		BAIL_OUT("cannot map %s", shm_path.c_str());
+	}
+
+	std::string snapshot;
+	uint64_t upto_seq = 0;
+	bool have_snapshot = shm.read_snapshot(snapshot, upto_seq);
+
+	// The snapshot is the compact ST body: "<uuid>:<iv>[:<iv>...]".
+	const std::string st_uuid = strip_dashes(st.uuid);
+	const trxid_t st_max = max_interval_end(st.intervals);
+	std::string snap_uuid;
+	std::vector<TrxId_Interval> snap_ivs;
+	size_t pos = snapshot.find(':');
+	if (pos != std::string::npos) {
+		snap_uuid = snapshot.substr(0, pos);
+		while (pos != std::string::npos) {
+			const size_t next = snapshot.find(':', pos + 1);
+			snap_ivs.push_back(TrxId_Interval(snapshot.substr(pos + 1, next - pos - 1)));
+			pos = next;
+		}
+	}
+	const trxid_t snap_max = max_interval_end(snap_ivs);
+	ok(have_snapshot && strip_dashes(snap_uuid) == st_uuid && snap_max == st_max,
+	   "snapshot matches ST (snapshot='%s', upto_seq=%llu, ST max=%lld)",
+	   snapshot.c_str(), (unsigned long long)upto_seq, (long long)st_max);
+
+	if (!db.exec("INSERT INTO binlog_reader_test.shm_t (v) VALUES (1)")) {
+		BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+	}
+	BinlogReaderMsg m1 = client.read_line(5000);
+	const trxid_t got1 = m1.intervals.empty() ? 0 : m1.intervals[0].start;
+	ok(m1.valid() && m1.kind == "I1" && got1 == st_max + 1,
+	   "TCP client got I1=%s:%lld (raw='%s')", m1.uuid.c_str(),
+	   (long long)got1, m1.raw.c_str());
+
+	GTID_Shm_Entry e;
+	int rc = 0;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (std::chrono::steady_clock::now() < deadline) {
+		rc = shm.read_update(upto_seq + 1, e);
+		if (rc != 0) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	ok(rc == 1 && e.uuid == st_uuid && e.interval.start == got1 && e.interval.end == got1,
+	   "ring update %llu is %s:%lld-%lld (rc=%d, expected %s:%lld)",
+	   (unsigned long long)(upto_seq + 1), e.uuid.c_str(),
+	   (long long)e.interval.start, (long long)e.interval.end, rc,
+	   st_uuid.c_str(), (long long)got1);
+
+	return exit_status();
+}
@@ -0,0 +1,113 @@
+/* test_source_heartbeat-t
+ *
+ * With -H, the reader asks the source for heartbeats and publishes the time
+ * of the last data it received in the shared-memory header. While the source
+ * is idle, heartbeats must keep that time fresh, and must not be mistaken for
+ * a stalled stream. Run once per engine:
+ *
+ *   1. Start reader with -H 200 -S <path>; read ST= over TCP.
+ *   2. Leave the source idle for 2 seconds, sampling the age of the last
+ *      source event in the region: it must stay under the 600 ms after which
+ *      the stream counts as stalled.
+ *   3. INSERT once; the update arrives for the next trxid.
+ */
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "proxysql_gtid.h"
+#include "proxysql_gtid_shm.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+static int64_t now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return int64_t(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+static void run(const CommandLine& cli, MySQLClient& db, const std::string& engine) {
+	const char* name = engine.empty() ? "libslave" : engine.c_str();
+	const std::string shm_path =
+	    "/tmp/proxysql_binlog_reader_tap_hb_" + std::to_string(cli.reader_port) + ".gtid";
+
+	BinlogReaderProcess reader;
+	reader.engine = engine;
+	reader.heartbeat_ms = 200;
+	reader.shm_path = shm_path;
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader (%s)", name);
+	}
+
+	BinlogReaderClient client;
+	if (!client.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(), cli.reader_port);
+	}
+	BinlogReaderMsg st = client.read_line(10000);
+	ok(st.valid() && st.kind == "ST" && !st.intervals.empty(), "%s: ST= received (raw='%s')", name,
+	   st.raw.c_str());
+	if (!st.valid() || st.intervals.empty()) {
+		BAIL_OUT("no usable ST= from reader (error='%s')", st.error.c_str());
+	}
+
+	GTID_Shm_Reader shm;
+	if (!shm.open(shm_path.c_str())) {
+		BAIL_OUT("cannot map %s", shm_path.c_str());
+	}
+	// Let the dump start before sampling.
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	int64_t max_age = -1;
+	for (int i = 0; i < 20; i++) {
+		const int64_t last = shm.source_event_time_ms();
+		const int64_t age = last ? now_ms() - last : INT64_MAX;
+		if (age > max_age) max_age = age;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	ok(max_age >= 0 && max_age < 600, "%s: idle source heard from every heartbeat (max age %lld ms)", name,
+	   (long long)max_age);
+
+	const trxid_t next = st.intervals.back().end + 1;
+	db.exec("INSERT INTO binlog_reader_test.heartbeat_t (v) VALUES (1)");
+	BinlogReaderMsg u = client.read_line(5000);
+	const trxid_t got = u.intervals.empty() ? 0 : u.intervals[0].end;
+	ok(u.valid() && (u.kind == "I1" || u.kind == "I2") && got == next,
+	   "%s: INSERT after idle delivered (raw='%s', expected trxid %lld)", name, u.raw.c_str(),
+	   (long long)next);
+}
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("-H needs a spawned reader");
+	}
+
+	plan(6);
+
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.heartbeat_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	run(cli, db, "");
+	run(cli, db, "native");
+
+	return exit_status();
+}
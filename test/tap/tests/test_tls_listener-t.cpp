@@ -0,0 +1,187 @@
+/* test_tls_listener-t
+ *
+ * With -T/-K the listener speaks TLS: the initial state is only sent
+ * after a completed handshake, and updates flow over the encrypted
+ * session (kTLS or userspace, the wire is the same).
+ *
+ *   1. Reset GTID state; generate a throwaway self-signed certificate.
+ *   2. Start reader with -T <cert> -K <key>.
+ *   3. Plaintext client — must NOT receive a cleartext ST= line.
+ *   4. TLS client — handshake, then read ST=.
+ *   5. INSERT once; the TLS client gets I1=<uuid>:<trxid>.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "binlog_reader_client.h"
+#include "binlog_reader_process.h"
+#include "command_line.h"
+#include "mysql_client.h"
+#include "tap.h"
+#include "tap_utils.h"
+
+/** Writes a self-signed P-256 certificate and its key to the given paths. */
+static bool make_self_signed(const std::string& cert_path, const std::string& key_path) {
+	EVP_PKEY* pkey = EVP_EC_gen("P-256");
+	X509* x = X509_new();
+	if (pkey == nullptr || x == nullptr) return false;
+
+	X509_set_version(x, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x), -60);
+	X509_gmtime_adj(X509_getm_notAfter(x), 3600);
+	X509_set_pubkey(x, pkey);
+	X509_NAME* name = X509_get_subject_name(x);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+	                           (const unsigned char*)"localhost", -1, -1, 0);
+	X509_set_issuer_name(x, name);
+	bool ok_ = X509_sign(x, pkey, EVP_sha256()) > 0;
+
+	FILE* f = fopen(cert_path.c_str(), "w");
+	ok_ = ok_ && f && PEM_write_X509(f, x);
+	if (f) fclose(f);
+	f = fopen(key_path.c_str(), "w");
+	ok_ = ok_ && f && PEM_write_PrivateKey(f, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+	if (f) fclose(f);
+
+	X509_free(x);
+	EVP_PKEY_free(pkey);
+	return ok_;
+}
+
+/** Minimal blocking TLS line reader; the reader's certificate is not verified. */
+class TlsLineClient {
+   public:
+	~TlsLineClient() {
+		if (ssl_) SSL_free(ssl_);
+		if (ctx_) SSL_CTX_free(ctx_);
+		if (fd_ >= 0) close(fd_);
+	}
+
+	bool connect(const std::string& host, int port, int timeout_ms) {
+		fd_ = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd_ < 0) return false;
+		struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+		setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+		if (::connect(fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0) return false;
+
+		ctx_ = SSL_CTX_new(TLS_client_method());
+		if (ctx_ == nullptr) return false;
+		ssl_ = SSL_new(ctx_);
+		SSL_set_fd(ssl_, fd_);
+		if (SSL_connect(ssl_) != 1) {
+			char buf[256];
+			ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+			error = buf;
+			return false;
+		}
+		return true;
+	}
+
+	/** Returns the next line without its '\n', or "" on timeout/close. */
+	std::string read_line() {
+		size_t nl;
+		while ((nl = buf_.find('\n')) == std::string::npos) {
+			char tmp[4096];
+			int rc = SSL_read(ssl_, tmp, sizeof(tmp));
+			if (rc <= 0) return "";
+			buf_.append(tmp, rc);
+		}
+		std::string line = buf_.substr(0, nl);
+		buf_.erase(0, nl + 1);
+		return line;
+	}
+
+	std::string error;
+
+   private:
+	int fd_ = -1;
+	SSL_CTX* ctx_ = nullptr;
+	SSL* ssl_ = nullptr;
+	std::string buf_;
+};
+
+int main() {
+	CommandLine cli;
+	if (cli.reader_bin.empty()) {
+		skip_all("TLS listener needs a spawned reader");
+	}
+
+	plan(3);
+
+	diag("target MySQL %s:%d (version=%s)", cli.mysql_host.c_str(),
+	     cli.mysql_port, cli.mysql_version.empty() ? "?" : cli.mysql_version.c_str());
+
+	MySQLClient db;
+	if (!db.connect(cli)) {
+		BAIL_OUT("cannot connect to MySQL: %s", db.last_error().c_str());
+	}
+
+	db.reset_gtid_set();
+
+	db.exec("CREATE DATABASE IF NOT EXISTS binlog_reader_test");
+	db.exec("CREATE TABLE IF NOT EXISTS binlog_reader_test.tls_t "
+	        "(id INT PRIMARY KEY AUTO_INCREMENT, v INT)");
+
+	const std::string base = "/tmp/proxysql_binlog_reader_tap_" + std::to_string(cli.reader_port);
+	BinlogReaderProcess reader;
+	reader.tls_cert = base + ".crt";
+	reader.tls_key = base + ".key";
+	if (!make_self_signed(reader.tls_cert, reader.tls_key)) {
+		BAIL_OUT("cannot write test certificate to %s", reader.tls_cert.c_str());
+	}
+
+	auto reader_host = setup_reader(cli, reader);
+	if (reader_host.empty()) {
+		BAIL_OUT("failed to start reader");
+	}
+
+	BinlogReaderClient plain;
+	if (!plain.connect(reader_host, cli.reader_port, 2000)) {
+		BAIL_OUT("cannot connect to reader at %s:%d", reader_host.c_str(),
+		         cli.reader_port);
+	}
+	BinlogReaderMsg leak = plain.read_line(1000);
+	ok(!leak.valid(), "plaintext client receives no ST= (error='%s', raw='%s')",
+	   leak.error.c_str(), leak.raw.c_str());
+	plain.disconnect();
+
+	TlsLineClient client;
+	if (!client.connect(reader_host, cli.reader_port, 5000)) {
+		BAIL_OUT("TLS handshake with reader failed: %s", client.error.c_str());
+	}
+	const std::string st = client.read_line();
+	const size_t colon = st.find(':');
+	ok(st.compare(0, 3, "ST=") == 0 && colon != std::string::npos,
+	   "ST= received over TLS (raw='%s')", st.c_str());
+	const std::string uuid = colon == std::string::npos ? "" : st.substr(3, colon - 3);
+
+	if (!db.exec("INSERT INTO binlog_reader_test.tls_t (v) VALUES (1)")) {
+		BAIL_OUT("INSERT failed: %s", db.last_error().c_str());
+	}
+	const std::string i1 = client.read_line();
+	ok(i1.compare(0, 3 + uuid.size() + 1, "I1=" + uuid + ":") == 0,
+	   "I1= received over TLS (raw='%s', expected uuid '%s')", i1.c_str(), uuid.c_str());
+
+	unlink(reader.tls_cert.c_str());
+	unlink(reader.tls_key.c_str());
+
+	return exit_status();
+}